@@ -18,6 +18,10 @@
 #define __CBANLIST_H__
 
 #include <string>
+#include <vector>
+#include <map>
+#include <unordered_map>
+#include <SDL.h>
 
 
 // Ban List structure
@@ -33,6 +37,8 @@ class banlist_t { public:
 
 
 // Ban List class
+// The linked list is the view used by the API, the lookups go through the index:
+// exact addresses are hashed, ranges ("1.2.3.*" or "1.2.3.0/24") are kept per prefix length.
 class CBanList {
 private:
     // Attributes
@@ -40,9 +46,19 @@ private:
     banlist_t   *m_psBanList;
     banlist_t   *m_psSortedList;
     int         m_nCount;
+	bool		m_bSorted;
 	std::string	m_szPath;
 	bool		m_bLoading;
 
+	// Index
+	std::vector<banlist_t *> m_cItems;  // In order of adding, the list is in reverse order
+	std::unordered_map<std::string, banlist_t *> m_cExactIndex;  // Lowercase address -> newest entry
+	std::map< int, std::unordered_map<Uint32, banlist_t *> > m_cRangeIndex;  // Prefix length -> masked IPv4 -> newest entry
+
+	void		indexItem(banlist_t *item);
+	void		rebuildIndex();
+	banlist_t	*findExact(const std::string& szAddress);
+
 
 
 public:
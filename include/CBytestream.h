@@ -90,6 +90,8 @@ public:
 	bool		write2Int4(short x, short y);
 	bool		writeBit(bool bit);
 	bool		writeData(const std::string& value);	// Do not append '\0' at the end, writes just the raw data
+	bool		writeData(const char* data, size_t size);
+	bool		writeByteAt(size_t bytePos, uchar byte); // overwrites an already written byte
 	bool		writeVar(const ScriptVar_t& var);
 	
 	// Reads
@@ -105,11 +107,17 @@ public:
 	void		read2Int4(short& x, short& y);
 	bool		readBit();
 	std::string	readData( size_t size = (size_t)(-1) );
+	// Like readData but doesn't copy anything. size is set to the amount of data which was read.
+	// WARNING: the returned pointer is only valid until the stream is modified
+	const char*	readDataPtr( size_t& size );
 	bool		readVar(ScriptVar_t& var);
 
 	// Peeks
 	uchar		peekByte() const;
 	std::string	peekData(size_t len) const;
+	// Like peekData(GetRestLen()) but doesn't copy anything
+	// WARNING: the returned pointer is only valid until the stream is modified
+	const char*	peekDataPtr() const { return Data.data() + (isPosAtEnd() ? Data.size() : pos); }
 
 	// Skips
 	// Folowing functions return true if we're at the end of stream after the skip
@@ -91,6 +91,40 @@ public:
 };
 
 
+// Retransmission timeout and send window of the reliable stream, estimated from the connection.
+// The timeout follows the smoothed round trip time and its deviation (like in TCP, RFC 6298).
+// The window grows while packets get through and shrinks on packet loss, at most once per round trip.
+class ReliableFlowControl {
+public:
+	ReliableFlowControl() { reset( 1, 1 ); }
+
+	void		reset( int initialWindow, int maxWindow );
+
+	void		addRttSample( float rtt ); // In sec, only from packets that were sent once (the others are ambiguous)
+	void		packetsAcked( int amount, bool windowLimited ); // The window grows only if it limits the sending
+	void		packetLost(); // A packet got lost while packets sent later got through
+	void		timeout(); // Packets weren't acknowledged in time - if nothing gets through the window goes to minimum, and the timeout is doubled
+
+	float		getRetransmitTimeout() const	{ return fRetransmitTimeout; }
+	// A packet is lost if it's not acknowledged for that long, while packets sent later are
+	float		getLossDelay() const;
+	float		getSmoothedRtt() const			{ return fSmoothedRtt; }
+	int			getWindow() const				{ return (int)fWindow; }
+
+private:
+	bool		bGotRttSample;
+	float		fSmoothedRtt;
+	float		fRttVariance;
+	float		fRetransmitTimeout;
+	float		fWindow;
+	float		fSlowStartThreshold;
+	int			iMaxWindow;
+	AbsTime		fLastAck;
+	AbsTime		fLastDecrease;
+	AbsTime		fLastTimeout;
+};
+
+
 class CChannel {
 	
 protected:
@@ -171,6 +205,8 @@ public:
 	virtual bool	getBufferEmpty() = 0;
 	// Not the same as "! getBufferEmpty()" for new CChannel implementation - it can buffer up multiple packets.
 	virtual bool	getBufferFull() = 0;
+	// Amount of messages from AddReliablePacketToSend() which are waiting for place in the window
+	size_t			getMessagesQueued()	{ return Messages.size(); }
 
 	size_t			getOutgoing()		{ return iOutgoingBytes; }
 	size_t			getIncoming()		{ return iIncomingBytes; }
@@ -261,17 +297,12 @@ private:
 	int				LastReliablePacketSent;				// To make packet flow smooth
 	int				NextReliablePacketToSend;			// To make packet flow smooth
 	
-	// Constants to shape packet flow - in the future we may want to change them dynamically from connection characteristics
-	
 	// How much to wait before sending another empty keep-alive packet, sec (doesn't really matter much).
 	float			KeepAlivePacketTimeout;
-	// How much to wait before sending data packet again, sec - 
-	// if packets rarely get lost over net it will decrease bandwidth dramatically, for little lag tradeoff.
-	// Set to 0 to flood net with packets instantly as in CChannel_056b.
+	// How much to wait before sending data packet again (the retransmission timeout), and
+	// max amount of packets that can be flying through the net at the same time (the window).
 	// If any new data available to send, or unreliable data present, packet is sent anyway.
-	float			DataPacketTimeout;
-	// Max amount of packets that can be flying through the net at the same time.
-	int				MaxNonAcknowledgedPackets;
+	ReliableFlowControl	Flow;
 
 	#ifdef DEBUG
 	AbsTime			DebugSimulateLaggyConnectionSendDelay; // Self-explanatory
@@ -294,7 +325,7 @@ public:
 	void		Clear();
 
 	bool		getBufferEmpty()	{ return ReliableOut.empty(); };
-	bool		getBufferFull()		{ return (int)ReliableOut.size() >= MaxNonAcknowledgedPackets; };
+	bool		getBufferFull()		{ return (int)ReliableOut.size() >= Flow.getWindow(); };
 
 	friend void TestCChannelRobustness();
 };
@@ -310,17 +341,42 @@ private:
 		CBytestream data;
 		int idx;
 		bool fragmented;
+		bool used;
+		int sendCount;
+		AbsTime lastSent;
+		Uint32 lastSentNetPacket; // Number of the net packet it was sent with the last time
 
-		Packet_t( const CBytestream & d, int i, bool f ): data(d), idx(i), fragmented(f) { };
-		
-		bool operator < ( const Packet_t & p ) const; // For sorting
+		Packet_t(): idx(0), fragmented(false), used(false), sendCount(0), lastSentNetPacket(0) { };
 	};
-	typedef std::list< Packet_t > PacketList_t;
-	PacketList_t	ReliableOut;		// Reliable messages waiting to be acknowledged, with their ID-s, sorted
+
+	// The packets following the sequence base, in a ring buffer indexed by the distance to base
+	// (SEQUENCE_WRAPAROUND is no power of 2, so the sequence itself can't be the index).
+	// The slots keep their buffers, so the packet data is not reallocated for every packet.
+	struct PacketWindow_t
+	{
+		enum { SIZE = 64 };
+		Packet_t	packets[SIZE];
+		int			base;		// Sequence right before the first slot
+		int			first;		// Slot of base + 1
+		int			count;		// Used slots
+
+		void		reset(int _base);
+		Packet_t *	get(int idx); // NULL if idx is not inside the window or not used
+		Packet_t *	add(int idx, bool fragmented); // Returns the cleared slot for idx, NULL if outside of the window
+		void		remove(Packet_t * p);
+		void		advance(int newBase); // Removes all packets up to newBase
+	};
+
+	PacketWindow_t	ReliableOut;		// Reliable messages waiting to be acknowledged, base is LastReliableOut
 	int				LastReliableOut;	// Last acknowledged packet from remote side
 	int				LastAddedToOut;		// Last packet that was added to ReliableOut buf
+	size_t			MessageFragmentPos;	// How much of Messages.front() is already in ReliableOut
 
-	PacketList_t	ReliableIn;			// Reliable messages from the other side, not sorted, with their ID-s
+	// Reliable messages from the other side, base is the last one returned by Process() or moved to ReliableInFragments.
+	// The sender keeps its packets inside the window after the acknowledged ones, so the acknowledged fragments
+	// of a big message have to leave the window, or it could not get the rest of the message into it.
+	PacketWindow_t	ReliableIn;
+	CBytestream		ReliableInFragments;	// Acknowledged fragments of the message which is not complete yet
 	int				LastReliableIn;		// Last packet acknowledged by me
 	
 	// Pinging
@@ -328,26 +384,24 @@ private:
 	
 	// Misc vars to shape packet flow
 	int				LastReliableIn_SentWithLastPacket;	// Required to check if we need to send empty packet with acknowledges
-	int				LastReliablePacketSent;				// To make packet flow smooth
-	int				NextReliablePacketToSend;			// To make packet flow smooth
-	
-	// Constants to shape packet flow - in the future we may want to change them dynamically from connection characteristics
+	bool			ReliableInChanged;					// Got out of sequence packets, their acknowledges have to be sent
+	Uint32			NetPacketsSent;						// Counter for the net packets, to know the order the packets were sent in
+	Uint32			LastAckedNetPacket;					// The newest net packet that got some packet acknowledged, for the loss detection
 	
 	// How much to wait before sending another empty keep-alive packet, sec (doesn't really matter much).
 	float			KeepAlivePacketTimeout;
-	// How much to wait before sending data packet again, sec - 
-	// if packets rarely get lost over net it will decrease bandwidth dramatically, for little lag tradeoff.
-	// Set to 0 to flood net with packets instantly as in CChannel_056b.
+	// How much to wait before sending data packet again (the retransmission timeout), and
+	// max amount of packets that can be flying through the net at the same time (the window).
 	// If any new data available to send, or unreliable data present, packet is sent anyway.
-	float			DataPacketTimeout;
-	// Max amount of packets that can be flying through the net at the same time.
-	int				MaxNonAcknowledgedPackets;
+	ReliableFlowControl	Flow;
 
 	#ifdef DEBUG
 	AbsTime			DebugSimulateLaggyConnectionSendDelay; // Self-explanatory
 	#endif
 
 	bool			GetPacketFromBuffer(CBytestream *bs);
+	void			AcknowledgePacket(Packet_t * p, int& ackedCount, AbsTime& rttPacketSent, bool& rttSample);
+	bool			TransmitPacket(CBytestream *unreliableData, int& flying);
 
 public:
 
@@ -363,8 +417,8 @@ public:
 	bool		Process( CBytestream *bs );
 	void		Clear();
 
-	bool		getBufferEmpty()	{ return ReliableOut.empty(); };
-	bool		getBufferFull()		{ return (int)ReliableOut.size() >= MaxNonAcknowledgedPackets; };
+	bool		getBufferEmpty()	{ return ReliableOut.count == 0; };
+	bool		getBufferFull()		{ return ReliableOut.count >= Flow.getWindow(); };
 
 	void		AddReliablePacketToSend(CBytestream& bs); // The same as in CChannel but without error msg
 
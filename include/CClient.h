@@ -35,6 +35,7 @@
 #include "LieroX.h"
 #include "CViewport.h"
 #include "SafeVector.h"
+#include "SortedVector.h"
 
 
 namespace DeprecatedGUI {
@@ -187,6 +188,7 @@ public:
 	friend class CClientNetEngine;
 	friend class CClientNetEngineBeta7;
 	friend class CClientNetEngineBeta9;
+	friend class CClientNetEngineRc6;
 
 	typedef void (*DownloadFinishedCB) ();
 
@@ -231,7 +233,9 @@ public:
 		
 		long index(const CMap* m) const;
 	};
-	typedef std::set<CProjectile*> ProjectileSet;
+	// HINT: SortedVector iterates in the same order as std::set, which matters for Proj_ProjHitEvent.
+	// The cells keep their memory, so moving projectiles don't allocate anything.
+	typedef SortedVector<CProjectile*> ProjectileSet;
 	typedef SafeVector<ProjectileSet> ProjectilePosMap;
 	ProjectilePosMap projPosMap;
 	
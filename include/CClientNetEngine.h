@@ -16,6 +16,7 @@
 
 #include <string>
 #include "Consts.h"
+#include "WormDelta.h"
 
 
 class CClient;
@@ -50,6 +51,7 @@ public:
 	virtual void		SendAFK(int wormid, AFK_TYPE afkType, const std::string & message = "") { return; }
 	virtual void		SendReportDamage(bool flush = false) { return; }
 	virtual void		QueueReportDamage(int victim, float damage, int offender) { return; }
+	virtual void		SendUpdateWormsAck() { return; }
 #ifdef FUZZY_ERROR_TESTING
 	void				SendRandomPacket();
 #endif
@@ -81,6 +83,7 @@ protected:
 	virtual void ParseSpawnWorm(CBytestream *bs);
 	virtual void ParseWormDown(CBytestream *bs);
 	virtual void ParseUpdateWorms(CBytestream *bs);
+	virtual void ParseUpdateWormsDelta(CBytestream *bs);
 	virtual int  ParseWormInfo(CBytestream *bs);
 
 	void		 ParseUpdateLobby(CBytestream *bs);
@@ -98,6 +101,8 @@ protected:
 	void		 ParseDestroyBonus(CBytestream *bs);
     void		 ParseDropped(CBytestream *bs);
     void		 ParseSendFile(CBytestream *bs);
+	void		 ParseSendFileStream(CBytestream *bs);
+	void		 ProcessReceivedFile();
 	virtual void ParseFlagInfo(CBytestream* bs);
 	virtual void ParseTeamScoreUpdate(CBytestream* bs);
 	virtual void ParseWormProps(CBytestream* bs);
@@ -152,4 +157,20 @@ private:
     std::map< std::pair< int, int >, float > cDamageReport;
 };
 
+class CClientNetEngineRc6: public CClientNetEngineBeta9 {
+public:
+	CClientNetEngineRc6( CClient * _client ): CClientNetEngineBeta9( _client )
+	{
+		fLastWormsAckSent = AbsTime();
+	}
+
+	virtual void ParseUpdateWormsDelta(CBytestream *bs);
+
+	virtual void SendUpdateWormsAck();
+
+private:
+	AbsTime fLastWormsAckSent;
+	WormDeltaReceiver cWormDelta;
+};
+
 #endif  //  __CCLIENT_NET_ENGINE_H__
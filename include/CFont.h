@@ -22,6 +22,7 @@
 
 #include <SDL.h>
 #include <vector>
+#include <list>
 #include "Unicode.h"
 #include "SmartPointer.h"
 #include "Color.h"
@@ -42,6 +43,7 @@ public:
 		Spacing = 1;
 		VSpacing = 3;
 		NumCharacters = 0;
+		ColourCacheEnabled = true;
 	}
 
 
@@ -64,6 +66,23 @@ private:
 	Color f_white;
 	Color f_green;
 
+	// Colourised copies of bmpFont for all other colours, most recently used first
+	struct ColouredFont {
+		Color colour;
+		bool outline;
+		SmartPointer<SDL_Surface> bmp;
+	};
+	enum { COLOUR_CACHE_SIZE = 32, SEEN_COLOURS_SIZE = 32 };
+	std::list<ColouredFont> ColourCache;
+	// Colours used only once yet (and if it was with outline), so they don't push precalculated ones out of ColourCache
+	std::list< std::pair<Color, bool> > SeenColours;
+	bool ColourCacheEnabled;
+	void ClearColourCache() { ColourCache.clear(); SeenColours.clear(); }
+
+#ifdef DEBUG
+	friend void TestFontDrawing();
+#endif
+
 public:
 	// Methods
 
@@ -122,6 +141,7 @@ private:
 	bool				IsColumnFree(int x);
 	void				Parse();
 	void				PreCalculate(const SmartPointer<SDL_Surface> & bmpSurf, Color colour);
+	SmartPointer<SDL_Surface> GetColouredFont(Color colour);
 	
 	// Internal functions for glyph drawing, first one for normal fonts, second one for outline fonts
 	// These do the fast glyph blit without any additional checks or clipping
@@ -136,4 +156,8 @@ private:
 
 
 
+#ifdef DEBUG
+void TestFontDrawing();
+#endif
+
 #endif  //  __CFONT_H__
@@ -16,6 +16,7 @@
 #include "Consts.h"
 #include "Options.h"
 #include "Version.h"
+#include "Timer.h"
 
 class CWorm;
 class GameServer;
@@ -24,7 +25,7 @@ struct Flag;
 
 class CGameMode {
 public:
-	CGameMode() {}
+	CGameMode();
 	virtual ~CGameMode() {}
 
 	// This is the game mode name as shown in the lobby for clients
@@ -50,7 +51,13 @@ public:
 	virtual void Carve(CWorm* worm, int d) {}
 	virtual void Simulate() {}
 	virtual bool CheckGameOver();
-	virtual bool NeedUpdate(CServerConnection* cl, CWorm* worm) { return true; }
+	// Area of interest: worms far away from all worms of the client are updated less often.
+	// Game modes which override this should return CGameMode::NeedUpdate() instead of true.
+	virtual bool NeedUpdate(CServerConnection* cl, CWorm* worm);
+	// True if NeedUpdate() has delayed an update of the worm for the client and it is due now
+	bool NeedDelayedUpdate(CServerConnection* cl, CWorm* worm);
+	// Forgets the update times of the previous client in the connection slot
+	void ClientConnected(CServerConnection* cl);
 	
 	virtual int CompareWormsScore(CWorm* w1, CWorm* w2);
 	virtual int CompareTeamsScore(int t1, int t2);
@@ -75,6 +82,12 @@ protected:
 	bool bFirstBlood;
 	int	iKillsInRow[MAX_WORMS];
 	int	iDeathsInRow[MAX_WORMS];
+
+	bool IsInAreaOfInterest(CServerConnection* cl, CWorm* worm);
+
+private:
+	AbsTime fLastWormUpdate[MAX_CLIENTS][MAX_WORMS];
+	bool bWormUpdateDelayed[MAX_CLIENTS][MAX_WORMS];
 };
 
 void InitGameModes();
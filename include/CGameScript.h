@@ -91,6 +91,7 @@ class CGameScript {
 	friend struct Proj_SpawnInfo;
 	friend struct Proj_Action;
 	friend struct Proj_ProjHitEvent;
+	friend struct GSAssetLoadAction;
 public:
 	// Constructor
 	CGameScript() {
@@ -130,6 +131,7 @@ private:
 	typedef std::map<int, proj_t*> Projectiles;
 	typedef std::map<std::string, int, stringcaseless> ProjFileMap;
 	ProjFileMap projFileIndexes; // only for compiling
+	std::vector<std::string> compiledSources; // only for compiling, the source files for the disk cache
 	std::set<proj_t*> savedProjs; // only for saving
 	
 	Projectiles projectiles;
@@ -146,6 +148,23 @@ private:
 	std::vector< SmartPointer<SDL_Surface> > CachedImages;	// To safely delete the vars, along with CGameScript.
 	std::vector< SmartPointer<SoundSample> > CachedSamples;	// To safely delete the vars, along with CGameScript.
 
+	// Image or sound requested while loading. They are all decoded together
+	// at the end of Load()/Compile() (in parallel), see LoadRequestedAssets()
+	struct AssetRequest {
+		std::string		dir;
+		std::string		filename;
+		proj_t			*proj;		// Image: sets proj->bmpImage and proj->bmpShadow
+		SoundSample		**sample;	// Sound
+		bool			*useSound;	// Sound: set to false if it cannot be loaded, can be NULL
+		std::string		failMsg;	// Written to the mod log if it cannot be loaded
+		std::string		imageFile;	// Image: the file that was decoded
+		bool			imageCached;	// Image: image is from the image cache, it doesn't need to be converted
+		SmartPointer<SDL_Surface>	image;
+		SmartPointer<SDL_Surface>	shadow;
+		SmartPointer<SoundSample>	sound;
+	};
+	std::vector<AssetRequest> assetRequests;
+
 private:
 
 	void		Shutdown();
@@ -160,8 +179,13 @@ public:
 	bool		isLoaded() const { return loaded; }
 	
 private:
+	int			LoadFromFile(FILE *fp, const std::string& filename);
+	bool		SaveToFile(FILE *fp);
 	proj_t		*LoadProjectile(FILE *fp);
 	bool		SaveProjectile(proj_t *proj, FILE *fp);
+	bool		LoadFromDiskCache(const std::string& dir);
+	void		SaveToDiskCache(const std::string& dir, Sint64 compileStart);
+	void		WriteDiskCache(const std::string& dir, Uint32 numSources, const std::string& sourceList);
 
 public:
 	size_t		GetMemorySize();
@@ -177,6 +201,14 @@ public:
 	SDL_Surface * LoadGSImage(const std::string& dir, const std::string& filename);
 	SoundSample * LoadGSSample(const std::string& dir, const std::string& filename);
 
+private:
+	void		RequestGSImage(const std::string& dir, proj_t *proj);
+	void		RequestGSSample(const std::string& dir, const std::string& filename, SoundSample **sample, bool *useSound, const std::string& failMsg);
+	void		RequestGSActionSounds(const std::string& dir, const std::string& where, Proj_Action *act);
+	void		LoadRequestedAssets();
+
+public:
+
 	const gs_header_t	*GetHeader()				{ return &Header; }
 	static bool	isCompatibleWith(int scriptVer, const Version& ver) {
 		if(scriptVer < GS_FIRST_SUPPORTED_VERSION) return false;
@@ -20,6 +20,7 @@
 #include <SDL.h>
 #include <string>
 #include <set>
+#include <vector>
 #include "ReadWriteLock.h"
 #include "SmartPointer.h"
 #include "LieroX.h" // for maprandom_t
@@ -121,11 +122,13 @@ public:
         bmpShadowMap = NULL;
         GridFlags = NULL;
 		AbsoluteGridFlags = NULL;
+		shadowBandX = shadowBandW = 0;
 		
 		NumObjects = 0;
 		Objects = NULL;
 
 		bMiniMapDirty = true;
+		MiniMapDirtyRects.clear();
 
 		
 		AdditionalData.clear();
@@ -169,12 +172,20 @@ private:
 	uchar		*AbsoluteGridFlags;
 	uchar		*CollisionGrid;
 
+	// Spawn points (grid cells without rock also in the neighbour cells), used by GameServer::FindSpot
+	std::vector<int> SpawnCells; // grid cell indexes
+	std::vector<int> SpawnCellPos; // position in SpawnCells for every grid cell or -1; empty if not calculated
+
+	int			shadowBandX, shadowBandW; // area for ApplyShadowBand
+
 	// Minimap
 	TimeDiff	fBlinkTime;
 
     //maprandom_t sRandomLayout;
 
 	bool		bMiniMapDirty;
+	// Areas of bmpImage changed since the last minimap update, resampled together in UpdateMiniMap
+	std::vector<SDL_Rect>	MiniMapDirtyRects;
 
 	ReadWriteLock	flagsLock;
 
@@ -188,6 +199,7 @@ private:
 	// Update functions
 	void		UpdateMiniMap(bool force = false);
 	void		UpdateMiniMapRect(int x, int y, int w, int h);
+	void		InvalidateMiniMapRect(int x, int y, int w, int h);
 	void		UpdateArea(int x, int y, int w, int h, bool update_image = false);
 
 	friend class CCache;
@@ -195,13 +207,19 @@ private:
 	bool		NewFrom(CMap *map);
 	void		SaveToCache();
 	bool		LoadFromCache();
+	void		SaveToDiskCache(Sint64 loadStart);
+	bool		LoadFromDiskCache();
 	void		LoadPostProcess();
+	void		WaitForPreload(const std::string& filename);
+	bool		LoadWithoutAni(const std::string& filename);
 
 public:
 	// Methods
 	bool		Create(uint _width, uint _height, const std::string& _theme, uint _minimap_w = 128, uint _minimap_h = 96);
 	bool		New(uint _width, uint _height, const std::string& _theme, uint _minimap_w = 128, uint _minimap_h = 96);
 	bool		Load(const std::string& filename);
+	// Loads the map in a worker thread into the cache, so that a following Load is fast
+	static void	PreloadInBackground(const std::string& filename);
 	bool		Save(const std::string& name, const std::string& filename);
 	bool		SaveImageFormat(FILE *fp);
 
@@ -223,6 +241,7 @@ public:
     void        calculateGrid();
 	bool		createCollisionGrid();
 	void		calculateCollisionGridArea(int x, int y, int w, int h);
+	void		calculateCollisionGrid();
 	void		PostProcessMirroredMap();
 
 	int	getCollGridCellW() const;
@@ -230,6 +249,14 @@ public:
 private:
 	// not thread-safe    
     void        calculateGridCell(int x, int y, bool bSkipEmpty);
+	bool		isSpawnCell(int i, int j) const;
+	void		updateSpawnCell(int i, int j);
+	void		calculateSpawnCells();
+	// these work on the rows [y, y+h) and are used with ForEachMapBand
+	void		calculateGridBand(int y, int h);
+	void		calculateCollisionGridBand(int y, int h);
+	void		ApplyShadowBand(int y, int h);
+	void		ApplyShadow_Internal(int sx, int sy, int w, int h);
 public:	
 	void		TileMap();
     
@@ -385,6 +412,9 @@ public:
 		return GridFlags; 
 	}
 	const uchar	*getAbsoluteGridFlags() const { return AbsoluteGridFlags; }
+	// WARNING: lockFlags() before using these
+	bool		hasSpawnCellIndex() const { return !SpawnCellPos.empty(); }
+	const std::vector<int>& getSpawnCells() const { return SpawnCells; }
 	bool			getCreated()	{ return Created; }
 	
 	
@@ -405,6 +435,32 @@ public:
 
 
 
+/*
+	the map data needed by the trace functions, fetched once
+	use one view for many traces instead of going through cClient->getMap() for every line
+	it's only valid as long as the map isn't reloaded; like the flags themselves, lock them while tracing
+	from another thread
+*/
+struct MapTraceView {
+	const uchar* pxflags;
+	const uchar* gridflags;
+	int map_w, map_h;
+	int grid_w, grid_h, grid_cols;
+
+	MapTraceView(const CMap* map) : pxflags(NULL), gridflags(NULL), map_w(0), map_h(0), grid_w(1), grid_h(1), grid_cols(0) {
+		if(!map) return;
+		pxflags = map->GetPixelFlags();
+		gridflags = map->getAbsoluteGridFlags();
+		map_w = map->GetWidth();
+		map_h = map->GetHeight();
+		grid_w = map->getGridWidth();
+		grid_h = map->getGridHeight();
+		grid_cols = map->getGridCols();
+	}
+
+	bool isValid() const { return pxflags && gridflags; }
+};
+
 // TODO: make this a member function of CMap
 /*
 	this traces the given line
@@ -413,7 +469,7 @@ public:
 	if the returned value is false, the loop will break
 */
 template<class _action>
-void fastTraceLine(CVec target, CVec start, uchar checkflag, _action& checkflag_action) {
+void fastTraceLine(const MapTraceView& view, CVec target, CVec start, uchar checkflag, _action& checkflag_action) {
 	enum { X_DOM=-1, Y_DOM=1 } dom; // which is dominating?
 	CVec dir = target-start;
 	if(dir.x == 0 && dir.y == 0)
@@ -435,16 +491,16 @@ void fastTraceLine(CVec target, CVec start, uchar checkflag, _action& checkflag_
 	//SmartPointer<SDL_Surface> bmpDest = cClient->getMap()->GetDebugImage();
 #endif
 	
-	const uchar* pxflags = cClient->getMap()->GetPixelFlags();
-	const uchar* gridflags = cClient->getMap()->getAbsoluteGridFlags();
-	if (!pxflags || !gridflags)  // map has been probably shut down in the meantime
+	if (!view.isValid())  // map has been probably shut down in the meantime
 		return;
 
-	int map_w = cClient->getMap()->GetWidth();
-	int map_h = cClient->getMap()->GetHeight();	
-    int grid_w = cClient->getMap()->getGridWidth();
-    int grid_h = cClient->getMap()->getGridHeight();
-	int grid_cols = cClient->getMap()->getGridCols();
+	const uchar* pxflags = view.pxflags;
+	const uchar* gridflags = view.gridflags;
+	const int map_w = view.map_w;
+	const int map_h = view.map_h;
+	const int grid_w = view.grid_w;
+	const int grid_h = view.grid_h;
+	const int grid_cols = view.grid_cols;
 	
 	int start_x = (int)start.x;
 	int start_y = (int)start.y;
@@ -579,6 +635,27 @@ void fastTraceLine(CVec target, CVec start, uchar checkflag, _action& checkflag_
 	}
 }
 
+template<class _action>
+void fastTraceLine(CVec target, CVec start, uchar checkflag, _action& checkflag_action) {
+	fastTraceLine(MapTraceView(cClient->getMap()), target, start, checkflag, checkflag_action);
+}
+
+// One line for fastTraceLines()
+struct TraceRay {
+	CVec target, start;
+	uchar checkflag;
+
+	// Result
+	bool hit; // found a pixel with checkflag or left the map
+	VectorD2<int> hitPos; // the first of them, only set if hit
+
+	TraceRay() : checkflag(0), hit(false) {}
+	TraceRay(CVec t, CVec s, uchar flag) : target(t), start(s), checkflag(flag), hit(false) {}
+};
+
+// Traces all the lines until their first collision (like fastTraceLine_hasAnyCollision, but also gives the position)
+void fastTraceLines(const MapTraceView& view, TraceRay* rays, size_t count);
+
 struct SimpleTracelineCheck {
 	bool result;
 	SimpleTracelineCheck() : result(false) {}
@@ -79,6 +79,8 @@ class CProjectile: public CGameObject {
 	friend ProjCollisionType LX56Projectile_checkCollAndMove_Frame(CProjectile* const prj, TimeDiff dt, CMap *map, CWorm* worms);
 	friend ProjCollisionType FinalWormCollisionCheck(CProjectile* proj, const CVec& vFrameOldPos, const CVec& vFrameOldVel, CWorm* worms, TimeDiff dt, ProjCollisionType curResult);
 	friend void Projectile_HandleAttractiveForceForProjectiles(CProjectile* const prj, TimeDiff dt, CWorm* worms);
+	friend struct LX56ProjectileMoveState;
+	friend void TestProjectileIteration();
 public:
 	// Constructor
 	CProjectile() {
@@ -209,5 +211,6 @@ public:
 	Event<> onInvalidation;
 };
 
+void TestProjectileIteration();
 
 #endif  //  __CPROJECTILE_H__
@@ -18,6 +18,7 @@
 #define	__CSERVER_H__
 
 #include <string>
+#include <unordered_map>
 #include "Networking.h"
 #include "SmartPointer.h"
 #include "CGameScript.h"
@@ -134,6 +135,10 @@ private:
 	int				nPort;
 	typedef std::list< SmartPointer<NatConnection> > NatConnList;
 	NatConnList	tNatClients;
+	NetworkSocketWaiter	tSocketWaiter;
+	// Address hash (GetNetAddrHash) -> index in cClients, verified on every use (see findClientByAddr)
+	typedef std::unordered_map<Uint64, int> ClientAddrMap;
+	ClientAddrMap	tClientAddrMap;
 	challenge_t		tChallenges[MAX_CHALLENGES]; // TODO: use std::list or vector
 	CShootList		cShootList;
 	CHttp			tHttp;
@@ -167,6 +172,7 @@ private:
 	friend class CServerNetEngine;
 	friend class CServerNetEngineBeta7;
 	friend class CServerNetEngineBeta9;
+	friend class CServerNetEngineRc6;
 	
 public:
 	// Methods
@@ -211,6 +217,8 @@ public:
 	void		SendPackets(bool sendPendingOnly = false);
 
 	bool		ReadPacketsFromSocket(const SmartPointer<NetworkSocket>& sock);
+	CServerConnection* findClientByAddr(const NetworkAddr& addr);
+	bool		WaitForPackets(int timeoutMs);
 
 	int			getPort() { return nPort; }
 	bool		checkBandwidth(CServerConnection *cl);
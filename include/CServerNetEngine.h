@@ -14,6 +14,7 @@
 
 #include "CWorm.h"
 #include "CVec.h"
+#include "WormDelta.h"
 
 class GameServer;
 class CServerConnection;
@@ -42,6 +43,7 @@ public:
 	virtual void ParseChatCommandCompletionRequest(CBytestream *bs) { return; };
 	virtual void ParseAFK(CBytestream *bs) { return; };
 	virtual void ParseReportDamage(CBytestream *bs) { return; };
+	virtual void ParseUpdateWormsAck(CBytestream *bs) { WormDeltaReceiver::skipAck(bs); };
 
 	void		 ParseImReady(CBytestream *bs);
 	void		 ParseUpdate(CBytestream *bs);
@@ -82,6 +84,7 @@ public:
 	static bool isWormPropertyDefault(CWorm* worm);
 	virtual void SendSelectWeapons(CWorm* worm);
 	virtual void SendUpdateWorm(CWorm* w);
+	virtual void WriteUpdateWorms(CBytestream *bs, const std::vector<CWorm*>& worms);
 	
 	int getConnectionArrayIndex();
 	
@@ -181,4 +184,21 @@ private:
     std::map< std::pair< int, int >, float > cDamageReport;
 };
 
+class CServerNetEngineRc6: public CServerNetEngineBeta9
+{
+
+public:
+	CServerNetEngineRc6( GameServer * _server, CServerConnection * _client ):
+		CServerNetEngineBeta9( _server, _client )
+		{ }
+
+	virtual void ParseUpdateWormsAck(CBytestream *bs) { cWormDelta.parseAck(bs); }
+	virtual void WriteUpdateWorms(CBytestream *bs, const std::vector<CWorm*>& worms);
+	virtual int  SendFiles();
+
+private:
+	WormDeltaSender cWormDelta;
+	WormNetStates tStates; // of the current WriteUpdateWorms, kept to reuse the memory
+};
+
 #endif  //  __CSERVER_NET_ENGINE_H__
@@ -644,7 +644,9 @@ public:
 };
 
 
+struct MapTraceView;
 int traceWormLine(CVec target, CVec start, CVec* collision = NULL);
+int traceWormLine(const MapTraceView& view, CVec target, CVec start, CVec* collision = NULL);
 
 struct WormJoinInfo {
 	WormJoinInfo() : iTeam(0), m_type(NULL) {}
@@ -36,7 +36,7 @@ struct Logger {
 	int minCallstackVerb;
 	std::string prefix;
 	std::string buffer;
-	bool lastWasNewline;
+	bool lastWasNewline; // only when printing directly, the log writer keeps its own
 	SDL_mutex* mutex;
 	
 	Logger(int o, int ingame, int callst, const std::string& p);
@@ -80,4 +80,18 @@ extern Logger hints;
 extern Logger warnings;
 extern Logger errors;
 
+// The Logger output is written by a background thread while it is running.
+// Before InitLogWriter and after UnInitLogWriter, everything is printed directly.
+void InitLogWriter();
+void UnInitLogWriter();
+void FlushLogQueue(); // writes out all queued lines in the calling thread (used by the CrashHandler)
+
+struct LogQueueStats {
+	Uint64 enqueued; // lines handed to the writer thread
+	Uint64 dropped; // lines thrown away because the queue was full
+	Uint64 flushed; // lines written out
+	LogQueueStats() : enqueued(0), dropped(0), flushed(0) {}
+};
+LogQueueStats GetLogQueueStats();
+
 #endif
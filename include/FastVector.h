@@ -23,14 +23,42 @@
 
 	also, FastVector only works correct if all new objects are requested from it, 
 	so you should not call operator delete on getNewObj() return value or some other stupid thing
+
+	Besides the objects, we keep a bitmask of the slots which are in use. The iteration
+	only looks at those slots (in slot order), so we don't touch all the unused objects
+	when only a few of them are alive.
 */
 template < typename _Obj, int SIZE >
 class FastVector {
 protected:
+	enum { MASK_BITS = 32, MASK_SIZE = (SIZE + MASK_BITS - 1) / MASK_BITS };
 	_Obj m_objects[SIZE];
+	Uint32 m_usedMask[MASK_SIZE];
 	int m_firstUnused;
 	int m_lastUsed;
 
+	void maskSet(int index) {
+		m_usedMask[index / MASK_BITS] |= 1u << (index % MASK_BITS);
+	}
+	void maskUnset(int index) {
+		m_usedMask[index / MASK_BITS] &= ~(1u << (index % MASK_BITS));
+	}
+
+	// returns the first slot >= index which is marked in m_usedMask or SIZE if there is none
+	int nextMarked(int index) const {
+		if(index >= SIZE) return SIZE;
+		int w = index / MASK_BITS;
+		Uint32 bits = m_usedMask[w] & (~0u << (index % MASK_BITS));
+		while(bits == 0) {
+			++w;
+			if(w >= MASK_SIZE || w * MASK_BITS > m_lastUsed) return SIZE;
+			bits = m_usedMask[w];
+		}
+		int i = w * MASK_BITS;
+		while((bits & 1) == 0) { bits >>= 1; ++i; }
+		return (i < SIZE) ? i : SIZE;
+	}
+
 	void findNewFirstUnused() {
 		while(true) {
 			m_firstUnused++;
@@ -50,6 +78,8 @@ protected:
 	}
 
 	void init() {
+		for(int i = 0; i < MASK_SIZE; i++)
+			m_usedMask[i] = 0;
 		for(int i = 0; i < SIZE; i++) {
 			m_objects[i].setUnused();
 			m_objects[i].onInvalidation.handler() = getEventHandler(this, &FastVector::onObjectInvalidation);
@@ -72,14 +102,17 @@ public:
 	void clear() {
 		for(int i = 0; i <= m_lastUsed; i++)
 			m_objects[i].setUnused();
+		for(int i = 0; i < MASK_SIZE; i++)
+			m_usedMask[i] = 0;
 		m_firstUnused = 0;
 		m_lastUsed = -1;
 	}
 
-	size_t size() {
+	// The mask also has the slots from getNewObj() which were not set used yet, so check each marked slot
+	size_t size() const {
 		size_t c = 0;
-		for(int i = 0; i <= m_lastUsed; i++)
-			if(m_objects[i].isUsed()) c++;
+		for(int i = nextMarked(0); i < SIZE; i = nextMarked(i + 1))
+			if(isUsed(i)) c++;
 		return c;
 	}
 	
@@ -89,6 +122,7 @@ public:
 
 		int newObj = m_firstUnused;
 		if(newObj > m_lastUsed) m_lastUsed = newObj;
+		maskSet(newObj);
 		findNewFirstUnused();
 		return &m_objects[newObj];
 	}
@@ -96,6 +130,7 @@ public:
 	// call this when you manually have setUnused() an obj
 	void refreshObj(int index) {
 		if(!isUsed(index)) {
+			maskUnset(index);
 			if(index < m_firstUnused) m_firstUnused = index;
 			if(index >= m_lastUsed) findNewLastUsed();
 		}
@@ -113,15 +148,10 @@ public:
 		Iterator* copy() const { return new Iterator(m_parent, m_index); }
 
 		void next() {
-			++m_index;
-			while (m_index < SIZE) {
-				if(m_parent.isUsed(m_index))
-					break;
-
-				++m_index;
-
-				if(m_index > m_parent.m_lastUsed)
-					m_index = SIZE;
+			while(true) {
+				m_index = m_parent.nextMarked(m_index + 1);
+				if(m_index >= SIZE) break;
+				if(m_parent.isUsed(m_index)) break;
 			}
 		}
 		bool operator==(const ::Iterator<_Obj*>& other) const { return m_index == ((Iterator*)&other)->m_index; }
@@ -144,6 +174,8 @@ public:
 			else
 				m_objects[i].setUnused();
 		}
+		for(int i = 0; i < MASK_SIZE; i++)
+			m_usedMask[i] = v.m_usedMask[i];
 		m_firstUnused = v.m_firstUnused;
 		m_lastUsed = v.m_lastUsed;
 		return *this;
@@ -30,6 +30,8 @@
 #include "HTTP.h"
 #include "types.h"
 #include "CBytestream.h"
+#include "SmartPointer.h"
+#include "Mutex.h"
 
 
 // File download states
@@ -171,11 +173,13 @@ public:
 // Actually we're using reliable CChannel to send packets so this downloader
 // doesn't contain any checks on packet lost / received in wrong order, 
 // only Adler32 checksum which is calculated by zlib.
+// With 0.58_rc6+ peers files are streamed instead (S2C_SENDFILESTREAM): the sender reads and compresses
+// the file incrementally and sends it in chunks which fill whole CChannel packets, as many as the channel window allows.
 class CUdpFileDownloader
 {
 public:
-	CUdpFileDownloader() { reset(); bAllowFileRequest = true; };
-	~CUdpFileDownloader() { };
+	CUdpFileDownloader() { pStream = NULL; reset(); bAllowFileRequest = true; bAllowFileStream = false; };
+	~CUdpFileDownloader();
 
 	enum State_t 	{ S_SEND, S_RECEIVE, S_FINISHED };
 
@@ -195,11 +199,17 @@ public:
 	// Does not change any variables, just pings server with zero-sized packet to un-freeze it, else download speed sucks
 	void		sendPing( CBytestream * bs ) const;
 
+	// Same as receive() and send(), for S2C_SENDFILESTREAM msgs
+	bool		receiveStream( CBytestream * bs );
+	bool		sendStream( CBytestream * bs );
+
 	State_t		getState() const { return tState; };
 
 	bool		isSending() const { return tState == S_SEND; };
 	bool		isReceiving() const { return tState == S_RECEIVE; };
 	bool		isFinished() const { return tState == S_FINISHED; };
+	bool		isSendingStream() const { return tState == S_SEND && pStream != NULL; };
+	bool		isReceivingStream() const { return tState == S_RECEIVE && pStream != NULL; };
 	bool		wasSending() const { return tPrevState == S_SEND; };
 	bool		wasReceiving() const { return tPrevState == S_RECEIVE; };
 
@@ -211,6 +221,8 @@ public:
 
 	void		setDataToSend( const std::string & name, const std::string & data, bool noCompress = false );
 	void		setFileToSend( const std::string & path );
+	// Resumes from offset if the first offset bytes of the file have the given Adler32 checksum, else sends the whole file
+	void		setFileToStream( const std::string & path, size_t offset, Uint32 checksum );
 
 	void		reset();
 	
@@ -218,10 +230,12 @@ public:
 
 	// Functions that will trigger remote CFileDownloaderInGame to do something like send some file or list some dir
 	void		allowFileRequest( bool allow );
+	void		allowFileStream( bool allow ) { bAllowFileStream = allow; };	// Remote side understands streamed transfers
 	void		requestFile( const std::string & path, bool retryIfFail );
 	bool		requestFilesPending(); // Re-send file request if downloading fails
 	void		removeFileFromRequest( const std::string & path );
 	static bool	isPathValid( const std::string & path );	// Check if someone tries to access /etc/shadow to get system passwords
+	static bool	isFileCompressed( const std::string & path );	// Compressing these files again won't make them smaller
 	
 	struct		StatInfo
 	{
@@ -241,12 +255,15 @@ public:
 	// Additional functionality to show download progress - inexact, server may send any file and we should accept it,
 	// yet current implementation will send only files we will request
 	float		getFileDownloadingProgress() const; // Downloading progress of current file, in range 0.0-1.0
-	size_t		getFileDownloadingProgressBytes() const;
+	size_t		getFileDownloadingProgressBytes() const; // In the same (compressed) size as getFilesPendingSize()
 	size_t		getFilesPendingAmount() const;
 	size_t		getFilesPendingSize() const; // Calculates compressed size of all pending files, incluing the one currently downloading
 
 private:
 	void			processFileRequests();
+	void			setCompressedDataToSend( const std::string & name, const SmartPointer<std::string> & data );
+	void			closeStream( bool keepPartial );	// keepPartial saves the received data to resume the download later
+	void			prunePartialDownloads();
 
 	// TODO: should use intern-pointer here
 	std::string		sFilename;
@@ -259,6 +276,18 @@ private:
 	bool			bWasAborted;
 	
 	bool			bAllowFileRequest;
+	bool			bAllowFileStream;
+
+	struct FileStream;
+	FileStream *	pStream;	// Set while sending or receiving a stream
+	// Data of interrupted streamed downloads, survives reset() so the download can be resumed after reconnecting
+	// Only kept for some minutes and up to some size, see prunePartialDownloads()
+	struct PartialDownload
+	{
+		std::string	data;
+		AbsTime		saved;
+	};
+	std::map< std::string, PartialDownload > tPartialDownloads;
 	
 	std::vector< std::string > tRequestedFiles;
 	
@@ -270,4 +299,91 @@ private:
 
 };
 
+// Cache of compressed files and directory listings (STAT_ACK:) for CUdpFileDownloader, shared by all connections,
+// so when many clients download the same mod it's read and compressed only once.
+// Compressed streams are stored by the file content (size and checksums), the path index is checked with the file size and mtime.
+// With Advanced.FileDownloadDiskCache the streams are also saved in cache/files and survive restarts, the oldest are deleted
+// when it gets too big.
+class UdpFileCache
+{
+public:
+	UdpFileCache() : iMemoryUsed(0) {}
+
+	// Size and Adler32 checksum of the file, same as FileChecksum() returns, false if the file cannot be read
+	bool		getFileInfo( const std::string & path, Uint32 * size, Uint32 * checksum );
+
+	struct ContentKey
+	{
+		Uint32	size;
+		Uint32	checksum;	// Adler32
+		Uint32	crc;		// CRC32, so the key is hard to get the same by accident
+		bool operator<( const ContentKey & k ) const
+			{ return size != k.size ? size < k.size : checksum != k.checksum ? checksum < k.checksum : crc < k.crc; }
+	};
+
+	// Compressed data for setFileToSend() and setFileToStream() (the latter only when sending the whole file), NULL if not cached
+	SmartPointer<std::string>	getCompressedFile( const std::string & path );
+	void		saveCompressedFile( const std::string & path, const SmartPointer<std::string> & data );
+	// Sets key to the current content of the file even if the stream is not cached, false if the file cannot be read
+	bool		getFileStream( const std::string & path, ContentKey * key, SmartPointer<std::string> * data );
+	// The stream is saved under the key of the file when the sending started, not under the path, the file could have changed meanwhile
+	void		saveFileStream( const ContentKey & key, const SmartPointer<std::string> & data );
+
+	// Compressed STAT_ACK: answer for path, rebuilt only if some file or dir inside has changed
+	SmartPointer<std::string>	getStatPacket( const std::string & path );
+
+private:
+
+	struct FileStamp
+	{
+		std::string	path;
+		Sint64		mtime;
+		Uint64		size;
+		Sint64		taken;	// When the stamp was taken, a file modified in that same second may change again unnoticed
+		bool unchanged( const FileStamp & now ) const
+			{ return mtime == now.mtime && size == now.size && mtime < taken; }
+	};
+
+	struct PathItem
+	{
+		FileStamp	stamp;
+		ContentKey	content;
+		SmartPointer<std::string>	compressed;	// S2C_SENDFILE data, contains the filename so it's not stored by content
+		AbsTime		lastUsed;
+	};
+
+	struct ContentItem
+	{
+		SmartPointer<std::string>	stream;		// S2C_SENDFILESTREAM data
+		AbsTime		lastUsed;
+	};
+
+	struct StatItem
+	{
+		std::vector<FileStamp>		stamps;	// All files and dirs the listing was created from
+		SmartPointer<std::string>	compressed;
+		AbsTime		lastUsed;
+	};
+
+	std::map< std::string, PathItem >		cPaths;
+	std::map< ContentKey, ContentItem >	cContents;
+	std::map< std::string, StatItem >		cStats;
+	size_t		iMemoryUsed;
+	Mutex		mutex;
+
+	static bool	stampFile( const std::string & path, FileStamp * stamp );
+	PathItem *	findFile( const std::string & path );	// Updates the checksums if the file has changed
+	void		setBlob( SmartPointer<std::string> & blob, const SmartPointer<std::string> & data );
+	void		freeMemory();
+	static std::string	diskCacheFilename( const ContentKey & key );
+	static void	pruneDiskCache();
+	static bool	isStreamOf( const std::string & data, const ContentKey & key );
+};
+
+extern UdpFileCache cUdpFileCache;
+
+#ifdef DEBUG
+void TestFileDownloadStreaming();
+#endif
+
 #endif // __FILEDOWNLOAD_H__
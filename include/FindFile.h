@@ -207,6 +207,15 @@ bool	IsAbsolutePath(const std::string& path);
 // IMPORTANT: filenames are absolute; no game-path!
 bool	FileCopy(const std::string& src, const std::string& dest);
 
+// writes a file in a way that other processes never see it half written: the data goes to a temporary file
+// with a name unique to this process and thread, which replaces path when it was written completely
+// OpenTempFile() returns NULL on error, CommitTempFile() closes fp and removes the temporary file on error
+// (ok = false if writing to fp failed already)
+// IMPORTANT: filenames are absolute; no game-path!
+FILE*	OpenTempFile(const std::string& path, std::string& tmpFile);
+bool	CommitTempFile(FILE* fp, const std::string& tmpFile, const std::string& path, bool ok = true);
+bool	WriteFileAtomic(const std::string& path, const std::string& data);
+
 // returns true, if we can write to the dir
 bool	CanWriteToDir(const std::string& dir);
 
@@ -16,7 +16,9 @@
 #define __GEOIPDATABASE_H__
 
 #include <string>
-#include <cstdio>
+#include <list>
+#include <map>
+#include "Mutex.h"
 
 // A record structure, contains various info about an IP
 struct GeoRecord  {
@@ -47,8 +49,12 @@ struct GeoRecord  {
 };
 
 // The MaxMind's database reader
+// The whole database is loaded into memory, the tree is walked from there
 class GeoIPDatabase  {
-	FILE *m_file;
+	friend void TestGeoIPLookup();
+
+	std::string m_data;  // Contents of the database file
+	bool m_loaded;
 	std::string m_fileName;
 
 	// Internal datbase data info
@@ -56,24 +62,38 @@ class GeoIPDatabase  {
 	int m_dbType;
 	int m_recordLength;
 
+	// Cache of the most recent lookups, the list is sorted by last use
+	enum { CACHE_SIZE = 256 };
+	typedef std::list< std::pair<unsigned long, GeoRecord> > CacheList;
+	mutable CacheList m_cache;
+	mutable std::map<unsigned long, CacheList::iterator> m_cacheIndex;
+	mutable Mutex m_cacheMutex;
+
 	// Helper functions
+	const unsigned char *dataAt(size_t offset, size_t len) const;
 	bool setupSegments();
 	unsigned int seekRecord(unsigned long ipnum) const;
 	GeoRecord extractRecordCity(unsigned int seekRecord) const;
 	GeoRecord extractRecordCtry(unsigned int seekRecord) const;
 	unsigned long convertIp(const std::string& strIp) const;
 	void fillContinent(GeoRecord& res) const;
+	GeoRecord lookupUncached(unsigned long ipnum) const;
 
 public:
-	GeoIPDatabase() : m_file(NULL), m_dbSegments(NULL), m_dbType(0), m_recordLength(0) {}
+	GeoIPDatabase() : m_loaded(false), m_dbSegments(NULL), m_dbType(0), m_recordLength(0) {}
 	~GeoIPDatabase();
 
 	bool load(const std::string& filename);
 	void close();
-	bool loaded() const { return m_file != NULL; }
+	bool loaded() const { return m_loaded; }
 
 	GeoRecord lookup(const std::string& ip) const;
+	void clearCache() const;
 
 };
 
+#ifdef DEBUG
+void TestGeoIPLookup();
+#endif
+
 #endif  // __GEOIPDATABASE_H__
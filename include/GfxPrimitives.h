@@ -304,6 +304,15 @@ inline bool ContainsRect(const SDL_Rect& rect1, const SDL_Rect& rect2)
 // Load an image
 SmartPointer<SDL_Surface> LoadGameImage(const std::string& _filename, bool withalpha = false);
 
+//////////////////
+// The two steps of LoadGameImage, for loading many images in parallel.
+// DecodeGameImage only reads the file (no video functions), so it can run in any thread;
+// if the image is in the cache already, it returns that and sets cached.
+// ConvertGameImage converts the decoded image and saves it in the cache, it calls the
+// video functions of SDL, which are not thread safe, so it has to run in the main thread.
+SmartPointer<SDL_Surface> DecodeGameImage(const std::string& _filename, bool& cached);
+SmartPointer<SDL_Surface> ConvertGameImage(const std::string& _filename, const SmartPointer<SDL_Surface>& img, bool withalpha);
+
 /////////////////
 // Loads an image and quits with error if could not load
 #define		LOAD_IMAGE(bmp,name)			{ if (!Load_Image(bmp,name)) return false; }
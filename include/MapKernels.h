@@ -0,0 +1,67 @@
+/*
+	OpenLieroX
+
+	row kernels for the map modification (CarveHole, PlaceDirt, PlaceGreenDirt)
+
+	code under LGPL
+*/
+
+#ifndef __MAPKERNELS_H__
+#define __MAPKERNELS_H__
+
+#include <SDL.h>
+#include "types.h"
+
+
+// The kernels work on one row of the map at a time. They take the hole image row, the pixel flags row
+// and the destination image row (bmpImage, or bmpDrawImage with 2x2 stretching when doubled is set).
+// 16 and 32 bit rows are processed with SSE2 where available, everything else with the plain loop.
+// All surfaces have to be in the same pixel format.
+
+
+// Describes when a pixel of the source image counts as transparent (see IsTransparent)
+struct MapKernelTransparency {
+	Uint32 alphaMask; // Amask if SDL_SRCALPHA is set, otherwise 0
+	Uint32 keyOrMask; // Amask of the format, ignored by the colorkey compare (see EqualRGB)
+	Uint32 key; // colorkey | keyOrMask
+	bool hasKey;
+
+	MapKernelTransparency() : alphaMask(0), keyOrMask(0), key(0), hasKey(false) {}
+	MapKernelTransparency(SDL_Surface* surf);
+
+	bool isTransparent(Uint32 pixel) const {
+		if ((pixel & alphaMask) != alphaMask) return true;
+		return hasKey && (pixel | keyOrMask) == key;
+	}
+};
+
+struct MapKernelRow {
+	uchar* flags; // PixelFlags of the first pixel
+	Uint8* dst; // destination image pixel
+	int dstPitch; // pitch of the destination image, needed for the second row when doubled
+	const Uint8* src; // hole / mask image pixel
+	int width; // in pixels of the map
+	int bpp;
+	bool doubled; // dst is the 2x hi-res draw image
+};
+
+// Carves dirt with a hole image row. Pink source pixels make dirt empty, others except black are drawn.
+// Returns the number of dirt pixels carved.
+int CarveHoleRow(const MapKernelRow& row, Uint32 pink, Uint32 black);
+
+// Places dirt with a hole image row, the dirt pixels are taken from the front tile row.
+// tileRow points to the start of the front tile row, tileX is the tile column of the first pixel.
+// Returns the number of dirt pixels placed (counted like the old loop did).
+int PlaceDirtRow(const MapKernelRow& row, const MapKernelTransparency& transp, Uint32 pink,
+				 const Uint8* tileRow, int tileW, int tileX);
+
+// Places green dirt with a green mask row. Green pixels get one of the 4 greens (chosen randomly).
+// Returns the number of green pixels placed.
+int PlaceGreenDirtRow(const MapKernelRow& row, Uint32 green, Uint32 pink, const Uint32 greens[4]);
+
+
+#ifdef DEBUG
+void TestMapKernels();
+#endif
+
+#endif // __MAPKERNELS_H__
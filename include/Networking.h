@@ -69,6 +69,7 @@ std::string NetAddrToString(const NetworkAddr& addr);
 unsigned short GetNetAddrPort(const NetworkAddr& addr);
 bool	SetNetAddrPort(NetworkAddr& addr, unsigned short port, std::string* errorStr = NULL);
 bool	AreNetAddrEqual(const NetworkAddr& addr1, const NetworkAddr& addr2);
+Uint64	GetNetAddrHash(const NetworkAddr& addr); // equal addresses (with port) have equal hashes
 bool	GetNetAddrFromNameAsync(const std::string& name);
 bool	GetFromDnsCache(const std::string& name, NetworkAddr& addr4, NetworkAddr& addr6);
 
@@ -111,6 +112,8 @@ private:
 	struct InternSocket; InternSocket* m_socket;
 	friend struct InternSocket;
 	struct EventHandler; friend struct EventHandler;
+	struct DatagramBatch; friend struct DatagramBatch;
+	friend class NetworkSocketWaiter;
 	void checkEventHandling();
 	
 	// Don't copy instances of this class! Use SmartPointer if you want to have multiple references to a socket.
@@ -153,6 +156,18 @@ public:
 	
 	bool isDataAvailable(); // Slow!
 
+	// Batched UDP I/O (unconnected UDP sockets only, otherwise ignored)
+	// When enabled, Read() is served from a queue which is filled with as many datagrams as
+	// possible per system call, and Write() calls between beginWriteBatch() and flushWriteBatch()
+	// are queued and sent together. On Linux, recvmmsg/sendmmsg are used, other systems fall
+	// back to one call per datagram.
+	void setBatching(bool v);
+	bool batching() const;
+	void beginWriteBatch();
+	int flushWriteBatch(); // returns amount of sent datagrams
+	// Amount of system calls used for sending/receiving since the socket was opened
+	void getSyscallStats(Uint64& sendCalls, Uint64& recvCalls) const;
+
 	// WARNING: Don't use!
 	void	WaitForSocketWrite(int timeout);
 	void	WaitForSocketRead(int timeout);
@@ -162,6 +177,31 @@ public:
 };
 
 
+// Sleeps until one of a set of sockets has data to read or a timeout is over.
+// On Linux, this uses epoll and only re-registers the sockets when the set has changed,
+// otherwise a HawkNL poll group is used.
+// Usage: call clear(), addSocket() for each socket and then wait().
+class NetworkSocketWaiter {
+private:
+	struct Intern; Intern* m_intern;
+
+	// Don't copy instances of this class!
+	NetworkSocketWaiter(const NetworkSocketWaiter&) { assert(false); }
+	NetworkSocketWaiter& operator=(const NetworkSocketWaiter&) { assert(false); return *this; }
+public:
+	NetworkSocketWaiter(); ~NetworkSocketWaiter();
+
+	void clear();
+	void addSocket(const NetworkSocket& sock);
+	// Returns true if there is data to read on any of the sockets
+	bool wait(int timeoutMs);
+};
+
+
+
+#ifdef DEBUG
+void	TestNetworkBatching();
+#endif
 
 int		GetSocketErrorNr();
 std::string	GetSocketErrorStr(int errnr);
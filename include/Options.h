@@ -298,6 +298,13 @@ struct GameOptions {
 	bool	bMatchLogging;			// Save screenshot of every game final score
 	bool	bRecoverAfterCrash;		// If we should try to recover after segfault etc, or generate coredump and quit
 	bool	bCheckForUpdates;		// Check for new development version on sourceforge.net
+	int		iPhysicsThreads;		// Amount of threads used for the projectile simulation (1 = no extra threads, 0 = automatic)
+	int		iAIPathfindingThreads;	// Amount of threads shared by all bots for the pathfinding (0 = automatic)
+	bool	bNetworkBatching;		// Send/receive multiple UDP packets per system call on the server sockets
+	bool	bMapDiskCache;			// Keep loaded and post-processed maps in cache/maps for the next start
+	bool	bFileDownloadDiskCache;	// Keep files compressed for the in-game download in cache/files for the next start
+	bool	bModDiskCache;			// Keep mods compiled from source in cache/mods for the next start
+	float	fFarWormUpdateDelay;	// Server: min seconds between updates of worms far away from all worms of a client (0 = always update)
 
 	// Misc.
 	bool    bLogConvos;
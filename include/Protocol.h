@@ -54,6 +54,7 @@ enum C2S_MESSAGES {
 	C2S_REPORTDAMAGE	= 12, // since Beta9
 	//C2S_NEWNET_KEYS		= 13, // since Beta9
 	//C2S_NEWNET_CHECKSUM = 14, // since Beta9
+	C2S_UPDATEWORMSACK	= 15, // since 0.58_rc6, acknowledges S2C_UPDATEWORMSDELTA snapshots
 };
 
 // Server->Client
@@ -92,6 +93,8 @@ enum S2C_MESSAGES {
 	S2C_FLAGINFO		= 31, // >=beta9
 	S2C_SETWORMPROPS	= 32, // >=beta9
 	S2C_SELECTWEAPONS	= 33, // >=beta9
+	S2C_UPDATEWORMSDELTA = 34, // since 0.58_rc6, S2C_UPDATEWORMS as delta to the acknowledged state
+	S2C_SENDFILESTREAM	= 35, // since 0.58_rc6, streamed S2C_SENDFILE, sent only if client requested it
 };
 
 
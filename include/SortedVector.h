@@ -0,0 +1,58 @@
+//
+// C++ Interface: SortedVector
+//
+// Description: set-like container based on a sorted vector
+//
+// It iterates in the same order as a std::set but it doesn't need
+// an allocation for each insert. It is meant for small sets where
+// inserts and erases happen very often (like the cells of a grid).
+//
+// code under LGPL
+//
+//
+
+
+#ifndef __OLX__SORTEDVECTOR_H__
+#define __OLX__SORTEDVECTOR_H__
+
+#include <vector>
+#include <algorithm>
+
+template<typename T>
+class SortedVector {
+private:
+	std::vector<T> m_data;
+	
+public:
+	typedef typename std::vector<T>::const_iterator const_iterator;
+	
+	const_iterator begin() const { return m_data.begin(); }
+	const_iterator end() const { return m_data.end(); }
+	size_t size() const { return m_data.size(); }
+	bool empty() const { return m_data.empty(); }
+	
+	// HINT: this keeps the reserved memory
+	void clear() { m_data.clear(); }
+	
+	// returns false if it was already in the set
+	bool insert(const T& v) {
+		typename std::vector<T>::iterator i = std::lower_bound(m_data.begin(), m_data.end(), v);
+		if(i != m_data.end() && !(v < *i)) return false;
+		m_data.insert(i, v);
+		return true;
+	}
+	
+	// returns false if it was not in the set
+	bool erase(const T& v) {
+		typename std::vector<T>::iterator i = std::lower_bound(m_data.begin(), m_data.end(), v);
+		if(i == m_data.end() || v < *i) return false;
+		m_data.erase(i);
+		return true;
+	}
+	
+	bool contains(const T& v) const {
+		return std::binary_search(m_data.begin(), m_data.end(), v);
+	}
+};
+
+#endif
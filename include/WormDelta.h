@@ -0,0 +1,119 @@
+/*
+	OpenLieroX
+
+	delta compressed worm updates (S2C_UPDATEWORMSDELTA)
+
+	code under LGPL
+*/
+
+#ifndef __WORMDELTA_H__
+#define __WORMDELTA_H__
+
+#include <vector>
+#include <SDL.h>
+#include "types.h"
+#include "Consts.h"
+
+class CBytestream;
+class BitWriter;
+class BitReader;
+
+
+// The worm state as written by CWorm::writePacket (server side, with velocity)
+struct WormNetState {
+	short x, y;
+	uchar angle;
+	uchar bits;
+	uchar weapon;
+	uchar ropeType; // only valid if (bits & 0x10)
+	short ropeX, ropeY;
+	uchar ropeExtra; // heading or hooked worm, only for ROP_SHOOTING and ROP_PLYHOOKED
+	Sint16 vx, vy;
+
+	WormNetState() : x(0), y(0), angle(0), bits(0), weapon(0), ropeType(0), ropeX(0), ropeY(0), ropeExtra(0), vx(0), vy(0) {}
+
+	bool hasRope() const { return (bits & 0x10) != 0; }
+	bool ropeHasExtra() const;
+	bool ropeEquals(const WormNetState& s) const;
+
+	// Conversion from/to the CWorm::writePacket format
+	bool readPacket(CBytestream *bs);
+	void writePacket(CBytestream *bs) const;
+
+	// Bit packed, only the changes to base are written if given
+	void writeDelta(BitWriter& w, const WormNetState* base) const;
+	bool readDelta(BitReader& r, const WormNetState* base);
+};
+
+typedef std::vector< std::pair<int, WormNetState> > WormNetStates;
+
+enum { WORMDELTA_HISTORY = 32 }; // snapshots remembered, also the ack window
+
+
+// Server side, one per client
+// Every update message is a numbered snapshot. The worms in it are encoded against the
+// newest state the client has acknowledged for them, or fully if there is none.
+class WormDeltaSender {
+public:
+	WormDeltaSender() { reset(); }
+
+	void reset(); // forget all acknowledged states, the next updates will be full
+
+	// Writes a S2C_UPDATEWORMSDELTA message
+	void write(CBytestream *bs, const WormNetStates& worms);
+	// Reads a C2S_UPDATEWORMSACK message
+	void parseAck(CBytestream *bs);
+
+private:
+	struct Snapshot {
+		bool used;
+		uchar seq;
+		Uint32 worms;
+		WormNetState states[MAX_WORMS];
+	};
+
+	uchar iSeq; // of the next snapshot
+	Snapshot tSent[WORMDELTA_HISTORY];
+	WormNetState tAcked[MAX_WORMS];
+	uchar iAckedSeq[MAX_WORMS];
+	bool bAcked[MAX_WORMS];
+};
+
+// Client side
+class WormDeltaReceiver {
+public:
+	WormDeltaReceiver() { reset(); }
+
+	void reset();
+
+	// Reads a S2C_UPDATEWORMSDELTA message, returns false if it could not be decoded
+	// The stream is always left behind the message.
+	bool read(CBytestream *bs, WormNetStates& worms);
+	// Writes a C2S_UPDATEWORMSACK message if we got some new snapshots
+	void writeAck(CBytestream *bs);
+
+	// Skips a S2C_UPDATEWORMSDELTA message
+	static void skip(CBytestream *bs);
+	// Skips a C2S_UPDATEWORMSACK message
+	static void skipAck(CBytestream *bs);
+
+private:
+	struct Entry {
+		bool valid;
+		uchar seq;
+		WormNetState state;
+	};
+
+	Entry tStates[MAX_WORMS][WORMDELTA_HISTORY];
+	bool bGotSnapshot;
+	uchar iLatest;
+	Uint32 iReceived; // bit n set if we got snapshot iLatest - n - 1
+	bool bNeedAck;
+	bool bNeedReset; // we couldn't decode a snapshot, the server has to send full states
+};
+
+#ifdef DEBUG
+void TestWormDelta();
+#endif
+
+#endif // __WORMDELTA_H__
@@ -525,8 +525,29 @@ void CapFPS() {
 	// tLX->currentTime is old time
 
 	// Cap the FPS
-	if(currentTime - tLX->currentTime < fMaxFrameTime)
-		SDL_Delay((Uint32)(fMaxFrameTime - (currentTime - tLX->currentTime)).milliseconds());
+	if(currentTime - tLX->currentTime < fMaxFrameTime) {
+		if(bDedicated && cServer && cServer->isServerRunning()) {
+			// Sleep on the server sockets and handle packets as soon as they arrive instead of
+			// waiting for the next frame. The frame itself is still not started earlier.
+			const AbsTime frameStartTime = tLX->currentTime;
+			AbsTime now = currentTime;
+			while(now - frameStartTime < fMaxFrameTime) {
+				if(!cServer->WaitForPackets((int)(fMaxFrameTime - (now - frameStartTime)).milliseconds()))
+					break;
+				tLX->currentTime = GetTime(); // packets are timestamped with this
+				const bool gotData = cServer->ReadPackets();
+				now = GetTime();
+				if(!gotData) {
+					// socket reported data we cannot read (error state), don't spin on it
+					if(now - frameStartTime < fMaxFrameTime)
+						SDL_Delay((Uint32)(fMaxFrameTime - (now - frameStartTime)).milliseconds());
+					break;
+				}
+			}
+		}
+		else
+			SDL_Delay((Uint32)(fMaxFrameTime - (currentTime - tLX->currentTime)).milliseconds());
+	}
 	else
 		// do at least one small break, else it's possible that we never receive signals from our OS
 		SDL_Delay(1);
@@ -789,7 +789,8 @@ void CClient::ProcessUdpUploads()
 		fLastFileRequestPacketReceived = tLX->currentTime;
 		fLastFileRequest = tLX->currentTime + fDownloadRetryTimeout/10.0f;
 		// Do not spam server with STAT packets, it may take long to scan all files in mod dir
-		if( getUdpFileDownloader()->getFilename() == "STAT:" || getUdpFileDownloader()->getFilename() == "GET:" )
+		if( getUdpFileDownloader()->getFilename() == "STAT:" || getUdpFileDownloader()->getFilename() == "GET:" ||
+			getUdpFileDownloader()->getFilename() == "GET_STREAM:" )
 			fLastFileRequest = tLX->currentTime + fDownloadRetryTimeout;
 	}
 }
@@ -1023,9 +1024,13 @@ void CClient::ProcessModDownloads()
 	// Update download progress
 	if( iModDownloadingSize == 0 )
 		iDlProgress = byte(cUdpFileDownloader.getFileDownloadingProgress() * 100);
-	bool downloadStarted = ( cUdpFileDownloader.getFilename() != "" && cUdpFileDownloader.getFilename() != "STAT:" );
-	iDlProgress = byte( ( downloadStarted ? 5.0f : 0.0f ) + 95.0f - 95.0f / iModDownloadingSize * 
-					(cUdpFileDownloader.getFilesPendingSize() - cUdpFileDownloader.getFileDownloadingProgressBytes()) );
+	else {
+		bool downloadStarted = ( cUdpFileDownloader.getFilename() != "" && cUdpFileDownloader.getFilename() != "STAT:" );
+		size_t pendingSize = cUdpFileDownloader.getFilesPendingSize();
+		size_t receivedSize = MIN( cUdpFileDownloader.getFileDownloadingProgressBytes(), pendingSize );
+		size_t leftSize = MIN( pendingSize - receivedSize, iModDownloadingSize );
+		iDlProgress = byte( ( downloadStarted ? 5.0f : 0.0f ) + 95.0f - 95.0f / iModDownloadingSize * leftSize );
+	}
 	
 	// Receiving
 	if(cUdpFileDownloader.isReceiving())	 {
@@ -1177,6 +1182,7 @@ void CClient::SendPackets(bool sendPendingOnly)
 		{
 			cNetEngine->SendWormDetails();
 			cNetEngine->SendReportDamage();	// It sends only if someting is queued
+			cNetEngine->SendUpdateWormsAck();	// Only if we got some S2C_UPDATEWORMSDELTA
 		}
 
 
@@ -2375,12 +2381,15 @@ void CClient::setNetEngineFromServerVersion()
 {
 	if(cNetEngine) delete cNetEngine;
 	cNetEngine = NULL;
-	if( getServerVersion() >= OLXBetaVersion(0,58,1) )
+	if( getServerVersion() >= OLXRcVersion(0,58,6) && getServerVersion() < OLXBetaVersion(0,59,0) ) // 0.59 doesn't know the worm deltas
+		cNetEngine = new CClientNetEngineRc6(this);
+	else if( getServerVersion() >= OLXBetaVersion(0,58,1) )
 		cNetEngine = new CClientNetEngineBeta9(this);
 	else if( getServerVersion() >= OLXBetaVersion(7) )
 		cNetEngine = new CClientNetEngineBeta7(this);
 	else
 		cNetEngine = new CClientNetEngine(this);
+	cUdpFileDownloader.allowFileStream( getServerVersion() >= OLXRcVersion(0,58,6) && getServerVersion() < OLXBetaVersion(0,59,0) );
 };
 
 std::string CClient::debugName() {
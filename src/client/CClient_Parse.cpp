@@ -578,6 +578,11 @@ bool CClientNetEngine::ParsePacket(CBytestream *bs)
 				ParseUpdateWorms(bs);
 				break;
 
+			// Worm state update, delta compressed
+			case S2C_UPDATEWORMSDELTA:
+				ParseUpdateWormsDelta(bs);
+				break;
+
 			// Game lobby update
 			case S2C_UPDATELOBBYGAME:
 				ParseUpdateLobbyGame(bs);
@@ -627,6 +632,10 @@ bool CClientNetEngine::ParsePacket(CBytestream *bs)
                 ParseSendFile(bs);
                 break;
 
+			case S2C_SENDFILESTREAM:
+				ParseSendFileStream(bs);
+				break;
+
             case S2C_REPORTDAMAGE:
                 ParseReportDamage(bs);
                 break;
@@ -1986,6 +1995,38 @@ void CClientNetEngine::ParseUpdateWorms(CBytestream *bs)
 	DeprecatedGUI::bHost_Update = true;
 }
 
+///////////////////
+// Parse a delta compressed worm update packet
+void CClientNetEngine::ParseUpdateWormsDelta(CBytestream *bs)
+{
+	// We never asked for it
+	hints << "CClientNetEngine::ParseUpdateWormsDelta: unexpected delta update" << endl;
+	WormDeltaReceiver::skip(bs);
+}
+
+void CClientNetEngineRc6::ParseUpdateWormsDelta(CBytestream *bs)
+{
+	// Always decode, even if we can't use the states yet, the following snapshots are based on them
+	WormNetStates worms;
+	if(!cWormDelta.read(bs, worms))
+		return;
+
+	// See CClientNetEngine::ParseUpdateWorms
+	if(!client->bGameReady || !client->cMap || !client->cMap->isLoaded())
+		return;
+
+	for(WormNetStates::const_iterator it = worms.begin(); it != worms.end(); ++it) {
+		// Back to the format of CWorm::writePacket, so the worm only has one way to read its state
+		CBytestream state;
+		it->second.writePacket(&state);
+		state.ResetPosToBegin();
+		client->cRemoteWorms[it->first].readPacketState(&state, client->cRemoteWorms);
+	}
+
+	DeprecatedGUI::bJoin_Update = true;
+	DeprecatedGUI::bHost_Update = true;
+}
+
 ///////////////////
 // Parse an 'update game lobby' packet
 void CClientNetEngine::ParseUpdateLobbyGame(CBytestream *bs)
@@ -2333,95 +2374,108 @@ void CClientNetEngine::ParseSendFile(CBytestream *bs)
 
 	client->fLastFileRequestPacketReceived = tLX->currentTime;
 	if( client->getUdpFileDownloader()->receive(bs) )
+		ProcessReceivedFile();
+	if( client->getUdpFileDownloader()->isReceiving() )
 	{
-		if( CUdpFileDownloader::isPathValid( client->getUdpFileDownloader()->getFilename() ) &&
-			! IsFileAvailable( client->getUdpFileDownloader()->getFilename() ) &&
-			client->getUdpFileDownloader()->isFinished() )
-		{
-			// Server sent us some file we don't have - okay, save it
-			FILE * ff=OpenGameFile( client->getUdpFileDownloader()->getFilename(), "wb" );
-			if( ff == NULL )
-			{
-				errors << "CClientNetEngine::ParseSendFile(): cannot write file " << client->getUdpFileDownloader()->getFilename() << endl;
-				return;
-			};
-			fwrite( client->getUdpFileDownloader()->getData().data(), 1, client->getUdpFileDownloader()->getData().size(), ff );
-			fclose(ff);
+		// Speed up download - server will send next packet when receives ping, or once in 0.5 seconds
+		CBytestream bs;
+		bs.writeByte(C2S_SENDFILE);
+		client->getUdpFileDownloader()->sendPing( &bs );
+		client->cNetChan->AddReliablePacketToSend(bs);
+	}
+}
 
-			if( client->getUdpFileDownloader()->getFilename().find("levels/") == 0 &&
-					IsFileAvailable( "levels/" + client->tGameInfo.sMapFile ) )
-			{
-				client->bDownloadingMap = false;
-				client->bWaitingForMap = false;
-				client->FinishMapDownloads();
-				client->sMapDownloadName = "";
+// Server streams us some file, we requested it with GET_STREAM:
+void CClientNetEngine::ParseSendFileStream(CBytestream *bs)
+{
+	client->fLastFileRequestPacketReceived = tLX->currentTime;
+	// No pings here, the server sends the stream as fast as the channel allows
+	if( client->getUdpFileDownloader()->receiveStream(bs) )
+		ProcessReceivedFile();
+}
 
-				DeprecatedGUI::bJoin_Update = true;
-				DeprecatedGUI::bHost_Update = true;
-			}
-			if( client->getUdpFileDownloader()->getFilename().find("skins/") == 0 )
-			{
-				// Loads skin from disk automatically on next frame
-				DeprecatedGUI::bJoin_Update = true;
-				DeprecatedGUI::bHost_Update = true;
-			}
-			if( ! client->bHaveMod &&
-				client->getUdpFileDownloader()->getFilename().find( client->tGameInfo.sModDir ) == 0 &&
-				IsFileAvailable(client->tGameInfo.sModDir + "/script.lgs", false) )
-			{
-				client->bDownloadingMod = false;
-				client->bWaitingForMod = false;
-				client->FinishModDownloads();
-				client->sModDownloadName = "";
+// Called when the UDP file downloader finished receiving something
+void CClientNetEngine::ProcessReceivedFile()
+{
+	if( CUdpFileDownloader::isPathValid( client->getUdpFileDownloader()->getFilename() ) &&
+		! IsFileAvailable( client->getUdpFileDownloader()->getFilename() ) &&
+		client->getUdpFileDownloader()->isFinished() )
+	{
+		// Server sent us some file we don't have - okay, save it
+		FILE * ff=OpenGameFile( client->getUdpFileDownloader()->getFilename(), "wb" );
+		if( ff == NULL )
+		{
+			errors << "CClientNetEngine::ProcessReceivedFile(): cannot write file " << client->getUdpFileDownloader()->getFilename() << endl;
+			return;
+		};
+		fwrite( client->getUdpFileDownloader()->getData().data(), 1, client->getUdpFileDownloader()->getData().size(), ff );
+		fclose(ff);
 
-				DeprecatedGUI::bJoin_Update = true;
-				DeprecatedGUI::bHost_Update = true;
-			}
+		if( client->getUdpFileDownloader()->getFilename().find("levels/") == 0 &&
+				IsFileAvailable( "levels/" + client->tGameInfo.sMapFile ) )
+		{
+			client->bDownloadingMap = false;
+			client->bWaitingForMap = false;
+			client->FinishMapDownloads();
+			client->sMapDownloadName = "";
 
-			client->getUdpFileDownloader()->requestFilesPending(); // Immediately request another file
-			client->fLastFileRequest = tLX->currentTime;
+			DeprecatedGUI::bJoin_Update = true;
+			DeprecatedGUI::bHost_Update = true;
+		}
+		if( client->getUdpFileDownloader()->getFilename().find("skins/") == 0 )
+		{
+			// Loads skin from disk automatically on next frame
+			DeprecatedGUI::bJoin_Update = true;
+			DeprecatedGUI::bHost_Update = true;
+		}
+		if( ! client->bHaveMod &&
+			client->getUdpFileDownloader()->getFilename().find( client->tGameInfo.sModDir ) == 0 &&
+			IsFileAvailable(client->tGameInfo.sModDir + "/script.lgs", false) )
+		{
+			client->bDownloadingMod = false;
+			client->bWaitingForMod = false;
+			client->FinishModDownloads();
+			client->sModDownloadName = "";
 
+			DeprecatedGUI::bJoin_Update = true;
+			DeprecatedGUI::bHost_Update = true;
 		}
-		else
-		if( client->getUdpFileDownloader()->getFilename() == "STAT_ACK:" &&
-			client->getUdpFileDownloader()->getFileInfo().size() > 0 &&
-			! client->bHaveMod &&
-			client->getUdpFileDownloader()->isFinished() )
+
+		client->getUdpFileDownloader()->requestFilesPending(); // Immediately request another file
+		client->fLastFileRequest = tLX->currentTime;
+
+	}
+	else
+	if( client->getUdpFileDownloader()->getFilename() == "STAT_ACK:" &&
+		client->getUdpFileDownloader()->getFileInfo().size() > 0 &&
+		! client->bHaveMod &&
+		client->getUdpFileDownloader()->isFinished() )
+	{
+		// Got filenames list of mod dir - push "script.lgs" to the end of list to download all other data before
+		uint f;
+		for( f=0; f<client->getUdpFileDownloader()->getFileInfo().size(); f++ )
 		{
-			// Got filenames list of mod dir - push "script.lgs" to the end of list to download all other data before
-			uint f;
-			for( f=0; f<client->getUdpFileDownloader()->getFileInfo().size(); f++ )
+			if( client->getUdpFileDownloader()->getFileInfo()[f].filename.find( client->tGameInfo.sModDir ) == 0 &&
+				! IsFileAvailable( client->getUdpFileDownloader()->getFileInfo()[f].filename ) &&
+				stringcaserfind( client->getUdpFileDownloader()->getFileInfo()[f].filename, "/script.lgs" ) != std::string::npos )
 			{
-				if( client->getUdpFileDownloader()->getFileInfo()[f].filename.find( client->tGameInfo.sModDir ) == 0 &&
-					! IsFileAvailable( client->getUdpFileDownloader()->getFileInfo()[f].filename ) &&
-					stringcaserfind( client->getUdpFileDownloader()->getFileInfo()[f].filename, "/script.lgs" ) != std::string::npos )
-				{
-					client->getUdpFileDownloader()->requestFile( client->getUdpFileDownloader()->getFileInfo()[f].filename, true );
-					client->fLastFileRequest = tLX->currentTime + 1.5f;	// Small delay so server will be able to send all the info
-					client->iModDownloadingSize = client->getUdpFileDownloader()->getFilesPendingSize();
-				}
+				client->getUdpFileDownloader()->requestFile( client->getUdpFileDownloader()->getFileInfo()[f].filename, true );
+				client->fLastFileRequest = tLX->currentTime + 1.5f;	// Small delay so server will be able to send all the info
+				client->iModDownloadingSize = client->getUdpFileDownloader()->getFilesPendingSize();
 			}
-			for( f=0; f<client->getUdpFileDownloader()->getFileInfo().size(); f++ )
+		}
+		for( f=0; f<client->getUdpFileDownloader()->getFileInfo().size(); f++ )
+		{
+			if( client->getUdpFileDownloader()->getFileInfo()[f].filename.find( client->tGameInfo.sModDir ) == 0 &&
+				! IsFileAvailable( client->getUdpFileDownloader()->getFileInfo()[f].filename ) &&
+				stringcaserfind( client->getUdpFileDownloader()->getFileInfo()[f].filename, "/script.lgs" ) == std::string::npos )
 			{
-				if( client->getUdpFileDownloader()->getFileInfo()[f].filename.find( client->tGameInfo.sModDir ) == 0 &&
-					! IsFileAvailable( client->getUdpFileDownloader()->getFileInfo()[f].filename ) &&
-					stringcaserfind( client->getUdpFileDownloader()->getFileInfo()[f].filename, "/script.lgs" ) == std::string::npos )
-				{
-					client->getUdpFileDownloader()->requestFile( client->getUdpFileDownloader()->getFileInfo()[f].filename, true );
-					client->fLastFileRequest = tLX->currentTime + 1.5f;	// Small delay so server will be able to send all the info
-					client->iModDownloadingSize = client->getUdpFileDownloader()->getFilesPendingSize();
-				}
+				client->getUdpFileDownloader()->requestFile( client->getUdpFileDownloader()->getFileInfo()[f].filename, true );
+				client->fLastFileRequest = tLX->currentTime + 1.5f;	// Small delay so server will be able to send all the info
+				client->iModDownloadingSize = client->getUdpFileDownloader()->getFilesPendingSize();
 			}
 		}
 	}
-	if( client->getUdpFileDownloader()->isReceiving() )
-	{
-		// Speed up download - server will send next packet when receives ping, or once in 0.5 seconds
-		CBytestream bs;
-		bs.writeByte(C2S_SENDFILE);
-		client->getUdpFileDownloader()->sendPing( &bs );
-		client->cNetChan->AddReliablePacketToSend(bs);
-	}
 }
 
 void CClientNetEngineBeta9::ParseReportDamage(CBytestream *bs)
@@ -356,6 +356,22 @@ void CClientNetEngineBeta9::QueueReportDamage(int victim, float damage, int offe
 	SendReportDamage();
 }
 
+///////////////////
+// Tell the server which worm snapshots we got, it uses them as base for the next ones
+void CClientNetEngineRc6::SendUpdateWormsAck()
+{
+	if( tLX->currentTime - fLastWormsAckSent < 0.05f )
+		return;
+
+	CBytestream bs;
+	cWormDelta.writeAck(&bs);
+	if( bs.GetLength() == 0 )
+		return;
+
+	client->bsUnreliable.Append(&bs);
+	fLastWormsAckSent = tLX->currentTime;
+}
+
 void CClientNetEngineBeta9::SendReportDamage(bool flush)
 {
 	if( ! flush && tLX->currentTime - fLastDamageReportSent < 0.1f * ( NST_LOCAL - client->getNetSpeed() ) )
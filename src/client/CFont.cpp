@@ -45,6 +45,7 @@ int CFont::Load(const std::string& fontname, bool _colour) {
 	SetColorKey(bmpFont.get(), 255, 0, 255);
 
 	Colorize = _colour;
+	ClearColourCache();
 
 	bmpWhite = gfxCreateSurfaceAlpha(bmpFont.get()->w, bmpFont.get()->h);
 	bmpGreen = gfxCreateSurfaceAlpha(bmpFont.get()->w, bmpFont.get()->h);
@@ -69,6 +70,7 @@ int CFont::Load(const std::string& fontname, bool _colour) {
 ///////////////////
 // Shutdown the font
 void CFont::Shutdown() {
+	ClearColourCache();
 }
 
 
@@ -163,7 +165,7 @@ void CFont::PreCalculate(const SmartPointer<SDL_Surface> & bmpSurf, Color colour
 	LOCK_OR_QUIT(bmpFont);
 
 	Uint8 R, G, B, A;
-	const Uint8 sr = colour.r, sg = colour.g, sb = colour.b;
+	const Uint8 sr = colour.r, sg = colour.g, sb = colour.b, sa = colour.a;
 
 	// Outline font: replace white pixels with appropriate color, put black pixels
 	if (OutlineFont) {
@@ -174,10 +176,10 @@ void CFont::PreCalculate(const SmartPointer<SDL_Surface> & bmpSurf, Color colour
 
 				if (R == 255 && G == 255 && B == 255)    // White
 					PutPixel(bmpSurf.get(), x, y,
-					         SDL_MapRGBA(bmpSurf.get()->format, sr, sg, sb, A));
+					         SDL_MapRGBA(bmpSurf.get()->format, sr, sg, sb, (A * sa) / 255));
 				else if (!R && !G && !B)   // Black
 					PutPixel(bmpSurf.get(), x, y,
-					         SDL_MapRGBA(bmpSurf.get()->format, 0, 0, 0, A));
+					         SDL_MapRGBA(bmpSurf.get()->format, 0, 0, 0, (A * sa) / 255));
 			}
 		}
 	// Not outline: replace black pixels with appropriate color
@@ -189,7 +191,7 @@ void CFont::PreCalculate(const SmartPointer<SDL_Surface> & bmpSurf, Color colour
 
 				if (!R && !G && !B)   // Black
 					PutPixel(bmpSurf.get(), x, y,
-					         SDL_MapRGBA(bmpSurf.get()->format, sr, sg, sb, A));
+					         SDL_MapRGBA(bmpSurf.get()->format, sr, sg, sb, (A * sa) / 255));
 			}
 		}
 	}
@@ -201,6 +203,54 @@ void CFont::PreCalculate(const SmartPointer<SDL_Surface> & bmpSurf, Color colour
 }
 
 
+///////////////////
+// Get the precalculated font for the colour from the cache
+// Returns NULL if the glyphs should be drawn manually
+// A colour is precalculated only when it is used the second time, so that
+// colours which are used only once (e.g. fading text) don't trash the cache.
+// HINT: not thread-safe
+SmartPointer<SDL_Surface> CFont::GetColouredFont(Color colour) {
+	if (!ColourCacheEnabled)
+		return NULL;
+
+	for (std::list<ColouredFont>::iterator it = ColourCache.begin(); it != ColourCache.end(); ++it) {
+		if (it->colour != colour || it->outline != OutlineFont)
+			continue;
+
+		// Move to the front
+		if (it != ColourCache.begin())
+			ColourCache.splice(ColourCache.begin(), ColourCache, it);
+		return ColourCache.front().bmp;
+	}
+
+	const std::pair<Color, bool> key(colour, OutlineFont);
+	for (std::list< std::pair<Color, bool> >::iterator it = SeenColours.begin(); it != SeenColours.end(); ++it) {
+		if (*it != key)
+			continue;
+
+		// Second use, precalculate it
+		SeenColours.erase(it);
+		ColouredFont entry;
+		entry.colour = colour;
+		entry.outline = OutlineFont;
+		entry.bmp = gfxCreateSurfaceAlpha(bmpFont.get()->w, bmpFont.get()->h);
+		if (!entry.bmp.get())
+			return NULL;
+		PreCalculate(entry.bmp, colour);
+		ColourCache.push_front(entry);
+		if (ColourCache.size() > COLOUR_CACHE_SIZE)
+			ColourCache.pop_back();
+		return ColourCache.front().bmp;
+	}
+
+	// First use, just remember it
+	SeenColours.push_front(key);
+	if (SeenColours.size() > SEEN_COLOURS_SIZE)
+		SeenColours.pop_back();
+	return NULL;
+}
+
+
 ////////////////////
 // Get height of multiline text
 int CFont::GetHeight(const std::string& buf) {
@@ -268,6 +318,8 @@ void CFont::DrawAdv(SDL_Surface * dst, int x, int y, int max_w, Color col, const
 			bmpCached = bmpFont;
 		else if (col == f_green)
 			bmpCached = bmpGreen;
+		else
+			bmpCached = GetColouredFont(col);
 	}
 	// Not colourize, bmpFont itself should be blitted without any changes, so it's precached
 	else {
@@ -493,3 +545,48 @@ void CFont::DrawCentre(SDL_Surface * dst, int x, int y, Color col, const std::st
 void CFont::DrawCentreAdv(SDL_Surface * dst, int x, int y, int min_x, int max_w, Color col, const std::string& txt) {
 	DrawAdv(dst, MAX(min_x, x - GetWidth(txt) / 2), y, max_w, col, txt);
 }
+
+
+#ifdef DEBUG
+// Compares the glyph drawing speed with and without the colour cache
+void TestFontDrawing() {
+	CFont& font = tLX->cFont;
+	if (!font.bmpFont.get()) {
+		errors << "TestFontDrawing: font not loaded" << endl;
+		return;
+	}
+
+	SmartPointer<SDL_Surface> dst = gfxCreateSurface(640, 480);
+	if (!dst.get()) {
+		errors << "TestFontDrawing: cannot create surface" << endl;
+		return;
+	}
+
+	const std::string txt = "The quick brown fox jumps over the lazy dog 0123456789";
+	size_t glyphs = 0;
+	for (std::string::const_iterator it = txt.begin(); it != txt.end(); )
+		if (font.TranslateCharacter(it, txt.end()) >= 0) glyphs++;
+
+	// Some player and team colours
+	std::vector<Color> colours;
+	for (int i = 0; i < 16; i++)
+		colours.push_back(Color((Uint8)(i * 16), (Uint8)(255 - i * 8), (Uint8)(i * 5 + 40)));
+
+	const int iterations = 20000;
+	for (int cached = 0; cached < 2; cached++) {
+		font.ColourCacheEnabled = cached != 0;
+		font.ClearColourCache();
+
+		Uint32 start = SDL_GetTicks();
+		for (int i = 0; i < iterations; i++)
+			font.Draw(dst.get(), 10, (i % 40) * 11, colours[i % colours.size()], txt);
+		float secs = (SDL_GetTicks() - start) / 1000.0f;
+
+		notes << "TestFontDrawing: " << (cached ? "with" : "without") << " colour cache: "
+			<< (secs > 0 ? (float)(glyphs * iterations) / secs : 0.0f) << " glyphs/sec" << endl;
+	}
+
+	font.ColourCacheEnabled = true;
+	font.ClearColourCache();
+}
+#endif
@@ -65,6 +65,12 @@ extern void OlxWriteCoreDump_Win32(const char* fileName, PEXCEPTION_POINTERS pEx
 // This callback function is called whenever an unhandled exception occurs
 LONG WINAPI CustomUnhandledExceptionFilter(PEXCEPTION_POINTERS pExInfo)
 {
+	// Write out what was logged right before the crash
+	__try {
+		FlushLogQueue();
+	}
+	__except(EXCEPTION_EXECUTE_HANDLER) {}
+
 	// Get the path
 	char buf[1024];
 	if (!SHGetSpecialFolderPath(NULL, buf, CSIDL_PERSONAL, false))  {
@@ -265,6 +271,7 @@ public:
 	
 	static void SimpleSignalHandler(int signr, siginfo_t *info, void *secret) {
 		signal(signr, SIG_IGN); // discard all remaining signals
+		FlushLogQueue(); // don't lose what was logged right before the crash
 
 		signal_def *d = NULL;
 		for (unsigned int i = 0; i < sizeof(signal_data) / sizeof(signal_def); i++)
@@ -2493,26 +2493,39 @@ bool IsCorrectSurfaceFormat(const SDL_PixelFormat* format) {
 // Loads an image, and converts it to the same colour depth as the screen (speed)
 SmartPointer<SDL_Surface> LoadGameImage(const std::string& _filename, bool withalpha)
 {
-	ScopedLock lock(cCache.mutex);
-	
+	bool cached = false;
+	SmartPointer<SDL_Surface> img = DecodeGameImage(_filename, cached);
+	if(cached || !img.get())
+		return img;
+	return ConvertGameImage(_filename, img, withalpha);
+}
+
+///////////////////
+// Decodes an image file, or returns it from the cache
+SmartPointer<SDL_Surface> DecodeGameImage(const std::string& _filename, bool& cached)
+{
 	{
 		// Try cache first
+		ScopedLock lock(cCache.mutex);
 		SmartPointer<SDL_Surface> ImageCache = cCache.GetImage__unsafe(_filename);
-		if( ImageCache.get() )
+		cached = ImageCache.get() != NULL;
+		if( cached )
 			return ImageCache;
 	}
 	
 	// Load the image
+	// The cache is not locked while decoding, so several images can be decoded in parallel (e.g. by CGameScript)
 	std::string fullfname = GetFullFileName(_filename);
 	if(fullfname.size() == 0)
 		return NULL;
 
-	SmartPointer<SDL_Surface> img = IMG_Load(Utf8ToSystemNative(fullfname).c_str());
-
-	if(!img.get())  {
-		return NULL;
-	}
+	return IMG_Load(Utf8ToSystemNative(fullfname).c_str());
+}
 
+///////////////////
+// Converts a decoded image to the colour depth of the screen, and saves it in the cache
+SmartPointer<SDL_Surface> ConvertGameImage(const std::string& _filename, const SmartPointer<SDL_Surface>& img, bool withalpha)
+{
 	SmartPointer<SDL_Surface> Image;
 	if(bDedicated || !VideoPostProcessor::videoSurface()) {
 		if(!bDedicated)
@@ -2548,6 +2561,11 @@ SmartPointer<SDL_Surface> LoadGameImage(const std::string& _filename, bool witha
 	#ifdef DEBUG
 	//printf("LoadImage() %p %s\n", Image.get(), _filename.c_str() );
 	#endif
+	ScopedLock lock(cCache.mutex);
+	// The same image could have been decoded twice in parallel, keep only one of them
+	SmartPointer<SDL_Surface> ImageCache = cCache.GetImage__unsafe(_filename);
+	if( ImageCache.get() )
+		return ImageCache;
 	cCache.SaveImage__unsafe(_filename, Image);
 	return Image;
 }
@@ -226,6 +226,13 @@ bool GameOptions::Init() {
 																		false )
 #endif
 		( tLXOptions->bCheckForUpdates, "Advanced.CheckForUpdates", true )
+		( tLXOptions->iPhysicsThreads, "Advanced.PhysicsThreads", 0 )
+		( tLXOptions->iAIPathfindingThreads, "Advanced.AIPathfindingThreads", 0 )
+		( tLXOptions->bNetworkBatching, "Advanced.NetworkBatching", true )
+		( tLXOptions->bMapDiskCache, "Advanced.MapDiskCache", true )
+		( tLXOptions->bFileDownloadDiskCache, "Advanced.FileDownloadDiskCache", true )
+		( tLXOptions->bModDiskCache, "Advanced.ModDiskCache", true )
+		( tLXOptions->fFarWormUpdateDelay, "Advanced.FarWormUpdateDelay", 0.25f )
 
 		( tLXOptions->bLogConvos, "Misc.LogConversations", false )
 		( tLXOptions->bLogServerChatToMainlog, "Network.LogServerChatToMainlog", true)	//Log chat to main log when hosting a server - previously OLX always did this. NOTE: It's under network settings as it affects mostly the server side.
@@ -18,6 +18,7 @@
 
 
 #include <cassert>
+#include <cstring>
 #include <stdarg.h>
 #include <iomanip>
 
@@ -203,6 +204,24 @@ void CBytestream::Test()
 	notes <<endl;
 	Clear();
 
+	// Data pointer, patched byte and bounded strings
+	notes << "Data pointer: ";
+	writeData("xyz", 3);
+	writeString("hello");
+	writeData("world!", 6);
+	writeByteAt(1, 'Y');
+	{
+		size_t len = 2;
+		const char* d = readDataPtr(len);
+		if( len != 2 || d[0] != 'x' || d[1] != 'Y' )
+			notes << "NOT SAME!";
+	}
+	readByte();
+	if( readString() != "hello" || readString(3) != "wor" || readString(10) != "ld!" || !isPosAtEnd() )
+		notes << "NOT SAME!";
+	notes <<endl;
+	Clear();
+
 	// Bit iterator
 	char bitData[10];
 	bitData[0] = 0;
@@ -236,7 +255,7 @@ void CBytestream::Test()
 }
 
 void CBytestream::Clear() {
-	Data = "";
+	Data.clear(); // HINT: this keeps the allocated memory
 	pos = 0;
 	bitPos = 0;
 }
@@ -245,7 +264,7 @@ void CBytestream::Clear() {
 ///////////////////
 // Append another bytestream onto this one
 void CBytestream::Append(CBytestream *bs) {
-	Data += bs->Data;
+	Data.append(bs->Data);
 }
 
 
@@ -382,6 +401,22 @@ bool CBytestream::writeData(const std::string& value)
 	return true;
 }
 
+bool CBytestream::writeData(const char* data, size_t size)
+{
+	Data.append( data, size );
+	return true;
+}
+
+bool CBytestream::writeByteAt(size_t bytePos, uchar byte)
+{
+	if(bytePos >= Data.size()) {
+		errors << "CBytestream::writeByteAt: " << bytePos << " is behind end" << endl;
+		return false;
+	}
+	Data[bytePos] = byte;
+	return true;
+}
+
 bool CBytestream::writeVar(const ScriptVar_t& var) {
 	assert( var.type >= 0 && var.type <= 4 );
 	if(!writeByte( var.type )) return false;
@@ -498,22 +533,53 @@ float CBytestream::readFloat()
 
 
 std::string CBytestream::readString() {
-	std::string result = "";
-	uchar b;
-	while((b = readByte()) != 0) result += (char)b;
+	if(isPosAtEnd()) {
+		readByte(); // for the error message
+		return "";
+	}
+	
+	const char* start = Data.data() + pos;
+	const char* end = (const char*)memchr(start, '\0', Data.size() - pos);
+	if(end == NULL) {
+		// we read everything and complain about reading behind the end
+		std::string result(start, Data.size() - pos);
+		pos = Data.size();
+		readByte();
+		return result;
+	}
+	
+	std::string result(start, end - start);
+	pos += result.size() + 1;
 	return result;
 }
 
 std::string CBytestream::readString(size_t maxlen) {
-	std::string result = "";
-	size_t i = 0;
-	uchar b = 0;
-	while(i < maxlen && (b = readByte()) != 0) {
-		result += b;
-		++i;
+	if(maxlen == 0) return "";
+	if(isPosAtEnd()) {
+		readByte(); // for the error message
+		return "";
+	}
+	
+	const char* start = Data.data() + pos;
+	const size_t avail = Data.size() - pos;
+	const char* end = (const char*)memchr(start, '\0', MIN(avail, maxlen));
+	if(end != NULL) {
+		std::string result(start, end - start);
+		pos += result.size() + 1;
+		return result;
 	}
-	if(b != 0)
+	
+	if(maxlen <= avail) {
+		// we have read maxlen chars without finding the ending
+		pos += maxlen;
 		warnings("WARNING: CBytestream: stop reading string at no real ending\n");
+		return std::string(start, maxlen);
+	}
+	
+	// we read everything and complain about reading behind the end
+	std::string result(start, avail);
+	pos = Data.size();
+	readByte();
 	return result;
 }
 
@@ -567,6 +633,14 @@ std::string CBytestream::readData( size_t size )
 	return Data.substr( oldpos, size );
 }
 
+const char* CBytestream::readDataPtr( size_t& size )
+{
+	size = MIN( size, GetRestLen() );
+	const char* ret = Data.data() + pos;
+	pos += size;
+	return ret;
+}
+
 bool CBytestream::readVar(ScriptVar_t& var) {
 	assert( var.type >= 0 && var.type <= 4 );
 	var.type = (ScriptVarType_t)readByte();
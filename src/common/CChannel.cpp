@@ -404,8 +404,11 @@ enum {
 // SEQUENCE_SAFE_DIST is the max distance between two sequences when packets will get ignored as erroneous ones.
 	SEQUENCE_SAFE_DIST = 100,
 
-// MAX_NON_ACKNOWLEDGED_PACKETS is max amount of packets that can be flying through the net at the same time.
+// MAX_NON_ACKNOWLEDGED_PACKETS is the initial amount of packets that can be flying through the net at the same time.
+// The window changes with time according to packet loss, between MIN_ and MAX_NON_ACKNOWLEDGED_PACKETS.
 	MAX_NON_ACKNOWLEDGED_PACKETS = 3,	// 1 is minimum - it behaves like old CChannel then.
+	MIN_NON_ACKNOWLEDGED_PACKETS = 2,
+	MAX_NON_ACKNOWLEDGED_PACKETS_LIMIT = 64,	// Should be less than SEQUENCE_SAFE_DIST, or the acknowledges get ignored
 
 // SEQUENCE_HIGHEST_BIT is highest bit in a 2-byte int, for convenience.
 	SEQUENCE_HIGHEST_BIT = 0x8000
@@ -421,9 +424,16 @@ const float KEEP_ALIVE_PACKET_TIMEOUT = 1.0f;
 // This is only inital value, it will get changed with time according to ping.
 const float DATA_PACKET_TIMEOUT = 0.2f;
 
-// DataPacketTimeout = ping / DATA_PACKET_TIMEOUT_PING_COEFF, 
-// the bigger that value is, the more often channel will re-send data delayed in network.
-const float DATA_PACKET_TIMEOUT_PING_COEFF = 1.5f;
+// Bounds of the data packet timeout, sec. The minimum also covers the delay of acknowledges
+// which are sent only with the next frame of the other side.
+const float MIN_DATA_PACKET_TIMEOUT = 0.1f;
+const float MAX_DATA_PACKET_TIMEOUT = 3.0f;
+// Minimum space between the round trip time and the data packet timeout, sec.
+const float DATA_PACKET_TIMEOUT_MIN_DEVIATION = 0.05f;
+
+// The window is multiplied by that on packet loss. Not halved as in TCP, because the packets
+// are lost randomly on bad links more often than because of congestion.
+const float RELIABLE_WINDOW_DECREASE = 0.7f;
 
 #ifdef DEBUG
 const float DEBUG_SIMULATE_LAGGY_CONNECTION_SEND_DELAY = 0.0f; // Self-explanatory
@@ -441,6 +451,103 @@ int SequenceDiff( int s1, int s2 )
 	return diff;
 }
 
+// Sequence s1 + diff, wrapped around
+static int SequenceAdd( int s1, int diff )
+{
+	int s = ( s1 + diff ) % SEQUENCE_WRAPAROUND;
+	if( s < 0 )
+		s += SEQUENCE_WRAPAROUND;
+	return s;
+}
+
+///////////////////
+// Flow control for the reliable stream of CChannel2 and CChannel3
+
+void ReliableFlowControl::reset( int initialWindow, int maxWindow )
+{
+	bGotRttSample = false;
+	fSmoothedRtt = 0.0f;
+	fRttVariance = 0.0f;
+	fRetransmitTimeout = DATA_PACKET_TIMEOUT;
+	iMaxWindow = maxWindow;
+	fWindow = (float)MIN( initialWindow, maxWindow );
+	fSlowStartThreshold = (float)maxWindow;
+	fLastAck = fLastDecrease = fLastTimeout = AbsTime();
+}
+
+void ReliableFlowControl::addRttSample( float rtt )
+{
+	if( !bGotRttSample )
+	{
+		fSmoothedRtt = rtt;
+		fRttVariance = rtt / 2.0f;
+		bGotRttSample = true;
+	}
+	else
+	{
+		fRttVariance = fRttVariance * 0.75f + fabs( fSmoothedRtt - rtt ) * 0.25f;
+		fSmoothedRtt = fSmoothedRtt * 0.875f + rtt * 0.125f;
+	}
+	// The deviation is allowed to be small on stable links, but the packets sent together
+	// wait behind each other in the net, so there should be some space. This also resets the backoff after a timeout.
+	fRetransmitTimeout = fSmoothedRtt + MAX( 4.0f * fRttVariance, DATA_PACKET_TIMEOUT_MIN_DEVIATION );
+	fRetransmitTimeout = CLAMP( fRetransmitTimeout, MIN_DATA_PACKET_TIMEOUT, MAX_DATA_PACKET_TIMEOUT );
+}
+
+float ReliableFlowControl::getLossDelay() const
+{
+	if( !bGotRttSample )
+		return fRetransmitTimeout;
+	// Allow a quarter of the round trip, or the usual deviation, for packets reordered in the net
+	return MAX( fSmoothedRtt + MAX( fSmoothedRtt / 4.0f, 2.0f * fRttVariance ), MIN_DATA_PACKET_TIMEOUT );
+}
+
+void ReliableFlowControl::packetsAcked( int amount, bool windowLimited )
+{
+	fLastAck = tLX->currentTime;
+	if( !windowLimited )
+		return;
+	for( ; amount > 0; amount-- )
+	{
+		if( fWindow < fSlowStartThreshold )
+			fWindow += 1.0f; // Slow start - doubles the window each round trip
+		else
+			fWindow += 1.0f / fWindow; // One more packet each round trip
+	}
+	if( fWindow > (float)iMaxWindow )
+		fWindow = (float)iMaxWindow;
+}
+
+void ReliableFlowControl::packetLost()
+{
+	// All packets lost in the same round trip are caused by the same congestion
+	if( tLX->currentTime - fLastDecrease < fSmoothedRtt )
+		return;
+	fLastDecrease = tLX->currentTime;
+	fSlowStartThreshold = MAX( fWindow * RELIABLE_WINDOW_DECREASE, (float)MIN_NON_ACKNOWLEDGED_PACKETS );
+	fWindow = MIN( fSlowStartThreshold, (float)iMaxWindow );
+}
+
+void ReliableFlowControl::timeout()
+{
+	// The last packets sent got lost, but the other side still acknowledges packets - it's not worse than a lost packet.
+	if( tLX->currentTime - fLastAck < fRetransmitTimeout )
+	{
+		packetLost();
+		return;
+	}
+	// The packets sent together time out together
+	if( tLX->currentTime - fLastTimeout < fRetransmitTimeout )
+		return;
+	fLastTimeout = fLastDecrease = tLX->currentTime;
+	fSlowStartThreshold = MAX( fWindow * RELIABLE_WINDOW_DECREASE, (float)MIN_NON_ACKNOWLEDGED_PACKETS );
+	fWindow = (float)MIN( (int)MIN_NON_ACKNOWLEDGED_PACKETS, iMaxWindow );
+	fRetransmitTimeout = MIN( fRetransmitTimeout * 2.0f, MAX_DATA_PACKET_TIMEOUT );
+}
+
+///////////////////
+// CChannel2
+
 void CChannel2::Clear()
 {
 	CChannel::Clear();
@@ -456,8 +563,7 @@ void CChannel2::Clear()
 	LastReliableIn_SentWithLastPacket = SEQUENCE_WRAPAROUND - 1;
 	
 	KeepAlivePacketTimeout = KEEP_ALIVE_PACKET_TIMEOUT;
-	DataPacketTimeout = DATA_PACKET_TIMEOUT;
-	MaxNonAcknowledgedPackets = MAX_NON_ACKNOWLEDGED_PACKETS;
+	Flow.reset( MAX_NON_ACKNOWLEDGED_PACKETS, MAX_NON_ACKNOWLEDGED_PACKETS_LIMIT );
 
 	#ifdef DEBUG
 	DebugSimulateLaggyConnectionSendDelay = tLX->currentTime;
@@ -527,6 +633,8 @@ bool CChannel2::Process(CBytestream *bs)
 	iPacketsGood++;	// Update statistics
 
 	// Delete acknowledged packets from buffer
+	bool windowFull = getBufferFull();
+	int acked = 0;
 	for( PacketList_t::iterator it = ReliableOut.begin(); it != ReliableOut.end(); )
 	{
 		bool erase = false;
@@ -536,20 +644,23 @@ bool CChannel2::Process(CBytestream *bs)
 			if( seqAckList[f] == it->second )
 				erase = true;
 		if(erase)
+		{
 			it = ReliableOut.erase(it);
+			acked++;
+		}
 		else
 			it++;
 	}
+	if( acked > 0 )
+		Flow.packetsAcked( acked, windowFull );
 
 	// Calculate ping ( with LastReliableOut, not with last packet - should be fair enough )
 	if( PongSequence != -1 && SequenceDiff( LastReliableOut, PongSequence ) >= 0 )
 	{
 		iPing = (int) ((tLX->currentTime - fLastPingSent).milliseconds());
 		PongSequence = -1;
-		// Traffic shaping occurs here - change DataPacketTimeout according to received ping
-		// Change the value slowly, to avoid peaks
-		// TODO: I haven't really tested it this thing does any good, but it seems to work okay.
-		DataPacketTimeout = ( iPing/1000.0f/DATA_PACKET_TIMEOUT_PING_COEFF + DataPacketTimeout*9.0f ) / 10.0f; 
+		// Traffic shaping occurs here - the data packet timeout follows the ping
+		Flow.addRttSample( iPing / 1000.0f );
 	};
 
 	// Processing of arrived data packets
@@ -580,7 +691,9 @@ bool CChannel2::Process(CBytestream *bs)
 		if( addPacket && SequenceDiff( seqList[f], LastReliableIn ) > 0 ) // Do not add packets from the past
 		{	// Packet not in buffer yet - add it
 			CBytestream bs1;
-			bs1.writeData( bs->readData(seqSizeList[f]) );
+			size_t size = seqSizeList[f];
+			const char* data = bs->readDataPtr(size);
+			bs1.writeData( data, size );
 			ReliableIn.push_back( std::make_pair( bs1, seqList[f] ) );
 		}
 		else	// Packet is in buffer already
@@ -641,7 +754,7 @@ void CChannel2::Transmit(CBytestream *unreliableData)
 	bs.writeInt( LastReliableIn, 2 );
 
 	// Add reliable packet to ReliableOut buffer
-	while( (int)ReliableOut.size() < MaxNonAcknowledgedPackets && ! Messages.empty() && ! ReliableStreamBandwidthLimitHit() )
+	while( (int)ReliableOut.size() < Flow.getWindow() && ! Messages.empty() && ! ReliableStreamBandwidthLimitHit() )
 	{
 		LastAddedToOut ++ ;
 		if( LastAddedToOut >= SEQUENCE_WRAPAROUND )
@@ -660,23 +773,32 @@ void CChannel2::Transmit(CBytestream *unreliableData)
 
 	// Check if other side acknowledged packets with indexes bigger than NextReliablePacketToSend,
 	// and roll NextReliablePacketToSend back to LastReliableOut.
+	bool packetLost = false;
 	if( ! ReliableOut.empty() )
 	{
 		for( PacketList_t::iterator it = ReliableOut.begin(), it1 = it++; it != ReliableOut.end(); it1 = it++ )
 		{
 			if( SequenceDiff( it->second, it1->second ) != 1 )
-				NextReliablePacketToSend = LastReliableOut;
+				packetLost = true;
 		};
 		if( ReliableOut.back().second != LastAddedToOut )
-			NextReliablePacketToSend = LastReliableOut;
+			packetLost = true;
 	};
+	if( packetLost )
+	{
+		NextReliablePacketToSend = LastReliableOut;
+		Flow.packetLost();
+		PongSequence = -1; // The ping of a re-sent packet is ambiguous
+	}
 
 	// Timeout occured - other side didn't acknowledge our packets in time - re-send all of them from the first one.
 	if( LastReliablePacketSent == LastAddedToOut &&
-		SequenceDiff( LastReliablePacketSent, LastReliableOut ) >= MaxNonAcknowledgedPackets &&
-		tLX->currentTime - fLastSent >= DataPacketTimeout )
+		SequenceDiff( LastReliablePacketSent, LastReliableOut ) >= Flow.getWindow() &&
+		tLX->currentTime - fLastSent >= Flow.getRetransmitTimeout() )
 	{
 		NextReliablePacketToSend = LastReliableOut;
+		Flow.timeout();
+		PongSequence = -1;
 	}
 	
 	// Add packet headers and data - send all packets with indexes from NextReliablePacketToSend and up.
@@ -687,10 +809,15 @@ void CChannel2::Transmit(CBytestream *unreliableData)
 	bool firstPacket = true;	// Always send first packet, even if it bigger than MAX_PACKET_SIZE
 	int packetIndex = LastReliableOut;
 	int packetSize = 0;
+	// The packet sent last time goes again only if there is nothing newer,
+	// otherwise big packets which don't fit together are sent one per round trip.
+	int firstPacketToSend = NextReliablePacketToSend;
+	if( LastReliablePacketSent == NextReliablePacketToSend && SequenceDiff( LastAddedToOut, NextReliablePacketToSend ) > 0 )
+		firstPacketToSend = SequenceAdd( NextReliablePacketToSend, 1 );
 	
 	for( PacketList_t::iterator it = ReliableOut.begin(); it != ReliableOut.end(); it++ )
 	{
-		if( SequenceDiff( it->second, NextReliablePacketToSend ) >= 0 )
+		if( SequenceDiff( it->second, firstPacketToSend ) >= 0 )
 		{
 			if( ! CheckReliableStreamBandwidthLimit( (float)(it->first.GetLength() + 4) ) ||
 				( bs.GetLength() + 4 + packetData.GetLength() + it->first.GetLength() > MAX_PACKET_SIZE && ! firstPacket ) )
@@ -724,8 +851,8 @@ void CChannel2::Transmit(CBytestream *unreliableData)
 		if( bs.GetLength() + unreliableData->GetLength() <= MAX_PACKET_SIZE )
 			bs.Append(unreliableData);
 
-		// If we are sending a reliable message, remember this time and use it for ping calculations
-		if (PongSequence == -1)
+		// If we are sending a new reliable message, remember this time and use it for ping calculations
+		if (PongSequence == -1 && NextReliablePacketToSend == LastAddedToOut && LastReliablePacketSent != LastAddedToOut)
 		{
 			PongSequence = NextReliablePacketToSend;
 			fLastPingSent = tLX->currentTime;
@@ -734,7 +861,7 @@ void CChannel2::Transmit(CBytestream *unreliableData)
 
 	if( unreliableData->GetLength() == 0 &&
 		LastReliablePacketSent == LastAddedToOut &&
-		tLX->currentTime - fLastSent < DataPacketTimeout )
+		tLX->currentTime - fLastSent < Flow.getRetransmitTimeout() )
 	{
 		// No unreliable data to send, and we've just sent the same packet -
 		// send it again after some timeout, don't flood net.
@@ -780,6 +907,249 @@ std::string printBinary(const std::string & s)
 	return r;
 }
 
+Uint16 crc16(const char * buffer, size_t len, Uint16 crc);
+Uint16 crc16_bytewise(const char * buffer, size_t len, Uint16 crc);
+
+// Throughput of the CRC and of CChannel3 without lag and packet loss
+static void TestCChannelThroughput()
+{
+	notes << "\n\n\n\nTesting CChannel3 throughput" << endl;
+
+	// CRC16
+	std::string data( 1024 * 1024, '\0' );
+	for( size_t f=0; f<data.size(); f++ )
+		data[f] = (char)GetRandomInt(255);
+	for( size_t len=0; len<64; len++ )
+		for( size_t start=0; start<8; start++ )
+			if( crc16( data.data() + start, len, 0xffff ) != crc16_bytewise( data.data() + start, len, 0xffff ) )
+				notes << "CRC16 of " << len << " bytes at " << start << " - ERROR!" << endl;
+
+	Uint16 crc = 0xffff;
+	Uint32 start = SDL_GetTicks();
+	for( int f=0; f<64; f++ )
+		crc = crc16_bytewise( data.data(), data.size(), crc );
+	Uint32 timeBytewise = SDL_GetTicks() - start;
+	start = SDL_GetTicks();
+	for( int f=0; f<64; f++ )
+		crc = crc16( data.data(), data.size(), crc );
+	Uint32 timeSliced = SDL_GetTicks() - start;
+	notes << "CRC16 of 64 MB: bytewise " << timeBytewise << " ms, slicing-by-8 " << timeSliced << " ms (" << crc << ")" << endl;
+
+	// Reliable messages of different sizes from c1 to c2
+	static const int messageSizes[] = { 8, 200, 2000 };
+	for( size_t m=0; m<sizeof(messageSizes)/sizeof(messageSizes[0]); m++ )
+	{
+		const int messageSize = messageSizes[m];
+		const int messageCount = 20000000 / (messageSize + 200); // About the same time for every size
+
+		CChannel3 c1, c2;
+		SmartPointer<NetworkSocket> s1 = new NetworkSocket(); s1->OpenUnreliable(0);
+		SmartPointer<NetworkSocket> s2 = new NetworkSocket(); s2->OpenUnreliable(0);
+		c1.Create( s2->localAddress(), s1 );
+		c2.Create( s1->localAddress(), s2 );
+
+		int sent = 0, received = 0, errors = 0;
+		CBytestream msg, empty, bs;
+		// The clock only goes forward, continue from where the previous test stopped
+		Uint64 testtime = tLX->currentTime.milliseconds();
+		const Uint64 endtime = testtime + 10000000;
+		start = SDL_GetTicks();
+		while( received < messageCount && testtime < endtime )
+		{
+			tLX->currentTime = AbsTime(++testtime);
+
+			while( sent < messageCount && sent - received < 64 )
+			{
+				msg.Clear();
+				msg.writeInt( ++sent, 4 );
+				for( int f=4; f<messageSize; f++ )
+					msg.writeByte( (uchar)f );
+				c1.AddReliablePacketToSend( msg );
+			}
+			c1.Transmit( &empty );
+
+			bs.Clear();
+			while( bs.Read( s2.get() ) > 0 )
+			{
+				bs.ResetPosToBegin();
+				while( c2.Process( &bs ) )
+				{
+					while( bs.GetRestLen() >= (size_t)messageSize )
+					{
+						if( bs.readInt(4) != received + 1 )
+							errors++;
+						received++;
+						bs.Skip( messageSize - 4 );
+					}
+					bs.Clear();
+				}
+				bs.Clear();
+			}
+			c2.Transmit( &empty );
+
+			bs.Clear();
+			while( bs.Read( s1.get() ) > 0 )
+			{
+				bs.ResetPosToBegin();
+				while( c1.Process( &bs ) )
+					bs.Clear();
+				bs.Clear();
+			}
+		}
+		Uint32 time = MAX( SDL_GetTicks() - start, (Uint32)1 );
+		notes << messageSize << " byte messages: " << received << " of " << messageCount << " in " << time << " ms, " <<
+				(received * 1000 / time) << " msgs/sec, " << (Uint64)received * messageSize / 1024 * 1000 / time << " KB/sec, " <<
+				errors << " errors" << endl;
+	}
+}
+
+// Net link for the tests: packets sent to the socket of the link get delayed, lost, and limited by the link bandwidth,
+// and then forwarded to the destination. Packets which don't fit into the queue of the link are dropped, like a router does.
+struct LossyLink
+{
+	SmartPointer<NetworkSocket> socket;
+	int lagMin, lagMax; // In ms
+	int packetLoss; // In percents
+	float bandwidth; // In bytes/ms, 0 is unlimited
+	float queueSize; // In bytes
+	float linkFreeTime; // When all queued packets have left the link
+	std::multimap< int, CBytestream > packets; // By arrival time
+	size_t bytesSent, packetsSent, packetsLost;
+
+	LossyLink( int _lagMin, int _lagMax, int _packetLoss, float bytesPerSec = 0, float _queueSize = 0 ):
+		lagMin(_lagMin), lagMax(_lagMax), packetLoss(_packetLoss), bandwidth(bytesPerSec / 1000.0f), queueSize(_queueSize),
+		linkFreeTime(0), bytesSent(0), packetsSent(0), packetsLost(0)
+	{
+		socket = new NetworkSocket();
+		socket->OpenUnreliable(0);
+	}
+
+	// Takes the packets sent to the link, and forwards the arrived ones to dest
+	void update( int time, const NetworkAddr& dest )
+	{
+		CBytestream bs;
+		while( bs.Read( socket.get() ) > 0 )
+		{
+			bytesSent += bs.GetLength();
+			packetsSent++;
+			float departure = (float)time;
+			if( bandwidth > 0 )
+			{
+				departure = MAX( departure, linkFreeTime );
+				if( ( departure - time ) * bandwidth + bs.GetLength() > queueSize )
+				{
+					packetsLost++; // Link congested
+					bs.Clear();
+					continue;
+				}
+				departure += bs.GetLength() / bandwidth;
+				linkFreeTime = departure;
+			}
+			if( GetRandomInt(99) < packetLoss )
+				packetsLost++;
+			else
+				packets.insert( std::make_pair( (int)departure + lagMin + GetRandomInt(lagMax-lagMin), bs ) );
+			bs.Clear();
+		}
+
+		socket->setRemoteAddress( dest );
+		while( !packets.empty() && packets.begin()->first <= time )
+		{
+			packets.begin()->second.ResetPosToBegin();
+			packets.begin()->second.Send( socket.get() );
+			packets.erase( packets.begin() );
+		}
+	}
+};
+
+// Throughput of the reliable stream versus the packet loss, like a file transfer over a 2 Mbit link.
+// Messages bigger than the window of the channel test the fragmented messages, which have to get through completely.
+template< class Channel >
+static void TestCChannelLossyLink( const std::string& name, int messageSize )
+{
+	notes << "\n\n\n\nTesting " << name << " throughput with packet loss, " << messageSize << " byte messages" << endl;
+
+	const int messageCount = 1024 * 1024 / messageSize;
+	static const int packetLosses[] = { 0, 1, 5, 10, 20 };
+	for( size_t l=0; l<sizeof(packetLosses)/sizeof(packetLosses[0]); l++ )
+	{
+		Channel c1, c2;
+		SmartPointer<NetworkSocket> s1 = new NetworkSocket(); s1->OpenUnreliable(0);
+		SmartPointer<NetworkSocket> s2 = new NetworkSocket(); s2->OpenUnreliable(0);
+		LossyLink link1( 40, 60, packetLosses[l], 256 * 1024, 16 * 1024 ); // c1 -> c2
+		LossyLink link2( 40, 60, packetLosses[l] ); // c2 -> c1
+		c1.Create( link1.socket->localAddress(), s1 );
+		c2.Create( link2.socket->localAddress(), s2 );
+
+		int sent = 0, received = 0, errors = 0;
+		CBytestream msg, empty, bs;
+		// The clock only goes forward, continue from where the previous test stopped
+		const int starttime = (int)tLX->currentTime.milliseconds() + 1000;
+		int testtime = starttime;
+		int lastReceived = starttime;
+		for( ; received < messageCount && testtime < starttime + 120000; testtime += 10 ) // 100 frames per second
+		{
+			tLX->currentTime = AbsTime(testtime);
+
+			while( sent < messageCount && sent - received < 256 )
+			{
+				msg.Clear();
+				msg.writeInt( ++sent, 4 );
+				for( int f=4; f<messageSize; f++ )
+					msg.writeByte( (uchar)( f + sent ) ); // Misplaced fragments don't match
+				c1.AddReliablePacketToSend( msg );
+			}
+			c1.Transmit( &empty );
+			c2.Transmit( &empty );
+			link1.update( testtime, s2->localAddress() );
+			link2.update( testtime, s1->localAddress() );
+
+			bs.Clear();
+			while( bs.Read( s2.get() ) > 0 )
+			{
+				bs.ResetPosToBegin();
+				while( c2.Process( &bs ) )
+				{
+					while( bs.GetRestLen() >= (size_t)messageSize )
+					{
+						if( bs.readInt(4) != received + 1 )
+							errors++;
+						received++;
+						lastReceived = testtime;
+						size_t size = messageSize - 4;
+						const char* data = bs.readDataPtr( size );
+						for( int f=4; f<messageSize; f++ )
+							if( (uchar)data[f-4] != (uchar)( f + received ) )
+							{
+								errors++;
+								break;
+							}
+					}
+					if( bs.GetRestLen() > 0 ) // Messages have to come out in whole
+						errors++;
+					bs.Clear();
+				}
+				bs.Clear();
+			}
+
+			bs.Clear();
+			while( bs.Read( s1.get() ) > 0 )
+			{
+				bs.ResetPosToBegin();
+				while( c1.Process( &bs ) )
+					bs.Clear();
+				bs.Clear();
+			}
+		}
+		int time = MAX( testtime - starttime, 1 );
+		notes << name << " packet loss " << packetLosses[l] << "%: " << received << " of " << messageCount << " messages in " <<
+				time << " ms, " << (Uint64)received * messageSize / 1024 * 1000 / time << " KB/sec, " <<
+				link1.packetsSent << " net packets (" << link1.packetsLost << " lost), " <<
+				(int)( link1.bytesSent * 100 / MAX( (Uint64)received * messageSize, (Uint64)1 ) ) << "% of the data sent, ping " <<
+				c1.getPing() << ", " << errors << " errors" << ( received < messageCount && testtime - lastReceived > 60000 ? " - ERROR! transfer stalled" : "" ) << endl;
+	}
+}
+
 void TestCChannelRobustness()
 {
 	notes << "Testing CBytestream" << endl;
@@ -951,6 +1321,11 @@ void TestCChannelRobustness()
 		}
 
 	}
+
+	TestCChannelThroughput();
+	TestCChannelLossyLink<CChannel2>( "CChannel2", 400 );
+	TestCChannelLossyLink<CChannel3>( "CChannel3", 400 );
+	TestCChannelLossyLink<CChannel3>( "CChannel3", 100 * 1024 ); // About 200 fragments per message
 }
 
 /*
@@ -964,33 +1339,87 @@ one packet with Packet Size highest bit = 0 following it is assembled into one b
 */
 
 enum {
-	MAX_FRAGMENTED_PACKET_SIZE = MAX_PACKET_SIZE - 24 // Actually 12 bytes are enough, but I want to have safety bound.
+	MAX_FRAGMENTED_PACKET_SIZE = MAX_PACKET_SIZE - 24, // Actually 12 bytes are enough, but I want to have safety bound.
+	MAX_NET_PACKETS_PER_TRANSMIT = 8 // Don't send the whole window in a single burst
 };
 
 Uint16 crc16(const char * buffer, size_t len, Uint16 crc = 0xffff); // Default non-zero value
 
-bool CChannel3::Packet_t::operator < ( const Packet_t & p ) const
-{ 
-	return SequenceDiff( idx, p.idx ) < 0; 
-};
+void CChannel3::PacketWindow_t::reset(int _base)
+{
+	for( int f = 0; f < SIZE; f++ )
+	{
+		packets[f].used = false;
+		packets[f].data.Clear();
+	}
+	base = _base;
+	first = 0;
+	count = 0;
+}
+
+CChannel3::Packet_t * CChannel3::PacketWindow_t::get(int idx)
+{
+	int diff = SequenceDiff( idx, base );
+	if( diff <= 0 || diff > SIZE )
+		return NULL;
+	Packet_t * p = &packets[ ( first + diff - 1 ) % SIZE ];
+	return p->used ? p : NULL;
+}
+
+CChannel3::Packet_t * CChannel3::PacketWindow_t::add(int idx, bool fragmented)
+{
+	int diff = SequenceDiff( idx, base );
+	if( diff <= 0 || diff > SIZE )
+		return NULL;
+	Packet_t * p = &packets[ ( first + diff - 1 ) % SIZE ];
+	if( !p->used )
+		count++;
+	p->used = true;
+	p->idx = idx;
+	p->fragmented = fragmented;
+	p->sendCount = 0;
+	p->data.Clear();
+	return p;
+}
+
+void CChannel3::PacketWindow_t::remove(Packet_t * p)
+{
+	if( !p->used )
+		return;
+	p->used = false;
+	count--;
+}
+
+void CChannel3::PacketWindow_t::advance(int newBase)
+{
+	int diff = SequenceDiff( newBase, base );
+	if( diff <= 0 )
+		return;
+	for( int f = 0; f < diff && f < SIZE; f++ )
+		remove( &packets[ ( first + f ) % SIZE ] );
+	first = ( first + diff ) % SIZE;
+	base = newBase;
+}
 
 void CChannel3::Clear()
 {
 	CChannel::Clear();
 	Messages.clear();
-	ReliableOut.clear();
-	ReliableIn.clear();
 	LastReliableOut = 0;
 	LastAddedToOut = 0;
+	MessageFragmentPos = 0;
 	LastReliableIn = 0;
+	ReliableOut.reset( LastReliableOut );
+	ReliableIn.reset( LastReliableIn );
+	ReliableInFragments.Clear();
 	PongSequence = -1;
-	LastReliablePacketSent = SEQUENCE_WRAPAROUND - 1;
-	NextReliablePacketToSend = 0;
 	LastReliableIn_SentWithLastPacket = SEQUENCE_WRAPAROUND - 1;
+	ReliableInChanged = false;
+	NetPacketsSent = 0;
+	LastAckedNetPacket = 0;
 	
 	KeepAlivePacketTimeout = KEEP_ALIVE_PACKET_TIMEOUT;
-	DataPacketTimeout = DATA_PACKET_TIMEOUT;
-	MaxNonAcknowledgedPackets = MAX_NON_ACKNOWLEDGED_PACKETS;
+	Flow.reset( MAX_NON_ACKNOWLEDGED_PACKETS, MIN( (int)MAX_NON_ACKNOWLEDGED_PACKETS_LIMIT, (int)PacketWindow_t::SIZE ) );
 
 	#ifdef DEBUG
 	DebugSimulateLaggyConnectionSendDelay = tLX->currentTime;
@@ -1006,25 +1435,55 @@ void CChannel3::Create(const NetworkAddr& _adr, const SmartPointer<NetworkSocket
 // Get reliable packet from local buffer (merge fragmented packet)
 bool CChannel3::GetPacketFromBuffer(CBytestream *bs)
 {
-	if( ReliableIn.size() == 0 )
+	if( ReliableIn.count == 0 )
 		return false;
 
+	// All fragments and the final packet have to be there, which is the case if the final one is acknowledged
+	int last = ReliableIn.base;
+	Packet_t * p = NULL;
+	do
+	{
+		last = SequenceAdd( last, 1 );
+		p = ( SequenceDiff( last, LastReliableIn ) > 0 ) ? NULL : ReliableIn.get( last );
+		if( p == NULL )
+		{
+			// Only fragments of an incomplete message are acknowledged, move them out of the window
+			for( int idx = SequenceAdd( ReliableIn.base, 1 ); SequenceDiff( idx, LastReliableIn ) <= 0; idx = SequenceAdd( idx, 1 ) )
+				ReliableInFragments.Append( & ReliableIn.get( idx )->data );
+			ReliableIn.advance( LastReliableIn );
+			return false;
+		}
+	}
+	while( p->fragmented );
+
 	bs->Clear();
-	PacketList_t::iterator it = ReliableIn.begin();
-	while( it != ReliableIn.end() && it->fragmented )
+	bs->Append( & ReliableInFragments );
+	ReliableInFragments.Clear();
+	for( int idx = SequenceAdd( ReliableIn.base, 1 ); ; idx = SequenceAdd( idx, 1 ) )
 	{
-		bs->Append( & it->data );
-		it++;
-	};
-	if( it != ReliableIn.end() && it->idx <= LastReliableIn )
+		bs->Append( & ReliableIn.get( idx )->data );
+		if( idx == last )
+			break;
+	}
+	ReliableIn.advance( last );
+	return true;
+}
+
+// Removes the packet acknowledged by the other side from ReliableOut.
+// The round trip time is measured on the newest packet that was sent only once.
+void CChannel3::AcknowledgePacket(Packet_t * p, int& ackedCount, AbsTime& rttPacketSent, bool& rttSample)
+{
+	if( p == NULL || p->sendCount == 0 )
+		return;
+	ackedCount++;
+	if( p->lastSentNetPacket > LastAckedNetPacket )
+		LastAckedNetPacket = p->lastSentNetPacket;
+	if( p->sendCount == 1 && ( !rttSample || p->lastSent > rttPacketSent ) )
 	{
-		bs->Append( & it->data );
-		it++;
-		ReliableIn.erase( ReliableIn.begin(), it );
-		return true;
+		rttPacketSent = p->lastSent;
+		rttSample = true;
 	}
-	bs->Clear();
-	return false;
+	ReliableOut.remove( p );
 }
 
 // This function will first return non-reliable data,
@@ -1041,7 +1500,7 @@ bool CChannel3::Process(CBytestream *bs)
 	// CRC16 check
 	
 	unsigned crc = bs->readInt(2);
-	if( crc != crc16( bs->peekData( bs->GetRestLen() ).c_str(), bs->GetRestLen() ) )
+	if( crc != crc16( bs->peekDataPtr(), bs->GetRestLen() ) )
 	{
 		iPacketsDropped++;	// Update statistics
 		return GetPacketFromBuffer(bs);	// Packet from the past or from too distant future - ignore it.
@@ -1067,29 +1526,27 @@ bool CChannel3::Process(CBytestream *bs)
 
 	iPacketsGood++;	// Update statistics
 
-	// Delete acknowledged packets from buffer
-	for( PacketList_t::iterator it = ReliableOut.begin(); it != ReliableOut.end(); )
-	{
-		bool erase = false;
-		if( SequenceDiff( LastReliableOut, it->idx ) >= 0 )
-			erase = true;
-		for( unsigned f=0; f<seqAckList.size(); f++ )
-			if( seqAckList[f] == it->idx )
-				erase = true;
-		if(erase)
-			it = ReliableOut.erase(it);
-		else
-			it++;
-	}
+	// Delete acknowledged packets from buffer, and update the flow control with them
+	bool windowFull = getBufferFull();
+	int acked = 0;
+	AbsTime rttPacketSent;
+	bool rttSample = false;
+	for( int idx = SequenceAdd( ReliableOut.base, 1 ); SequenceDiff( idx, LastReliableOut ) <= 0; idx = SequenceAdd( idx, 1 ) )
+		AcknowledgePacket( ReliableOut.get( idx ), acked, rttPacketSent, rttSample );
+	ReliableOut.advance( LastReliableOut );
+	for( unsigned f=0; f<seqAckList.size(); f++ )
+		AcknowledgePacket( ReliableOut.get( seqAckList[f] ), acked, rttPacketSent, rttSample );
+
+	if( rttSample )
+		Flow.addRttSample( ( tLX->currentTime - rttPacketSent ).seconds() );
+	if( acked > 0 )
+		Flow.packetsAcked( acked, windowFull );
 
 	// Calculate ping ( with LastReliableOut, not with last packet - should be fair enough )
 	if( PongSequence != -1 && SequenceDiff( LastReliableOut, PongSequence ) >= 0 )
 	{
 		iPing = (int) ((tLX->currentTime - fLastPingSent).milliseconds());
 		PongSequence = -1;
-		// Traffic shaping occurs here - change DataPacketTimeout according to received ping
-		// Change the value slowly, to avoid peaks
-		DataPacketTimeout = ( iPing/1000.0f/DATA_PACKET_TIMEOUT_PING_COEFF + DataPacketTimeout*9.0f ) / 10.0f; 
 	};
 
 	// Processing of arrived data packets
@@ -1113,15 +1570,16 @@ bool CChannel3::Process(CBytestream *bs)
 		if( seqSizeList[f] == 0 ) // Last reliable packet may have size 0, if we're received non-reliable-only net packet
 			continue;	// Just skip it, it's fake packet
 
-		bool addPacket = true;
-		for( PacketList_t::iterator it = ReliableIn.begin(); it != ReliableIn.end() && addPacket; it++ )
-			if( it->idx == seqList[f] )
-				addPacket = false;
-		if( addPacket && SequenceDiff( seqList[f], LastReliableIn ) > 0 ) // Do not add packets from the past
+		Packet_t * p = NULL;
+		// Do not add packets from the past, or which are already in buffer, or which are too far ahead (they will be resent)
+		if( SequenceDiff( seqList[f], LastReliableIn ) > 0 && ReliableIn.get( seqList[f] ) == NULL )
+			p = ReliableIn.add( seqList[f], (seqSizeList[f] & SEQUENCE_HIGHEST_BIT) != 0 );
+		if( p )
 		{	// Packet not in buffer yet - add it
-			CBytestream bs1;
-			bs1.writeData( bs->readData( seqSizeList[f] & ~ SEQUENCE_HIGHEST_BIT ) );
-			ReliableIn.push_back( Packet_t( bs1, seqList[f], (seqSizeList[f] & SEQUENCE_HIGHEST_BIT) != 0 ) );
+			size_t size = seqSizeList[f] & ~ SEQUENCE_HIGHEST_BIT;
+			const char* data = bs->readDataPtr(size);
+			p->data.writeData( data, size );
+			ReliableInChanged = true;
 		}
 		else	// Packet is in buffer already
 		{
@@ -1131,23 +1589,8 @@ bool CChannel3::Process(CBytestream *bs)
 	}
 
 	// Increase LastReliableIn until the first packet that is missing from sequence
-	while( true )	// I just love such constructs :P don't worry, I've put "break" inside the loop.
-	{
-		bool nextPacketFound = false;
-		int LastReliableInInc = LastReliableIn + 1;	// Next value of LastReliableIn
-		if( LastReliableInInc >= SEQUENCE_WRAPAROUND )
-			LastReliableInInc = 0;
-		for( PacketList_t::iterator it = ReliableIn.begin(); it != ReliableIn.end() && !nextPacketFound; it++ )
-			if( it->idx == LastReliableInInc )
-				nextPacketFound = true;
-		if( nextPacketFound )
-			LastReliableIn = LastReliableInInc;
-		else
-			break;
-	}
-
-	// The ReliableIn list updated - sort it
-	ReliableIn.sort();
+	while( ReliableIn.get( SequenceAdd( LastReliableIn, 1 ) ) )
+		LastReliableIn = SequenceAdd( LastReliableIn, 1 );
 	
 	if( bs->GetRestLen() > 0 )	// Non-reliable data left in this packet
 		return true;	// Do not modify bs, allow user to read non-reliable data at the end of bs
@@ -1174,134 +1617,155 @@ void CChannel3::Transmit(CBytestream *unreliableData)
 	}
 	#endif
 
-	CBytestream bs;
-	// Add acknowledged packets indexes
-
-	for( PacketList_t::iterator it = ReliableIn.begin(); it != ReliableIn.end(); it++ )
-		if( SequenceDiff( it->idx, LastReliableIn ) > 0 ) // Packets out of sequence
-			bs.writeInt( it->idx | SEQUENCE_HIGHEST_BIT, 2 );
-
-	bs.writeInt( LastReliableIn, 2 );
-
 	// Add reliable packet to ReliableOut buffer
-	while( (int)ReliableOut.size() < MaxNonAcknowledgedPackets && !Messages.empty() && ! ReliableStreamBandwidthLimitHit() )
+	while( ReliableOut.count < Flow.getWindow() && !Messages.empty() && ! ReliableStreamBandwidthLimitHit() &&
+			SequenceDiff( LastAddedToOut, LastReliableOut ) < PacketWindow_t::SIZE )
 	{
-		LastAddedToOut ++ ;
-		if( LastAddedToOut >= SEQUENCE_WRAPAROUND )
-			LastAddedToOut = 0;
+		LastAddedToOut = SequenceAdd( LastAddedToOut, 1 );
+
+		size_t restSize = Messages.front().GetLength() - MessageFragmentPos;
+		Messages.front().ResetPosToBegin();
+		Messages.front().Skip( MessageFragmentPos );
 
-		if( Messages.front().GetLength() > MAX_FRAGMENTED_PACKET_SIZE )
+		if( restSize > MAX_FRAGMENTED_PACKET_SIZE )
 		{
-			// Fragment the packet
-			Messages.front().ResetPosToBegin();
-			CBytestream bs;
-			bs.writeData( Messages.front().readData( MAX_FRAGMENTED_PACKET_SIZE ) );
-			ReliableOut.push_back( Packet_t( bs, LastAddedToOut, true ) );
-			bs.Clear();
-			bs.writeData( Messages.front().readData() );
-			Messages.front() = bs;
+			// Fragment the packet, the rest stays in Messages
+			size_t size = MAX_FRAGMENTED_PACKET_SIZE;
+			const char* data = Messages.front().readDataPtr( size );
+			ReliableOut.add( LastAddedToOut, true )->data.writeData( data, size );
+			MessageFragmentPos += size;
 		}
 		else
 		{
-			ReliableOut.push_back( Packet_t( Messages.front(), LastAddedToOut, false ) );
+			size_t size = restSize;
+			const char* data = Messages.front().readDataPtr( size );
+			Packet_t * p = ReliableOut.add( LastAddedToOut, false );
+			p->data.writeData( data, size );
 			Messages.pop_front();
+			MessageFragmentPos = 0;
 			while( ! Messages.empty() && 
-					ReliableOut.back().data.GetLength() + Messages.front().GetLength() <= MAX_FRAGMENTED_PACKET_SIZE )
+					p->data.GetLength() + Messages.front().GetLength() <= MAX_FRAGMENTED_PACKET_SIZE )
 			{
-				ReliableOut.back().data.Append( & Messages.front() );
+				p->data.Append( & Messages.front() );
 				Messages.pop_front();
 			}
 		}
 	}
 
-	// Check if other side acknowledged packets with indexes bigger than NextReliablePacketToSend,
-	// and roll NextReliablePacketToSend back to LastReliableOut.
-	if( ! ReliableOut.empty() )
+	// The packets sent recently and not acknowledged yet are flying through the net, they are limited by the window.
+	int flying = 0;
+	for( int idx = SequenceAdd( LastReliableOut, 1 ); ReliableOut.count > 0 && SequenceDiff( idx, LastAddedToOut ) <= 0; idx = SequenceAdd( idx, 1 ) )
 	{
-		for( PacketList_t::iterator it = ReliableOut.begin(), it1 = it++; it != ReliableOut.end(); it1 = it++ )
-		{
-			if( SequenceDiff( it->idx, it1->idx ) != 1 )
-				NextReliablePacketToSend = LastReliableOut;
-		}
-		if( ReliableOut.back().idx != LastAddedToOut )
-			NextReliablePacketToSend = LastReliableOut;
+		Packet_t * it = ReliableOut.get( idx );
+		if( it != NULL && it->sendCount > 0 && tLX->currentTime - it->lastSent < Flow.getRetransmitTimeout() &&
+			!( it->lastSentNetPacket < LastAckedNetPacket && tLX->currentTime - it->lastSent >= Flow.getLossDelay() ) )
+			flying++;
 	}
 
-	// Timeout occured - other side didn't acknowledge our packets in time - re-send all of them from the first one.
-	if( LastReliablePacketSent == LastAddedToOut &&
-		SequenceDiff( LastReliablePacketSent, LastReliableOut ) >= MaxNonAcknowledgedPackets &&
-		tLX->currentTime - fLastSent >= DataPacketTimeout )
-	{
-		NextReliablePacketToSend = LastReliableOut;	
-	}
-	
-	// Add packet headers and data - send all packets with indexes from NextReliablePacketToSend and up.
+	// The unreliable data goes with the first net packet, if there are more reliable packets
+	// ready to send than fit into one net packet, they are sent in the following ones.
+	CBytestream noUnreliableData;
+	bool morePackets = TransmitPacket( unreliableData, flying );
+	for( int f = 1; morePackets && f < MAX_NET_PACKETS_PER_TRANSMIT; f++ )
+		morePackets = TransmitPacket( &noUnreliableData, flying );
+}
+
+// Sends one net packet, returns true if there are more reliable packets to send which didn't fit into it
+bool CChannel3::TransmitPacket(CBytestream *unreliableData, int& flying)
+{
+	CBytestream bs;
+	// Space for CRC16, it is written at the end
+	bs.writeInt( 0, 2 );
+
+	// Add acknowledged packets indexes
+
+	for( int idx = SequenceAdd( LastReliableIn, 1 ); ReliableIn.count > 0 && SequenceDiff( idx, ReliableIn.base ) <= PacketWindow_t::SIZE; idx = SequenceAdd( idx, 1 ) )
+		if( ReliableIn.get( idx ) ) // Packets out of sequence
+			bs.writeInt( idx | SEQUENCE_HIGHEST_BIT, 2 );
+
+	bs.writeInt( LastReliableIn, 2 );
+
+	// Add packet headers and data - send the new packets, the lost ones, and the ones not acknowledged in time.
+	// A packet is lost if packets sent after it got acknowledged, and it is not for some time.
 	// Add older packets to the output first.
-	// NextReliablePacketToSend points to the last packet.
 	CBytestream packetData;
 	bool unreliableOnly = true;
 	bool firstPacket = true;	// Always send first packet, even if it bigger than MAX_PACKET_SIZE
 								// This should not occur when packets are fragmented
+	bool packetLost = false;
+	bool timeout = false;
+	bool morePackets = false;
 	int packetIndex = LastReliableOut;
 	int packetSize = 0;
 	
-	for( PacketList_t::iterator it = ReliableOut.begin(); it != ReliableOut.end(); it++ )
+	for( int idx = SequenceAdd( LastReliableOut, 1 ); ReliableOut.count > 0 && SequenceDiff( idx, LastAddedToOut ) <= 0; idx = SequenceAdd( idx, 1 ) )
 	{
-		if( SequenceDiff( it->idx, NextReliablePacketToSend ) >= 0 )
-		{
-			if( ! CheckReliableStreamBandwidthLimit( (float)(it->data.GetLength() + 4) ) ||
-				( bs.GetLength() + 4 + packetData.GetLength() + it->data.GetLength() > MAX_PACKET_SIZE-2 && !firstPacket ) )  // Substract CRC16 size
-				break;
+		Packet_t * it = ReliableOut.get( idx );
+		if( it == NULL )
+			continue;
 
-			if( !firstPacket )
-			{
-				bs.writeInt( packetIndex | SEQUENCE_HIGHEST_BIT, 2 );
-				bs.writeInt( packetSize, 2 );
-			};
-			packetIndex = it->idx;
-			packetSize = it->data.GetLength();
-			if( it->fragmented )
-				packetSize |= SEQUENCE_HIGHEST_BIT;
+		bool lost = false, timedOut = false;
+		if( it->sendCount > 0 )
+		{
+			lost = it->lastSentNetPacket < LastAckedNetPacket && tLX->currentTime - it->lastSent >= Flow.getLossDelay();
+			timedOut = !lost && tLX->currentTime - it->lastSent >= Flow.getRetransmitTimeout();
+			if( !lost && !timedOut )
+				continue;
+		}
 
-			firstPacket = false;
-			unreliableOnly = false;
-			NextReliablePacketToSend = it->idx;
+		if( flying >= Flow.getWindow() ||
+			! CheckReliableStreamBandwidthLimit( (float)(it->data.GetLength() + 4) ) )
+			break;
+		if( bs.GetLength() + 4 + packetData.GetLength() + it->data.GetLength() > MAX_PACKET_SIZE && !firstPacket ) // CRC16 is already in bs
+		{
+			morePackets = true;
+			break;
+		}
 
-			packetData.Append( &it->data );
+		if( !firstPacket )
+		{
+			bs.writeInt( packetIndex | SEQUENCE_HIGHEST_BIT, 2 );
+			bs.writeInt( packetSize, 2 );
+		};
+		packetIndex = it->idx;
+		packetSize = it->data.GetLength();
+		if( it->fragmented )
+			packetSize |= SEQUENCE_HIGHEST_BIT;
+
+		firstPacket = false;
+		unreliableOnly = false;
+		packetLost = packetLost || lost;
+		timeout = timeout || timedOut;
+		flying++;
+
+		// If we are sending a new reliable message, remember this time and use it for ping calculations
+		if( PongSequence == -1 && it->sendCount == 0 )
+		{
+			PongSequence = it->idx;
+			fLastPingSent = tLX->currentTime;
 		}
+		it->sendCount++;
+		it->lastSent = tLX->currentTime;
+		it->lastSentNetPacket = NetPacketsSent + 1;
+
+		packetData.Append( &it->data );
 	}
 
+	if( packetLost )
+		Flow.packetLost();
+	if( timeout )
+		Flow.timeout();
+
 	bs.writeInt( packetIndex, 2 );
 	bs.writeInt( packetSize, 2 );
 	
 	bs.Append( &packetData );
 
-	if( unreliableOnly )
+	if( unreliableOnly || bs.GetLength() + unreliableData->GetLength() <= MAX_PACKET_SIZE ) // CRC16 is already in bs
 		bs.Append(unreliableData);
-	else
-	{
-		if( bs.GetLength() + unreliableData->GetLength() <= MAX_PACKET_SIZE-2 ) // Substract CRC16 size
-			bs.Append(unreliableData);
 
-		// If we are sending a reliable message, remember this time and use it for ping calculations
-		if (PongSequence == -1)
-		{
-			PongSequence = NextReliablePacketToSend;
-			fLastPingSent = tLX->currentTime;
-		}
-	}
-
-	if( unreliableData->GetLength() == 0 &&
-		LastReliablePacketSent == LastAddedToOut &&
-		tLX->currentTime - fLastSent < DataPacketTimeout )
-	{
-		// No unreliable data to send, and we've just sent the same packet -
-		// send it again after some timeout, don't flood net.
-		return;
-	}
-	
 	if( unreliableData->GetLength() == 0 && packetData.GetLength() == 0 && 
-		LastReliableIn == LastReliableIn_SentWithLastPacket &&
+		LastReliableIn == LastReliableIn_SentWithLastPacket && !ReliableInChanged &&
 		tLX->currentTime - fLastSent < KeepAlivePacketTimeout )
 	{
 		// Nothing to send really, send one empty packet per halfsecond so we won't timeout,
@@ -1310,23 +1774,28 @@ void CChannel3::Transmit(CBytestream *unreliableData)
 		// CChannel_056b will always send packet on each frame, so we're conserving bandwidth compared to it, hehe.
 		
 		cOutgoingRate.addData( tLX->currentTime, 0 );
-		return;
+		return false;
 	}
 
 	// Add CRC16 
 	
-	CBytestream bs1;
-	bs1.writeInt( crc16( bs.peekData( bs.GetLength() ).c_str(), bs.GetLength() ), 2);
-	bs1.Append(&bs);
+	bs.ResetPosToBegin();
+	bs.Skip(2);
+	Uint16 crc = crc16( bs.peekDataPtr(), bs.GetRestLen() );
+	bs.writeByteAt( 0, (uchar)( crc & 0xff ) ); // Little endian, like writeInt()
+	bs.writeByteAt( 1, (uchar)( crc >> 8 ) );
 	
 	// Send the packet
+	bs.ResetPosToBegin();
 	Socket->setRemoteAddress(RemoteAddr);
-	bs1.Send(Socket.get());
+	bs.Send(Socket.get());
 
 	LastReliableIn_SentWithLastPacket = LastReliableIn;
-	LastReliablePacketSent = NextReliablePacketToSend;
+	ReliableInChanged = false;
+	NetPacketsSent++;
 
-	UpdateTransmitStatistics( bs1.GetLength() );
+	UpdateTransmitStatistics( bs.GetLength() );
+	return morePackets;
 }
 
 void CChannel3::AddReliablePacketToSend(CBytestream& bs) // The same as in CChannel but without error msg
@@ -1380,7 +1849,20 @@ inline Uint16 crc16_byte(Uint16 crc, const Uint8 data)
 {
 	return (crc >> 8) ^ crc16_table[(crc ^ data) & 0xff];
 }
-   
+
+// Tables for slicing-by-8: crc16_slice[n][b] is the CRC of byte b followed by n zero bytes
+struct Crc16SliceTables {
+	Uint16 t[8][256];
+	Crc16SliceTables() {
+		for(int b = 0; b < 256; b++) {
+			t[0][b] = crc16_table[b];
+			for(int n = 1; n < 8; n++)
+				t[n][b] = (t[n-1][b] >> 8) ^ crc16_table[t[n-1][b] & 0xff];
+		}
+	}
+};
+static const Crc16SliceTables crc16_slice;
+
 /**
  * Compute the CRC-16 for the data buffer
  *
@@ -1391,11 +1873,34 @@ inline Uint16 crc16_byte(Uint16 crc, const Uint8 data)
  */
 Uint16 crc16(const char * buffer, size_t len, Uint16 crc )
 {
-        while (len--)
-		{
-                crc = crc16_byte(crc, (Uint8)*buffer);
-				++buffer;
-		}
-        return crc;
+	const Uint8* p = (const Uint8*)buffer;
+	const Uint16 (*t)[256] = crc16_slice.t;
+
+	// 8 bytes at once, the result is the same as with crc16_byte()
+	while (len >= 8)
+	{
+		const Uint16 c = crc ^ (Uint16)(p[0] | (p[1] << 8));
+		crc = t[7][c & 0xff] ^ t[6][c >> 8] ^ t[5][p[2]] ^ t[4][p[3]] ^
+			t[3][p[4]] ^ t[2][p[5]] ^ t[1][p[6]] ^ t[0][p[7]];
+		p += 8;
+		len -= 8;
+	}
+
+	while (len--)
+	{
+		crc = crc16_byte(crc, *p);
+		++p;
+	}
+	return crc;
 }
 
+// Reference implementation for TestCChannelRobustness()
+Uint16 crc16_bytewise(const char * buffer, size_t len, Uint16 crc)
+{
+	while (len--)
+	{
+		crc = crc16_byte(crc, (Uint8)*buffer);
+		++buffer;
+	}
+	return crc;
+}
@@ -19,6 +19,13 @@
  */
 
 #include <cstdarg>
+#include <cstdio>
+#include <cstring>
+#include <ctime>
+#include <atomic>
+#include <thread>
+#include <sys/stat.h>
+#include <zlib.h>
 
 #include "EndianSwap.h"
 #include "LieroX.h"
@@ -31,6 +38,9 @@
 #include "ProjectileDesc.h"
 #include "WeaponDesc.h"
 #include "IniReader.h"
+#include "Options.h"
+#include "ThreadPool.h"
+#include "MathLib.h"
 
 
 
@@ -46,8 +56,7 @@ void CGameScript::initNewWeapons(int num) {
 // Write a string in pascal format
 static void writeString(const std::string& szString, FILE *fp)
 {
-    if(szString == "") return;
-	
+	// Empty strings still get their length byte, readString() always reads it
 	size_t length = szString.size();
 	if(length > 255) {
 		warnings << "i will cut the following string for writing: " << szString << endl;
@@ -75,23 +84,60 @@ static std::string readString(FILE *fp)
 	return buf;
 }
 
+///////////////////
+// Read count 4 byte values with one fread and swap them to the host byte order
+// The fixed-size parts of the projectiles are read like this, a fread per value was most of the load time
+static bool readBlock(FILE *fp, Uint32 *block, size_t count)
+{
+	if(fread(block, sizeof(Uint32), count, fp) < count) {
+		memset(block, 0, count * sizeof(Uint32));
+		return false;
+	}
+	for(size_t i = 0; i < count; ++i)
+		EndianSwap(block[i]);
+	return true;
+}
+
+///////////////////
+// Set a field to a value of a block, the field has the type which is saved in the file
+template<typename T>
+static void fromBlock(T& field, Uint32 value)
+{
+	static_assert(sizeof(T) == sizeof(Uint32), "fromBlock__sizeMismatch");
+	memcpy(&field, &value, sizeof(T));
+}
+
+// bools are saved as ints
+static void fromBlock(bool& field, Uint32 value)
+{
+	field = value != 0;
+}
+
 
 
 ///////////////////
 // Save the script (compiler)
 int CGameScript::Save(const std::string& filename)
 {
-	FILE *fp;
-	int n;
-
-
 	// Open it
-	fp = OpenGameFile(filename,"wb");
+	FILE *fp = OpenGameFile(filename,"wb");
 	if(fp == NULL) {
 		errors << "CGameScript::Save: Could not open " << filename << " for writing" << endl;
 		return false;
 	}
 
+	bool ok = SaveToFile(fp);
+	fclose(fp);
+	return ok;
+}
+
+
+///////////////////
+// Save the game script to an open file
+bool CGameScript::SaveToFile(FILE *fp)
+{
+	int n;
+
 	Header.Version = GS_VERSION;
 	strcpy(Header.ID,"Liero Game Script");
 
@@ -191,12 +237,9 @@ int CGameScript::Save(const std::string& filename)
 	EndianSwap(tmpworm.GroundFriction);
 	fwrite(&tmpworm, sizeof(gs_worm_t), 1, fp);
 
-
-	fclose(fp);
-
 	savedProjs.clear();
 	
-	return true;
+	return !ferror(fp);
 }
 
 
@@ -204,8 +247,12 @@ int CGameScript::Save(const std::string& filename)
 // Save a projectile
 bool CGameScript::SaveProjectile(proj_t *proj, FILE *fp)
 {
-	if(!proj)
+	if(!proj) {
+		// Newer GS versions always have the index, LoadProjectile() reads it in any case
+		if(Header.Version > GS_LX56_VERSION)
+			fwrite_endian<int>(fp, -1);
 		return false;
+	}
 
 	if(Header.Version > GS_LX56_VERSION) {
 		// well, that's slow but it's not worth to create a reverted-map just for saving
@@ -446,6 +493,164 @@ bool CGameScript::SaveProjectile(proj_t *proj, FILE *fp)
 }
 
 
+// Buffer size for reading script.lgs, most are smaller than this
+#define		GS_READ_BUFFER_SIZE		(256 * 1024)
+
+
+///////////////
+// Disk cache of compiled source mods
+// Compiling a mod from its source (Main.txt, weapon and projectile files) parses many ini files.
+// The compiled mod is written as script.lgs data to cache/mods/<dir>.olxmod, after a header and
+// the list of the source files with their size, mtime and CRC. It is used as long as none
+// of the source files has changed. Images and sounds are not part of it, they are loaded as usual.
+// The cache is only written if all sources are older than the start of the compiling, so a change
+// always changes the mtime and the sources don't have to be read again on load; the CRC is only
+// checked if the mtime differs (e.g. after a checkout).
+
+#define MODDISKCACHE_MAGIC		"OLX mod cache"
+#define MODDISKCACHE_VERSION	2	// 2: empty strings have their length byte
+
+struct ModDiskCacheHeader {
+	char	magic[16];
+	Uint32	version;
+	Uint32	gsVersion;
+	Uint32	numSources;
+};
+
+struct ModDiskCacheSource {
+	Uint64	size;
+	Sint64	time;
+	Uint32	crc;
+	Uint32	nameSize;	// followed by the filename
+};
+
+static std::string ModDiskCacheFilename(const std::string& dir) {
+	std::string name = dir;
+	stringlwr(name);
+	for(std::string::iterator c = name.begin(); c != name.end(); ++c)
+		if(*c == '/' || *c == '\\' || *c == ':') *c = '_';
+	return "cache/mods/" + name + ".olxmod";
+}
+
+// Fills the info about the source file, returns false if the file cannot be read.
+// The file is only read if withCrc is set, otherwise crc is 0.
+static bool ModDiskCacheSourceInfo(const std::string& filename, ModDiskCacheSource& src, bool withCrc) {
+	struct stat st;
+	if(!StatFile(filename, &st)) return false;
+	src.size = (Uint64)st.st_size;
+	src.time = (Sint64)st.st_mtime;
+	src.crc = 0;
+	src.nameSize = (Uint32)filename.size();
+	if(withCrc) {
+		std::string content = GetFileContents(filename);
+		if(content.size() != (size_t)st.st_size) return false;
+		src.crc = (Uint32)crc32(0L, (const Bytef*)content.data(), (uInt)content.size());
+	}
+	return true;
+}
+
+///////////////
+// Save the compiled mod to the disk cache, compileStart is the time() before the sources were read
+void CGameScript::SaveToDiskCache(const std::string& dir, Sint64 compileStart)
+{
+	if(!tLXOptions->bModDiskCache) return;
+
+	std::string sourceList;
+	for(size_t i = 0; i < compiledSources.size(); i++) {
+		ModDiskCacheSource src;
+		memset(&src, 0, sizeof(src));
+		if(!ModDiskCacheSourceInfo(compiledSources[i], src, true)) return;
+		// Could have changed after it was read, without changing its mtime later
+		if(src.time >= compileStart) return;
+		sourceList.append((const char*)&src, sizeof(src));
+		sourceList += compiledSources[i];
+	}
+	WriteDiskCache(dir, (Uint32)compiledSources.size(), sourceList);
+}
+
+///////////////
+// Write the disk cache file, sourceList are the ModDiskCacheSource entries with the filenames
+void CGameScript::WriteDiskCache(const std::string& dir, Uint32 numSources, const std::string& sourceList)
+{
+	ModDiskCacheHeader head;
+	memset(&head, 0, sizeof(head));
+	strncpy(head.magic, MODDISKCACHE_MAGIC, sizeof(head.magic));
+	head.version = MODDISKCACHE_VERSION;
+	head.gsVersion = GS_VERSION;
+	head.numSources = numSources;
+
+	std::string out;
+	out.append((const char*)&head, sizeof(head));
+	out += sourceList;
+
+	// Other processes could read the cache at the same time
+	const std::string cacheFile = GetWriteFullFileName(ModDiskCacheFilename(dir), true);
+	std::string tmpFile;
+	FILE* fp = OpenTempFile(cacheFile, tmpFile);
+	bool ok = fp != NULL;
+	if(fp) {
+		ok = fwrite(out.data(), 1, out.size(), fp) == out.size();
+		ok = CommitTempFile(fp, tmpFile, cacheFile, ok && SaveToFile(fp));
+	}
+	if(!ok)
+		warnings << "cannot write mod disk cache " << cacheFile << endl;
+}
+
+///////////////
+// Try to load the compiled mod from the disk cache
+bool CGameScript::LoadFromDiskCache(const std::string& dir)
+{
+	if(!tLXOptions->bModDiskCache) return false;
+
+	const std::string cacheFile = GetWriteFullFileName(ModDiskCacheFilename(dir));
+	FILE* fp = OpenAbsFile(cacheFile, "rb");
+	if(!fp) return false;
+	setvbuf(fp, NULL, _IOFBF, GS_READ_BUFFER_SIZE);
+
+	ModDiskCacheHeader head;
+	bool ok = fread(&head, sizeof(head), 1, fp) == 1;
+	ok = ok && strncmp(head.magic, MODDISKCACHE_MAGIC, sizeof(head.magic)) == 0;
+	ok = ok && head.version == MODDISKCACHE_VERSION && head.gsVersion == GS_VERSION && head.numSources > 0;
+	bool restamp = false; // a source got a new mtime but has the same content
+	const Sint64 loadStart = (Sint64)time(NULL);
+	std::string sourceList; // with the new mtimes
+	for(Uint32 i = 0; ok && i < head.numSources; i++) {
+		ModDiskCacheSource src, cur;
+		ok = fread(&src, sizeof(src), 1, fp) == 1 && src.nameSize > 0 && src.nameSize < 4096;
+		if(!ok) break;
+		std::string name(src.nameSize, '\0');
+		ok = fread(&name[0], 1, name.size(), fp) == name.size();
+		// Different dirs can share the cache filename (case, '/' vs. '_'), the sources tell the real one
+		ok = ok && name.size() > dir.size() + 1 && name.compare(0, dir.size() + 1, dir + "/") == 0;
+		ok = ok && ModDiskCacheSourceInfo(name, cur, false) && cur.size == src.size;
+		if(ok && cur.time != src.time) {
+			ok = ModDiskCacheSourceInfo(name, cur, true) && cur.crc == src.crc;
+			// If it is from this second, it could still change without changing the mtime
+			restamp = restamp || cur.time < loadStart;
+			src.time = cur.time;
+		}
+		sourceList.append((const char*)&src, sizeof(src));
+		sourceList += name;
+	}
+
+	int result = ok ? LoadFromFile(fp, cacheFile) : GSE_FILE;
+	fclose(fp);
+	if(result != GSE_OK) {
+		if(ok)
+			warnings << "GameScript: '" << dir << "': cannot use mod disk cache " << cacheFile << endl;
+		Shutdown();
+		return false;
+	}
+
+	notes << "GameScript: '" << dir << "': loaded from the mod disk cache" << endl;
+
+	// Write the new mtimes, so the content doesn't have to be checked again next time
+	if(restamp)
+		WriteDiskCache(dir, head.numSources, sourceList);
+	return true;
+}
+
+
 ///////////////////
 // Load the game script from a file (game)
 int CGameScript::Load(const std::string& dir)
@@ -464,7 +669,6 @@ int CGameScript::Load(const std::string& dir)
 	*/
 	Shutdown();
 
-	int n;
 	std::string filename = dir + "/script.lgs";
 	sDirectory = dir;
 
@@ -472,9 +676,15 @@ int CGameScript::Load(const std::string& dir)
 	FILE* fp = OpenGameFile(filename,"rb");
 	if(fp == NULL) {
 		if(IsFileAvailable(dir + "/main.txt")) {
+			if(LoadFromDiskCache(dir))
+				return GSE_OK;
+			
 			hints << "GameScript: '" << dir << "': loading from gamescript source" << endl;
-			if(Compile(dir))
+			const Sint64 compileStart = (Sint64)time(NULL);
+			if(Compile(dir)) {
+				SaveToDiskCache(dir, compileStart);
 				return GSE_OK;
+			}
 			else {
 				warnings << "GameScript::Load(): could not compile source gamescript '" << dir << "'" << endl;
 				return GSE_BAD;
@@ -485,6 +695,25 @@ int CGameScript::Load(const std::string& dir)
 		return GSE_FILE;
 	}
 
+	// The script is read in many small pieces, let the stdio buffer get them with a few big reads
+	setvbuf(fp, NULL, _IOFBF, GS_READ_BUFFER_SIZE);
+	int result = LoadFromFile(fp, filename);
+	fclose(fp);
+
+	// Already cached externally
+	// Save to cache
+	//cCache.SaveMod(dir, this);
+
+	return result;
+}
+
+
+///////////////////
+// Load the game script from an open file, starting at the current position
+int CGameScript::LoadFromFile(FILE *fp, const std::string& filename)
+{
+	int n;
+
 	// Header
 	fread_compat(Header,sizeof(gs_header_t),1,fp);
 	EndianSwap(Header.Version);
@@ -494,17 +723,15 @@ int CGameScript::Load(const std::string& dir)
 
 	// Check ID
 	if(strcmp(Header.ID,"Liero Game Script") != 0) {
-		fclose(fp);
 		SetError("CGameScript::Load(): Bad script id");
 		return GSE_BAD;
 	}
 
 	// Check version
 	if(Header.Version < GS_FIRST_SUPPORTED_VERSION || Header.Version > GS_VERSION) {
-		warnings << "GS:CheckFile: WARNING: " << dir << "/script.lgs has a wrong version";
+		warnings << "GS:CheckFile: WARNING: " << filename << " has a wrong version";
 		warnings << " (" << (unsigned)Header.Version << ", required is in the range ";
 		warnings << "[" << GS_FIRST_SUPPORTED_VERSION << "," << GS_VERSION << "])" << endl;
-		fclose(fp);
 		SetError("CGameScript::Load(): Bad script version");
 		return GSE_VERSION;
 	}
@@ -609,10 +836,7 @@ int CGameScript::Load(const std::string& dir)
 
 			if(!bDedicated && wpn->UseSound) {
 				// Load the sample
-				wpn->smpSample = LoadGSSample(dir,wpn->SndFilename);
-
-				if(wpn->smpSample == NULL)
-					wpn->UseSound = false;
+				RequestGSSample(sDirectory, wpn->SndFilename, &wpn->smpSample, &wpn->UseSound, "");
 			}
 		}
 
@@ -645,12 +869,8 @@ int CGameScript::Load(const std::string& dir)
 	EndianSwap(Worm.AirFriction);
 	EndianSwap(Worm.GroundFriction);
 
-
-	fclose(fp);
-
-	// Already cached externally
-	// Save to cache
-	//cCache.SaveMod(dir, this);
+	// Decode all images and sounds of the mod
+	LoadRequestedAssets();
 
 	loaded = true;
 	
@@ -665,6 +885,8 @@ proj_t *CGameScript::LoadProjectile(FILE *fp)
 	int projIndex = -1;
 	if(Header.Version > GS_LX56_VERSION) {
 		fread_endian<int>(fp, projIndex);
+		if(projIndex < 0) // saved without projectile
+			return NULL;
 		std::map<int, proj_t*>::iterator f = projectiles.find(projIndex);
 		if(f != projectiles.end())
 			return f->second;
@@ -677,33 +899,36 @@ proj_t *CGameScript::LoadProjectile(FILE *fp)
 		return NULL;
 	projectiles[projIndex] = proj;
 
-	fread_compat(proj->Type,			sizeof(int),  1,fp);
-	EndianSwap(proj->Type);
-	fread_compat(proj->Timer.Time,	sizeof(float),1,fp);
-	EndianSwap(proj->Timer.Time);
-	fread_compat(proj->Timer.TimeVar,	sizeof(float),1,fp);
-	EndianSwap(proj->Timer.TimeVar);
-	fread_compat(proj->Trail.Type,			sizeof(int),  1,fp);
-	EndianSwap(proj->Trail.Type);
-	fread_endian<int>(fp, proj->UseCustomGravity);
+	Uint32 block[6];
+	readBlock(fp, block, 5);
+	fromBlock(proj->Type, block[0]);
+	fromBlock(proj->Timer.Time, block[1]);
+	fromBlock(proj->Timer.TimeVar, block[2]);
+	fromBlock(proj->Trail.Type, block[3]);
+	fromBlock(proj->UseCustomGravity, block[4]);
 	if(proj->UseCustomGravity)
 	{
-		fread_compat(proj->Gravity,	sizeof(int), 1, fp);
-		EndianSwap(proj->Gravity);
+		readBlock(fp, block, 2);
+		fromBlock(proj->Gravity, block[0]);
+		fromBlock(proj->Dampening, block[1]);
+	}
+	else {
+		readBlock(fp, block, 1);
+		fromBlock(proj->Dampening, block[0]);
 	}
-	fread_compat(proj->Dampening,		sizeof(int),  1, fp);
-	EndianSwap(proj->Dampening);
 
 	if(Header.Version > GS_LX56_VERSION) {
-		fread_endian<int>(fp, proj->AttractiveForce);
-		fread_endian<int>(fp, proj->AttractiveForceType);
-		fread_endian<int>(fp, proj->AttractiveForceObjects);
-		fread_endian<int>(fp, proj->AttractiveForceClasses);
-		fread_endian<int>(fp, proj->AttractiveForceRadius);
+		readBlock(fp, block, 5);
+		fromBlock(proj->AttractiveForce, block[0]);
+		fromBlock(proj->AttractiveForceType, block[1]);
+		fromBlock(proj->AttractiveForceObjects, block[2]);
+		fromBlock(proj->AttractiveForceClasses, block[3]);
+		fromBlock(proj->AttractiveForceRadius, block[4]);
 		fread_endian<bool>(fp, proj->AttractiveForceThroughWalls);
 
-		fread_endian<int>(fp, proj->Width);
-		fread_endian<int>(fp, proj->Height);
+		readBlock(fp, block, 2);
+		fromBlock(proj->Width, block[0]);
+		fromBlock(proj->Height, block[1]);
 	}
 	else {
 		proj->AttractiveForce = 0;
@@ -752,40 +977,32 @@ proj_t *CGameScript::LoadProjectile(FILE *fp)
 			fread_endian<int>(fp, NumColours);
 			proj->Colour.resize(NumColours);
 			
-			for(size_t i = 0; i < NumColours; ++i) {
-				if(Header.Version <= GS_LX56_VERSION) {
-					int color[3] = {0,0,0};
-					fread_endian<int>(fp, color[0]);
-					fread_endian<int>(fp, color[1]);
-					fread_endian<int>(fp, color[2]);
-					proj->Colour[i] = Color(color[0],color[1],color[2]);
-				} else {
-					fread_compat(proj->Colour[i].r,1,1,fp);
-					fread_compat(proj->Colour[i].g,1,1,fp);
-					fread_compat(proj->Colour[i].b,1,1,fp);
-					fread_compat(proj->Colour[i].a,1,1,fp);
+			if(Header.Version <= GS_LX56_VERSION) {
+				for(size_t i = 0; i < NumColours; ++i) {
+					readBlock(fp, block, 3);
+					proj->Colour[i] = Color(block[0], block[1], block[2]);
 				}
 			}
+			else if(NumColours > 0) {
+				// saved as r,g,b,a bytes, just like Color
+				static_assert(sizeof(Color) == 4, "Color__SizeCheck");
+				if(fread(&proj->Colour[0], sizeof(Color), NumColours, fp) < NumColours)
+					proj->Colour.clear();
+			}
 			break;
 		}
 		case PRJ_IMAGE:
 			proj->ImgFilename = readString(fp);
 		
-			if(!bDedicated) {
-				proj->bmpImage = LoadGSImage(sDirectory, proj->ImgFilename);
-				if(!proj->bmpImage)
-					modLog("Could not open image '" + proj->ImgFilename + "'");
-				else
-					proj->bmpShadow = GenerateShadowSurface(proj->bmpImage);
-			}
+			if(!bDedicated)
+				RequestGSImage(sDirectory, proj);
 			
-			fread_endian<int>(fp, proj->Rotating);
-			fread_compat(proj->RotIncrement, sizeof(int), 1, fp);
-			EndianSwap(proj->RotIncrement);
-			fread_compat(proj->RotSpeed,sizeof(int),1,fp);
-			EndianSwap(proj->RotSpeed);
-			fread_endian<int>(fp, proj->UseAngle);
-			fread_endian<int>(fp, proj->UseSpecAngle);
+			readBlock(fp, block, 5);
+			fromBlock(proj->Rotating, block[0]);
+			fromBlock(proj->RotIncrement, block[1]);
+			fromBlock(proj->RotSpeed, block[2]);
+			fromBlock(proj->UseAngle, block[3]);
+			fromBlock(proj->UseSpecAngle, block[4]);
 			if(proj->UseAngle || proj->UseSpecAngle)
 			{
 				fread_compat(proj->AngleImages,sizeof(int),1,fp);
@@ -793,10 +1010,9 @@ proj_t *CGameScript::LoadProjectile(FILE *fp)
 			}
 			fread_endian<int>(fp, proj->Animating);
 			if(proj->Animating) {
-				fread_compat(proj->AnimRate,sizeof(float),1,fp);
-				EndianSwap(proj->AnimRate);
-				fread_compat(proj->AnimType,sizeof(int),1,fp);
-				EndianSwap(proj->AnimType);
+				readBlock(fp, block, 2);
+				fromBlock(proj->AnimRate, block[0]);
+				fromBlock(proj->AnimType, block[1]);
 			}
 			break;
 						
@@ -813,12 +1029,11 @@ proj_t *CGameScript::LoadProjectile(FILE *fp)
 
 		// Hit::Explode
 		if(proj->Hit.Type == PJ_EXPLODE) {
-			fread_compat(proj->Hit.Damage,		sizeof(int),1,fp);
-			EndianSwap(proj->Hit.Damage);
-			fread_endian<int>(fp, proj->Hit.Projectiles);
-			fread_endian<int>(fp, proj->Hit.UseSound);
-			fread_compat(proj->Hit.Shake,			sizeof(int),1,fp);
-			EndianSwap(proj->Hit.Shake);
+			readBlock(fp, block, 4);
+			fromBlock(proj->Hit.Damage, block[0]);
+			fromBlock(proj->Hit.Projectiles, block[1]);
+			fromBlock(proj->Hit.UseSound, block[2]);
+			fromBlock(proj->Hit.Shake, block[3]);
 
 			if(proj->Hit.UseSound) {
 				proj->Hit.SndFilename = readString(fp);
@@ -827,10 +1042,9 @@ proj_t *CGameScript::LoadProjectile(FILE *fp)
 
 		// Hit::Bounce
 		if(proj->Hit.Type == PJ_BOUNCE) {
-			fread_compat(proj->Hit.BounceCoeff,	sizeof(float), 1, fp);
-			EndianSwap(proj->Hit.BounceCoeff);
-			fread_compat(proj->Hit.BounceExplode, sizeof(int),   1, fp);
-			EndianSwap(proj->Hit.BounceExplode);
+			readBlock(fp, block, 2);
+			fromBlock(proj->Hit.BounceCoeff, block[0]);
+			fromBlock(proj->Hit.BounceExplode, block[1]);
 		}
 
 		// Hit::Carve
@@ -841,13 +1055,9 @@ proj_t *CGameScript::LoadProjectile(FILE *fp)
 
 		if(!bDedicated && proj->Hit.UseSound) {
 			// Load the sample
-			proj->Hit.Sound = LoadGSSample(sDirectory,proj->Hit.SndFilename);
-			
-			if(proj->Hit.Sound == NULL) {
-				proj->Hit.UseSound = false;
-				modLog("Could not open sound '" + proj->Hit.SndFilename + "'");
-			}
-		}		
+			RequestGSSample(sDirectory, proj->Hit.SndFilename, &proj->Hit.Sound, &proj->Hit.UseSound,
+							"Could not open sound '" + proj->Hit.SndFilename + "'");
+		}
 	}
 	else { // newer GS version
 		proj->Hit.read(this, fp);
@@ -864,11 +1074,10 @@ proj_t *CGameScript::LoadProjectile(FILE *fp)
 			fread_compat(proj->Timer.Type,sizeof(int),1,fp);
 			EndianSwap(proj->Timer.Type);
 			if(proj->Timer.Type == PJ_EXPLODE) {
-				fread_compat(proj->Timer.Damage,sizeof(int),1,fp);
-				EndianSwap(proj->Timer.Damage);
-				fread_endian<int>(fp, proj->Timer.Projectiles);
-				fread_compat(proj->Timer.Shake,sizeof(int),1,fp);
-				EndianSwap(proj->Timer.Shake);
+				readBlock(fp, block, 3);
+				fromBlock(proj->Timer.Damage, block[0]);
+				fromBlock(proj->Timer.Projectiles, block[1]);
+				fromBlock(proj->Timer.Shake, block[2]);
 			}
 		}
 		else {
@@ -887,8 +1096,9 @@ proj_t *CGameScript::LoadProjectile(FILE *fp)
 
 		// PlyHit::Explode || PlyHit::Injure
 		if(proj->PlyHit.Type == PJ_INJURE || proj->PlyHit.Type == PJ_EXPLODE) {
-			fread_endian<int>(fp, proj->PlyHit.Damage);
-			fread_endian<int>(fp, proj->PlyHit.Projectiles);
+			readBlock(fp, block, 2);
+			fromBlock(proj->PlyHit.Damage, block[0]);
+			fromBlock(proj->PlyHit.Projectiles, block[1]);
 		}
 
 		// PlyHit::Bounce
@@ -907,12 +1117,11 @@ proj_t *CGameScript::LoadProjectile(FILE *fp)
 		//
 		// Explode
 		//
-		fread_compat(proj->Exp.Type,     sizeof(int), 1, fp);
-		EndianSwap(proj->Exp.Type);
-		fread_compat(proj->Exp.Damage,   sizeof(int), 1, fp);
-		EndianSwap(proj->Exp.Damage);
-		fread_endian<int>(fp, proj->Exp.Projectiles);
-		fread_endian<int>(fp, proj->Exp.UseSound);
+		readBlock(fp, block, 4);
+		fromBlock(proj->Exp.Type, block[0]);
+		fromBlock(proj->Exp.Damage, block[1]);
+		fromBlock(proj->Exp.Projectiles, block[2]);
+		fromBlock(proj->Exp.UseSound, block[3]);
 		if(proj->Exp.UseSound) {
 			proj->Exp.SndFilename = readString(fp);
 		}
@@ -920,12 +1129,11 @@ proj_t *CGameScript::LoadProjectile(FILE *fp)
 		//
 		// Touch
 		//
-		fread_compat(proj->Tch.Type,     sizeof(int), 1, fp);
-		EndianSwap(proj->Tch.Type);
-		fread_compat(proj->Tch.Damage,   sizeof(int), 1, fp);
-		EndianSwap(proj->Tch.Damage);
-		fread_endian<int>(fp, proj->Tch.Projectiles);
-		fread_endian<int>(fp, proj->Tch.UseSound);
+		readBlock(fp, block, 4);
+		fromBlock(proj->Tch.Type, block[0]);
+		fromBlock(proj->Tch.Damage, block[1]);
+		fromBlock(proj->Tch.Projectiles, block[2]);
+		fromBlock(proj->Tch.UseSound, block[3]);
 		if(proj->Tch.UseSound) {
 			proj->Tch.SndFilename = readString(fp);
 		}
@@ -945,17 +1153,13 @@ proj_t *CGameScript::LoadProjectile(FILE *fp)
 	}
 	else if(proj->Timer.Projectiles || proj->Hit.Projectiles || proj->PlyHit.Projectiles || proj->Exp.Projectiles ||
        proj->Tch.Projectiles) {
-		fread_endian<int>(fp, proj->GeneralSpawnInfo.Useangle);
-		fread_compat(proj->GeneralSpawnInfo.Angle,		sizeof(int),	1, fp);
-		EndianSwap(proj->GeneralSpawnInfo.Angle);
-		fread_compat(proj->GeneralSpawnInfo.Amount,	sizeof(int),	1, fp);
-		EndianSwap(proj->GeneralSpawnInfo.Amount);
-		fread_compat(proj->GeneralSpawnInfo.Spread,	sizeof(float),	1, fp);
-		EndianSwap(proj->GeneralSpawnInfo.Spread);
-		fread_compat(proj->GeneralSpawnInfo.Speed,		sizeof(int),	1, fp);
-		EndianSwap(proj->GeneralSpawnInfo.Speed);
-		fread_compat(proj->GeneralSpawnInfo.SpeedVar,	sizeof(float),	1, fp);
-		EndianSwap(proj->GeneralSpawnInfo.SpeedVar);
+		readBlock(fp, block, 6);
+		fromBlock(proj->GeneralSpawnInfo.Useangle, block[0]);
+		fromBlock(proj->GeneralSpawnInfo.Angle, block[1]);
+		fromBlock(proj->GeneralSpawnInfo.Amount, block[2]);
+		fromBlock(proj->GeneralSpawnInfo.Spread, block[3]);
+		fromBlock(proj->GeneralSpawnInfo.Speed, block[4]);
+		fromBlock(proj->GeneralSpawnInfo.SpeedVar, block[5]);
 
 		proj->GeneralSpawnInfo.Proj = LoadProjectile(fp);
 	}
@@ -964,20 +1168,18 @@ proj_t *CGameScript::LoadProjectile(FILE *fp)
 	// Projectile trail
 	if(proj->Trail.Type == TRL_PROJECTILE) {
 
-		fread_endian<int>(fp, proj->Trail.Proj.UseParentVelocityForSpread);
-		fread_endian<float>(fp, proj->Trail.Delay);
+		// LX56 has the spawn info right after the delay
+		readBlock(fp, block, (Header.Version <= GS_LX56_VERSION) ? 6 : 2);
+		fromBlock(proj->Trail.Proj.UseParentVelocityForSpread, block[0]);
+		fromBlock(proj->Trail.Delay, block[1]);
 		// Change from milli-seconds to seconds
 		proj->Trail.Delay /= 1000.0f;
 		
 		if(Header.Version <= GS_LX56_VERSION) {
-			fread_compat(proj->Trail.Proj.Amount,			sizeof(int),	1, fp);
-			EndianSwap(proj->Trail.Proj.Amount);
-			fread_compat(proj->Trail.Proj.Speed,			sizeof(int),	1, fp);
-			EndianSwap(proj->Trail.Proj.Speed);
-			fread_compat(proj->Trail.Proj.SpeedVar,		sizeof(float),	1, fp);
-			EndianSwap(proj->Trail.Proj.SpeedVar);
-			fread_compat(proj->Trail.Proj.Spread,			sizeof(float),	1, fp);
-			EndianSwap(proj->Trail.Proj.Spread);
+			fromBlock(proj->Trail.Proj.Amount, block[2]);
+			fromBlock(proj->Trail.Proj.Speed, block[3]);
+			fromBlock(proj->Trail.Proj.SpeedVar, block[4]);
+			fromBlock(proj->Trail.Proj.Spread, block[5]);
 
 			proj->Trail.Proj.Proj = LoadProjectile(fp);
 		}
@@ -991,28 +1193,59 @@ proj_t *CGameScript::LoadProjectile(FILE *fp)
 }
 
 ///////////////////
-// Load an image
-SDL_Surface * CGameScript::LoadGSImage(const std::string& dir, const std::string& filename)
+// Load an image of the mod, without keeping a reference to it
+static SmartPointer<SDL_Surface> LoadGSImageFile(const std::string& dir, const std::string& filename)
 {
-	if(bDedicated) return NULL;
+	// First, check the gfx directory in the mod dir
+	SmartPointer<SDL_Surface> img = LoadGameImage(dir + "/gfx/" + filename, true);
 
-	SmartPointer<SDL_Surface> img = NULL;
+	// Check the gfx directory in the data dir
+	if(!img.get())
+		img = LoadGameImage("data/gfx/" + filename, true);
 
-	// First, check the gfx directory in the mod dir
-	img = LoadGameImage(dir + "/gfx/" + filename, true);
-	if(img.get())  {
+	if(img.get())
 		SetColorKey(img.get());
-		CachedImages.push_back(img);
-		return img.get();
-	}
+	return img;
+}
+
+///////////////////
+// Decode an image of the mod, like LoadGSImageFile, but without the video functions (see DecodeGameImage)
+static SmartPointer<SDL_Surface> DecodeGSImageFile(const std::string& dir, const std::string& filename, std::string& file, bool& cached)
+{
+	// First, check the gfx directory in the mod dir
+	file = dir + "/gfx/" + filename;
+	SmartPointer<SDL_Surface> img = DecodeGameImage(file, cached);
 
 	// Check the gfx directory in the data dir
-	img = LoadGameImage("data/gfx/" + filename, true);
+	if(!img.get()) {
+		file = "data/gfx/" + filename;
+		img = DecodeGameImage(file, cached);
+	}
+	return img;
+}
+
+///////////////////
+// Load a sample of the mod, without keeping a reference to it
+static SmartPointer<SoundSample> LoadGSSampleFile(const std::string& dir, const std::string& filename)
+{
+	// First, check the sfx directory in the mod dir
+	SmartPointer<SoundSample> smp = LoadSample(dir + "/sfx/" + filename, 10);
+
+	// Check the sounds directory in the data dir
+	if(!smp.get())
+		smp = LoadSample("data/sounds/" + filename, 10);
+	return smp;
+}
+
+///////////////////
+// Load an image
+SDL_Surface * CGameScript::LoadGSImage(const std::string& dir, const std::string& filename)
+{
+	if(bDedicated) return NULL;
+
+	SmartPointer<SDL_Surface> img = LoadGSImageFile(dir, filename);
 	if(img.get())
-	{ 
-		SetColorKey(img.get());
 		CachedImages.push_back(img);
-	}
 	return img.get();
 }
 
@@ -1022,22 +1255,140 @@ SoundSample * CGameScript::LoadGSSample(const std::string& dir, const std::strin
 {
 	if(bDedicated) return NULL;
 	
-	SmartPointer<SoundSample> smp = NULL;
-
-	// First, check the sfx directory in the mod dir
-	smp = LoadSample(dir + "/sfx/" + filename, 10);
-
+	SmartPointer<SoundSample> smp = LoadGSSampleFile(dir, filename);
 	if(smp.get())
-	{
 		CachedSamples.push_back(smp);
-		return smp.get();
+	return smp.get();
+}
+
+///////////////////
+// Request the image of the projectile, it's set in LoadRequestedAssets()
+void CGameScript::RequestGSImage(const std::string& dir, proj_t *proj)
+{
+	AssetRequest req;
+	req.dir = dir;
+	req.filename = proj->ImgFilename;
+	req.proj = proj;
+	req.sample = NULL;
+	req.useSound = NULL;
+	req.failMsg = "Could not open image '" + proj->ImgFilename + "'";
+	req.imageCached = false;
+	assetRequests.push_back(req);
+}
+
+///////////////////
+// Request a sample, *sample is set in LoadRequestedAssets()
+void CGameScript::RequestGSSample(const std::string& dir, const std::string& filename, SoundSample **sample, bool *useSound, const std::string& failMsg)
+{
+	AssetRequest req;
+	req.dir = dir;
+	req.filename = filename;
+	req.proj = NULL;
+	req.sample = sample;
+	req.useSound = useSound;
+	req.failMsg = failMsg;
+	req.imageCached = false;
+	assetRequests.push_back(req);
+}
+
+///////////////////
+// Request the samples of an action and its additional actions
+void CGameScript::RequestGSActionSounds(const std::string& dir, const std::string& where, Proj_Action *act)
+{
+	for(std::string section = where; act; act = act->additionalAction, section += ".Additional")
+		if(act->UseSound)
+			RequestGSSample(dir, act->SndFilename, &act->Sound, NULL, section + ": Could not open sound '" + act->SndFilename + "'");
+}
+
+struct GSAssetLoadAction : Action {
+	std::vector<CGameScript::AssetRequest*>* jobs;
+	std::atomic<size_t>* next;
+	int handle() {
+		for(size_t i = (*next)++; i < jobs->size(); i = (*next)++) {
+			CGameScript::AssetRequest* req = (*jobs)[i];
+			if(req->proj)
+				// Only decoded here, the surfaces are converted by the loading thread (SDL video is not thread safe)
+				req->image = DecodeGSImageFile(req->dir, req->filename, req->imageFile, req->imageCached);
+			else
+				req->sound = LoadGSSampleFile(req->dir, req->filename);
+		}
+		return 0;
 	}
+};
 
-	// Check the sounds directory in the data dir
-	smp = LoadSample("data/sounds/" + filename, 10);
-	if(smp.get())
-		CachedSamples.push_back(smp);
-	return smp.get();
+///////////////////
+// Decode all requested images and sounds on the thread pool and set them where they were requested
+// The same file is decoded only once, most mods use the same images and sounds in many places
+void CGameScript::LoadRequestedAssets()
+{
+	if(assetRequests.empty()) return;
+
+	// Jobs are the first request for each file, the others get its result
+	std::vector<AssetRequest*> jobs;
+	std::vector<size_t> jobOfRequest(assetRequests.size());
+	std::map<std::string, size_t> jobIndexes;
+	for(size_t i = 0; i < assetRequests.size(); i++) {
+		const AssetRequest& req = assetRequests[i];
+		std::string key = std::string(req.proj ? "i:" : "s:") + req.dir + ":" + req.filename;
+		stringlwr(key);
+		std::map<std::string, size_t>::iterator f = jobIndexes.find(key);
+		if(f != jobIndexes.end()) {
+			jobOfRequest[i] = f->second;
+			continue;
+		}
+		jobOfRequest[i] = jobs.size();
+		jobIndexes[key] = jobs.size();
+		jobs.push_back(&assetRequests[i]);
+	}
+
+	// We take part in the work ourself, the thread pool does the rest
+	std::atomic<size_t> next(0);
+	GSAssetLoadAction action;
+	action.jobs = &jobs;
+	action.next = &next;
+	const int threadNum = threadPool ? CLAMP((int)std::thread::hardware_concurrency(), 1, 8) : 1;
+	std::vector<ThreadPoolItem*> threads;
+	for(int t = 1; t < threadNum && (size_t)t < jobs.size(); t++)
+		threads.push_back(threadPool->start(new GSAssetLoadAction(action), "mod assets loading"));
+	action.handle();
+	for(size_t t = 0; t < threads.size(); t++)
+		threadPool->wait(threads[t], NULL);
+
+	for(size_t j = 0; j < jobs.size(); j++) {
+		AssetRequest* job = jobs[j];
+		if(!job->image.get()) continue;
+		if(!job->imageCached)
+			job->image = ConvertGameImage(job->imageFile, job->image, true);
+		if(!job->image.get()) continue;
+		SetColorKey(job->image.get());
+		job->shadow = GenerateShadowSurface(job->image.get());
+	}
+
+	for(size_t i = 0; i < assetRequests.size(); i++) {
+		AssetRequest& req = assetRequests[i];
+		const AssetRequest* job = jobs[jobOfRequest[i]];
+		if(req.proj) {
+			req.proj->bmpImage = job->image.get();
+			req.proj->bmpShadow = job->shadow;
+			if(!job->image.get())
+				modLog(req.failMsg);
+		}
+		else {
+			*req.sample = job->sound.get();
+			if(!job->sound.get()) {
+				if(req.useSound) *req.useSound = false;
+				if(req.failMsg != "") modLog(req.failMsg);
+			}
+		}
+	}
+
+	for(size_t j = 0; j < jobs.size(); j++) {
+		if(jobs[j]->image.get()) CachedImages.push_back(jobs[j]->image);
+		if(jobs[j]->sound.get()) CachedSamples.push_back(jobs[j]->sound);
+	}
+
+	notes << "GameScript: loaded " << jobs.size() << " images and sounds with " << (threads.size() + 1) << " threads" << endl;
+	assetRequests.clear();
 }
 
 
@@ -1129,6 +1480,8 @@ void CGameScript::Shutdown()
 	projectiles.clear();
 	savedProjs.clear();
 	projFileIndexes.clear();
+	compiledSources.clear();
+	assetRequests.clear();
 	
 	if(Weapons)
 		delete[] Weapons;
@@ -1392,6 +1745,7 @@ bool CGameScript::Compile(const std::string& dir)
 
 	InitDefaultCompilerKeywords();
 	IniReader ini(dir + "/Main.txt", compilerKeywords);
+	compiledSources.push_back(dir + "/Main.txt");
 
 	if (!ini.Parse())  {
 		errors << "Error while parsing the gamescript " << dir << endl;
@@ -1431,6 +1785,9 @@ bool CGameScript::Compile(const std::string& dir)
 	// Compile the extra stuff
 	CompileExtra(ini);
 
+	// Decode all images and sounds of the mod
+	LoadRequestedAssets();
+
 	loaded = true;
 	
 	return true;
@@ -1445,6 +1802,7 @@ bool CGameScript::CompileWeapon(const std::string& dir, const std::string& weapo
 	
 	weapon_t *Weap = Game->Weapons+id;
 	IniReader ini(dir + "/" + weapon, compilerKeywords);
+	compiledSources.push_back(dir + "/" + weapon);
 	if (!ini.Parse())  {
 		errors << "Error while parsing weapon file " << weapon << endl;
 		return false;
@@ -1505,7 +1863,7 @@ bool CGameScript::CompileWeapon(const std::string& dir, const std::string& weapo
 	
 		if(!bDedicated) {
 			// Load the sample
-			Weap->smpSample = LoadGSSample(dir,Weap->SndFilename);
+			RequestGSSample(dir, Weap->SndFilename, &Weap->smpSample, NULL, "");
 		}
 	}
 	
@@ -1572,6 +1930,7 @@ proj_t *CGameScript::CompileProjectile(const std::string& dir, const std::string
 	
 	// Load the projectile
 	IniReader ini(dir + "/" + pfile, compilerKeywords);
+	compiledSources.push_back(dir + "/" + pfile);
 	notes << "    Compiling Projectile '" << pfile << "'" << endl;
 	
 	proj->filename = pfile;
@@ -1675,13 +2034,8 @@ proj_t *CGameScript::CompileProjectile(const std::string& dir, const std::string
 				ini.ReadKeyword("General","AnimType",(int*)&proj->AnimType,ANI_ONCE);
 			}
 	
-			if(!bDedicated) {
-				proj->bmpImage = LoadGSImage(dir, proj->ImgFilename);
-				if(!proj->bmpImage)
-					modLog("Could not open image '" + proj->ImgFilename + "'");
-				else
-					proj->bmpShadow = GenerateShadowSurface(proj->bmpImage);
-			}
+			if(!bDedicated)
+				RequestGSImage(dir, proj);
 			break;
 			
 		case __PRJ_LBOUND: case __PRJ_UBOUND: errors << "PRJ BOUND err" << endl;
@@ -1761,6 +2115,7 @@ proj_t *CGameScript::CompileProjectile(const std::string& dir, const std::string
 		proj->Tch.UseSound = true;
 	 */
 	
+	std::vector<int> actionSections; // Section number of the actions
 	{
 		int projHitC = 0;
 		ini.ReadInteger("General", "ActionNum", &projHitC, 0);
@@ -1779,8 +2134,18 @@ proj_t *CGameScript::CompileProjectile(const std::string& dir, const std::string
 			}
 			
 			proj->actions.push_back(act);
+			actionSections.push_back(i+1);
 		}
 	}	
+
+	// All actions are at their final place now, so the samples can be set there later by LoadRequestedAssets()
+	if(!bDedicated) {
+		RequestGSActionSounds(dir, ini.getFileName() + ":Hit", &proj->Hit);
+		RequestGSActionSounds(dir, ini.getFileName() + ":Time", &proj->Timer);
+		RequestGSActionSounds(dir, ini.getFileName() + ":PlayerHit", &proj->PlyHit);
+		for(size_t i = 0; i < proj->actions.size(); ++i)
+			RequestGSActionSounds(dir, ini.getFileName() + ":Action" + itoa(actionSections[i]), &proj->actions[i]);
+	}
 	
 	// Projectile trail
 	if(proj->Trail.Type == TRL_PROJECTILE) {
@@ -2018,18 +2383,10 @@ bool Proj_Action::readFromIni(CGameScript* gs, const std::string& dir, const Ini
 	ini.ReadInteger(section,"Damage",&Damage,Damage);
 	ini.ReadInteger(section,"Shake",&Shake,Shake);
 		
+	// The sample is requested by CGameScript::CompileProjectile() when the action is at its final place
 	UseSound = false;
-	if(ini.ReadString(section,"Sound",SndFilename,"")) {
+	if(ini.ReadString(section,"Sound",SndFilename,""))
 		UseSound = true;
-
-		if(!bDedicated) {
-			// Load the sample
-			Sound = gs->LoadGSSample(dir, SndFilename);
-			
-			if(Sound == NULL)
-				gs->modLog(ini.getFileName() + ":" + section + ": Could not open sound '" + SndFilename + "'");
-		}
-	}
 	
 	ini.ReadFloat(section,"BounceCoeff",&BounceCoeff,BounceCoeff);
 	ini.ReadInteger(section,"BounceExplode",&BounceExplode,BounceExplode);
@@ -2110,10 +2467,7 @@ bool Proj_Action::read(CGameScript* gs, FILE* fp) {
 
 		if(!bDedicated) {
 			// Load the sample
-			Sound = gs->LoadGSSample(gs->sDirectory, SndFilename);
-			
-			if(Sound == NULL)
-				gs->modLog("Could not open sound '" + SndFilename + "'");
+			gs->RequestGSSample(gs->sDirectory, SndFilename, &Sound, NULL, "Could not open sound '" + SndFilename + "'");
 		}
 	}
 	fread_endian<float>(fp, BounceCoeff);
@@ -17,11 +17,22 @@
 #include <cassert>
 #include <zlib.h>
 #include <list>
+#include <map>
+#include <thread>
+#include <cstdio>
+#include <ctime>
+#include <sys/stat.h>
+#ifndef WIN32
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
 
 
 #include "LieroX.h"
 #include "CViewport.h"
 #include "CMap.h"
+#include "MapKernels.h"
 #include "EndianSwap.h"
 #include "MathLib.h"
 #include "Error.h"
@@ -41,6 +52,8 @@
 #include "FileUtils.h"
 #include "EndianSwap.h"
 #include "MapLoader.h"
+#include "ThreadPool.h"
+#include "Condition.h"
 
 
 ////////////////////
@@ -64,6 +77,7 @@ bool CMap::NewFrom(CMap* map)
 	nGridCols = map->nGridCols;
 	nGridRows = map->nGridRows;
 	bMiniMapDirty = map->bMiniMapDirty;
+	MiniMapDirtyRects = map->MiniMapDirtyRects;
 	NumObjects = map->NumObjects;
 	
 	bmpGreenMask = GetCopiedImage(map->bmpGreenMask);
@@ -86,6 +100,8 @@ bool CMap::NewFrom(CMap* map)
 #endif
 	memcpy(GridFlags, map->GridFlags, nGridCols * nGridRows);
 	memcpy(AbsoluteGridFlags, map->AbsoluteGridFlags, nGridCols * nGridRows);
+	SpawnCells = map->SpawnCells;
+	SpawnCellPos = map->SpawnCellPos;
 	memcpy(Objects, map->Objects, MAX_OBJECTS * sizeof(object_t));
 	bmpBackImageHiRes = NULL;
 	if( map->bmpBackImageHiRes.get() )
@@ -125,6 +141,309 @@ bool CMap::LoadFromCache()
 	return NewFrom(cached.get());
 }
 
+
+///////////////
+// Disk cache of loaded maps
+// It contains the complete map state after LoadPostProcess, so that neither the
+// level decoding nor the post processing is needed after a restart.
+// The file is laid out that it can be used directly memory mapped: a fixed header,
+// followed by 16-byte aligned sections in a fixed order (strings, objects,
+// pixel flags, collision grid, grids, surfaces as packed rows).
+// It is only valid for the same level file and for the same settings which affect
+// the post processing. The level file is trusted if it has the same size and timestamp,
+// it is only saved if the level was older than the start of the loading, so a level
+// changed in the same second is not missed. The CRC is only checked if the timestamp differs.
+// MAPDISKCACHE_VERSION has to be increased whenever the layout changes and also
+// whenever LoadPostProcess() or anything it calls (shadows, minimap, grids, dirt count)
+// computes something different, otherwise the old results are loaded from the cache.
+
+#define MAPDISKCACHE_MAGIC		"OLX map cache"
+#define MAPDISKCACHE_VERSION	1
+
+struct MapDiskCacheHeader {
+	char	magic[16];
+	Uint32	version;
+	Uint32	settings;
+	Uint64	sourceSize;
+	Sint64	sourceTime;
+	Uint32	sourceCrc;
+	Uint32	bytesPerPixel, Rmask, Gmask, Bmask, Amask;
+	Uint32	width, height, minimapWidth, minimapHeight;
+	Uint32	type, dirtCount, numObjects, miniMapDirty;
+	Uint32	gridWidth, gridHeight, gridCols, gridRows;
+	Uint32	hasHiRes;
+	Uint32	stringsSize;
+};
+
+// Read-only view of a whole file; memory mapped where possible
+struct MappedFile {
+	const char* data;
+	size_t size;
+#ifndef WIN32
+	void* mapped;
+	MappedFile() : data(NULL), size(0), mapped(NULL) {}
+	~MappedFile() { if(mapped) munmap(mapped, size); }
+#else
+	std::string buffer;
+	MappedFile() : data(NULL), size(0) {}
+#endif
+
+	bool open(const std::string& absfilename) {
+#ifndef WIN32
+		int fd = ::open(absfilename.c_str(), O_RDONLY);
+		if(fd < 0) return false;
+		struct stat st;
+		if(fstat(fd, &st) != 0 || st.st_size <= 0) { close(fd); return false; }
+		void* p = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+		close(fd);
+		if(p == MAP_FAILED) return false;
+		mapped = p;
+		data = (const char*)p;
+		size = (size_t)st.st_size;
+#else
+		buffer = GetFileContents(absfilename, true);
+		data = buffer.data();
+		size = buffer.size();
+#endif
+		return size > 0;
+	}
+};
+
+static std::string MapDiskCacheFilename(const std::string& filename) {
+	std::string name = filename;
+	stringlwr(name);
+	for(std::string::iterator c = name.begin(); c != name.end(); ++c)
+		if(*c == '/' || *c == '\\' || *c == ':') *c = '_';
+	return "cache/maps/" + name + ".olxmap";
+}
+
+static Uint32 MapDiskCacheSettings() {
+	Uint32 settings = 0;
+	if(bDedicated) settings |= 1;
+	if(tLXOptions->bShadows) settings |= 2;
+	if(tLXOptions->bAntiAliasing) settings |= 4;
+	return settings;
+}
+
+// Fills the source file info of the header, returns false if the file cannot be read
+// The file is only read for the CRC if withCrc is set
+static bool MapDiskCacheSourceInfo(const std::string& filename, MapDiskCacheHeader& head, bool withCrc) {
+	struct stat st;
+	if(!StatFile(filename, &st)) return false;
+	head.sourceSize = (Uint64)st.st_size;
+	head.sourceTime = (Sint64)st.st_mtime;
+	head.sourceCrc = 0;
+	if(withCrc) {
+		std::string content = GetFileContents(filename);
+		if(content.size() != (size_t)st.st_size) return false;
+		head.sourceCrc = (Uint32)crc32(0L, (const Bytef*)content.data(), (uInt)content.size());
+	}
+	return true;
+}
+
+static void MapDiskCacheAlign(std::string& out) {
+	while(out.size() % 16) out += '\0';
+}
+
+static size_t MapDiskCacheAlign(size_t pos) {
+	return (pos + 15) & ~(size_t)15;
+}
+
+static bool MapDiskCacheWriteSurface(std::string& out, const SmartPointer<SDL_Surface>& surf) {
+	if(!LockSurface(surf)) return false;
+	const size_t rowSize = surf->w * surf->format->BytesPerPixel;
+	for(int y = 0; y < surf->h; y++)
+		out.append((const char*)surf->pixels + y * surf->pitch, rowSize);
+	UnlockSurface(surf);
+	MapDiskCacheAlign(out);
+	return true;
+}
+
+static bool MapDiskCacheReadSurface(const MappedFile& f, size_t& pos, const SmartPointer<SDL_Surface>& surf) {
+	const size_t rowSize = surf->w * surf->format->BytesPerPixel;
+	if(pos + rowSize * surf->h > f.size) return false;
+	if(!LockSurface(surf)) return false;
+	for(int y = 0; y < surf->h; y++)
+		memcpy((char*)surf->pixels + y * surf->pitch, f.data + pos + y * rowSize, rowSize);
+	UnlockSurface(surf);
+	pos = MapDiskCacheAlign(pos + rowSize * surf->h);
+	return true;
+}
+
+static bool MapDiskCacheReadData(const MappedFile& f, size_t& pos, void* dest, size_t size) {
+	if(pos + size > f.size) return false;
+	memcpy(dest, f.data + pos, size);
+	pos = MapDiskCacheAlign(pos + size);
+	return true;
+}
+
+///////////////
+// Save this map to the disk cache, loadStart is the time when the level file was opened
+void CMap::SaveToDiskCache(Sint64 loadStart)
+{
+	if(!tLXOptions->bMapDiskCache) return;
+	if(bmpGreenMask.get()) return; // not supported, only set by the editor
+
+	MapDiskCacheHeader head;
+	memset(&head, 0, sizeof(head));
+	if(!MapDiskCacheSourceInfo(FileName, head, true)) return;
+	// It could have been changed after we have read it, in the same second
+	if(head.sourceTime >= loadStart) return;
+
+	SDL_PixelFormat* fmt = bmpImage->format;
+	strncpy(head.magic, MAPDISKCACHE_MAGIC, sizeof(head.magic));
+	head.version = MAPDISKCACHE_VERSION;
+	head.settings = MapDiskCacheSettings();
+	head.bytesPerPixel = fmt->BytesPerPixel;
+	head.Rmask = fmt->Rmask; head.Gmask = fmt->Gmask; head.Bmask = fmt->Bmask; head.Amask = fmt->Amask;
+	head.width = Width; head.height = Height;
+	head.minimapWidth = MinimapWidth; head.minimapHeight = MinimapHeight;
+	head.type = Type;
+	head.dirtCount = nTotalDirtCount;
+	head.numObjects = NumObjects;
+	head.miniMapDirty = bMiniMapDirty || !MiniMapDirtyRects.empty();
+	head.gridWidth = nGridWidth; head.gridHeight = nGridHeight;
+	head.gridCols = nGridCols; head.gridRows = nGridRows;
+	head.hasHiRes = bmpBackImageHiRes.get() ? 1 : 0;
+
+	// Strings: name, theme and the additional data, all zero terminated
+	std::string strings = Name + '\0' + Theme.name + '\0';
+	for(std::map<std::string, std::string>::const_iterator it = AdditionalData.begin(); it != AdditionalData.end(); ++it) {
+		strings += it->first + '\0';
+		strings += itoa((int)it->second.size()) + '\0';
+		strings += it->second;
+	}
+	head.stringsSize = (Uint32)strings.size();
+
+	std::string out;
+	out.append((const char*)&head, sizeof(head));
+	MapDiskCacheAlign(out);
+	out += strings; MapDiskCacheAlign(out);
+	out.append((const char*)Objects, MAX_OBJECTS * sizeof(object_t)); MapDiskCacheAlign(out);
+	lockFlags(false);
+	out.append((const char*)PixelFlags, Width * Height); MapDiskCacheAlign(out);
+	out.append((const char*)CollisionGrid, Width * Height); MapDiskCacheAlign(out);
+	out.append((const char*)GridFlags, nGridCols * nGridRows); MapDiskCacheAlign(out);
+	out.append((const char*)AbsoluteGridFlags, nGridCols * nGridRows); MapDiskCacheAlign(out);
+	unlockFlags(false);
+	if(!MapDiskCacheWriteSurface(out, bmpImage)) return;
+	if(!MapDiskCacheWriteSurface(out, bmpDrawImage)) return;
+	if(!MapDiskCacheWriteSurface(out, bmpBackImage)) return;
+	if(!MapDiskCacheWriteSurface(out, bmpMiniMap)) return;
+	if(!MapDiskCacheWriteSurface(out, bmpShadowMap)) return;
+	if(head.hasHiRes && !MapDiskCacheWriteSurface(out, bmpBackImageHiRes)) return;
+
+	// Other processes could read the cache at the same time
+	const std::string cacheFile = GetWriteFullFileName(MapDiskCacheFilename(FileName), true);
+	if(!WriteFileAtomic(cacheFile, out))
+		warnings << "cannot write map disk cache " << cacheFile << endl;
+}
+
+///////////////
+// Try to load the map from the disk cache
+bool CMap::LoadFromDiskCache()
+{
+	if(!tLXOptions->bMapDiskCache) return false;
+
+	MappedFile f;
+	if(!f.open(GetWriteFullFileName(MapDiskCacheFilename(FileName))))
+		return false;
+
+	MapDiskCacheHeader head;
+	if(f.size < sizeof(head)) return false;
+	memcpy(&head, f.data, sizeof(head));
+	if(strncmp(head.magic, MAPDISKCACHE_MAGIC, sizeof(head.magic)) != 0 || head.version != MAPDISKCACHE_VERSION)
+		return false;
+
+	// Check that it is still valid
+	SDL_PixelFormat* fmt = getMainPixelFormat();
+	if(head.settings != MapDiskCacheSettings() || head.bytesPerPixel != fmt->BytesPerPixel ||
+		head.Rmask != fmt->Rmask || head.Gmask != fmt->Gmask || head.Bmask != fmt->Bmask || head.Amask != fmt->Amask)
+		return false;
+	{
+		MapDiskCacheHeader source;
+		if(!MapDiskCacheSourceInfo(FileName, source, false) || source.sourceSize != head.sourceSize)
+			return false;
+		if(source.sourceTime != head.sourceTime &&
+			(!MapDiskCacheSourceInfo(FileName, source, true) || source.sourceCrc != head.sourceCrc))
+			return false;
+	}
+	if(head.numObjects > MAX_OBJECTS) return false;
+
+	// The file must be big enough for the flags and the surfaces, so a broken header doesn't make us allocate a huge map
+	if(head.width == 0 || head.height == 0 || head.width > 0x10000 || head.height > 0x10000) return false;
+	if((Uint64)head.width * head.height * (2 + 3 * head.bytesPerPixel) > f.size) return false;
+	if((Uint64)head.minimapWidth * head.minimapHeight * head.bytesPerPixel > f.size) return false;
+
+	size_t pos = MapDiskCacheAlign(sizeof(head));
+	if(pos + head.stringsSize > f.size) return false;
+	const std::string strings(f.data + pos, head.stringsSize);
+	pos = MapDiskCacheAlign(pos + head.stringsSize);
+
+	// Parse the strings
+	std::vector<std::string> parts;
+	size_t start = 0;
+	for(int i = 0; i < 2; i++) {
+		size_t end = strings.find('\0', start);
+		if(end == std::string::npos) return false;
+		parts.push_back(strings.substr(start, end - start));
+		start = end + 1;
+	}
+	std::map<std::string, std::string> additionalData;
+	while(start < strings.size()) {
+		size_t keyEnd = strings.find('\0', start);
+		if(keyEnd == std::string::npos) return false;
+		size_t sizeEnd = strings.find('\0', keyEnd + 1);
+		if(sizeEnd == std::string::npos) return false;
+		const size_t size = (size_t)from_string<int>(strings.substr(keyEnd + 1, sizeEnd - keyEnd - 1));
+		if(sizeEnd + 1 + size > strings.size()) return false;
+		additionalData[strings.substr(start, keyEnd - start)] = strings.substr(sizeEnd + 1, size);
+		start = sizeEnd + 1 + size;
+	}
+
+	// Create the map (and bmpImage and friends)
+	if (!Create(head.width, head.height, parts[1], head.minimapWidth, head.minimapHeight))
+		return false;
+	bool ok = nGridWidth == (int)head.gridWidth && nGridHeight == (int)head.gridHeight &&
+		nGridCols == (int)head.gridCols && nGridRows == (int)head.gridRows;
+
+	Name = parts[0];
+	Type = head.type;
+	nTotalDirtCount = head.dirtCount;
+	NumObjects = head.numObjects;
+	bMiniMapDirty = head.miniMapDirty != 0;
+	AdditionalData = additionalData;
+
+	ok = ok && MapDiskCacheReadData(f, pos, Objects, MAX_OBJECTS * sizeof(object_t));
+	lockFlags();
+	ok = ok && MapDiskCacheReadData(f, pos, PixelFlags, Width * Height);
+	ok = ok && MapDiskCacheReadData(f, pos, CollisionGrid, Width * Height);
+	ok = ok && MapDiskCacheReadData(f, pos, GridFlags, nGridCols * nGridRows);
+	ok = ok && MapDiskCacheReadData(f, pos, AbsoluteGridFlags, nGridCols * nGridRows);
+	if(ok) calculateSpawnCells();
+	unlockFlags();
+	ok = ok && MapDiskCacheReadSurface(f, pos, bmpImage);
+	ok = ok && MapDiskCacheReadSurface(f, pos, bmpDrawImage);
+	ok = ok && MapDiskCacheReadSurface(f, pos, bmpBackImage);
+	ok = ok && MapDiskCacheReadSurface(f, pos, bmpMiniMap);
+	ok = ok && MapDiskCacheReadSurface(f, pos, bmpShadowMap);
+	if(ok && head.hasHiRes) {
+		bmpBackImageHiRes = gfxCreateSurface(Width*2, Height*2);
+		ok = bmpBackImageHiRes.get() && MapDiskCacheReadSurface(f, pos, bmpBackImageHiRes);
+	}
+
+	if(!ok) {
+		warnings << "map disk cache for " << FileName << " is corrupted" << endl;
+		const std::string filename = FileName;
+		Shutdown();
+		FileName = filename;
+		return false;
+	}
+
+	Created = true;
+	return true;
+}
+
 /////////////////////
 // Returns number of bytes that the map takes in memory
 size_t CMap::GetMemorySize()
@@ -545,7 +864,7 @@ void CMap::UpdateArea(int x, int y, int w, int h, bool update_image)
 	UpdateDrawImage(x, y, w, h);
 
 	// Update minimap
-	UpdateMiniMapRect(x - shadow_update - 10, y - shadow_update - 10, w + 2 * shadow_update + 20, h + 2 * shadow_update + 20);
+	InvalidateMiniMapRect(x - shadow_update - 10, y - shadow_update - 10, w + 2 * shadow_update + 20, h + 2 * shadow_update + 20);
 }
 
 
@@ -668,6 +987,57 @@ bool CMap::CreatePixelFlags()
 }
 
 
+///////////////////
+// Parallel processing of the whole map (used when loading)
+
+typedef void (CMap::*MapBandFct)(int y, int h);
+
+struct MapBandAction : Action {
+	CMap* map;
+	MapBandFct fct;
+	int y, h;
+	int handle() { (map->*fct)(y, h); return 0; }
+};
+
+static int MapBandThreadNum() {
+	return CLAMP((int)std::thread::hardware_concurrency(), 1, 16);
+}
+
+// Splits the rows [begin, end) into bands of at least minBand rows and calls (map->*fct) for
+// each of them, in parallel on the thread pool. The bands must not write into the same memory.
+// With alternate, the even bands are done first and the odd bands after that. This way,
+// a band can also write into the first minBand rows of the following band.
+static void ForEachMapBand(CMap* map, MapBandFct fct, int begin, int end, int minBand, bool alternate) {
+	const int rows = end - begin;
+	if(rows <= 0) return;
+	int bandNum = MIN(MapBandThreadNum() * (alternate ? 2 : 1), rows / MAX(minBand, 1));
+	if(threadPool == NULL || bandNum <= 1) {
+		(map->*fct)(begin, rows);
+		return;
+	}
+
+	std::vector<MapBandAction> bands(bandNum);
+	for(int b = 0; b < bandNum; b++) {
+		bands[b].map = map;
+		bands[b].fct = fct;
+		bands[b].y = begin + (int)((long long)rows * b / bandNum);
+		bands[b].h = begin + (int)((long long)rows * (b + 1) / bandNum) - bands[b].y;
+	}
+
+	const int rounds = alternate ? 2 : 1;
+	for(int r = 0; r < rounds; r++) {
+		// The first band of the round is done by ourself, the others by the thread pool.
+		// ThreadPool deletes the given action, so we give it a copy.
+		std::vector<ThreadPoolItem*> threads;
+		for(int b = r + rounds; b < bandNum; b += rounds)
+			threads.push_back(threadPool->start(new MapBandAction(bands[b]), "map processing"));
+		bands[r].handle();
+		for(size_t t = 0; t < threads.size(); t++)
+			threadPool->wait(threads[t], NULL);
+	}
+}
+
+
 ///////////////////
 // Create the AI Grid
 bool CMap::createGrid() {
@@ -691,6 +1061,8 @@ bool CMap::createGrid() {
     }
 	memset(GridFlags,PX_EMPTY,nGridCols*nGridRows*sizeof(uchar));
 	memset(AbsoluteGridFlags,PX_EMPTY,nGridCols*nGridRows*sizeof(uchar));
+	SpawnCells.clear();
+	SpawnCellPos.clear(); // calculated by calculateGrid
 	unlockFlags();
 
     return true;
@@ -702,15 +1074,88 @@ bool CMap::createGrid() {
 void CMap::calculateGrid()
 {
 	lockFlags();
-    for(uint y=0; y<Height; y+=nGridHeight)  {
-        for(uint x=0; x<Width; x+=nGridWidth) {
-            calculateGridCell(x,y, false);
-        }
-    }
+	SpawnCellPos.clear(); // no incremental updates, we calculate it afterwards
+	ForEachMapBand(this, &CMap::calculateGridBand, 0, (Height + nGridHeight - 1) / nGridHeight, 4, false);
+	calculateSpawnCells();
     unlockFlags();
 }
 
 
+///////////////////
+// Calculate the grid rows [y, y+h)
+// WARNING: not thread-safe (the caller has to ensure the threadsafty!)
+void CMap::calculateGridBand(int y, int h)
+{
+	for(int j = y; j < y + h; j++)
+		for(uint x=0; x<Width; x+=nGridWidth)
+			calculateGridCell(x, j * nGridHeight, false);
+}
+
+
+///////////////////
+// Check if a worm can be spawned in the grid cell
+// This is the same condition as GameServer::FindSpot always used
+bool CMap::isSpawnCell(int i, int j) const
+{
+	// Note: -1 because the grid is slightly larger than the level size
+	const int cols = nGridCols - 1;
+	const int rows = nGridRows - 1;
+	if(i < 0 || j < 0 || i >= cols || j >= rows) return false;
+	if(i + j < 6) return false; // Do not spawn in top left corner
+
+	const uchar *cell = AbsoluteGridFlags + j*nGridCols + i;
+	if(*cell & PX_ROCK) return false;
+	if(i == 0 || (*(cell - 1) & PX_ROCK)) return false;
+	if(i == cols - 1 || (*(cell + 1) & PX_ROCK)) return false;
+	if(j == 0 || (*(cell - nGridCols) & PX_ROCK)) return false;
+	if(j == rows - 1 || (*(cell + nGridCols) & PX_ROCK)) return false;
+	return true;
+}
+
+
+///////////////////
+// Add or remove the grid cell from the spawn index
+// WARNING: not thread-safe (the caller has to ensure the threadsafty!)
+void CMap::updateSpawnCell(int i, int j)
+{
+	if(i < 0 || j < 0 || i >= nGridCols || j >= nGridRows) return;
+
+	const int idx = j*nGridCols + i;
+	const bool spawnCell = isSpawnCell(i, j);
+	int& pos = SpawnCellPos[idx];
+	if(spawnCell == (pos >= 0)) return;
+
+	if(spawnCell) {
+		pos = (int)SpawnCells.size();
+		SpawnCells.push_back(idx);
+	}
+	else {
+		// swap with the last one, the order doesn't matter
+		const int last = SpawnCells.back();
+		SpawnCells[pos] = last;
+		SpawnCellPos[last] = pos;
+		SpawnCells.pop_back();
+		pos = -1;
+	}
+}
+
+
+///////////////////
+// Build the spawn index from the grid
+// WARNING: not thread-safe (the caller has to ensure the threadsafty!)
+void CMap::calculateSpawnCells()
+{
+	SpawnCells.clear();
+	SpawnCellPos.assign(nGridCols * nGridRows, -1);
+	for(int j = 0; j < nGridRows; j++)
+		for(int i = 0; i < nGridCols; i++)
+			if(isSpawnCell(i, j)) {
+				SpawnCellPos[j*nGridCols + i] = (int)SpawnCells.size();
+				SpawnCells.push_back(j*nGridCols + i);
+			}
+}
+
+
 ///////////////////
 // Calculate a single grid cell
 // x & y are pixel locations, not grid cell locations
@@ -752,12 +1197,22 @@ void CMap::calculateGridCell(int x, int y, bool bSkipEmpty)
         }
     }
 
+    const uchar oldAbs = *abs_cell;
     *abs_cell = PX_EMPTY;
     if(dirtCount > 0)
     	*abs_cell |= PX_DIRT;
     if(rockCount > 0)
     	*abs_cell |= PX_ROCK;
 
+	// Rock changes affect the spawn points of this and the neighbour cells
+	if(((oldAbs ^ *abs_cell) & PX_ROCK) && !SpawnCellPos.empty()) {
+		updateSpawnCell(i, j);
+		updateSpawnCell(i - 1, j);
+		updateSpawnCell(i + 1, j);
+		updateSpawnCell(i, j - 1);
+		updateSpawnCell(i, j + 1);
+	}
+
     int size = nGridWidth*nGridHeight / 10;
 
     // If the dirt or rock count is greater than a 10th, the cell is flagged
@@ -784,6 +1239,28 @@ int CMap::getCollGridCellW() const {
 	return 10;
 }
 
+///////////////////
+// Calculate the collision grid for the whole map
+void CMap::calculateCollisionGrid()
+{
+	const int ch = getCollGridCellH();
+	if((int)Height < 4 * ch) {
+		calculateCollisionGridArea(0, 0, Width, Height);
+		return;
+	}
+
+	// The top and bottom border are handled extra by calculateCollisionGridArea
+	// and could overlap with other bands, thus do them first
+	calculateCollisionGridArea(0, 0, Width, ch);
+	calculateCollisionGridArea(0, Height - ch - 1, Width, ch + 1);
+	ForEachMapBand(this, &CMap::calculateCollisionGridBand, ch, Height - ch - 1, 16, false);
+}
+
+void CMap::calculateCollisionGridBand(int y, int h)
+{
+	calculateCollisionGridArea(0, y, Width, h);
+}
+
 void CMap::calculateCollisionGridArea(int x, int y, int w, int h)
 {
 	const int cw = getCollGridCellW();
@@ -1267,93 +1744,34 @@ int CMap::CarveHole(int size, CVec pos, bool wrapAround)
 	if (!LockSurface(hole))
 		return 0;
 
-	Uint8* hole_px = (Uint8 *)hole.get()->pixels;
-	uchar* PixelFlag = PixelFlags + map_y * Width + map_x;
+	// Hi-res image is drawn directly, 2x2 pixels per map pixel
+	MapKernelRow row;
+	row.width = w;
+	row.bpp = bpp;
+	row.doubled = bmpBackImageHiRes.get() != NULL;
+	SmartPointer<SDL_Surface> image = row.doubled ? bmpDrawImage : bmpImage;
+	const int scale = row.doubled ? 2 : 1;
+	row.dstPitch = image.get()->pitch;
+
+	if (!LockSurface(image))  {
+		UnlockSurface(hole);
+		return 0;
+	}
 
-	int HoleRowStep = hole.get()->pitch - (w * bpp);
-	int PixelFlagRowStep = Width - w;
+	const Uint32 pink = tLX->clPink.get(hole.get()->format);
+	const Uint32 black = tLX->clBlack.get(hole.get()->format);
 
 	// Lock
 	lockFlags();
 
-	if( bmpBackImageHiRes.get() ) // Hi-res image
-	{
-		if (!LockSurface(bmpDrawImage))
-			return 0;
-		Uint8* mapimage_px = (Uint8 *)bmpDrawImage.get()->pixels + map_y * 2 * bmpDrawImage.get()->pitch + map_x * bpp * 2;
-		int MapImageRowSize = bmpDrawImage.get()->pitch;
-		int MapImageRowStep = bmpDrawImage.get()->pitch * 2 - (w * bpp * 2);
-		for(int hy = h; hy; --hy)  
-		{
-			for(int hx = w; hx; --hx) 
-			{
-				if (*PixelFlag & PX_DIRT)  // Carve only dirt
-				{
-					Uint32 CurrentPixel = GetPixelFromAddr(hole_px, bpp);
-					// Set the flag to empty
-					if(CurrentPixel == tLX->clPink.get(hole.get()->format)) 
-					{
-						// Increase the dirt count
-						nNumDirt++;
-						*PixelFlag = PX_EMPTY;
-					} 
-					else if(CurrentPixel != tLX->clBlack.get(hole.get()->format)) // Put pixels that are not black/pink (eg, brown)
-					{
-						PutPixelToAddr(mapimage_px, CurrentPixel, bpp);
-						PutPixelToAddr(mapimage_px+bpp, CurrentPixel, bpp);
-						PutPixelToAddr(mapimage_px+MapImageRowSize, CurrentPixel, bpp);
-						PutPixelToAddr(mapimage_px+MapImageRowSize+bpp, CurrentPixel, bpp);
-					}
-				}
-				hole_px += bpp;
-				mapimage_px += bpp * 2;
-				PixelFlag++;
-			}
-			hole_px += HoleRowStep;
-			mapimage_px += MapImageRowStep;
-			PixelFlag += PixelFlagRowStep;
-		}
-		UnlockSurface(bmpDrawImage);
+	for(int hy = 0; hy < h; hy++)  {
+		row.src = (Uint8 *)hole.get()->pixels + hy * hole.get()->pitch;
+		row.flags = PixelFlags + (map_y + hy) * Width + map_x;
+		row.dst = (Uint8 *)image.get()->pixels + (map_y + hy) * scale * row.dstPitch + map_x * bpp * scale;
+		nNumDirt += CarveHoleRow(row, pink, black);
 	}
-	else // Low-res image
-	{
-		if (!LockSurface(bmpImage))
-			return 0;
-		Uint8* mapimage_px = (Uint8 *)bmpImage.get()->pixels + map_y * bmpImage.get()->pitch + map_x * bpp;
-		int MapImageRowStep = bmpImage.get()->pitch - (w * bpp);
-		for(int hy = h; hy; --hy)  {
-			for(int hx = w; hx; --hx) {
 
-				// Carve only dirt
-				if (*PixelFlag & PX_DIRT)  {
-
-					Uint32 CurrentPixel = GetPixelFromAddr(hole_px, bpp);
-
-					// Set the flag to empty
-					if(CurrentPixel == tLX->clPink.get(hole.get()->format)) {
-
-						// Increase the dirt count
-						nNumDirt++;
-
-						*PixelFlag = PX_EMPTY;
-
-					// Put pixels that are not black/pink (eg, brown)
-					} else if(CurrentPixel != tLX->clBlack.get(hole.get()->format))
-						PutPixelToAddr(mapimage_px, CurrentPixel, bpp);
-				}
-
-				hole_px += bpp;
-				mapimage_px += bpp;
-				PixelFlag++;
-
-			}
-
-			hole_px += HoleRowStep;
-			mapimage_px += MapImageRowStep;
-			PixelFlag += PixelFlagRowStep;
-		}
-		UnlockSurface(bmpImage);
-	}
+	UnlockSurface(image);
 
 	unlockFlags();
 
@@ -1484,12 +1902,8 @@ int CMap::CarveHole(int size, CVec pos)
 int CMap::PlaceDirt(int size, CVec pos)
 {
 	SmartPointer<SDL_Surface> hole;
-	int dx,dy, sx,sy;
-	int x,y;
+	int sx,sy;
 	int w,h;
-	int ix,iy;
-	Uint32 pixel, pixel2;
-	uchar flag;
 
     int nDirtCount = 0;
 
@@ -1510,12 +1924,10 @@ int CMap::PlaceDirt(int size, CVec pos)
 
 	if (!LockSurface(hole))
 		return 0;
-	if (!LockSurface(Theme.bmpFronttile))
+	if (!LockSurface(Theme.bmpFronttile))  {
+		UnlockSurface(hole);
 		return 0;
-
-	Uint8 *p;
-	uchar *px;
-	Uint8 *p2;
+	}
 
 	short screenbpp = getMainPixelFormat()->BytesPerPixel;
 
@@ -1527,104 +1939,37 @@ int CMap::PlaceDirt(int size, CVec pos)
 	int hole_clip_y = -MIN(sy,(int)0);
 	int hole_clip_x = -MIN(sx,(int)0);
 
-	lockFlags();
-
-	if( bmpBackImageHiRes.get() ) // Hi-res image
-	{
-		if (!LockSurface(bmpDrawImage))
-			return 0;
-		// Go through the pixels in the hole, setting the flags to dirt
-		int DrawImagePitch = bmpDrawImage.get()->pitch;
-		for(y = hole_clip_y, dy = clip_y; dy < clip_h; y++, dy++) {
-
-			p = (Uint8 *)hole.get()->pixels + y * hole.get()->pitch + hole_clip_x * hole.get()->format->BytesPerPixel;
-			px = PixelFlags + dy * Width + clip_x;
-			p2 = (Uint8 *)bmpDrawImage.get()->pixels + dy * 2 * bmpDrawImage.get()->pitch + clip_x * 2 * bmpDrawImage.get()->format->BytesPerPixel;
-
-			for(x=hole_clip_x,dx=clip_x;dx<clip_w;x++,dx++) {
-
-				pixel = GetPixelFromAddr(p, screenbpp);
-				flag = *(uchar *)px;
-
-				ix = dx % Theme.bmpFronttile.get()->w;
-				iy = dy % Theme.bmpFronttile.get()->h;
-
-				// Set the flag to empty
-				if(!IsTransparent(hole.get(), pixel) && !(flag & PX_ROCK)) {
-                    if( flag & PX_EMPTY )
-                        nDirtCount++;
-
-					*(uchar*)px = PX_DIRT;
-					pixel2 = GetPixel(Theme.bmpFronttile.get(), ix, iy);
-					// Place the dirt image
-					PutPixelToAddr(p2, pixel2, screenbpp);
-					PutPixelToAddr(p2+screenbpp, pixel2, screenbpp);
-					PutPixelToAddr(p2+DrawImagePitch, pixel2, screenbpp);
-					PutPixelToAddr(p2+DrawImagePitch+screenbpp, pixel2, screenbpp);
-				}
-
-				// Put pixels that are not black/pink (eg, brown)
-                if(!IsTransparent(hole.get(), pixel) && pixel != pink && (flag & PX_EMPTY)) {
-					PutPixelToAddr(p2, pixel, screenbpp);
-					PutPixelToAddr(p2+screenbpp, pixel, screenbpp);
-					PutPixelToAddr(p2+DrawImagePitch, pixel, screenbpp);
-					PutPixelToAddr(p2+DrawImagePitch+screenbpp, pixel, screenbpp);
-                    *(uchar*)px = PX_DIRT;
-                    nDirtCount++;
-                }
-
-				p += screenbpp;
-				p2 += screenbpp * 2;
-				px++;
-			}
-		}
-		UnlockSurface(bmpDrawImage);
+	// Hi-res image is drawn directly, 2x2 pixels per map pixel
+	MapKernelRow row;
+	row.width = clip_w - clip_x;
+	row.bpp = screenbpp;
+	row.doubled = bmpBackImageHiRes.get() != NULL;
+	SmartPointer<SDL_Surface> image = row.doubled ? bmpDrawImage : bmpImage;
+	const int scale = row.doubled ? 2 : 1;
+	row.dstPitch = image.get()->pitch;
+	const MapKernelTransparency transp(hole.get());
+	SDL_Surface* tile = Theme.bmpFronttile.get();
+
+	if (!LockSurface(image))  {
+		UnlockSurface(hole);
+		UnlockSurface(Theme.bmpFronttile);
+		return 0;
 	}
-	else // Low-res image
-	{
-		if (!LockSurface(bmpImage))
-			return 0;
-		// Go through the pixels in the hole, setting the flags to dirt
-		for(y = hole_clip_y, dy = clip_y; dy < clip_h; y++, dy++) {
-
-			p = (Uint8 *)hole.get()->pixels + y * hole.get()->pitch + hole_clip_x * hole.get()->format->BytesPerPixel;
-			px = PixelFlags + dy * Width + clip_x;
-			p2 = (Uint8 *)bmpImage.get()->pixels + dy * bmpImage.get()->pitch + clip_x * bmpImage.get()->format->BytesPerPixel;
 
-			for(x=hole_clip_x,dx=clip_x;dx<clip_w;x++,dx++) {
-
-				pixel = GetPixelFromAddr(p, screenbpp);
-				flag = *(uchar *)px;
-
-				ix = dx % Theme.bmpFronttile.get()->w;
-				iy = dy % Theme.bmpFronttile.get()->h;
-
-				// Set the flag to empty
-				if(!IsTransparent(hole.get(), pixel) && !(flag & PX_ROCK)) {
-                    if( flag & PX_EMPTY )
-                        nDirtCount++;
-
-					*(uchar*)px = PX_DIRT;
-
-					// Place the dirt image
-					PutPixelToAddr(p2, GetPixel(Theme.bmpFronttile.get(), ix, iy), screenbpp);
-				}
+	lockFlags();
 
-				// Put pixels that are not black/pink (eg, brown)
-                if(!IsTransparent(hole.get(), pixel) && pixel != pink && (flag & PX_EMPTY)) {
-					PutPixelToAddr(p2, pixel, screenbpp);
-                    *(uchar*)px = PX_DIRT;
-                    nDirtCount++;
-                }
+	// Go through the pixels in the hole, setting the flags to dirt
+	for(int y = hole_clip_y, dy = clip_y; dy < clip_h; y++, dy++) {
+		row.src = (Uint8 *)hole.get()->pixels + y * hole.get()->pitch + hole_clip_x * hole.get()->format->BytesPerPixel;
+		row.flags = PixelFlags + dy * Width + clip_x;
+		row.dst = (Uint8 *)image.get()->pixels + dy * scale * row.dstPitch + clip_x * scale * screenbpp;
 
-				p += screenbpp;
-				p2 += screenbpp;
-				px++;
-			}
-		}
-		UnlockSurface(bmpImage);
+		nDirtCount += PlaceDirtRow(row, transp, pink,
+								   (Uint8 *)tile->pixels + (dy % tile->h) * tile->pitch, tile->w, clip_x % tile->w);
 	}
 
+	UnlockSurface(image);
+
 	unlockFlags();
 
 	UnlockSurface(hole);
@@ -1653,11 +1998,8 @@ int CMap::PlaceGreenDirt(CVec pos)
 		return 0;
 	}
 	
- 	int dx,dy, sx,sy;
-	int x,y;
+ 	int sx,sy;
 	int w,h;
-	Uint32 pixel;
-	uchar flag;
     const Uint32 green = MakeColour(0,255,0);
 	const Uint32 pink = MakeColour(255,0,255);
     const Uint32 greens[4] = {MakeColour(148,136,0),
@@ -1678,11 +2020,6 @@ int CMap::PlaceGreenDirt(CVec pos)
 	if (!LockSurface(bmpGreenMask))
 		return 0;
 
-	Uint8 *p;
-	uchar *px;
-	Uint8 *p2;
-	Uint32 gr;
-
 	// Calculate clipping
 	int clip_y = MAX(sy, 0);
 	int clip_x = MAX(sx, 0);
@@ -1693,104 +2030,35 @@ int CMap::PlaceGreenDirt(CVec pos)
 
 	short screenbpp = getMainPixelFormat()->BytesPerPixel;
 
-	lockFlags();
-
-	if( bmpBackImageHiRes.get() ) // Hi-res image
-	{
-		if (!LockSurface(bmpDrawImage))
-			return 0;
-		// Go through the pixels in the hole, setting the flags to dirt
-		int DrawImagePitch = bmpDrawImage.get()->pitch;
-		for(y = green_clip_y, dy=clip_y; dy < clip_h; y++, dy++) {
-
-			p = (Uint8*)bmpGreenMask.get()->pixels
-				+ y * bmpGreenMask.get()->pitch
-				+ green_clip_x * bmpGreenMask.get()->format->BytesPerPixel;
-			px = PixelFlags + dy * Width + clip_x;
-			p2 = (Uint8 *)bmpDrawImage.get()->pixels + dy * 2 * bmpDrawImage.get()->pitch + clip_x * 2 * bmpDrawImage.get()->format->BytesPerPixel;
-
-			for(x = green_clip_x, dx=clip_x; dx < clip_w; x++, dx++) {
-
-				pixel = GetPixelFromAddr(p,screenbpp);
-				flag = *(uchar*)px;
-
-				// Set the flag to dirt
-				if(pixel == green && (flag & PX_EMPTY)) {
-					*(uchar*)px = PX_DIRT;
-					nGreenCount++;
-
-					// Place a random green pixel
-					gr = greens[ GetRandomInt(3) ];
-
-					// Place the green pixel
-					PutPixelToAddr(p2, gr, screenbpp);
-					PutPixelToAddr(p2+screenbpp, gr, screenbpp);
-					PutPixelToAddr(p2+DrawImagePitch, gr, screenbpp);
-					PutPixelToAddr(p2+DrawImagePitch+screenbpp, gr, screenbpp);
-				}
-
-				// Put pixels that are not green/pink (eg, dark green)
-                if(pixel != green && pixel != pink && (flag & PX_EMPTY)) {
-					PutPixelToAddr(p2, pixel, screenbpp);
-					PutPixelToAddr(p2+screenbpp, pixel, screenbpp);
-					PutPixelToAddr(p2+DrawImagePitch, pixel, screenbpp);
-					PutPixelToAddr(p2+DrawImagePitch+screenbpp, pixel, screenbpp);
-					*(uchar*)px = PX_DIRT;
-					nGreenCount++;
-                }
-
-				p += screenbpp;
-				p2 += screenbpp * 2;
-				px++;
-			}
-		}
-		UnlockSurface(bmpDrawImage);
+	// Hi-res image is drawn directly, 2x2 pixels per map pixel
+	MapKernelRow row;
+	row.width = clip_w - clip_x;
+	row.bpp = screenbpp;
+	row.doubled = bmpBackImageHiRes.get() != NULL;
+	SmartPointer<SDL_Surface> image = row.doubled ? bmpDrawImage : bmpImage;
+	const int scale = row.doubled ? 2 : 1;
+	row.dstPitch = image.get()->pitch;
+
+	if (!LockSurface(image))  {
+		UnlockSurface(bmpGreenMask);
+		return 0;
 	}
-	else // Low-res image
-	{
-		if (!LockSurface(bmpImage))
-			return 0;
-		// Go through the pixels in the hole, setting the flags to dirt
-		for(y = green_clip_y, dy=clip_y; dy < clip_h; y++, dy++) {
-
-			p = (Uint8*)bmpGreenMask.get()->pixels
-				+ y * bmpGreenMask.get()->pitch
-				+ green_clip_x * bmpGreenMask.get()->format->BytesPerPixel;
-			px = PixelFlags + dy * Width + clip_x;
-			p2 = (Uint8 *)bmpImage.get()->pixels + dy * bmpImage.get()->pitch + clip_x * bmpImage.get()->format->BytesPerPixel;
-
-			for(x = green_clip_x, dx=clip_x; dx < clip_w; x++, dx++) {
 
-				pixel = GetPixelFromAddr(p,screenbpp);
-				flag = *(uchar*)px;
-
-				// Set the flag to dirt
-				if(pixel == green && (flag & PX_EMPTY)) {
-					*(uchar*)px = PX_DIRT;
-                    nGreenCount++;
-
-                    // Place a random green pixel
-                    gr = greens[ GetRandomInt(3) ];
-
-					// Place the green pixel
-					PutPixelToAddr(p2, gr, screenbpp);
-				}
+	lockFlags();
 
-				// Put pixels that are not green/pink (eg, dark green)
-                if(pixel != green && pixel != pink && (flag & PX_EMPTY)) {
-					PutPixelToAddr(p2, pixel, screenbpp);
-                    *(uchar*)px = PX_DIRT;
-                    nGreenCount++;
-                }
+	// Go through the pixels in the mask, setting the flags to dirt
+	for(int y = green_clip_y, dy = clip_y; dy < clip_h; y++, dy++) {
+		row.src = (Uint8*)bmpGreenMask.get()->pixels
+			+ y * bmpGreenMask.get()->pitch
+			+ green_clip_x * bmpGreenMask.get()->format->BytesPerPixel;
+		row.flags = PixelFlags + dy * Width + clip_x;
+		row.dst = (Uint8 *)image.get()->pixels + dy * scale * row.dstPitch + clip_x * scale * screenbpp;
 
-				p += screenbpp;
-				p2 += screenbpp;
-				px++;
-			}
-		}
-		UnlockSurface(bmpImage);
+		nGreenCount += PlaceGreenDirtRow(row, green, pink, greens);
 	}
 
+	UnlockSurface(image);
+
 	unlockFlags();
 
 	UnlockSurface(bmpGreenMask);
@@ -1970,6 +2238,45 @@ void CMap::ApplyShadow(int sx, int sy, int w, int h)
 	// Draw shadows?
 	if(!tLXOptions->bShadows) return;
 
+	LOCK_OR_QUIT(bmpShadowMap);
+	SmartPointer<SDL_Surface> image = bmpBackImageHiRes.get() ? bmpDrawImage : bmpImage;
+	if(!LockSurface(image)) {
+		UnlockSurface(bmpShadowMap);
+		return;
+	}
+
+	lockFlags();
+
+	// Big areas (i.e. when loading the map) are done in parallel
+	if(h >= 256) {
+		shadowBandX = sx;
+		shadowBandW = w;
+		ForEachMapBand(this, &CMap::ApplyShadowBand, MAX(sy, 0), MIN(sy + h, (int)Height), 32, true);
+	}
+	else
+		ApplyShadow_Internal(sx, sy, w, h);
+
+	unlockFlags();
+
+	UnlockSurface(image);
+	UnlockSurface(bmpShadowMap);
+
+	// The shadow is dropped to the bottom right of the area
+	InvalidateMiniMapRect(sx, sy, w + SHADOW_DROP, h + SHADOW_DROP);
+}
+
+void CMap::ApplyShadowBand(int y, int h)
+{
+	ApplyShadow_Internal(shadowBandX, y, shadowBandW, h);
+}
+
+
+///////////////////
+// Apply a shadow to an area
+// WARNING: the flags, bmpShadowMap and bmpDrawImage/bmpImage must be locked
+// HINT: the shadow is drawn up to SHADOW_DROP pixels below the area
+void CMap::ApplyShadow_Internal(int sx, int sy, int w, int h)
+{
 	int x, y, n;
 	uchar *px;
 	uchar *p;
@@ -1981,10 +2288,6 @@ void CMap::ApplyShadow(int sx, int sy, int w, int h)
 
 	int screenbpp = getMainPixelFormat()->BytesPerPixel;
 
-	LOCK_OR_QUIT(bmpShadowMap);
-
-	lockFlags();
-
 	int clip_y = MAX(sy, (int)0);
 	int clip_x = MAX(sx, (int)0);
 	int clip_h = MIN(sy + h, Height);
@@ -1992,7 +2295,6 @@ void CMap::ApplyShadow(int sx, int sy, int w, int h)
 
 	if( bmpBackImageHiRes.get() ) // Hi-res image
 	{
-		LOCK_OR_QUIT(bmpDrawImage);
 		int DrawImagePitch = bmpDrawImage.get()->pitch;
 		int ShadowMapPitch = bmpShadowMap.get()->pitch;
 		for(y = clip_y; y < clip_h; y++) 
@@ -2033,11 +2335,9 @@ void CMap::ApplyShadow(int sx, int sy, int w, int h)
 				px++;
 			}
 		}
-		UnlockSurface(bmpDrawImage);
 	}
 	else // Low-res image
 	{
-		LOCK_OR_QUIT(bmpImage);
 		for(y = clip_y; y < clip_h; y++) {
 
 			px = PixelFlags + y * Width + clip_x;
@@ -2077,14 +2377,7 @@ void CMap::ApplyShadow(int sx, int sy, int w, int h)
 				px++;
 			}
 		}
-		UnlockSurface(bmpImage);
 	}
-
-	unlockFlags();
-
-	UnlockSurface(bmpShadowMap);
-
-	bMiniMapDirty = true;
 }
 
 
@@ -2273,7 +2566,7 @@ void CMap::PlaceMisc(int id, CVec pos)
 	// Update the draw image
 	UpdateDrawImage(sx, sy, clip_w, clip_h);
 
-	bMiniMapDirty = true;
+	InvalidateMiniMapRect(sx, sy, clip_w, clip_h);
 }
 
 
@@ -2301,7 +2594,17 @@ void CMap::PutImagePixel(uint x, uint y, Color colour)
 void CMap::UpdateMiniMap(bool force)
 {
 	if(bDedicated) return;
-	if(!bMiniMapDirty && !force) return;
+
+	// Only some areas changed, resample just them
+	if(!bMiniMapDirty && !force) {
+		if(MiniMapDirtyRects.empty()) return;
+
+		std::vector<SDL_Rect> rects;
+		rects.swap(MiniMapDirtyRects);
+		for(std::vector<SDL_Rect>::const_iterator r = rects.begin(); r != rects.end(); ++r)
+			UpdateMiniMapRect(r->x, r->y, r->w, r->h);
+		return;
+	}
 
 	if(!bmpMiniMap.get()) {
 		errors << "CMap::UpdateMiniMap: minimap surface not initialised" << endl;
@@ -2330,6 +2633,7 @@ void CMap::UpdateMiniMap(bool force)
 
 	// Not dirty anymore
 	bMiniMapDirty = false;
+	MiniMapDirtyRects.clear();
 }
 
 ///////////////////
@@ -2345,6 +2649,10 @@ void CMap::UpdateMiniMapRect(int x, int y, int w, int h)
 
 	if( bmpBackImageHiRes.get() )
 	{
+		// The draw image is twice as big as bmpImage
+		x *= 2; y *= 2;
+		w *= 2; h *= 2;
+
 		// Calculate ratios
 		const float xratio = (float)bmpMiniMap.get()->w / (float)bmpDrawImage.get()->w;
 		const float yratio = (float)bmpMiniMap.get()->h / (float)bmpDrawImage.get()->h;
@@ -2373,6 +2681,55 @@ void CMap::UpdateMiniMapRect(int x, int y, int w, int h)
 	}
 }
 
+///////////////////
+// Mark an area of the minimap for update
+// X, Y, W and H apply to the bmpImage, not bmpMinimap
+// The areas are collected and resampled in one go by UpdateMiniMap, which DrawMiniMap calls once per frame
+void CMap::InvalidateMiniMapRect(int x, int y, int w, int h)
+{
+	if(bDedicated) return;
+
+	// If the minimap is going to be fully repainted, just move on
+	if (bMiniMapDirty)
+		return;
+
+	// Clipping
+	int x2 = MIN(x + w, (int)Width);
+	int y2 = MIN(y + h, (int)Height);
+	x = MAX(x, 0);
+	y = MAX(y, 0);
+	if (x >= x2 || y >= y2)
+		return;
+
+	// Merge with the areas we overlap or touch, the union can then hit some other area again
+	for (size_t i = 0; i < MiniMapDirtyRects.size(); ) {
+		const SDL_Rect& r = MiniMapDirtyRects[i];
+		if (r.x <= x2 && x <= r.x + r.w && r.y <= y2 && y <= r.y + r.h) {
+			x = MIN(x, (int)r.x);
+			y = MIN(y, (int)r.y);
+			x2 = MAX(x2, r.x + r.w);
+			y2 = MAX(y2, r.y + r.h);
+			MiniMapDirtyRects[i] = MiniMapDirtyRects.back();
+			MiniMapDirtyRects.pop_back();
+			i = 0;
+		} else
+			++i;
+	}
+
+	SDL_Rect rect = { (Sint16)x, (Sint16)y, (Uint16)(x2 - x), (Uint16)(y2 - y) };
+	MiniMapDirtyRects.push_back(rect);
+
+	// With many or big areas, resampling the whole minimap is cheaper
+	static const size_t MAX_MINIMAP_RECTS = 32;
+	size_t area = 0;
+	for (std::vector<SDL_Rect>::const_iterator r = MiniMapDirtyRects.begin(); r != MiniMapDirtyRects.end(); ++r)
+		area += r->w * r->h;
+	if (MiniMapDirtyRects.size() > MAX_MINIMAP_RECTS || area > (size_t)Width * Height / 2) {
+		MiniMapDirtyRects.clear();
+		bMiniMapDirty = true;
+	}
+}
+
 
 void CMap::drawOnMiniMap(SDL_Surface* bmpDest, uint miniX, uint miniY, const CVec& pos, Uint8 r, Uint8 g, Uint8 b, bool big, bool special) {
 	if(bDedicated) return;
@@ -2446,9 +2803,8 @@ void CMap::DrawMiniMap(SDL_Surface * bmpDest, uint x, uint y, TimeDiff dt, CWorm
 		return;
 
 
-	// Update the minimap (only if dirty)
-	if(bMiniMapDirty)
-		UpdateMiniMap();
+	// Update the minimap (only the dirty parts)
+	UpdateMiniMap();
 
 
 	// Draw the minimap
@@ -2485,13 +2841,77 @@ void CMap::DrawMiniMap(SDL_Surface * bmpDest, uint x, uint y, TimeDiff dt, CWorm
 	}
 }
 
+///////////////////
+// Background loading of maps into the cache
+
+struct MapPreloader {
+	Mutex mutex;
+	Condition finished;
+	std::map<std::string, CMap*> loading; // lower case filename -> map which is loaded
+};
+static MapPreloader mapPreloader;
+
+void CMap::PreloadInBackground(const std::string& filename)
+{
+	if (filename == "") return;
+	std::string file = filename;
+	stringlwr(file);
+
+	CMap* map = NULL;
+	{
+		Mutex::ScopedLock lock(mapPreloader.mutex);
+		if (mapPreloader.loading.find(file) != mapPreloader.loading.end())
+			return;
+		if (cCache.GetMap(filename).get())
+			return;
+		map = new CMap;
+		mapPreloader.loading[file] = map;
+	}
+
+	struct Preloader : Action {
+		std::string filename, file;
+		CMap* map;
+		int handle() {
+			// Load puts the map into the cache
+			if (!map->LoadWithoutAni(filename))
+				warnings << "preloading map " << filename << " failed" << endl;
+			delete map;
+
+			Mutex::ScopedLock lock(mapPreloader.mutex);
+			mapPreloader.loading.erase(file);
+			mapPreloader.finished.broadcast();
+			return 0;
+		}
+	};
+	Preloader* action = new Preloader();
+	action->filename = filename;
+	action->file = file;
+	action->map = map;
+	notes << "preloading map " << filename << endl;
+	threadPool->start(action, "map preloading", true);
+}
+
+///////////////////
+// Wait until a running preload of the map has finished
+void CMap::WaitForPreload(const std::string& filename)
+{
+	std::string file = filename;
+	stringlwr(file);
+
+	Mutex::ScopedLock lock(mapPreloader.mutex);
+	while (true) {
+		std::map<std::string, CMap*>::iterator it = mapPreloader.loading.find(file);
+		if (it == mapPreloader.loading.end() || it->second == this)
+			return;
+		mapPreloader.finished.wait(mapPreloader.mutex);
+	}
+}
+
+
 ///////////////////
 // Load the map
 bool CMap::Load(const std::string& filename)
 {
-	// TODO: remove that as soon as we do the map loading in a seperate thread
-	ScopedBackgroundLoadingAni backgroundLoadingAni(320, 280, 50, 50, Color(128,128,128), Color(64,64,64));
-	
 	// Weird
 	if (filename == "") {
 		warnings("WARNING: loading unnamed map, ignoring ...\n");
@@ -2504,6 +2924,17 @@ bool CMap::Load(const std::string& filename)
 		return true;
 	}
 	
+	// The animation is drawn by its own thread while we are loading here
+	ScopedBackgroundLoadingAni backgroundLoadingAni(320, 280, 50, 50, Color(128,128,128), Color(64,64,64));
+	return LoadWithoutAni(filename);
+}
+
+///////////////////
+// Load the map, used directly by the preloading worker which must not draw anything
+bool CMap::LoadWithoutAni(const std::string& filename)
+{
+	// If it is preloaded right now, it will be in the cache soon
+	WaitForPreload(filename);
 	
 	FileName = filename;
 	
@@ -2516,6 +2947,15 @@ bool CMap::Load(const std::string& filename)
 		return true;
 	}
 	
+	// the disk cache has the map already post-processed
+	const Sint64 loadStart = (Sint64)time(NULL);
+	if(LoadFromDiskCache()) {
+		notes << "reusing disk cached map for " << filename << endl;
+		SaveToCache();
+		PostProcessMirroredMap();
+		return true;
+	}
+	
 	MapLoader* loader = MapLoader::open(filename);
 	if(!loader) {
 		warnings << "level " << filename << " couldn't be loaded" << endl;
@@ -2544,6 +2984,7 @@ bool CMap::Load(const std::string& filename)
 
 	// Save the map to cache
 	SaveToCache();
+	SaveToDiskCache(loadStart);
 
 	PostProcessMirroredMap();
 
@@ -2571,7 +3012,7 @@ void CMap::LoadPostProcess()
 	calculateGrid();
 
 	// Calculate collision grid
-	calculateCollisionGridArea(0, 0, Width, Height);
+	calculateCollisionGrid();
 }
 
 
@@ -2820,6 +3261,8 @@ void CMap::Shutdown()
         if(AbsoluteGridFlags)
             delete[] AbsoluteGridFlags;
         AbsoluteGridFlags = NULL;
+		SpawnCells.clear();
+		SpawnCellPos.clear();
 
 		if(CollisionGrid)
 			delete[] CollisionGrid;
@@ -2934,6 +3377,32 @@ public:
 
 
 
+class set_hitpos_and_break {
+public:
+	TraceRay& ray;
+
+	set_hitpos_and_break(TraceRay& r) : ray(r) {}
+	bool operator()(int x, int y) {
+		ray.hit = true;
+		ray.hitPos = VectorD2<int>(x, y);
+		return false;
+	}
+};
+
+///////////////////
+// Trace a bunch of lines against the same map view
+// HINT: no threads or SIMD here; the bots trace some dozen short lines per think and the grid
+// skipping makes the walk branchy, so the gain is from fetching the map data only once
+void fastTraceLines(const MapTraceView& view, TraceRay* rays, size_t count)
+{
+	for(size_t i = 0; i < count; i++) {
+		rays[i].hit = false;
+		set_hitpos_and_break action(rays[i]);
+		fastTraceLine(view, rays[i].target, rays[i].start, rays[i].checkflag, action);
+	}
+}
+
+
 ///////////////////
 // Check for a collision
 // HINT: this function is not used at the moment; and it is incomplete...
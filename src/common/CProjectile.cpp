@@ -28,6 +28,7 @@
 #include "ProjectileDesc.h"
 #include "Physics.h"
 #include "Geometry.h"
+#include "FastVector.h"
 
 
 void CProjectile::setUnused() {
@@ -445,10 +446,22 @@ static CClient::MapPosIndex MPI(const VectorD2<int>& p, const VectorD2<int>& r)
 	return CClient::MapPosIndex( p + VectorD2<int>(LEFT ? -r.x : r.x, TOP ? -r.y : r.y) );
 }
 
+struct MapPosRect {
+	CClient::MapPosIndex topLeft, bottomRight;
+	MapPosRect(const VectorD2<int>& p, const VectorD2<int>& r) :
+		topLeft(MPI<true,true>(p,r)), bottomRight(MPI<false,false>(p,r)) {}
+	bool contains(int x, int y) const {
+		return x >= topLeft.x && x <= bottomRight.x && y >= topLeft.y && y <= bottomRight.y;
+	}
+	bool operator==(const MapPosRect& r) const { return topLeft == r.topLeft && bottomRight == r.bottomRight; }
+};
+
+// inserts/erases prj in all cells of rect which are not in skip
 template<bool INSERT>
-static void updateMap(CProjectile* prj, const VectorD2<int>& p, const VectorD2<int>& r) {
-	for(int x = MPI<true,true>(p,r).x; x <= MPI<true,false>(p,r).x; ++x)
-		for(int y = MPI<true,true>(p,r).y; y <= MPI<false,true>(p,r).y; ++y) {
+static void updateMap(CProjectile* prj, const MapPosRect& rect, const MapPosRect* skip = NULL) {
+	for(int x = rect.topLeft.x; x <= rect.bottomRight.x; ++x)
+		for(int y = rect.topLeft.y; y <= rect.bottomRight.y; ++y) {
+			if(skip && skip->contains(x, y)) continue;
 			CClient::ProjectileSet* projs = cClient->projPosMap[CClient::MapPosIndex(x,y).index(cClient->getMap())];
 			if(projs == NULL) continue;
 			if(INSERT)
@@ -463,23 +476,112 @@ void CProjectile::updateCollMapInfo(const VectorD2<int>* oldPos, const VectorD2<
 	
 	if(!isUsed()) { // not used anymore
 		if(oldPos && oldRadius)
-			updateMap<false>(this, *oldPos, *oldRadius);
+			updateMap<false>(this, MapPosRect(*oldPos, *oldRadius));
 		return;
 	}
 	
+	const MapPosRect newRect(vPos, radius);
 	if(oldPos && oldRadius) {
-		if(
-		   (MPI<true,true>(*oldPos,*oldRadius) == MPI<true,true>(vPos,radius)) &&
-		   (MPI<true,false>(*oldPos,*oldRadius) == MPI<true,false>(vPos,radius)) &&
-		   (MPI<false,true>(*oldPos,*oldRadius) == MPI<false,true>(vPos,radius)) &&
-		   (MPI<false,false>(*oldPos,*oldRadius) == MPI<false,false>(vPos,radius))) {
+		const MapPosRect oldRect(*oldPos, *oldRadius);
+		if(oldRect == newRect)
 			return; // nothing has changed
-		}
 		
-		// delete from all
-		updateMap<false>(this, *oldPos, *oldRadius);
+		// only touch the cells which have changed
+		updateMap<false>(this, oldRect, &newRect);
+		updateMap<true>(this, newRect, &oldRect);
+		return;
 	}
 	
 	// add to all
-	updateMap<true>(this, vPos, radius);
+	updateMap<true>(this, newRect);
+}
+
+
+#ifdef DEBUG
+typedef FastVector<CProjectile,MAX_PROJECTILES> Projectiles;
+
+// This is how FastVector iterated before it had the used-slots bitmask:
+// every slot up to the last used one was checked via isUsed().
+class LegacyProjectileIterator : public Iterator<CProjectile*> {
+private:
+	int m_index;
+	Projectiles& m_parent;
+public:
+	LegacyProjectileIterator(Projectiles& parent, int index = 0) : m_parent(parent) {
+		m_index = CLAMP(index, 0, MAX_PROJECTILES) - 1;
+		next();
+	}
+	Iterator<CProjectile*>* copy() const { return new LegacyProjectileIterator(m_parent, m_index); }
+	
+	void next() {
+		++m_index;
+		while (m_index < MAX_PROJECTILES) {
+			if(m_parent.isUsed(m_index))
+				break;
+			
+			++m_index;
+			
+			if(m_index > m_parent.lastUsed())
+				m_index = MAX_PROJECTILES;
+		}
+	}
+	bool operator==(const Iterator<CProjectile*>& other) const { return m_index == ((LegacyProjectileIterator*)&other)->m_index; }
+	
+	bool isValid() { return m_index < MAX_PROJECTILES; }
+	CProjectile* get() { return &m_parent[m_index]; }
+};
+
+static float sumProjectilePositions(Iterator<CProjectile*>::Ref it, size_t& count) {
+	float sum = 0;
+	for(; it->isValid(); it->next()) {
+		sum += it->get()->getPos().x;
+		count++;
+	}
+	return sum;
+}
+
+static void benchProjectileIteration(Projectiles& projs, const std::string& desc) {
+	const int passes = 2000;
+	size_t legacyCount = 0, count = 0;
+	float legacySum = 0, sum = 0;
+	
+	Uint32 start = SDL_GetTicks();
+	for(int i = 0; i < passes; ++i)
+		legacySum += sumProjectilePositions(new LegacyProjectileIterator(projs), legacyCount);
+	Uint32 legacyTime = SDL_GetTicks() - start;
+	
+	start = SDL_GetTicks();
+	for(int i = 0; i < passes; ++i)
+		sum += sumProjectilePositions(projs.begin(), count);
+	Uint32 time = SDL_GetTicks() - start;
+	
+	notes << desc << ": " << passes << " passes over " << (count / passes) << " projectiles: ";
+	notes << "slot scan " << legacyTime << "ms, used mask " << time << "ms";
+	if(legacyCount != count || legacySum != sum) notes << " (MISMATCH!)";
+	notes << endl;
+}
+
+void TestProjectileIteration()
+{
+	notes << "Testing projectile iteration" << endl;
+	notes << "sizeof(CProjectile) = " << sizeof(CProjectile) << endl;
+	
+	// it's too big for the stack
+	Projectiles* projs = new Projectiles();
+	
+	for(int i = 0; i < MAX_PROJECTILES; ++i) {
+		CProjectile* p = projs->getNewObj();
+		p->bUsed = true;
+		p->setPos(CVec((float)i, 0));
+	}
+	benchProjectileIteration(*projs, "all slots used");
+	
+	// remove most of them, keep some at the end to get the worst case for the slot scan
+	for(int i = 0; i < MAX_PROJECTILES; ++i)
+		if(i % 100 != 99) (*projs)[i].setUnused();
+	benchProjectileIteration(*projs, "every 100th slot used");
+	
+	projs->clear();
+	delete projs;
 }
+#endif
@@ -24,6 +24,9 @@
 
 #include <cassert>
 #include <set>
+#include <list>
+#include <vector>
+#include <thread>
 
 #include "LieroX.h"
 #include "CGameScript.h"
@@ -45,6 +48,9 @@
 #include "ProjectileDesc.h"
 #include "WeaponDesc.h"
 #include "Mutex.h"
+#include "Condition.h"
+#include "ThreadPool.h"
+#include "Options.h"
 
 
 // used by searchpath algo
@@ -243,14 +249,50 @@ inline bool simpleTraceLine(VectorD2<int> start, VectorD2<int> dist, uchar check
 }
 
 
+class searchpath_base;
+
+/*
+shared pathfinding workers for all bots
+searchpath_base::startThreadSearch/restartThreadSearch put a request into the queue
+(restarts first, because the bot has no valid path then) and a fixed amount of
+worker threads processes them. the searcher itself works as the future of the
+request: isReady tells if the result is there, resultedPath returns it.
+*/
+class PathSearchService {
+public:
+	static void addUser();
+	static void removeUser();
+	static void request(searchpath_base* s, bool urgent);
+	static void cancel(searchpath_base* s);
+
+	enum State { S_IDLE, S_QUEUED, S_RUNNING };
+
+private:
+	Mutex mutex;
+	Condition newRequest; // signaled when something was queued or we should quit
+	Condition requestDone; // signaled when a worker finished a search
+	std::list<searchpath_base*> queue;
+	std::vector<ThreadPoolItem*> workers;
+	int users;
+	bool quitSignal;
+
+	PathSearchService() : users(0), quitSignal(false) {}
+	static int worker(void*);
+	void coalesce(searchpath_base* s);
+};
+
+static PathSearchService* pathSearchService = NULL;
+
+
 /*
 this class do the whole pathfinding (idea by AZ)
 you can use the findPath-function directly,
 or you can use the function StartThreadSearch, which
-start the search in an own thread; you can ask
+queues the search in the PathSearchService; you can ask
 for the state with IsReady
 */
 class searchpath_base {
+	friend class PathSearchService;
 public:
 
 // this will define, if we should break the search on the first result
@@ -494,21 +536,18 @@ public:
 
 	searchpath_base() :
 		resulted_path(NULL),
-		thread(NULL),
+		service_state(PathSearchService::S_IDLE),
 		thread_is_ready(true),
 		break_thread_signal(0),
 		restart_thread_searching_signal(0) {
-		thread = threadPool->start(threadSearch, this, "AI worm pathfinding");
-		if(!thread)
-			errors << "could not create AI thread" << endl;
+		PathSearchService::addUser();
 	}
 
 	~searchpath_base() {
-		// thread cleaning up
+		// stop a running search and remove us from the queue
 		breakThreadSignal();
-		if(thread) threadPool->wait(thread, NULL);
-		else warnings << "AI thread already uninitialized" << endl;
-		thread = NULL;
+		PathSearchService::cancel(this);
+		PathSearchService::removeUser();
 		
 		clear();
 	}
@@ -601,7 +640,6 @@ private:
 		addAreaNode(start, NULL);
 
 		while(areas_stack.size() > 0) {
-			SDL_Delay(1); // lower priority to this thread
 			if(shouldBreakThread() || shouldRestartThread() || !cClient->getMap()->getCreated()) return NULL;
 
 			area_item* a = getBestArea();
@@ -672,58 +710,66 @@ public:
 
 		// this is the signal to start the search
 		setReady(false);
+		PathSearchService::request(this, false);
 		return true;
 	}
 
 private:
-	// main-function used by the thread
-	static int threadSearch(void* b) {
-
-		searchpath_base* base = (searchpath_base*)b;
+	// does the search, called by a PathSearchService worker
+	void runSearch() {
 		NEW_ai_node_t* ret;
 
 		while(true) {
-			// sleep a little bit while we have nothing to do...
-			while(base->isReady()) {
-				// was there a break-signal?
-				if(base->shouldBreakThread()) {
-					//printf("got break signal(1) for %i\n", (long)base);
-					return 0;
-				}
-				SDL_Delay(100);
+			if(shouldRestartThread()) {
+				// HINT: both locks (of shouldRestartThread and the following) are seperated
+				//       this don't make any trouble, because here is the only place where we
+				//       reset it and we have always restart_thread_searching_signal==true here
+				Mutex::ScopedLock lock(mutex);
+				restart_thread_searching_signal = 0;
+				start = restart_thread_searching_newdata.start;
+				target = restart_thread_searching_newdata.target;
 			}
 
-			base->resulted_path = NULL;
-			base->clear(); // this is save and important here, else we would have invalid pointers
+			resulted_path = NULL;
+			clear(); // this is save and important here, else we would have invalid pointers
 
 			// start the main search
-			ret = base->findPath(base->start);
+			ret = findPath(start);
 
 			// finishing the result
-			base->completeNodesInfo(ret);
-			base->simplifyPath(ret);
-			base->splitUpNodes(ret, NULL);
-			base->resulted_path = ret;
-
-			if(base->shouldRestartThread()) {
-				// HINT: both locks (of shouldRestartThread and the following) are seperated
-				//       this don't make any trouble, because here is the only place where we
-				//       reset it and we have always restart_thread_searching_signal==true here
-				Mutex::ScopedLock lock(base->mutex);
-				base->restart_thread_searching_signal = 0;
-				base->start = base->restart_thread_searching_newdata.start;
-				base->target = base->restart_thread_searching_newdata.target;
+			completeNodesInfo(ret);
+			simplifyPath(ret);
+			splitUpNodes(ret, NULL);
+			resulted_path = ret;
+
+			// check and set in one lock, else a restart in between would get lost
+			Mutex::ScopedLock lock(mutex);
+			if(restart_thread_searching_signal && !shouldBreakThread())
 				continue;
-			}
 
 			// we are ready now
-			base->setReady(true);
+			thread_is_ready = true;
+			return;
 		}
 	}
 
+	// takes over a copy of the path another searcher found for the same start and target
+	void copyResult(searchpath_base* other) {
+		resulted_path = NULL;
+		clear();
+
+		NEW_ai_node_t* last = NULL;
+		for(NEW_ai_node_t* n = other->resulted_path; n; n = n->psNext) {
+			NEW_ai_node_t* node = createNewAiNode(n->fX, n->fY, NULL, last);
+			nodes.insert(node);
+			if(last) last->psNext = node;
+			else resulted_path = node;
+			last = node;
+		}
+	}
 	
-	// HINT: threadSearch is the only function, who should set this to true again!
-	// a set to false means for threadSearch, that it should start the search now
+	// HINT: runSearch is the only function, who should set this to true again!
+	// a set to false means, that the search is queued or running
 	void setReady(bool state) {
 		Mutex::ScopedLock lock(mutex);
 		thread_is_ready = state;
@@ -741,18 +787,22 @@ public:
 	}
 
 	void restartThreadSearch(VectorD2<int> newstart, VectorD2<int> newtarget) {
-		// set signal
-		Mutex::ScopedLock lock(mutex);
-		thread_is_ready = false;
-		restart_thread_searching_newdata.start = newstart;
-		restart_thread_searching_newdata.target = newtarget;
-		// HINT: the reading of this isn't synchronized
-		restart_thread_searching_signal = 1;
+		{
+			// set signal
+			Mutex::ScopedLock lock(mutex);
+			thread_is_ready = false;
+			restart_thread_searching_newdata.start = newstart;
+			restart_thread_searching_newdata.target = newtarget;
+			// HINT: the reading of this isn't synchronized
+			restart_thread_searching_signal = 1;
+		}
+		// a running search notices the signal itself, otherwise queue us
+		PathSearchService::request(this, true);
 	}
 
 private:
 	NEW_ai_node_t* resulted_path;
-	ThreadPoolItem* thread;
+	int service_state; // PathSearchService::State, protected by the service mutex
 	Mutex mutex;
 	bool thread_is_ready;
 	int break_thread_signal;
@@ -857,6 +907,133 @@ private:
 }; // class searchpath_base
 
 
+// HINT: addUser/removeUser are only called from the main thread (bot init/shutdown)
+void PathSearchService::addUser() {
+	if(!pathSearchService)
+		pathSearchService = new PathSearchService();
+	PathSearchService* service = pathSearchService;
+	service->users++;
+	if(!service->workers.empty()) return;
+
+	int threadNum = tLXOptions->iAIPathfindingThreads;
+	if(threadNum <= 0) // automatic: all cores except the one for the main thread
+		threadNum = (int)std::thread::hardware_concurrency() - 1;
+	threadNum = CLAMP(threadNum, 1, 32);
+
+	service->quitSignal = false;
+	for(int i = 0; i < threadNum; i++) {
+		ThreadPoolItem* item = threadPool->start(worker, service, "AI worm pathfinding " + itoa(i));
+		if(item)
+			service->workers.push_back(item);
+		else
+			errors << "could not create AI thread" << endl;
+	}
+}
+
+void PathSearchService::removeUser() {
+	PathSearchService* service = pathSearchService;
+	if(!service) return;
+	service->users--;
+	if(service->users > 0) return;
+
+	// nobody needs us anymore, stop the workers
+	{
+		Mutex::ScopedLock lock(service->mutex);
+		service->quitSignal = true;
+		service->newRequest.broadcast();
+	}
+	for(size_t i = 0; i < service->workers.size(); i++)
+		threadPool->wait(service->workers[i], NULL);
+	service->workers.clear();
+
+	delete service;
+	pathSearchService = NULL;
+}
+
+void PathSearchService::request(searchpath_base* s, bool urgent) {
+	PathSearchService* service = pathSearchService;
+	if(!service) return;
+	Mutex::ScopedLock lock(service->mutex);
+
+	// a running or already queued search handles the new data itself
+	if(s->service_state == S_RUNNING) return;
+	if(s->service_state == S_QUEUED) {
+		if(!urgent) return;
+		service->queue.remove(s);
+	}
+
+	if(urgent) service->queue.push_front(s);
+	else service->queue.push_back(s);
+	s->service_state = S_QUEUED;
+	service->newRequest.signal();
+}
+
+void PathSearchService::cancel(searchpath_base* s) {
+	PathSearchService* service = pathSearchService;
+	if(!service) return;
+	Mutex::ScopedLock lock(service->mutex);
+
+	if(s->service_state == S_QUEUED) {
+		service->queue.remove(s);
+		s->service_state = S_IDLE;
+	}
+
+	// the break signal is set, so this will not take long
+	while(s->service_state == S_RUNNING)
+		service->requestDone.wait(service->mutex);
+}
+
+// gives the result of s to all queued searches with the same start and target
+// WARNING: the service mutex must be locked
+void PathSearchService::coalesce(searchpath_base* s) {
+	if(!s->resulted_path || s->shouldBreakThread()) return;
+
+	for(std::list<searchpath_base*>::iterator it = queue.begin(); it != queue.end(); ) {
+		searchpath_base* other = *it;
+		Mutex::ScopedLock lock(other->mutex);
+		if(!other->thread_is_ready && !other->restart_thread_searching_signal
+		&& other->start == s->start && other->target == s->target) {
+			other->copyResult(s);
+			other->thread_is_ready = true;
+			other->service_state = S_IDLE;
+			it = queue.erase(it);
+		}
+		else
+			++it;
+	}
+}
+
+int PathSearchService::worker(void* p) {
+	PathSearchService* service = (PathSearchService*)p;
+	Mutex::ScopedLock lock(service->mutex);
+
+	while(true) {
+		while(service->queue.empty() && !service->quitSignal)
+			service->newRequest.wait(service->mutex);
+		if(service->quitSignal)
+			return 0;
+
+		searchpath_base* s = service->queue.front();
+		service->queue.pop_front();
+		s->service_state = S_RUNNING;
+
+		service->mutex.unlock();
+		s->runSearch();
+		service->mutex.lock();
+
+		service->coalesce(s);
+		if(s->shouldRestartThread() && !s->shouldBreakThread()) {
+			// restarted right after the search finished, request() has seen us running
+			service->queue.push_front(s);
+			s->service_state = S_QUEUED;
+		}
+		else
+			s->service_state = S_IDLE;
+		service->requestDone.broadcast();
+	}
+}
+
+
 
 ///////////////////
 // Initialize the AI
@@ -2910,27 +3087,14 @@ int CWormBotInputHandler::traceWeaponLine(CVec target, float *fDist, int *nType)
 
 
 
-class set_col_and_break {
-public:
-	CVec start;
-	CVec* collision;
-	bool hit;
-
-	set_col_and_break(CVec st, CVec* col) : start(st), collision(col), hit(false) {}
-	bool operator()(int x, int y) {
-		hit = true;
-		if(collision && (*collision - start).GetLength2() > (CVec((float)x,(float)y) - start).GetLength2()) {
-			collision->x = (float)x;
-			collision->y = (float)y;
-		}
-		return false;
-	}
-};
-
-
 ////////////////////
 // Trace the line with worm width
 int traceWormLine(CVec target, CVec start, CVec* collision)
+{
+	return traceWormLine(MapTraceView(cClient->getMap()), target, start, collision);
+}
+
+int traceWormLine(const MapTraceView& view, CVec target, CVec start, CVec* collision)
 {
 	// At least three, else it goes through walls in jukke
 	static const unsigned short wormsize = 3;
@@ -2942,13 +3106,26 @@ int traceWormLine(CVec target, CVec start, CVec* collision)
 
 	CVec dir = CVec(target.y-start.y,start.x-target.x); // rotate clockwise by 90 deg
 	NormalizeVector(&dir);
-	set_col_and_break action = set_col_and_break(start - dir*(wormsize-1)/2, collision);
+	start -= dir*(wormsize-1)/2;
 	target -= dir*(wormsize-1)/2;
-	for(unsigned short i = 0; i < wormsize; i++, action.start += dir, target += dir)
-		fastTraceLine(target, action.start, (uchar)PX_ROCK, action);
 
-	return !action.hit;
+	TraceRay rays[wormsize];
+	for(unsigned short i = 0; i < wormsize; i++, start += dir, target += dir)
+		rays[i] = TraceRay(target, start, (uchar)PX_ROCK);
+	fastTraceLines(view, rays, wormsize);
 
+	bool hit = false;
+	for(unsigned short i = 0; i < wormsize; i++) {
+		if(!rays[i].hit)
+			continue;
+		hit = true;
+		// the closest collision
+		const CVec pos((float)rays[i].hitPos.x, (float)rays[i].hitPos.y);
+		if(collision && (*collision - rays[i].start).GetLength2() > (pos - rays[i].start).GetLength2())
+			*collision = pos;
+	}
+
+	return !hit;
 }
 
 ////////////////////////
@@ -3210,9 +3387,14 @@ CVec CWormBotInputHandler::AI_FindBestFreeSpot(CVec vPoint, CVec vStart, CVec vD
 #endif
 
 	unsigned short i = 0;
-	int map_w = cClient->getMap()->GetWidth();
-	int map_h = cClient->getMap()->GetHeight();
-	const uchar* pxflags = cClient->getMap()->GetPixelFlags();
+	const MapTraceView view(cClient->getMap());
+	if(!view.isValid()) {
+		if(vEndPoint) *vEndPoint = vStart;
+		return vStart;
+	}
+	const int map_w = view.map_w;
+	const int map_h = view.map_h;
+	const uchar* pxflags = view.pxflags;
 	CVec pos = vStart;
 	CVec best = vStart;
 	CVec end = pos;
@@ -3258,7 +3440,7 @@ CVec CWormBotInputHandler::AI_FindBestFreeSpot(CVec vPoint, CVec vStart, CVec vD
 
 		if(i % 4 == 0 || lastWasMissingCon) {
 			// do we still have a direct connection to the point?
-			if(!traceWormLine(vPoint,pos)) {
+			if(!traceWormLine(view,vPoint,pos)) {
 				// perhaps we are behind an edge (because auf backdir)
 				// then go a little more to backdir
 				pos += backdir;
@@ -3271,7 +3453,7 @@ CVec CWormBotInputHandler::AI_FindBestFreeSpot(CVec vPoint, CVec vStart, CVec vD
 		// don't check to often
 		if(i % 4 == 0) {
 			// this is the parallel to backdir
-			traceWormLine(pos-backdir*1000,pos,&possible_end);
+			traceWormLine(view,pos-backdir*1000,pos,&possible_end);
 			possible_end += backdir*5/backdir.GetLength();
 #ifdef _AI_DEBUG
 			//PutPixel(bmpDest,(int)possible_end.x*2,(int)possible_end.y*2,tLX->clPink);
@@ -3537,9 +3719,15 @@ CVec CWormBotInputHandler::AI_GetBestRopeSpot(CVec trg)
 	SquareMatrix<float> step_m = SquareMatrix<float>::RotateMatrix(-step);
 	bestropespot_collision_action action(m_worm, trg);
 
-	for(ang=0; ang<(float)PI; dir=step_m(dir), ang+=step) {
-		fastTraceLine(m_worm->vPos+dir, m_worm->vPos, PX_ROCK|PX_DIRT, action);
-	}
+	std::vector<TraceRay> rays;
+	rays.reserve(21);
+	for(ang=0; ang<(float)PI; dir=step_m(dir), ang+=step)
+		rays.push_back(TraceRay(m_worm->vPos+dir, m_worm->vPos, PX_ROCK|PX_DIRT));
+	fastTraceLines(MapTraceView(cClient->getMap()), &rays[0], rays.size());
+
+	for(size_t i = 0; i < rays.size(); i++)
+		if(rays[i].hit)
+			action(rays[i].hitPos.x, rays[i].hitPos.y);
 
 	if(action.best_value < 0) // we don't find any spot
 		return trg;
@@ -126,15 +126,18 @@ void CWorm::writePacket(CBytestream *bs, bool fromServer, CServerConnection* rec
 
 
 	// Velocity
+	// HINT: GameServer::SendUpdate shares the written packets between all clients with the
+	// same net-engine variant (see WormUpdateCache), update it if you add receiver dependent data
 	const Version& versionOfReceiver = fromServer ? receiver->getClientVersion() : cClient->getServerVersion();
-	if(tState.bShoot || versionOfReceiver >= OLXBetaVersion(5)) {
+	static const Version beta5 = OLXBetaVersion(5), beta8 = OLXBetaVersion(8); // Version temporaries allocate
+	if(tState.bShoot || versionOfReceiver >= beta5) {
 		CVec v = vVelocity;
 		bs->writeInt16( (Sint16)v.x );
 		bs->writeInt16( (Sint16)v.y );
 	}
 	
 	// client (>=beta8) sends also current server time
-	if(!fromServer && versionOfReceiver >= OLXBetaVersion(8)) {
+	if(!fromServer && versionOfReceiver >= beta8) {
 		bs->writeFloat( (float)cClient->serverTime().seconds() );
 	}
 
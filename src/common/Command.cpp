@@ -582,6 +582,12 @@ void Cmd_coreDump::exec(CmdLineIntf* caller, const std::vector<std::string>& par
 	doActionInMainThread(new Dumper());
 }
 
+COMMAND(logStats, "print statistics of the logger queue", "", 0, 0);
+void Cmd_logStats::exec(CmdLineIntf* caller, const std::vector<std::string>& params) {
+	LogQueueStats stats = GetLogQueueStats();
+	caller->writeMsg("enqueued: " + to_string(stats.enqueued) + ", dropped: " + to_string(stats.dropped) + ", flushed: " + to_string(stats.flushed));
+}
+
 
 COMMAND(suicide, "suicide first local human worm", "[#kills]", 0, 1);
 void Cmd_suicide::exec(CmdLineIntf* caller, const std::vector<std::string>& params)
@@ -530,11 +530,10 @@ void DumpCallstack(const PrintOutFct& printer) {
 #include <android/log.h>
 #endif
 
-std::string GetLogTimeStamp()
+static std::string GetLogTimeStamp(time_t unif_time)
 {
 	// TODO: please recode this, don't use C-strings!
 	char buf[64];
-	const time_t unif_time = time(NULL);
 	struct tm *t = localtime(&unif_time);
 	if (t == NULL)
 		return "";
@@ -544,6 +543,11 @@ std::string GetLogTimeStamp()
 	return std::string(buf);
 }
 
+std::string GetLogTimeStamp()
+{
+	return GetLogTimeStamp(time(NULL));
+}
+
 Logger notes(0,2,1000, "n: ");
 Logger hints(0,1,100, "H: ");
 Logger warnings(0,0,10, "W: ");
@@ -555,6 +559,9 @@ Logger errors(-1,-1,1, "E: ");
 #include "Options.h"
 #include "console.h"
 #include "StringUtils.h"
+#include "Condition.h"
+#include <atomic>
+#include <map>
 
 static SDL_mutex* globalCoutMutex = NULL;
 
@@ -602,36 +609,38 @@ struct ConPrint : PrintOutFct {
 };
 
 // true if last was newline
-static bool logger_output(Logger& log, const std::string& buf) {
+// lastWasNewline is the state of whoever writes out the lines of the logger, i.e. Logger::lastWasNewline
+// if the Logger prints directly, or the one of the log writer (LogQueue::lineStart)
+static bool logger_output(Logger& log, const std::string& buf, time_t logTime, bool lastWasNewline) {
 	bool ret = true;
 
 	std::string prefix = log.prefix;
 	if (tLXOptions && tLXOptions->bLogTimestamps)
-		prefix = GetLogTimeStamp() + prefix;
+		prefix = GetLogTimeStamp(logTime) + prefix;
 
 	if(!tLXOptions || tLXOptions->iVerbosity >= log.minCoutVerb) {
 		SDL_mutexP(globalCoutMutex);
-		ret = PrettyPrint(prefix, buf, CoutPrint(), log.lastWasNewline);
+		ret = PrettyPrint(prefix, buf, CoutPrint(), lastWasNewline);
 		//std::cout.flush();
 		SDL_mutexV(globalCoutMutex);
 	}
 	if(tLXOptions && tLXOptions->iVerbosity >= log.minCallstackVerb) {
-		DumpCallstackPrintf();
+		DumpCallstackPrintf(); // HINT: Logger::flush ensures that we are in the thread of the caller
 	}
 	if(tLXOptions && Con_IsInited() && tLXOptions->iVerbosity >= log.minIngameConVerb) {
 		// the check is a bit hacky (see Con_AddText) but I really dont want to overcomplicate this
 		if(!strStartsWith(buf, "Ingame console: ")) {
 			// we are not safing explicitly a color in the Logger, thus we try to assume a good color from the verbosity level
 			if(log.minIngameConVerb < 0)
-				ret = PrettyPrint(prefix, buf, ConPrint<CNC_ERROR>(), log.lastWasNewline);
+				ret = PrettyPrint(prefix, buf, ConPrint<CNC_ERROR>(), lastWasNewline);
 			else if(log.minIngameConVerb == 0)
-				ret = PrettyPrint(prefix, buf, ConPrint<CNC_WARNING>(), log.lastWasNewline);
+				ret = PrettyPrint(prefix, buf, ConPrint<CNC_WARNING>(), lastWasNewline);
 			else if(log.minIngameConVerb == 1)
-				ret = PrettyPrint(prefix, buf, ConPrint<CNC_NOTIFY>(), log.lastWasNewline);
+				ret = PrettyPrint(prefix, buf, ConPrint<CNC_NOTIFY>(), lastWasNewline);
 			else if(log.minIngameConVerb < 5)
-				ret = PrettyPrint(prefix, buf, ConPrint<CNC_NORMAL>(), log.lastWasNewline);
+				ret = PrettyPrint(prefix, buf, ConPrint<CNC_NORMAL>(), lastWasNewline);
 			else // >=5
-				ret = PrettyPrint(prefix, buf, ConPrint<CNC_DEV>(), log.lastWasNewline);
+				ret = PrettyPrint(prefix, buf, ConPrint<CNC_DEV>(), lastWasNewline);
 		}
 		if(tLXOptions->iVerbosity >= log.minCallstackVerb) {
 			DumpCallstack(ConPrint<CNC_DEV>());
@@ -640,9 +649,272 @@ static bool logger_output(Logger& log, const std::string& buf) {
 	return ret;
 }
 
+
+/*
+Log lines are not printed directly by the thread which logs them but put into a
+lock-free ring (bounded MPMC queue by Dmitry Vyukov) which is written out by a
+background thread. This way, a slow terminal cannot stall the game loop.
+Only the raw text is queued; the prefix, the timestamp and the PrettyPrint
+formatting are done by the writer.
+If the ring is full, lines are dropped (and counted), except errors, which
+are written out synchronously.
+*/
+struct LogQueue {
+	enum { SIZE = 4096 }; // must be power of 2
+
+	struct Entry {
+		std::atomic<size_t> sequence;
+		Logger* log;
+		time_t time;
+		std::string text;
+	};
+
+	Entry entries[SIZE];
+	std::atomic<size_t> enqueuePos;
+	std::atomic<size_t> dequeuePos;
+
+	std::atomic<Uint64> enqueued, dropped, flushed;
+	Uint64 droppedReported; // protected by writeMutex
+	std::map<Logger*, bool> lineStart; // lastWasNewline of the loggers while the writer runs; protected by writeMutex
+
+	Mutex writeMutex; // only one thread at a time writes out the entries
+	Mutex wakeupMutex;
+	Condition wakeup;
+	std::atomic<bool> writerSleeping;
+	std::atomic<bool> writerRunning;
+	bool quitSignal; // protected by wakeupMutex
+	ThreadPoolItem* writer;
+
+	LogQueue() : enqueuePos(0), dequeuePos(0), enqueued(0), dropped(0), flushed(0), droppedReported(0),
+	writerSleeping(false), writerRunning(false), quitSignal(false), writer(NULL) {
+		for(size_t i = 0; i < SIZE; i++)
+			entries[i].sequence.store(i, std::memory_order_relaxed);
+	}
+
+	bool push(Logger* log, std::string& text) {
+		size_t pos = enqueuePos.load(std::memory_order_relaxed);
+		Entry* e;
+		while(true) {
+			e = &entries[pos & (SIZE - 1)];
+			size_t seq = e->sequence.load(std::memory_order_acquire);
+			intptr_t diff = (intptr_t)seq - (intptr_t)pos;
+			if(diff == 0) {
+				if(enqueuePos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+					break;
+			}
+			else if(diff < 0)
+				return false; // full
+			else
+				pos = enqueuePos.load(std::memory_order_relaxed);
+		}
+
+		e->log = log;
+		e->time = time(NULL);
+		e->text.swap(text);
+		e->sequence.store(pos + 1, std::memory_order_release);
+		enqueued++;
+
+		if(writerSleeping.load(std::memory_order_acquire))
+			wakeup.signal();
+		return true;
+	}
+
+	bool pop(Logger*& log, time_t& t, std::string& text) {
+		size_t pos = dequeuePos.load(std::memory_order_relaxed);
+		Entry* e;
+		while(true) {
+			e = &entries[pos & (SIZE - 1)];
+			size_t seq = e->sequence.load(std::memory_order_acquire);
+			intptr_t diff = (intptr_t)seq - (intptr_t)(pos + 1);
+			if(diff == 0) {
+				if(dequeuePos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+					break;
+			}
+			else if(diff < 0)
+				return false; // empty
+			else
+				pos = dequeuePos.load(std::memory_order_relaxed);
+		}
+
+		log = e->log;
+		t = e->time;
+		text.swap(e->text);
+		e->text.clear();
+		e->sequence.store(pos + SIZE, std::memory_order_release);
+		return true;
+	}
+
+	bool empty() {
+		size_t pos = dequeuePos.load(std::memory_order_acquire);
+		return entries[pos & (SIZE - 1)].sequence.load(std::memory_order_acquire) != pos + 1;
+	}
+
+	// WARNING: writeMutex must be locked
+	bool& lastWasNewline(Logger* log) {
+		std::map<Logger*, bool>::iterator it = lineStart.find(log);
+		if(it == lineStart.end())
+			it = lineStart.insert(std::make_pair(log, true)).first;
+		return it->second;
+	}
+
+	// writes out all queued entries; returns false if there was nothing
+	// WARNING: writeMutex must be locked
+	bool writeAll() {
+		Logger* log = NULL;
+		time_t t = 0;
+		std::string text;
+		bool didSomething = false;
+		while(pop(log, t, text)) {
+			bool& nl = lastWasNewline(log);
+			nl = logger_output(*log, text, t, nl);
+			flushed++;
+			didSomething = true;
+		}
+
+		Uint64 d = dropped;
+		if(d != droppedReported) {
+			bool& nl = lastWasNewline(&warnings);
+			nl = logger_output(warnings, "logger queue overflow, dropped " + to_string(d - droppedReported) + " lines\n", time(NULL), nl);
+			droppedReported = d;
+		}
+		return didSomething;
+	}
+
+	// Writes out the queued entries without taking any lock and without the ingame console,
+	// for the CrashHandler: the crashed thread could hold writeMutex or the cout mutex.
+	// pop() is lock-free, so the writer thread doesn't get the same entries.
+	void writeAllCrashed() {
+		Logger* log = NULL;
+		time_t t = 0;
+		std::string text;
+		while(pop(log, t, text)) {
+			std::string prefix = log->prefix;
+			if (tLXOptions && tLXOptions->bLogTimestamps)
+				prefix = GetLogTimeStamp(t) + prefix;
+			PrettyPrint(prefix, text, CoutPrint(), true);
+			flushed++;
+		}
+		fflush(stdout);
+	}
+
+	void flush() {
+		Mutex::ScopedLock lock(writeMutex);
+		writeAll();
+	}
+
+	// keeps the order: everything queued before is written out first
+	void writeDirect(Logger& log, const std::string& text) {
+		Mutex::ScopedLock lock(writeMutex);
+		writeAll();
+		bool& nl = lastWasNewline(&log);
+		nl = logger_output(log, text, time(NULL), nl);
+	}
+
+	static int writerThread(void* p) {
+		LogQueue* q = (LogQueue*)p;
+		while(true) {
+			{
+				Mutex::ScopedLock lock(q->writeMutex);
+				q->writeAll();
+			}
+
+			Mutex::ScopedLock lock(q->wakeupMutex);
+			if(q->quitSignal) break;
+			q->writerSleeping = true;
+			// HINT: push() doesn't lock wakeupMutex, thus we could miss a signal; the timeout covers that
+			if(q->empty())
+				q->wakeup.wait(q->wakeupMutex, 100);
+			q->writerSleeping = false;
+		}
+
+		Mutex::ScopedLock lock(q->writeMutex);
+		q->writeAll();
+		return 0;
+	}
+};
+
+static LogQueue* logQueue = NULL;
+
+void InitLogWriter() {
+	if(logQueue) return;
+	LogQueue* q = new LogQueue();
+	q->writer = threadPool->start(LogQueue::writerThread, q, "log writer");
+	if(!q->writer) {
+		delete q;
+		warnings << "could not start log writer thread, logging synchronously" << endl;
+		return;
+	}
+	q->writerRunning = true;
+	logQueue = q;
+}
+
+void UnInitLogWriter() {
+	LogQueue* q = logQueue;
+	if(!q) return;
+
+	// from now on, Logger::flush prints directly again
+	logQueue = NULL;
+	q->writerRunning = false;
+	{
+		Mutex::ScopedLock lock(q->wakeupMutex);
+		q->quitSignal = true;
+		q->wakeup.signal();
+	}
+	threadPool->wait(q->writer, NULL);
+	q->writer = NULL;
+
+	// some Logger::flush could have been still in progress with q, they all are done after this
+	notes.lock(); notes.unlock();
+	hints.lock(); hints.unlock();
+	warnings.lock(); warnings.unlock();
+	errors.lock(); errors.unlock();
+	q->flush();
+
+	// the loggers print directly again, with the newline state the writer left
+	for(std::map<Logger*, bool>::iterator it = q->lineStart.begin(); it != q->lineStart.end(); ++it) {
+		it->first->lock();
+		it->first->lastWasNewline = it->second;
+		it->first->unlock();
+	}
+
+	delete q;
+}
+
+void FlushLogQueue() {
+	// HINT: this is called from the CrashHandler, so nothing here may wait for a lock
+	LogQueue* q = logQueue;
+	if(q) q->writeAllCrashed();
+}
+
+LogQueueStats GetLogQueueStats() {
+	LogQueueStats stats;
+	LogQueue* q = logQueue;
+	if(q) {
+		stats.enqueued = q->enqueued;
+		stats.dropped = q->dropped;
+		stats.flushed = q->flushed;
+	}
+	return stats;
+}
+
 Logger& Logger::flush() {
 	lock();
-	lastWasNewline = logger_output(*this, buffer);
+	LogQueue* q = logQueue;
+	if(q && q->writerRunning) {
+		if(buffer.empty())
+			; // nothing to do
+		else if(tLXOptions && tLXOptions->iVerbosity >= minCallstackVerb)
+			// the callstack must be from this thread
+			q->writeDirect(*this, buffer);
+		else if(!q->push(this, buffer)) {
+			if(minCoutVerb < 0) // never drop errors
+				q->writeDirect(*this, buffer);
+			else
+				q->dropped++;
+		}
+	}
+	else
+		lastWasNewline = logger_output(*this, buffer, time(NULL), lastWasNewline);
 	buffer = "";
 	unlock();
 	return *this;
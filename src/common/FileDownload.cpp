@@ -32,6 +32,10 @@
 #include "FileDownload.h"
 #include "MathLib.h"
 
+#include <zlib.h>
+#include <time.h>
+#include <algorithm>
+
 
 
 
@@ -506,8 +510,117 @@ void CHttpDownloadManager::ProcessDownloads()
 // It might be also used not only in game in the future
 // Valid name will be CFileDownloaderUdp, since it's packet oriented, comments will appear someday (I hope).
 
+// State of a streamed transfer, see setFileToStream() and receiveStream()
+struct CUdpFileDownloader::FileStream
+{
+	std::string	filename;
+	bool		sending;
+	FILE *		file;		// Sender only, NULL after the whole file is read
+	SmartPointer<std::string>	cached;	// Sender only, the whole stream from cUdpFileCache instead of file
+	z_stream	zs;			// deflate() state for the sender, inflate() for the receiver
+	bool		zInit;
+	bool		finished;	// Reached the end of the zlib stream
+	bool		headerSent;
+	Uint32		size;		// Uncompressed size of the whole file
+	Uint32		offset;		// Size of the data the receiver already had when the transfer started
+	std::string	out;		// Sender only: compressed data which is not sent yet
+	size_t		outPos;
+	bool		record;		// Sender only: save the compressed stream to cUdpFileCache when finished
+	UdpFileCache::ContentKey	recordKey;	// Content of the file when the sending started, the stream is saved under it
+	std::string	recorded;
+	char		in[16384];
+
+	FileStream( const std::string & _filename, bool _sending ):
+		filename(_filename), sending(_sending), file(NULL), zInit(false), finished(false), headerSent(false),
+		size(0), offset(0), outPos(0), record(false)
+	{
+		zs.zalloc = Z_NULL;
+		zs.zfree = Z_NULL;
+		zs.opaque = Z_NULL;
+		zs.avail_in = 0;
+		zs.next_in = Z_NULL;
+	}
+};
+
+// S2C_SENDFILESTREAM msg types
+enum {
+	STREAM_START = 0,	// Filename, file size and resume offset
+	STREAM_DATA = 1,	// Next piece of the zlib stream
+	STREAM_END = 2,
+	STREAM_ABORT = 3,	// Sender failed to read the file
+};
+
+// Interrupted streamed downloads are kept this long (in seconds) and up to this size in total to resume them
+enum { PARTIAL_DOWNLOAD_TIMEOUT = 10 * 60, MAX_PARTIAL_DOWNLOADS_SIZE = 32 * 1024 * 1024 };
+
+// S2C_SENDFILESTREAM msg with the data chunk still fits into one CChannel2/CChannel3 packet (MAX_PACKET_SIZE = 512 minus headers),
+// so the chunks are never fragmented and fill the packets completely
+enum { MAX_STREAM_CHUNK = 480 };
+
+// Adler32 of the data, same as FileChecksum() calculates (StringChecksum() uses another initial value)
+static Uint32 dataChecksum( const char * data, size_t size, uLong checksum = adler32( 0L, Z_NULL, 0 ) )
+{
+	return (Uint32)adler32( checksum, (const Bytef *)data, (uInt)size );
+}
+
+CUdpFileDownloader::~CUdpFileDownloader()
+{
+	closeStream( false );
+}
+
+void CUdpFileDownloader::closeStream( bool keepPartial )
+{
+	if( pStream == NULL )
+		return;
+	if( pStream->sending )
+	{
+		if( pStream->zInit )
+			deflateEnd( &pStream->zs );
+	}
+	else
+	{
+		if( pStream->zInit )
+			inflateEnd( &pStream->zs );
+		if( keepPartial && tState == S_RECEIVE && sData.size() > 0 && sData.size() <= MAX_PARTIAL_DOWNLOADS_SIZE )
+		{
+			notes << "CUdpFileDownloader: keeping " << sData.size() << " bytes of " << pStream->filename << " to resume the download later" << endl;
+			PartialDownload & partial = tPartialDownloads[ pStream->filename ];
+			partial.data = sData;
+			partial.saved = tLX->currentTime;
+			prunePartialDownloads();
+		}
+	}
+	if( pStream->file )
+		fclose( pStream->file );
+	delete pStream;
+	pStream = NULL;
+}
+
+// Drops partial downloads which are too old to be resumed, and the oldest ones if they take too much memory
+void CUdpFileDownloader::prunePartialDownloads()
+{
+	size_t size = 0;
+	for( std::map< std::string, PartialDownload > :: iterator it = tPartialDownloads.begin(); it != tPartialDownloads.end(); )
+	{
+		if( ( tLX->currentTime - it->second.saved ).seconds() > PARTIAL_DOWNLOAD_TIMEOUT )
+			tPartialDownloads.erase( it++ );
+		else
+			size += ( it++ )->second.data.size();
+	}
+	while( size > MAX_PARTIAL_DOWNLOADS_SIZE )
+	{
+		std::map< std::string, PartialDownload > :: iterator oldest = tPartialDownloads.begin();
+		for( std::map< std::string, PartialDownload > :: iterator it = tPartialDownloads.begin(); it != tPartialDownloads.end(); it++ )
+			if( it->second.saved < oldest->second.saved )
+				oldest = it;
+		size -= oldest->second.data.size();
+		tPartialDownloads.erase( oldest );
+	}
+}
+
 void CUdpFileDownloader::reset()
 {
+	closeStream( true );
 	iPos = 0;
 	tPrevState = S_FINISHED;
 	tState = S_FINISHED;
@@ -539,8 +652,25 @@ void CUdpFileDownloader::setDataToSend( const std::string & name, const std::str
 	notes << "CFileDownloaderInGame::setDataToSend() filename " << sFilename << " data.size() " << data.size() << " compressed " << sData.size() << endl;
 }
 
+void CUdpFileDownloader::setCompressedDataToSend( const std::string & name, const SmartPointer<std::string> & data )
+{
+	tPrevState = tState;
+	tState = S_SEND;
+	iPos = 0;
+	sFilename = name;
+	sData = *data.get();
+	notes << "CFileDownloaderInGame::setCompressedDataToSend() filename " << sFilename << " compressed " << sData.size() << endl;
+}
+
 void CUdpFileDownloader::setFileToSend( const std::string & path )
 {
+	SmartPointer<std::string> cached = cUdpFileCache.getCompressedFile( path );
+	if( cached.get() )
+	{
+		setCompressedDataToSend( path, cached );
+		return;
+	}
+
 	FILE * ff = OpenGameFile( path, "rb" );
 	if( ff == NULL )
 	{
@@ -558,21 +688,121 @@ void CUdpFileDownloader::setFileToSend( const std::string & path )
 	};
 	fclose( ff );
 
-	bool noCompress = false;
-	if( stringcaserfind( path, ".png" ) != std::string::npos ||
-		stringcaserfind( path, ".lxl" ) != std::string::npos || // LieroX levels are in .png format
-		stringcaserfind( path, ".ogg" ) != std::string::npos ||
-		stringcaserfind( path, ".mp3" ) != std::string::npos )
-		noCompress = true;
-	setDataToSend( path, data, noCompress );
+	setDataToSend( path, data, isFileCompressed( path ) );
+	if( isSending() )
+		cUdpFileCache.saveCompressedFile( path, new std::string( sData ) );
 };
 
+void CUdpFileDownloader::setFileToStream( const std::string & path, size_t offset, Uint32 checksum )
+{
+	UdpFileCache::ContentKey key;
+	bool haveKey = false;
+	if( offset == 0 )
+	{
+		SmartPointer<std::string> cached;
+		haveKey = cUdpFileCache.getFileStream( path, &key, &cached );
+		if( cached.get() )
+		{
+			closeStream( false );
+			FileStream * s = new FileStream( path, true );
+			s->cached = cached;
+			s->finished = true;
+			s->size = key.size;
+
+			tPrevState = tState;
+			tState = S_SEND;
+			iPos = 0;
+			sFilename = path;
+			sData = "";
+			pStream = s;
+			notes << "CUdpFileDownloader::setFileToStream() filename " << path << " size " << key.size << " from cache" << endl;
+			return;
+		}
+	}
+
+	FILE * ff = OpenGameFile( path, "rb" );
+	if( ff == NULL )
+	{
+		reset();
+		bWasError = true;
+		return;
+	};
+	fseek( ff, 0, SEEK_END );
+	size_t size = ftell( ff );
+	fseek( ff, 0, SEEK_SET );
+
+	// Resume only if the receiver has the same beginning of the file as we have
+	if( offset > size )
+		offset = 0;
+	if( offset > 0 )
+	{
+		Uint32 sum = dataChecksum( NULL, 0 );
+		char buf[16384];
+		size_t left = offset;
+		while( left > 0 )
+		{
+			size_t read = fread( buf, 1, MIN( left, sizeof(buf) ), ff );
+			if( read == 0 )
+				break;
+			sum = dataChecksum( buf, read, sum );
+			left -= read;
+		}
+		if( left > 0 || sum != checksum )
+		{
+			notes << "CUdpFileDownloader::setFileToStream(): partial data of " << path << " differs, sending the whole file" << endl;
+			offset = 0;
+			fseek( ff, 0, SEEK_SET );
+		}
+	}
+
+	closeStream( false );
+	FileStream * s = new FileStream( path, true );
+	if( deflateInit( &s->zs, isFileCompressed( path ) ? Z_NO_COMPRESSION : Z_DEFAULT_COMPRESSION ) != Z_OK )
+	{
+		delete s;
+		fclose( ff );
+		reset();
+		bWasError = true;
+		return;
+	}
+	s->zInit = true;
+	s->file = ff;
+	s->size = (Uint32)size;
+	s->offset = (Uint32)offset;
+	s->record = ( offset == 0 && haveKey );	// Only the whole stream is useful for others
+	s->recordKey = key;
+
+	tPrevState = tState;
+	tState = S_SEND;
+	iPos = 0;
+	sFilename = path;
+	sData = "";
+	pStream = s;
+	notes << "CUdpFileDownloader::setFileToStream() filename " << path << " size " << size << " offset " << offset << endl;
+}
+
+bool CUdpFileDownloader::isFileCompressed( const std::string & path )
+{
+	return	stringcaserfind( path, ".png" ) != std::string::npos ||
+			stringcaserfind( path, ".lxl" ) != std::string::npos || // LieroX levels are in .png format
+			stringcaserfind( path, ".ogg" ) != std::string::npos ||
+			stringcaserfind( path, ".mp3" ) != std::string::npos;
+}
+
 enum { MAX_DATA_CHUNK = 254 };	// UCHAR_MAX - 1, client and server should have this equal
 bool CUdpFileDownloader::receive( CBytestream * bs )
 {
 	uint chunkSize = bs->readByte();
 	if( chunkSize == 0 )	// Ping packet with zero data - do not change downloader state
 		return false;
+	if( pStream )
+	{
+		// The receiver of our stream gave up and requests something else (or the same file again to resume it),
+		// or the sender of the stream aborted it
+		closeStream( true );
+		tPrevState = tState;
+		tState = S_FINISHED;
+	}
 	if( tState == S_FINISHED )
 	{
 		tPrevState = tState;
@@ -605,7 +835,11 @@ bool CUdpFileDownloader::receive( CBytestream * bs )
 		return true;	// Receive finished (due to error)
 	};
 	//notes << "CFileDownloaderInGame::receive() chunk " << chunkSize << endl;
-	sData.append( bs->readData(chunkSize) );
+	{
+		size_t size = chunkSize;
+		const char* data = bs->readDataPtr(size);
+		sData.append( data, size );
+	}
 	if( Finished )
 	{
 		tPrevState = tState;
@@ -643,7 +877,7 @@ bool CUdpFileDownloader::send( CBytestream * bs )
 	// The transferred file can be corrupted if some of the packets  gets lost,
 	// create some sequece checking here
 	// Don't worry about safety, we send everything zipped and it has checksum attached, missed packets -> wrong checksum.
-	if( tState != S_SEND )
+	if( tState != S_SEND || pStream )	// Streams are sent with sendStream()
 	{
 		reset();
 		bWasError = true;
@@ -671,6 +905,244 @@ void CUdpFileDownloader::sendPing( CBytestream * bs ) const
 	bs->writeByte( 0 );
 }
 
+bool CUdpFileDownloader::sendStream( CBytestream * bs )
+{
+	if( ! isSendingStream() || ! pStream->sending )
+	{
+		reset();
+		bWasError = true;
+		bs->writeByte( STREAM_ABORT );
+		return true;	// Send finished (due to error)
+	}
+	FileStream * s = pStream;
+
+	if( ! s->headerSent )
+	{
+		bs->writeByte( STREAM_START );
+		bs->writeString( sFilename );
+		bs->writeInt( s->size, 4 );
+		bs->writeInt( s->offset, 4 );
+		s->headerSent = true;
+		return false;
+	}
+
+	// Read and compress more of the file until we have a whole chunk
+	if( s->out.size() - s->outPos < MAX_STREAM_CHUNK && ! s->finished )
+	{
+		s->out.erase( 0, s->outPos );
+		s->outPos = 0;
+	}
+	while( s->out.size() < MAX_STREAM_CHUNK && ! s->finished )
+	{
+		if( s->zs.avail_in == 0 && s->file )
+		{
+			size_t read = fread( s->in, 1, sizeof(s->in), s->file );
+			if( read < sizeof(s->in) )
+			{
+				bool error = ferror( s->file ) != 0;
+				fclose( s->file );
+				s->file = NULL;
+				if( error )
+				{
+					notes << "CUdpFileDownloader::sendStream(): cannot read " << sFilename << endl;
+					reset();
+					bWasError = true;
+					bs->writeByte( STREAM_ABORT );
+					return true;
+				}
+			}
+			s->zs.next_in = (Bytef *) s->in;
+			s->zs.avail_in = (uInt) read;
+		}
+		char buf[16384];
+		s->zs.next_out = (Bytef *) buf;
+		s->zs.avail_out = sizeof(buf);
+		int ret = deflate( &s->zs, s->file ? Z_NO_FLUSH : Z_FINISH );
+		if( ret != Z_OK && ret != Z_STREAM_END && ret != Z_BUF_ERROR )
+		{
+			notes << "CUdpFileDownloader::sendStream(): deflate error " << ret << endl;
+			reset();
+			bWasError = true;
+			bs->writeByte( STREAM_ABORT );
+			return true;
+		}
+		s->out.append( buf, sizeof(buf) - s->zs.avail_out );
+		if( s->record )
+			s->recorded.append( buf, sizeof(buf) - s->zs.avail_out );
+		if( ret == Z_STREAM_END )
+			s->finished = true;
+	}
+
+	const std::string & out = s->cached.get() ? *s->cached.get() : s->out;
+	size_t chunkSize = MIN( out.size() - s->outPos, (size_t)MAX_STREAM_CHUNK );
+	if( chunkSize > 0 )
+	{
+		bs->writeByte( STREAM_DATA );
+		bs->writeInt( (int)chunkSize, 2 );
+		bs->writeData( out.data() + s->outPos, chunkSize );
+		s->outPos += chunkSize;
+		return false;
+	}
+
+	bs->writeByte( STREAM_END );
+	notes << "CUdpFileDownloader::sendStream() finished " << sFilename << endl;
+	// The file could have been changed after setFileToStream() got its key
+	if( s->record && s->zs.total_in == s->recordKey.size )
+	{
+		SmartPointer<std::string> data = new std::string();
+		data.get()->swap( s->recorded );
+		cUdpFileCache.saveFileStream( s->recordKey, data );
+	}
+	closeStream( false );
+	tPrevState = tState;
+	tState = S_FINISHED;
+	iPos = 0;
+	return true;	// Send finished
+}
+
+bool CUdpFileDownloader::receiveStream( CBytestream * bs )
+{
+	int type = bs->readByte();
+
+	if( type == STREAM_START )
+	{
+		std::string filename = bs->readString();
+		Uint32 size = (Uint32)bs->readInt(4);
+		Uint32 offset = (Uint32)bs->readInt(4);
+		if( tState != S_FINISHED )
+		{
+			notes << "CUdpFileDownloader::receiveStream() - not expecting " << filename << ", ignoring it" << endl;
+			return false;
+		}
+
+		std::string partial;
+		if( offset > 0 )
+		{
+			std::map< std::string, PartialDownload > :: iterator it = tPartialDownloads.find( filename );
+			if( it == tPartialDownloads.end() || it->second.data.size() != offset )
+			{
+				notes << "CUdpFileDownloader::receiveStream() - cannot resume " << filename << " from offset " << offset << endl;
+				reset();
+				bWasError = true;
+				processFileRequests();
+				return true;	// Receive finished (due to error)
+			}
+			partial.swap( it->second.data );
+		}
+		tPartialDownloads.erase( filename );
+
+		FileStream * s = new FileStream( filename, false );
+		if( inflateInit( &s->zs ) != Z_OK )
+		{
+			delete s;
+			reset();
+			bWasError = true;
+			processFileRequests();
+			return true;
+		}
+		s->size = size;
+		s->offset = offset;
+
+		tPrevState = tState;
+		tState = S_RECEIVE;
+		iPos = 0;
+		sFilename = "";
+		sData.swap( partial );
+		pStream = s;
+		notes << "CUdpFileDownloader::receiveStream() started receiving " << filename << " from offset " << offset << endl;
+		return false;
+	}
+
+	if( type == STREAM_DATA )
+	{
+		size_t size = bs->readInt(2);
+		const char * data = bs->readDataPtr( size );
+		if( ! isReceivingStream() )	// Leftovers of a stream we already gave up
+			return false;
+
+		FileStream * s = pStream;
+		s->zs.next_in = (Bytef *) data;
+		s->zs.avail_in = (uInt) size;
+		while( s->zs.avail_in > 0 && ! s->finished )
+		{
+			char buf[16384];
+			s->zs.next_out = (Bytef *) buf;
+			s->zs.avail_out = sizeof(buf);
+			int ret = inflate( &s->zs, Z_NO_FLUSH );
+			if( ret != Z_OK && ret != Z_STREAM_END )
+			{
+				notes << "CUdpFileDownloader::receiveStream() inflate error " << ret << " after " << sData.size() << " bytes" << endl;
+				closeStream( false );
+				reset();
+				bWasError = true;
+				processFileRequests();
+				return true;	// Receive finished (due to error)
+			}
+			sData.append( buf, sizeof(buf) - s->zs.avail_out );
+			if( sData.size() > s->size )	// Don't let a small stream inflate until we run out of memory
+			{
+				notes << "CUdpFileDownloader::receiveStream() " << s->filename << " is bigger than the announced " << s->size << " bytes" << endl;
+				closeStream( false );
+				reset();
+				bWasError = true;
+				processFileRequests();
+				return true;	// Receive finished (due to error)
+			}
+			if( ret == Z_STREAM_END )
+				s->finished = true;
+		}
+		return false;
+	}
+
+	if( type == STREAM_END )
+	{
+		if( ! isReceivingStream() )
+			return false;
+
+		std::string filename = pStream->filename;
+		bool error = ! pStream->finished || sData.size() != pStream->size;
+		std::map< std::string, StatInfo > :: const_iterator info = cStatInfoCache.find( filename );
+		if( ! error && info != cStatInfoCache.end() && info->second.checksum != dataChecksum( sData.data(), sData.size() ) )
+			error = true;
+		closeStream( false );
+
+		tPrevState = tState;
+		tState = S_FINISHED;
+		iPos = 0;
+		if( error )
+		{
+			notes << "CUdpFileDownloader::receiveStream() error after " << sData.size() << " bytes of " << filename << endl;
+			reset();
+		}
+		else
+		{
+			sFilename = filename;
+			notes << "CUdpFileDownloader::receiveStream() filename " << sFilename << " data.size() " << sData.size() << endl;
+		}
+		bWasError = error;
+		processFileRequests();
+		return true;	// Receive finished
+	}
+
+	if( type == STREAM_ABORT )
+	{
+		if( ! isReceivingStream() )
+			return false;
+		// Same as if we got "ABORT:" - processFileRequests() does the rest
+		closeStream( true );
+		tPrevState = tState;
+		tState = S_FINISHED;
+		sFilename = "ABORT:";
+		sData = "";
+		processFileRequests();
+		return true;
+	}
+
+	notes << "CUdpFileDownloader::receiveStream() - unknown msg type " << type << endl;
+	bs->SkipAll();
+	return false;
+}
+
 void CUdpFileDownloader::allowFileRequest( bool allow )
 {
 	bAllowFileRequest = allow;
@@ -678,7 +1150,25 @@ void CUdpFileDownloader::allowFileRequest( bool allow )
 
 void CUdpFileDownloader::requestFile( const std::string & path, bool retryIfFail )
 {
-	setDataToSend( "GET:", path, false );
+	if( bAllowFileStream )
+	{
+		// Ask to resume from the end of the data we already have, if any
+		Uint32 offset = 0, checksum = 0;
+		prunePartialDownloads();
+		std::map< std::string, PartialDownload > :: const_iterator partial = tPartialDownloads.find( path );
+		if( partial != tPartialDownloads.end() )
+		{
+			offset = (Uint32)partial->second.data.size();
+			checksum = dataChecksum( partial->second.data.data(), partial->second.data.size() );
+		}
+		EndianSwap( offset );
+		EndianSwap( checksum );
+		setDataToSend( "GET_STREAM:", path + '\0' +
+						std::string( (const char *) (&offset), 4 ) +
+						std::string( (const char *) (&checksum), 4 ), false );
+	}
+	else
+		setDataToSend( "GET:", path, false );
 	if( retryIfFail )
 	{
 		bool exist = false;
@@ -695,6 +1185,13 @@ bool CUdpFileDownloader::requestFilesPending()
 {
 	if( tRequestedFiles.empty() )
 		return false;
+	if( isReceivingStream() )
+	{
+		// Stream stalled - request the file again, we will continue where we stopped
+		closeStream( true );
+		tPrevState = tState;
+		tState = S_FINISHED;
+	}
 	if( ! isFinished() )
 		return true;	// Receiving or sending in progress
 
@@ -749,8 +1246,8 @@ void CUdpFileDownloader::abortDownload()
 	setDataToSend( "ABORT:", "" );
 }
 
-std::string getStatPacketOneFile( const std::string & path );
-std::string getStatPacketRecursive( const std::string & path );
+static std::string getStatPacketOneFile( const std::string & path );
+static std::string getStatPacketRecursive( const std::string & path, std::vector<std::string> * paths );
 
 void CUdpFileDownloader::processFileRequests()
 {
@@ -802,6 +1299,35 @@ void CUdpFileDownloader::processFileRequests()
 			return;
 		};
 	};
+	if( sFilename == "GET_STREAM:" && bAllowFileStream )
+	{
+		// Filename, then the size and Adler32 checksum of the data the receiver already has
+		std::string::size_type f = getData().find( '\0' );
+		if( f == std::string::npos || getData().size() < f + 9 )
+		{
+			notes << "CFileDownloaderInGame::processFileRequests(): invalid stream request" << endl;
+			return;
+		};
+		std::string path = getData().substr( 0, f );
+		Uint32 offset = 0, checksum = 0;
+		memcpy( &offset, getData().data() + f + 1, 4 );
+		memcpy( &checksum, getData().data() + f + 5, 4 );
+		EndianSwap( offset );
+		EndianSwap( checksum );
+		if( ! isPathValid( path ) )
+		{
+			notes << "CFileDownloaderInGame::processFileRequests(): invalid filename "<< path << endl;
+			return;
+		};
+		struct stat st;
+		if( ! StatFile( path, &st ) || ! S_ISREG( st.st_mode ) )
+		{
+			notes << "CFileDownloaderInGame::processFileRequests(): cannot stream " << path << endl;
+			return;
+		};
+		setFileToStream( path, offset, checksum );
+		return;
+	};
 	if( sFilename == "STAT:" )
 	{
 		if( ! isPathValid( getData() ) )
@@ -809,7 +1335,7 @@ void CUdpFileDownloader::processFileRequests()
 			notes << "CFileDownloaderInGame::processFileRequests(): invalid filename " << getData() << endl;
 			return;
 		};
-		setDataToSend( "STAT_ACK:", getStatPacketRecursive( getData() ) );
+		setCompressedDataToSend( "STAT_ACK:", cUdpFileCache.getStatPacket( getData() ) );
 		return;
 	};
 	if( sFilename == "STAT_ACK:" )
@@ -912,19 +1438,22 @@ bool CUdpFileDownloader::isPathValid( const std::string & path )
 	return true;
 };
 
+// The paths of all visited files and dirs are saved to paths, to check later if the listing is still valid
 class StatFileList
 {
 	public:
    	std::string *data;
 	const std::string & reqpath;	// Path as client requested it
+	std::vector<std::string> *paths;
    	int index;
-	StatFileList( std::string *_data, const std::string & _reqpath ) :
-		data(_data), reqpath(_reqpath) {}
+	StatFileList( std::string *_data, const std::string & _reqpath, std::vector<std::string> *_paths ) :
+		data(_data), reqpath(_reqpath), paths(_paths) {}
 	bool operator() (std::string path)
 	{
 		size_t slash = findLastPathSep(path);
 		if(slash != std::string::npos)
 			path.erase(0, slash+1);
+		paths->push_back( reqpath + "/" + path );
 		*data += getStatPacketOneFile( reqpath + "/" + path );
 		return true;
 	};
@@ -935,9 +1464,10 @@ class StatDirList
 	public:
    	std::string *data;
 	const std::string & reqpath;	// Path as client requested it
+	std::vector<std::string> *paths;
    	int index;
-	StatDirList( std::string *_data, const std::string & _reqpath ) :
-		data(_data), reqpath(_reqpath) {}
+	StatDirList( std::string *_data, const std::string & _reqpath, std::vector<std::string> *_paths ) :
+		data(_data), reqpath(_reqpath), paths(_paths) {}
 	bool operator() (std::string path)
 	{
 		size_t slash = findLastPathSep(path);
@@ -945,15 +1475,15 @@ class StatDirList
 			path.erase(0, slash+1);
 		if( path == ".svn" )
 			return true;
-		*data += getStatPacketRecursive( reqpath + "/" + path );
+		*data += getStatPacketRecursive( reqpath + "/" + path, paths );
 		return true;
 	};
 };
 
-std::string getStatPacketOneFile( const std::string & path )
+static std::string getStatPacketOneFile( const std::string & path )
 {
-	size_t checksum, size, compressedSize;
-	if( ! FileChecksum( path, &checksum, &size ) )
+	Uint32 checksum, size, compressedSize;
+	if( ! cUdpFileCache.getFileInfo( path, &size, &checksum ) )
 		return "";
 	compressedSize = size + path.size() + 24; // Most files from disk are compressed already, so guessing size
 	EndianSwap( checksum );
@@ -965,8 +1495,9 @@ std::string getStatPacketOneFile( const std::string & path )
 			std::string( (const char *) (&checksum), 4 );	// Checksum
 };
 
-std::string getStatPacketRecursive( const std::string & path )
+static std::string getStatPacketRecursive( const std::string & path, std::vector<std::string> * paths )
 {
+		paths->push_back( path );
 		struct stat st;
 		if( ! StatFile( path, &st ) )
 		{
@@ -980,9 +1511,9 @@ std::string getStatPacketRecursive( const std::string & path )
 		if( S_ISDIR( st.st_mode ) )
 		{
 			std::string data;
-			StatFileList fileWorker( &data, path );
+			StatFileList fileWorker( &data, path, paths );
 			FindFiles( fileWorker, path, false, FM_REG);
-			StatDirList dirWorker( &data, path );
+			StatDirList dirWorker( &data, path, paths );
 			FindFiles( dirWorker, path, false, FM_DIR);
 			return data;
 		};
@@ -993,9 +1524,11 @@ float CUdpFileDownloader::getFileDownloadingProgress() const
 {
 	if( getState() != S_RECEIVE )
 		return 0.0;
-	if( cStatInfoCache.find(sLastFileRequested) == cStatInfoCache.end() )
-		return 0.0;
-	float ret = float(sData.size()) / float(cStatInfoCache.find(sLastFileRequested)->second.compressedSize);
+	float ret = 0.0;
+	if( pStream )	// We know the exact size here, and sData is not compressed
+		ret = pStream->size ? float(sData.size()) / float(pStream->size) : 0.0f;
+	else if( cStatInfoCache.find(sLastFileRequested) != cStatInfoCache.end() )
+		ret = float(sData.size()) / float(cStatInfoCache.find(sLastFileRequested)->second.compressedSize);
 	if( ret < 0.0 )
 		ret = 0.0;
 	if( ret > 1.0 )
@@ -1007,6 +1540,13 @@ size_t CUdpFileDownloader::getFileDownloadingProgressBytes() const
 {
 	if( getState() != S_RECEIVE )
 		return 0;
+	if( pStream )	// sData is not compressed here, count it in the compressed size getFilesPendingSize() uses
+	{
+		std::map< std::string, StatInfo > :: const_iterator info = cStatInfoCache.find( pStream->filename );
+		if( info == cStatInfoCache.end() )
+			return 0;
+		return (size_t)( getFileDownloadingProgress() * info->second.compressedSize );
+	}
 	return sData.size();
 };
 
@@ -1024,3 +1564,414 @@ size_t CUdpFileDownloader::getFilesPendingSize() const
 			sum += cStatInfoCache.find(tRequestedFiles[f])->second.compressedSize;
 	return sum;
 };
+
+
+UdpFileCache cUdpFileCache;
+
+enum { MAX_FILE_CACHE_MEMORY = 64 * 1024 * 1024 };	// Compressed data kept in memory, the least recently used is freed first
+enum { MAX_FILE_CACHE_BLOB = MAX_FILE_CACHE_MEMORY / 4 };	// Bigger data is not kept in memory, it would free most of the others
+enum { MAX_FILE_DISK_CACHE = 256 * 1024 * 1024 };	// Size of cache/files, the oldest files are deleted first
+
+bool UdpFileCache::stampFile( const std::string & path, FileStamp * stamp )
+{
+	struct stat st;
+	stamp->path = path;
+	stamp->mtime = -1;	// Also a valid stamp for files which don't exist
+	stamp->size = 0;
+	stamp->taken = (Sint64)time( NULL );
+	if( ! StatFile( path, &st ) )
+		return false;
+	stamp->mtime = (Sint64)st.st_mtime;
+	stamp->size = (Uint64)st.st_size;
+	return true;
+}
+
+UdpFileCache::PathItem * UdpFileCache::findFile( const std::string & path )
+{
+	FileStamp stamp;
+	if( ! stampFile( path, &stamp ) )
+		return NULL;
+
+	std::map< std::string, PathItem > :: iterator it = cPaths.find( path );
+	if( it != cPaths.end() && it->second.stamp.unchanged( stamp ) )
+	{
+		it->second.lastUsed = tLX->currentTime;
+		return &it->second;
+	}
+
+	// New or changed file, get the new checksums
+	FILE * ff = OpenGameFile( path, "rb" );
+	if( ff == NULL )
+		return NULL;
+	char buf[16384];
+	uLong checksum = adler32( 0L, Z_NULL, 0 );
+	uLong crc = crc32( 0L, Z_NULL, 0 );
+	size_t size = 0;
+	while( ! feof( ff ) )
+	{
+		size_t read = fread( buf, 1, sizeof(buf), ff );
+		if( read == 0 )
+			break;
+		checksum = adler32( checksum, (const Bytef *)buf, (uInt)read );
+		crc = crc32( crc, (const Bytef *)buf, (uInt)read );
+		size += read;
+	};
+	fclose( ff );
+
+	PathItem & item = cPaths[ path ];
+	setBlob( item.compressed, NULL );
+	item.stamp = stamp;
+	item.content.size = (Uint32)size;
+	item.content.checksum = (Uint32)checksum;
+	item.content.crc = (Uint32)crc;
+	item.lastUsed = tLX->currentTime;
+	return &item;
+}
+
+void UdpFileCache::setBlob( SmartPointer<std::string> & blob, const SmartPointer<std::string> & data )
+{
+	if( blob.get() )
+		iMemoryUsed -= blob.get()->size();
+	blob = data;
+	if( blob.get() && blob.get()->size() > MAX_FILE_CACHE_BLOB )
+		blob = NULL;
+	if( blob.get() )
+		iMemoryUsed += blob.get()->size();
+}
+
+void UdpFileCache::freeMemory()
+{
+	while( iMemoryUsed > MAX_FILE_CACHE_MEMORY )
+	{
+		SmartPointer<std::string> * oldest = NULL;
+		AbsTime oldestTime;
+		for( std::map< std::string, PathItem > :: iterator it = cPaths.begin(); it != cPaths.end(); it++ )
+			if( it->second.compressed.get() && ( oldest == NULL || it->second.lastUsed < oldestTime ) )
+			{
+				oldest = &it->second.compressed;
+				oldestTime = it->second.lastUsed;
+			}
+		for( std::map< ContentKey, ContentItem > :: iterator it = cContents.begin(); it != cContents.end(); it++ )
+			if( it->second.stream.get() && ( oldest == NULL || it->second.lastUsed < oldestTime ) )
+			{
+				oldest = &it->second.stream;
+				oldestTime = it->second.lastUsed;
+			}
+		for( std::map< std::string, StatItem > :: iterator it = cStats.begin(); it != cStats.end(); it++ )
+			if( it->second.compressed.get() && ( oldest == NULL || it->second.lastUsed < oldestTime ) )
+			{
+				oldest = &it->second.compressed;
+				oldestTime = it->second.lastUsed;
+			}
+		if( oldest == NULL )
+			break;
+		setBlob( *oldest, NULL );
+	}
+}
+
+std::string UdpFileCache::diskCacheFilename( const ContentKey & key )
+{
+	return "cache/files/" + itoa( key.size, 16 ) + "-" + itoa( key.checksum, 16 ) + "-" + itoa( key.crc, 16 ) + ".z";
+}
+
+class DiskCacheFileList
+{
+	public:
+	struct File { Sint64 mtime; Uint64 size; std::string path; };
+	std::vector<File> files;
+	Uint64 size;
+	DiskCacheFileList() : size(0) {}
+	bool operator() ( const std::string & path )
+	{
+		struct stat st;
+		if( path.size() < 2 || path.substr( path.size() - 2 ) != ".z" )	// Temporary files are still being written
+			return true;
+		if( stat( Utf8ToSystemNative( path ).c_str(), &st ) != 0 )
+			return true;
+		File f = { (Sint64)st.st_mtime, (Uint64)st.st_size, path };
+		files.push_back( f );
+		size += f.size;
+		return true;
+	};
+	static bool older( const File & a, const File & b ) { return a.mtime < b.mtime; }
+};
+
+// Deletes the oldest streams in cache/files until it's below MAX_FILE_DISK_CACHE, called after adding one
+void UdpFileCache::pruneDiskCache()
+{
+	DiskCacheFileList list;
+	FindFiles( list, GetWriteFullFileName( "cache/files", true ), true, FM_REG );
+	if( list.size <= MAX_FILE_DISK_CACHE )
+		return;
+	std::sort( list.files.begin(), list.files.end(), DiskCacheFileList::older );
+	for( size_t f = 0; f < list.files.size() && list.size > MAX_FILE_DISK_CACHE; f++ )
+	{
+		if( remove( Utf8ToSystemNative( list.files[f].path ).c_str() ) == 0 )
+			list.size -= list.files[f].size;
+	}
+	notes << "UdpFileCache: pruned cache/files to " << list.size << " bytes" << endl;
+}
+
+bool UdpFileCache::getFileInfo( const std::string & path, Uint32 * size, Uint32 * checksum )
+{
+	Mutex::ScopedLock lock( mutex );
+	PathItem * item = findFile( path );
+	if( item == NULL )
+		return false;
+	*size = item->content.size;
+	*checksum = item->content.checksum;
+	return true;
+}
+
+SmartPointer<std::string> UdpFileCache::getCompressedFile( const std::string & path )
+{
+	Mutex::ScopedLock lock( mutex );
+	PathItem * item = findFile( path );
+	if( item == NULL )
+		return NULL;
+	return item->compressed;
+}
+
+void UdpFileCache::saveCompressedFile( const std::string & path, const SmartPointer<std::string> & data )
+{
+	Mutex::ScopedLock lock( mutex );
+	PathItem * item = findFile( path );
+	if( item == NULL )
+		return;
+	setBlob( item->compressed, data );
+	freeMemory();
+}
+
+// The zlib stream ends with the Adler32 of the file, this also catches incomplete cache files
+bool UdpFileCache::isStreamOf( const std::string & d, const ContentKey & key )
+{
+	return d.size() >= 4 &&
+		( (Uint32)(Uint8)d[d.size()-4] << 24 | (Uint32)(Uint8)d[d.size()-3] << 16 |
+		  (Uint32)(Uint8)d[d.size()-2] << 8 | (Uint32)(Uint8)d[d.size()-1] ) == key.checksum;
+}
+
+bool UdpFileCache::getFileStream( const std::string & path, ContentKey * key, SmartPointer<std::string> * data )
+{
+	Mutex::ScopedLock lock( mutex );
+	PathItem * item = findFile( path );
+	if( item == NULL )
+		return false;
+	*key = item->content;
+
+	ContentItem & content = cContents[ item->content ];
+	content.lastUsed = tLX->currentTime;
+	*data = content.stream;
+	if( content.stream.get() || ! tLXOptions->bFileDownloadDiskCache )
+		return true;
+
+	// Try the disk cache
+	SmartPointer<std::string> cached = new std::string( GetFileContents( GetWriteFullFileName( diskCacheFilename( item->content ) ), true ) );
+	if( ! isStreamOf( *cached.get(), item->content ) )
+		return true;
+	setBlob( content.stream, cached );
+	freeMemory();
+	*data = cached;	// Also when it's too big to be kept in memory
+	return true;
+}
+
+void UdpFileCache::saveFileStream( const ContentKey & key, const SmartPointer<std::string> & data )
+{
+	if( ! isStreamOf( *data.get(), key ) )
+	{
+		warnings << "UdpFileCache::saveFileStream(): the stream does not match the file content" << endl;
+		return;
+	}
+	Mutex::ScopedLock lock( mutex );
+	ContentItem & content = cContents[ key ];
+	setBlob( content.stream, data );
+	content.lastUsed = tLX->currentTime;
+
+	if( tLXOptions->bFileDownloadDiskCache )
+	{
+		// Other processes could read the cache at the same time
+		const std::string cacheFile = GetWriteFullFileName( diskCacheFilename( key ), true );
+		if( ! IsFileAvailable( cacheFile, true ) )
+		{
+			if( ! WriteFileAtomic( cacheFile, *data.get() ) )
+				warnings << "cannot write file download cache " << cacheFile << endl;
+			else
+				pruneDiskCache();
+		}
+	}
+	freeMemory();
+}
+
+SmartPointer<std::string> UdpFileCache::getStatPacket( const std::string & path )
+{
+	{
+		Mutex::ScopedLock lock( mutex );
+		std::map< std::string, StatItem > :: iterator it = cStats.find( path );
+		if( it != cStats.end() && it->second.compressed.get() )
+		{
+			bool changed = false;
+			FileStamp stamp;
+			for( std::vector<FileStamp> :: const_iterator s = it->second.stamps.begin(); s != it->second.stamps.end() && ! changed; s++ )
+			{
+				stampFile( s->path, &stamp );
+				changed = ! s->unchanged( stamp );
+			}
+			if( ! changed )
+			{
+				it->second.lastUsed = tLX->currentTime;
+				return it->second.compressed;
+			}
+		}
+	}
+
+	// Build it without the lock, getStatPacketOneFile() uses getFileInfo()
+	// The stamps count as taken before the listing, so a file changed while it's built is seen as changed the next time
+	const Sint64 listingStart = (Sint64)time( NULL );
+	std::vector<std::string> paths;
+	std::string data = getStatPacketRecursive( path, &paths );
+	SmartPointer<std::string> compressed = new std::string();
+	Compress( std::string( "STAT_ACK:" ) + '\0' + data, compressed.get() );
+
+	std::vector<FileStamp> stamps( paths.size() );
+	for( size_t f = 0; f < paths.size(); f++ )
+	{
+		stampFile( paths[f], &stamps[f] );
+		stamps[f].taken = listingStart;
+	}
+
+	Mutex::ScopedLock lock( mutex );
+	StatItem & item = cStats[ path ];
+	item.stamps.swap( stamps );
+	setBlob( item.compressed, compressed );
+	item.lastUsed = tLX->currentTime;
+	freeMemory();
+	return compressed;
+}
+
+#ifdef DEBUG
+/////////////////////
+// Streamed file transfers: resuming after a reconnect, resuming a file which has changed meanwhile,
+// and requesting a stalled stream again like CClient does after fDownloadRetryTimeout
+
+// Passes the msgs between both sides until the client got the file, or until stopAfter stream msgs were sent
+static size_t TestFileStreamTransfer( CUdpFileDownloader & server, CUdpFileDownloader & client, int stopAfter )
+{
+	size_t streamBytes = 0;
+	CBytestream bs;
+	while( client.isSending() )
+	{
+		bs.Clear();
+		client.send( &bs );
+		bs.ResetPosToBegin();
+		server.receive( &bs );
+	}
+	for( int msgs = 0; server.isSendingStream() && msgs != stopAfter; msgs++ )
+	{
+		bs.Clear();
+		server.sendStream( &bs );
+		streamBytes += bs.GetLength();
+		bs.ResetPosToBegin();
+		if( client.receiveStream( &bs ) )
+			break;
+	}
+	return streamBytes;
+}
+
+// The interrupted stream sent interrupted bytes before, resumed says whether the rest should continue from there
+static int TestFileStreamCase( const std::string & name, CUdpFileDownloader & client, const std::string & path,
+								size_t interrupted, size_t rest, size_t wholeFile, bool resumed )
+{
+	bool ok = client.isFinished() && ! client.wasError() && client.getFilename() == path && client.getData() == GetFileContents( path );
+	if( resumed )
+		ok = ok && rest + interrupted / 2 < wholeFile;
+	else
+		ok = ok && rest >= wholeFile;
+	notes << name << ": " << ( ok ? "ok" : "ERROR!" ) << ", " << interrupted << " + " << rest << " bytes sent, "
+			<< wholeFile << " for the whole file" << ( interrupted > 0 && ! resumed ? ", expected all of it again" : "" ) << endl;
+	return ok ? 0 : 1;
+}
+
+void TestFileDownloadStreaming()
+{
+	notes << "\n\n\n\nTesting streamed file transfers" << endl;
+
+	// Don't leave the streams of the test file in cache/files
+	const bool diskCache = tLXOptions->bFileDownloadDiskCache;
+	tLXOptions->bFileDownloadDiskCache = false;
+
+	const std::string path = "cache/filestreamtest.bin";
+	std::string content;
+	for( int i = 0; i < 200000; i++ )
+		content += (char)( i % 3 == 0 ? GetRandomInt( 255 ) : 'a' + i % 7 );
+	FILE * ff = OpenGameFile( path, "wb" );
+	if( ff == NULL )
+	{
+		errors << "TestFileDownloadStreaming: cannot write " << path << endl;
+		tLXOptions->bFileDownloadDiskCache = diskCache;
+		return;
+	}
+	fwrite( content.data(), 1, content.size(), ff );
+	fclose( ff );
+
+	int failed = 0;
+	size_t wholeFile = 0;
+	{
+		CUdpFileDownloader server, client;
+		server.allowFileStream( true );
+		client.allowFileStream( true );
+		client.requestFile( path, true );
+		wholeFile = TestFileStreamTransfer( server, client, -1 );
+		failed += TestFileStreamCase( "whole file", client, path, 0, wholeFile, wholeFile, false );
+	}
+	{
+		// The connection is lost in the middle, the partial data survives the reset() of the client
+		CUdpFileDownloader server, client;
+		server.allowFileStream( true );
+		client.allowFileStream( true );
+		client.requestFile( path, true );
+		const size_t interrupted = TestFileStreamTransfer( server, client, 100 );
+		client.reset();
+		CUdpFileDownloader server2;
+		server2.allowFileStream( true );
+		client.requestFile( path, true );
+		const size_t rest = TestFileStreamTransfer( server2, client, -1 );
+		failed += TestFileStreamCase( "resume after reconnect", client, path, interrupted, rest, wholeFile, true );
+	}
+	{
+		// The beginning of the file changes while the client is away, the checksum doesn't match and the whole file is sent
+		CUdpFileDownloader server, client;
+		server.allowFileStream( true );
+		client.allowFileStream( true );
+		client.requestFile( path, true );
+		const size_t interrupted = TestFileStreamTransfer( server, client, 100 );
+		client.reset();
+		ff = OpenGameFile( path, "r+b" );
+		if( ff )
+		{
+			fputc( 'X', ff );
+			fclose( ff );
+		}
+		CUdpFileDownloader server2;
+		server2.allowFileStream( true );
+		client.requestFile( path, true );
+		const size_t rest = TestFileStreamTransfer( server2, client, -1 );
+		failed += TestFileStreamCase( "resume of a changed file", client, path, interrupted, rest, wholeFile, false );
+	}
+	{
+		// The stream stops without any error, the client requests the file again when it notices
+		CUdpFileDownloader server, client;
+		server.allowFileStream( true );
+		client.allowFileStream( true );
+		client.requestFile( path, true );
+		const size_t interrupted = TestFileStreamTransfer( server, client, 100 );
+		if( ! client.isReceivingStream() )
+			failed++, notes << "ERROR! the stream should be stalled" << endl;
+		client.requestFilesPending();
+		const size_t rest = TestFileStreamTransfer( server, client, -1 );
+		failed += TestFileStreamCase( "stalled stream requested again", client, path, interrupted, rest, wholeFile, true );
+	}
+
+	remove( Utf8ToSystemNative( GetWriteFullFileName( path ) ).c_str() );
+	tLXOptions->bFileDownloadDiskCache = diskCache;
+	notes << "Streamed file transfers: " << failed << " errors" << endl;
+}
+#endif
@@ -29,6 +29,7 @@
 #include "Options.h"
 #include "Debug.h"
 
+#include <SDL_thread.h>
 
 #ifdef WIN32
 #	ifndef _WIN32_IE
@@ -791,6 +792,36 @@ bool FileCopy(const std::string& src, const std::string& dest) {
 	return success;
 }
 
+FILE* OpenTempFile(const std::string& path, std::string& tmpFile) {
+#ifdef WIN32
+	const unsigned long pid = (unsigned long)GetCurrentProcessId();
+#else
+	const unsigned long pid = (unsigned long)getpid();
+#endif
+	tmpFile = path + ".tmp" + itoa(pid) + "-" + itoa((unsigned long)SDL_ThreadID());
+	return fopen(Utf8ToSystemNative(tmpFile).c_str(), "wb");
+}
+
+bool CommitTempFile(FILE* fp, const std::string& tmpFile, const std::string& path, bool ok) {
+	ok = (fclose(fp) == 0) && ok;
+	if(ok) {
+#ifdef WIN32
+		remove(Utf8ToSystemNative(path).c_str()); // rename doesn't replace existing files on Windows
+#endif
+		ok = rename(Utf8ToSystemNative(tmpFile).c_str(), Utf8ToSystemNative(path).c_str()) == 0;
+	}
+	if(!ok)
+		remove(Utf8ToSystemNative(tmpFile).c_str());
+	return ok;
+}
+
+bool WriteFileAtomic(const std::string& path, const std::string& data) {
+	std::string tmpFile;
+	FILE* fp = OpenTempFile(path, tmpFile);
+	if(!fp) return false;
+	return CommitTempFile(fp, tmpFile, path, fwrite(data.data(), 1, data.size(), fp) == data.size());
+}
+
 bool CanWriteToDir(const std::string& dir) {
 	// TODO: we have to make this a lot better!
 	std::string fname = dir + "/.some_stupid_temp_file";
@@ -8,8 +8,15 @@
 */
 
 
+#include <cstring>
+#include <vector>
 #include "GeoIPDatabase.h"
 #include "FindFile.h"
+#include "MathLib.h"
+#ifdef DEBUG
+#include "IpToCountryDB.h"
+#include "StringUtils.h"
+#endif
 
 //
 // Defines
@@ -199,36 +206,62 @@ GeoRecord& GeoRecord::operator= (const GeoRecord& oth)
 // Destructor
 GeoIPDatabase::~GeoIPDatabase()
 {
-	if (m_file)  {
-		fclose(m_file);
-	}
+	close();
+}
+
+////////////////
+// Frees the database
+void GeoIPDatabase::close()
+{
 	if (m_dbSegments)  {
 		delete[] m_dbSegments;
 	}
+	m_dbSegments = NULL;
 
-	m_file = NULL;
+	m_data.clear();
+	m_loaded = false;
+	clearCache();
 }
 
 ////////////////
 // Loads the database, returns false on failure
 bool GeoIPDatabase::load(const std::string& filename)
 {
-	m_file = OpenGameFile(filename, "rb");
-	if (!m_file)
+	close();
+
+	FILE *fp = OpenGameFile(filename, "rb");
+	if (!fp)
 		return false;
 
+	// Read the whole file into memory
+	char buf[4096];
+	size_t read = 0;
+	while ((read = fread(buf, 1, sizeof(buf), fp)) > 0)
+		m_data.append(buf, read);
+	fclose(fp);
+
 	m_fileName = filename;
 	if (!setupSegments())  {
-		fclose(m_file);
+		m_data.clear();
 		return false;
 	}
 
+	m_loaded = true;
 	return true;
 }
 
+/////////////////
+// Returns a pointer to the database data at the given offset or NULL if there are not len bytes
+const unsigned char *GeoIPDatabase::dataAt(size_t offset, size_t len) const
+{
+	if (offset > m_data.size() || m_data.size() - offset < len)
+		return NULL;
+	return (const unsigned char *)m_data.data() + offset;
+}
+
 /////////////////
 // Reads database segments (private)
-// Requires the database file to be open
+// Requires the database data to be loaded
 // Returns true on success, false otherwise
 bool GeoIPDatabase::setupSegments()
 {
@@ -240,13 +273,23 @@ bool GeoIPDatabase::setupSegments()
 	// Default to GeoIP Country Edition
 	m_dbType = GEOIP_COUNTRY_EDITION;
 	m_recordLength = STANDARD_RECORD_LENGTH;
-	fseek(m_file, -3l, SEEK_END);
+	if (m_data.size() < 3)  {
+		errors << "Error reading from GeoIP database" << endl;
+		return false;
+	}
+
+	size_t pos = m_data.size() - 3;
 	for (int i = 0; i < STRUCTURE_INFO_MAX_SIZE; i++) {
-		unsigned char delim[3];  // Record delimiter
-		if (fread(delim, 1, 3, m_file) != 3)
+		const unsigned char *delim = dataAt(pos, 3);  // Record delimiter
+		if (!delim)  {
 			errors << "Error reading from GeoIP database" << endl;
+			break;
+		}
 		if (delim[0] == 255 && delim[1] == 255 && delim[2] == 255) {
-			if (fread(&m_dbType, 1, 1, m_file) != 1)
+			const unsigned char *type = dataAt(pos + 3, 1);
+			if (type)
+				m_dbType = type[0];
+			else
 				errors << "Error reading from GeoIP database" << endl;
 
 			// Backwards compatibility with databases from April 2003 and earlier
@@ -271,18 +314,21 @@ bool GeoIPDatabase::setupSegments()
 				m_dbSegments = new unsigned int[1];
 				m_dbSegments[0] = 0;
 
-				unsigned char buf[SEGMENT_RECORD_LENGTH];
-				if (fread(buf, SEGMENT_RECORD_LENGTH, 1, m_file) != 1)
+				const unsigned char *buf = dataAt(pos + 4, SEGMENT_RECORD_LENGTH);
+				if (buf)  {
+					for (int j = 0; j < SEGMENT_RECORD_LENGTH; j++)
+						m_dbSegments[0] += (buf[j] << (j * 8));
+				} else
 					errors << "Error reading from GeoIP database" << endl;
-				for (int j = 0; j < SEGMENT_RECORD_LENGTH; j++)
-					m_dbSegments[0] += (buf[j] << (j * 8));
 				
 				if (m_dbType == GEOIP_ORG_EDITION || m_dbType == GEOIP_ISP_EDITION)
 					m_recordLength = ORG_RECORD_LENGTH;
 			}
 			break;
 		} else {
-			fseek(m_file, -4l, SEEK_CUR);
+			if (pos == 0)
+				break;
+			pos--;
 		}
 	}
 
@@ -294,6 +340,11 @@ bool GeoIPDatabase::setupSegments()
 		m_dbSegments[0] = COUNTRY_BEGIN;
 	}
 
+	if (!m_dbSegments)  {
+		errors << "The Geo IP database has an unsupported format" << endl;
+		return false;
+	}
+
 	return true;
 }
 
@@ -301,21 +352,21 @@ bool GeoIPDatabase::setupSegments()
 // Seek a record in the database, returns record index or 0 on failure
 unsigned int GeoIPDatabase::seekRecord(unsigned long ipnum) const
 {
-	if (!m_file)
+	if (!m_loaded)
 		return 0;
 
 	unsigned int x;
-	unsigned char stack_buffer[2 * MAX_RECORD_LENGTH];
-	const unsigned char *buf = stack_buffer;
 	unsigned int offset = 0;
 
 	const unsigned char * p;
 
 	for (int depth = 31; depth >= 0; depth--) {
-		// Read from disk
-		fseek(m_file, (long)m_recordLength * 2 * offset, SEEK_SET);
-		if (fread(stack_buffer, m_recordLength, 2, m_file) != 2)
+		// Get the node from memory
+		const unsigned char *buf = dataAt((size_t)m_recordLength * 2 * offset, m_recordLength * 2);
+		if (!buf)  {
 			errors << "Error reading from GeoIP database" << endl;
+			return 0;
+		}
 
 		if (ipnum & (1 << depth)) {
 			// Take the right-hand branch
@@ -362,7 +413,7 @@ unsigned int GeoIPDatabase::seekRecord(unsigned long ipnum) const
 	}
 
 	// Shouldn't reach here
-	errors << "Error Traversing Database for ipnum = %lu - Perhaps database is corrupt?" << endl;
+	errors << "Error Traversing Database for ipnum = " << ipnum << " - Perhaps database is corrupt?" << endl;
 	return 0;
 }
 
@@ -372,26 +423,23 @@ GeoRecord GeoIPDatabase::extractRecordCity(unsigned int seekRecord) const
 {
 	GeoRecord record;
 
-	int record_pointer;
-	unsigned char *record_buf = NULL;
-	unsigned char *begin_record_buf = NULL;
+	size_t record_pointer;
+	unsigned char begin_record_buf[FULL_RECORD_LENGTH + 1];
+	const unsigned char *record_buf = begin_record_buf;
 	double latitude = 0, longitude = 0;
 	int metroarea_combo = 0;
-	int bytes_read = 0;
 	if (seekRecord == m_dbSegments[0])		
 		return record;
 
 	record_pointer = seekRecord + (2 * m_recordLength - 1) * m_dbSegments[0];
 
-	// Seek to the record
-	fseek(m_file, record_pointer, SEEK_SET);
-	begin_record_buf = record_buf = new unsigned char[FULL_RECORD_LENGTH];
-	bytes_read = fread(record_buf, sizeof(char), FULL_RECORD_LENGTH, m_file);
-	if (bytes_read == 0) {
+	// Copy the record, it can be shorter at the end of the file
+	if (record_pointer >= m_data.size())  {
 		// Eof or other error
-		delete[] begin_record_buf;
 		return record;
 	}
+	memset(begin_record_buf, 0, sizeof(begin_record_buf));
+	memcpy(begin_record_buf, m_data.data() + record_pointer, MIN((size_t)FULL_RECORD_LENGTH, m_data.size() - record_pointer));
 
 	// Get country
 	record.continentCode = GeoIP_country_continent[record_buf[0]];
@@ -401,18 +449,18 @@ GeoRecord GeoIPDatabase::extractRecordCity(unsigned int seekRecord) const
 	record_buf++;
 
 	// Get region
-	record.region = (char *)record_buf;
+	record.region = (const char *)record_buf;
 	record_buf += record.region.size() + 1;
 	record.region = ISO88591ToUtf8(record.region);
 
 	// Get city
-	record.city = (char *)record_buf;
+	record.city = (const char *)record_buf;
 	record_buf += record.city.size() + 1;
 	record.city = ISO88591ToUtf8(record.city);
 
 
 	// Get postal code
-	record.postalCode = (char *)record_buf;
+	record.postalCode = (const char *)record_buf;
 	record_buf += record.postalCode.size() + 1;
 
 	// Get latitude
@@ -437,8 +485,6 @@ GeoRecord GeoIPDatabase::extractRecordCity(unsigned int seekRecord) const
 		}
 	}
 
-	delete[] begin_record_buf;
-
 	record.hasCityLevel = true;
 	fillContinent(record);
 
@@ -536,7 +582,7 @@ GeoRecord GeoIPDatabase::lookup(const std::string& ip) const
 {
 	GeoRecord res;
 
-	if (!m_file)
+	if (!m_loaded)
 		return res;
 
 	// IP check
@@ -551,8 +597,34 @@ GeoRecord GeoIPDatabase::lookup(const std::string& ip) const
 		return res;
 	}
 
+	Mutex::ScopedLock lock(m_cacheMutex);
+
+	// Recently looked up?
+	std::map<unsigned long, CacheList::iterator>::iterator cached = m_cacheIndex.find(l_ip);
+	if (cached != m_cacheIndex.end())  {
+		m_cache.splice(m_cache.begin(), m_cache, cached->second);
+		return cached->second->second;
+	}
+
+	res = lookupUncached(l_ip);
+
+	// Remember it, throw away the least recently used one if full
+	m_cache.push_front(std::make_pair(l_ip, res));
+	m_cacheIndex[l_ip] = m_cache.begin();
+	if (m_cache.size() > CACHE_SIZE)  {
+		m_cacheIndex.erase(m_cache.back().first);
+		m_cache.pop_back();
+	}
+
+	return res;
+}
+
+/////////////////
+// Searches the database for the given IP (in MaxMind's representation)
+GeoRecord GeoIPDatabase::lookupUncached(unsigned long ipnum) const
+{
 	// Find the record
-	int record = seekRecord(l_ip);
+	int record = seekRecord(ipnum);
 
 	// Get information
 	if (m_dbType == GEOIP_CITY_EDITION_REV0 || m_dbType == GEOIP_CITY_EDITION_REV1)
@@ -561,6 +633,68 @@ GeoRecord GeoIPDatabase::lookup(const std::string& ip) const
 		return extractRecordCtry(record);
 	else  {
 		errors << "The Geo IP database has an unsupported format" << endl;
-		return res;
+		return GeoRecord();
+	}
+}
+
+/////////////////
+// Forgets all cached lookups
+void GeoIPDatabase::clearCache() const
+{
+	Mutex::ScopedLock lock(m_cacheMutex);
+	m_cache.clear();
+	m_cacheIndex.clear();
+}
+
+
+#ifdef DEBUG
+/////////////////
+// Benchmark for the IP lookups
+
+static std::string randomIp()
+{
+	return itoa(1 + GetRandomInt(222)) + "." + itoa(GetRandomInt(255)) + "." + itoa(GetRandomInt(255)) + "." + itoa(GetRandomInt(255));
+}
+
+void TestGeoIPLookup()
+{
+	notes << "Testing GeoIP lookup" << endl;
+
+	GeoIPDatabase db;
+	Uint32 start = SDL_GetTicks();
+	if (!db.load(IP_TO_COUNTRY_FILE))  {
+		errors << "Cannot load " << IP_TO_COUNTRY_FILE << endl;
+		return;
 	}
+	notes << "loaded " << db.m_data.size() << " bytes in " << (SDL_GetTicks() - start) << "ms" << endl;
+
+	const int lookups = 100000;
+	std::vector<std::string> ips;
+	for (int i = 0; i < lookups; ++i)
+		ips.push_back(randomIp());
+
+	// Different IPs, mostly cache misses
+	size_t found = 0;
+	start = SDL_GetTicks();
+	for (int i = 0; i < lookups; ++i)
+		if (db.lookup(ips[i]).countryCode != "UN") found++;
+	Uint32 time = SDL_GetTicks() - start;
+	notes << lookups << " random IPs: " << time << "ms";
+	if (time > 0) notes << " (" << (lookups * 1000 / time) << " lookups/sec)";
+	notes << ", " << found << " known" << endl;
+
+	// The same few IPs again and again, like the server list and the lobby do
+	start = SDL_GetTicks();
+	for (int i = 0; i < lookups; ++i)
+		db.lookup(ips[i % 32]);
+	time = SDL_GetTicks() - start;
+	notes << lookups << " lookups of 32 IPs: " << time << "ms";
+	if (time > 0) notes << " (" << (lookups * 1000 / time) << " lookups/sec)";
+	notes << endl;
+
+	// Cached results must be the same as the ones from the database
+	for (int i = 0; i < 32; ++i)
+		if (db.lookup(ips[i]).countryCode != db.lookupUncached(db.convertIp(ips[i])).countryCode)
+			notes << "cached result for " << ips[i] << " NOT SAME!" << endl;
 }
+#endif
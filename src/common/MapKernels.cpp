@@ -0,0 +1,517 @@
+/*
+	OpenLieroX
+
+	row kernels for the map modification (CarveHole, PlaceDirt, PlaceGreenDirt)
+
+	code under LGPL
+*/
+
+#include <cstring>
+#include <vector>
+
+#include "MapKernels.h"
+#include "CMap.h"
+#include "GfxPrimitives.h"
+#include "MathLib.h"
+#include "Debug.h"
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define MAPKERNELS_SSE2
+#include <emmintrin.h>
+#endif
+
+
+// Can be switched off to compare with the plain loops (TestMapKernels)
+static bool bMapKernelsSse2 = true;
+
+
+MapKernelTransparency::MapKernelTransparency(SDL_Surface* surf)
+{
+	alphaMask = (surf->flags & SDL_SRCALPHA) ? surf->format->Amask : 0;
+	keyOrMask = surf->format->Amask;
+	key = COLORKEY(surf) | keyOrMask;
+	hasKey = (surf->flags & SDL_SRCCOLORKEY) != 0;
+}
+
+
+////////////////////
+// Plain loops, used for the row ends and for the formats without a vectorized version
+
+// Writes one map pixel, 2x2 times in the hi-res image
+static inline void PutMapPixel(const MapKernelRow& row, Uint8* p, Uint32 colour)
+{
+	PutPixelToAddr(p, colour, row.bpp);
+	if (row.doubled)  {
+		PutPixelToAddr(p + row.bpp, colour, row.bpp);
+		PutPixelToAddr(p + row.dstPitch, colour, row.bpp);
+		PutPixelToAddr(p + row.dstPitch + row.bpp, colour, row.bpp);
+	}
+}
+
+static inline Uint8* DstPixel(const MapKernelRow& row, int i)
+{
+	return row.dst + i * row.bpp * (row.doubled ? 2 : 1);
+}
+
+static int CarveHoleRow_Plain(const MapKernelRow& row, int begin, Uint32 pink, Uint32 black)
+{
+	int nNumDirt = 0;
+	for (int i = begin; i < row.width; i++)  {
+		// Carve only dirt
+		if (!(row.flags[i] & PX_DIRT))
+			continue;
+
+		Uint32 pixel = GetPixelFromAddr((Uint8 *)row.src + i * row.bpp, row.bpp);
+
+		// Set the flag to empty
+		if (pixel == pink)  {
+			nNumDirt++;
+			row.flags[i] = PX_EMPTY;
+
+		// Put pixels that are not black/pink (eg, brown)
+		} else if (pixel != black)
+			PutMapPixel(row, DstPixel(row, i), pixel);
+	}
+	return nNumDirt;
+}
+
+static int PlaceDirtRow_Plain(const MapKernelRow& row, int begin, int end, const MapKernelTransparency& transp, Uint32 pink, const Uint8* tile)
+{
+	int nDirtCount = 0;
+	for (int i = begin; i < end; i++, tile += row.bpp)  {
+		Uint32 pixel = GetPixelFromAddr((Uint8 *)row.src + i * row.bpp, row.bpp);
+		if (transp.isTransparent(pixel))
+			continue;
+
+		uchar flag = row.flags[i];
+		const bool own = pixel != pink && (flag & PX_EMPTY); // pixels that are not pink (eg, brown) on empty places
+		const bool tiled = !(flag & PX_ROCK); // the dirt image anywhere else but rock
+
+		// HINT: brown pixels are counted twice, as the old code did
+		if (tiled && (flag & PX_EMPTY))
+			nDirtCount++;
+		if (own)
+			nDirtCount++;
+
+		if (own)
+			PutMapPixel(row, DstPixel(row, i), pixel);
+		else if (tiled)
+			PutMapPixel(row, DstPixel(row, i), GetPixelFromAddr((Uint8 *)tile, row.bpp));
+		else
+			continue;
+		row.flags[i] = PX_DIRT;
+	}
+	return nDirtCount;
+}
+
+static int PlaceGreenDirtRow_Plain(const MapKernelRow& row, int begin, Uint32 green, Uint32 pink, const Uint32 greens[4])
+{
+	int nGreenCount = 0;
+	for (int i = begin; i < row.width; i++)  {
+		if (!(row.flags[i] & PX_EMPTY))
+			continue;
+
+		Uint32 pixel = GetPixelFromAddr((Uint8 *)row.src + i * row.bpp, row.bpp);
+		if (pixel == pink)
+			continue;
+
+		// Green pixels get a random green, others (eg, dark green) are copied
+		if (pixel == green)
+			pixel = greens[ GetRandomInt(3) ];
+		PutMapPixel(row, DstPixel(row, i), pixel);
+		row.flags[i] = PX_DIRT;
+		nGreenCount++;
+	}
+	return nGreenCount;
+}
+
+
+#ifdef MAPKERNELS_SSE2
+
+////////////////////
+// SSE2 versions, one register holds 4 pixels at 32 bit or 8 pixels at 16 bit
+// The flags are handled as bytes (lower N bytes of a register), expand/shrink convert the masks
+// between byte and pixel lanes.
+
+template<int BPP> struct Sse2Pixels;
+
+template<> struct Sse2Pixels<4> {
+	enum { N = 4 };
+	static __m128i set1(Uint32 c) { return _mm_set1_epi32((int)c); }
+	static __m128i cmpeq(__m128i a, __m128i b) { return _mm_cmpeq_epi32(a, b); }
+	static __m128i loadFlags(const uchar* f) { int v; memcpy(&v, f, sizeof(v)); return _mm_cvtsi32_si128(v); }
+	static void storeFlags(uchar* f, __m128i v) { int x = _mm_cvtsi128_si32(v); memcpy(f, &x, sizeof(x)); }
+	static __m128i expand(__m128i m) { m = _mm_unpacklo_epi8(m, m); return _mm_unpacklo_epi16(m, m); }
+	static __m128i shrink(__m128i m) { m = _mm_packs_epi32(m, m); return _mm_packs_epi16(m, m); }
+	static __m128i dupLo(__m128i p) { return _mm_unpacklo_epi32(p, p); }
+	static __m128i dupHi(__m128i p) { return _mm_unpackhi_epi32(p, p); }
+};
+
+template<> struct Sse2Pixels<2> {
+	enum { N = 8 };
+	static __m128i set1(Uint32 c) { return _mm_set1_epi16((short)c); }
+	static __m128i cmpeq(__m128i a, __m128i b) { return _mm_cmpeq_epi16(a, b); }
+	static __m128i loadFlags(const uchar* f) { return _mm_loadl_epi64((const __m128i *)f); }
+	static void storeFlags(uchar* f, __m128i v) { _mm_storel_epi64((__m128i *)f, v); }
+	static __m128i expand(__m128i m) { return _mm_unpacklo_epi8(m, m); }
+	static __m128i shrink(__m128i m) { return _mm_packs_epi16(m, m); }
+	static __m128i dupLo(__m128i p) { return _mm_unpacklo_epi16(p, p); }
+	static __m128i dupHi(__m128i p) { return _mm_unpackhi_epi16(p, p); }
+};
+
+static inline __m128i Select(__m128i mask, __m128i a, __m128i b)
+{
+	return _mm_or_si128(_mm_and_si128(mask, a), _mm_andnot_si128(mask, b));
+}
+
+// Byte mask of the flags which have the bit set
+static inline __m128i FlagSet(__m128i flags, uchar bit)
+{
+	const __m128i b = _mm_set1_epi8((char)bit);
+	return _mm_cmpeq_epi8(_mm_and_si128(flags, b), b);
+}
+
+static inline int BitCount(unsigned int v)
+{
+	int c = 0;
+	for (; v; v &= v - 1)
+		c++;
+	return c;
+}
+
+// Bits of the used lanes of a shrunk (byte) mask
+template<int BPP>
+static inline unsigned int LaneBits(__m128i byteMask)
+{
+	return (unsigned int)_mm_movemask_epi8(byteMask) & ((1u << Sse2Pixels<BPP>::N) - 1);
+}
+
+// Writes the pixels selected by the mask
+template<int BPP>
+static inline void StoreMapPixels(const MapKernelRow& row, Uint8* d, __m128i px, __m128i mask)
+{
+	typedef Sse2Pixels<BPP> P;
+	if (!row.doubled)  {
+		_mm_storeu_si128((__m128i *)d, Select(mask, px, _mm_loadu_si128((const __m128i *)d)));
+		return;
+	}
+
+	const __m128i lo = P::dupLo(px), hi = P::dupHi(px);
+	const __m128i mlo = P::dupLo(mask), mhi = P::dupHi(mask);
+	for (int r = 0; r < 2; r++, d += row.dstPitch)  {
+		_mm_storeu_si128((__m128i *)d, Select(mlo, lo, _mm_loadu_si128((const __m128i *)d)));
+		_mm_storeu_si128((__m128i *)(d + 16), Select(mhi, hi, _mm_loadu_si128((const __m128i *)(d + 16))));
+	}
+}
+
+template<int BPP>
+static int CarveHoleRow_Sse2(const MapKernelRow& row, int& i, Uint32 pink, Uint32 black)
+{
+	typedef Sse2Pixels<BPP> P;
+	const __m128i pinkV = P::set1(pink), blackV = P::set1(black);
+	const __m128i emptyV = _mm_set1_epi8(PX_EMPTY);
+
+	int nNumDirt = 0;
+	for (; i + P::N <= row.width; i += P::N)  {
+		__m128i flags = P::loadFlags(row.flags + i);
+		const __m128i dirt = FlagSet(flags, PX_DIRT);
+		if (!LaneBits<BPP>(dirt))
+			continue;
+
+		const __m128i px = _mm_loadu_si128((const __m128i *)(row.src + i * BPP));
+		const __m128i dirtPx = P::expand(dirt);
+		const __m128i isPink = P::cmpeq(px, pinkV);
+
+		// Pink carves the dirt
+		const __m128i carve = P::shrink(_mm_and_si128(dirtPx, isPink));
+		const unsigned int carveBits = LaneBits<BPP>(carve);
+		if (carveBits)  {
+			nNumDirt += BitCount(carveBits);
+			P::storeFlags(row.flags + i, Select(carve, emptyV, flags));
+		}
+
+		// Put pixels that are not black/pink (eg, brown)
+		const __m128i draw = _mm_andnot_si128(_mm_or_si128(isPink, P::cmpeq(px, blackV)), dirtPx);
+		if (LaneBits<BPP>(P::shrink(draw)))
+			StoreMapPixels<BPP>(row, DstPixel(row, i), px, draw);
+	}
+	return nNumDirt;
+}
+
+template<int BPP>
+static int PlaceDirtRow_Sse2(const MapKernelRow& row, int& i, int end, const MapKernelTransparency& transp, Uint32 pink, const Uint8*& tile)
+{
+	typedef Sse2Pixels<BPP> P;
+	const __m128i pinkV = P::set1(pink);
+	const __m128i alphaV = P::set1(transp.alphaMask);
+	const __m128i keyOrV = P::set1(transp.keyOrMask), keyV = P::set1(transp.key);
+	const __m128i hasKeyV = P::set1(transp.hasKey ? 0xFFFFFFFF : 0);
+	const __m128i dirtV = _mm_set1_epi8(PX_DIRT);
+
+	int nDirtCount = 0;
+	for (; i + P::N <= end; i += P::N, tile += P::N * BPP)  {
+		const __m128i px = _mm_loadu_si128((const __m128i *)(row.src + i * BPP));
+
+		// See MapKernelTransparency::isTransparent
+		const __m128i transparent = _mm_or_si128(
+			_mm_andnot_si128(P::cmpeq(_mm_and_si128(px, alphaV), alphaV), _mm_set1_epi8(-1)),
+			_mm_and_si128(hasKeyV, P::cmpeq(_mm_or_si128(px, keyOrV), keyV)));
+		if (LaneBits<BPP>(P::shrink(transparent)) == (1u << P::N) - 1)
+			continue;
+
+		const __m128i flags = P::loadFlags(row.flags + i);
+		const __m128i emptyPx = P::expand(FlagSet(flags, PX_EMPTY));
+		const __m128i rockPx = P::expand(FlagSet(flags, PX_ROCK));
+
+		// See PlaceDirtRow_Plain
+		const __m128i own = _mm_andnot_si128(_mm_or_si128(transparent, P::cmpeq(px, pinkV)), emptyPx);
+		const __m128i tiled = _mm_andnot_si128(_mm_or_si128(transparent, rockPx), _mm_set1_epi8(-1));
+		const __m128i put = _mm_or_si128(own, tiled);
+
+		nDirtCount += BitCount(LaneBits<BPP>(P::shrink(own)));
+		nDirtCount += BitCount(LaneBits<BPP>(P::shrink(_mm_and_si128(tiled, emptyPx))));
+
+		const __m128i putBytes = P::shrink(put);
+		if (!LaneBits<BPP>(putBytes))
+			continue;
+
+		P::storeFlags(row.flags + i, Select(putBytes, dirtV, flags));
+		const __m128i tilePx = _mm_loadu_si128((const __m128i *)tile);
+		StoreMapPixels<BPP>(row, DstPixel(row, i), Select(own, px, tilePx), put);
+	}
+	return nDirtCount;
+}
+
+template<int BPP>
+static int PlaceGreenDirtRow_Sse2(const MapKernelRow& row, int& i, Uint32 green, Uint32 pink, const Uint32 greens[4])
+{
+	typedef Sse2Pixels<BPP> P;
+	const __m128i pinkV = P::set1(pink), greenV = P::set1(green);
+	const __m128i dirtV = _mm_set1_epi8(PX_DIRT);
+
+	int nGreenCount = 0;
+	for (; i + P::N <= row.width; i += P::N)  {
+		const __m128i flags = P::loadFlags(row.flags + i);
+		const __m128i empty = FlagSet(flags, PX_EMPTY);
+		if (!LaneBits<BPP>(empty))
+			continue;
+
+		const __m128i px = _mm_loadu_si128((const __m128i *)(row.src + i * BPP));
+		const __m128i put = _mm_andnot_si128(P::cmpeq(px, pinkV), P::expand(empty));
+		const __m128i putBytes = P::shrink(put);
+		const unsigned int putBits = LaneBits<BPP>(putBytes);
+		if (!putBits)
+			continue;
+
+		nGreenCount += BitCount(putBits);
+		P::storeFlags(row.flags + i, Select(putBytes, dirtV, flags));
+
+		// Copy the others (eg, dark green) at once, the random greens go pixel by pixel in the old order
+		const __m128i isGreen = P::cmpeq(px, greenV);
+		StoreMapPixels<BPP>(row, DstPixel(row, i), px, _mm_andnot_si128(isGreen, put));
+		for (unsigned int g = LaneBits<BPP>(P::shrink(_mm_and_si128(isGreen, put))); g; g &= g - 1)  {
+			int lane = 0;
+			while (!(g & (1u << lane)))
+				lane++;
+			PutMapPixel(row, DstPixel(row, i + lane), greens[ GetRandomInt(3) ]);
+		}
+	}
+	return nGreenCount;
+}
+
+#endif // MAPKERNELS_SSE2
+
+
+////////////////////
+// Carve a hole image row
+int CarveHoleRow(const MapKernelRow& row, Uint32 pink, Uint32 black)
+{
+	int nNumDirt = 0;
+	int i = 0;
+#ifdef MAPKERNELS_SSE2
+	if (bMapKernelsSse2)  {
+		if (row.bpp == 4)
+			nNumDirt += CarveHoleRow_Sse2<4>(row, i, pink, black);
+		else if (row.bpp == 2)
+			nNumDirt += CarveHoleRow_Sse2<2>(row, i, pink, black);
+	}
+#endif
+	return nNumDirt + CarveHoleRow_Plain(row, i, pink, black);
+}
+
+////////////////////
+// Place a dirt row
+int PlaceDirtRow(const MapKernelRow& row, const MapKernelTransparency& transp, Uint32 pink, const Uint8* tileRow, int tileW, int tileX)
+{
+	int nDirtCount = 0;
+
+	// The front tile repeats, go through the parts where it is continuous
+	for (int i = 0; i < row.width; tileX = 0)  {
+		const int end = MIN(row.width, i + tileW - tileX);
+		const Uint8* tile = tileRow + tileX * row.bpp;
+#ifdef MAPKERNELS_SSE2
+		if (bMapKernelsSse2)  {
+			if (row.bpp == 4)
+				nDirtCount += PlaceDirtRow_Sse2<4>(row, i, end, transp, pink, tile);
+			else if (row.bpp == 2)
+				nDirtCount += PlaceDirtRow_Sse2<2>(row, i, end, transp, pink, tile);
+		}
+#endif
+		nDirtCount += PlaceDirtRow_Plain(row, i, end, transp, pink, tile);
+		i = end;
+	}
+
+	return nDirtCount;
+}
+
+////////////////////
+// Place a green dirt row
+int PlaceGreenDirtRow(const MapKernelRow& row, Uint32 green, Uint32 pink, const Uint32 greens[4])
+{
+	int nGreenCount = 0;
+	int i = 0;
+#ifdef MAPKERNELS_SSE2
+	if (bMapKernelsSse2)  {
+		if (row.bpp == 4)
+			nGreenCount += PlaceGreenDirtRow_Sse2<4>(row, i, green, pink, greens);
+		else if (row.bpp == 2)
+			nGreenCount += PlaceGreenDirtRow_Sse2<2>(row, i, green, pink, greens);
+	}
+#endif
+	return nGreenCount + PlaceGreenDirtRow_Plain(row, i, green, pink, greens);
+}
+
+
+#ifdef DEBUG
+
+// Map buffers for TestMapKernels
+struct KernelTestMap {
+	enum { W = 512, H = 512, TILE = 64 };
+	int bpp;
+	std::vector<uchar> flags;
+	std::vector<Uint8> image; // W*2 x H*2, used as the normal image too
+	std::vector<Uint8> tile;
+
+	KernelTestMap(int bpp_) : bpp(bpp_), flags(W * H), image(W * H * 4 * bpp), tile(TILE * TILE * bpp) {
+		srand(1234);
+		for (size_t i = 0; i < flags.size(); i++)  {
+			int r = rand() % 10;
+			flags[i] = (r < 6) ? PX_DIRT : ((r < 9) ? PX_EMPTY : PX_ROCK);
+		}
+		for (size_t i = 0; i < image.size(); i++)
+			image[i] = (Uint8)rand();
+		for (size_t i = 0; i < tile.size(); i++)
+			tile[i] = (Uint8)rand();
+	}
+
+	MapKernelRow row(int x, int y, int w, const Uint8* src, bool doubled) {
+		MapKernelRow r;
+		r.flags = &flags[y * W + x];
+		r.dstPitch = W * 2 * bpp;
+		r.dst = doubled ? &image[y * 2 * r.dstPitch + x * 2 * bpp] : &image[y * W * bpp + x * bpp];
+		if (!doubled) r.dstPitch = W * bpp;
+		r.src = src;
+		r.width = w;
+		r.bpp = bpp;
+		r.doubled = doubled;
+		return r;
+	}
+};
+
+// Hole image like in the themes: pink disc, brown ring, black (colorkey) around
+static std::vector<Uint8> KernelTestHole(int size, int bpp, Uint32 pink, Uint32 black, Uint32 brown)
+{
+	std::vector<Uint8> hole(size * size * bpp);
+	const float r = size / 2.0f;
+	for (int y = 0; y < size; y++)
+		for (int x = 0; x < size; x++)  {
+			const float dx = x + 0.5f - r, dy = y + 0.5f - r;
+			const float d = dx * dx + dy * dy;
+			Uint32 c = (d < (r - 1) * (r - 1)) ? pink : ((d < r * r) ? brown : black);
+			PutPixelToAddr(&hole[(y * size + x) * bpp], c, bpp);
+		}
+	return hole;
+}
+
+enum KernelTestOp { KT_CARVE, KT_DIRT, KT_GREEN };
+
+// Applies the hole at a bunch of pseudo random places, returns the pixel count of the kernels
+static int KernelTestRun(KernelTestMap& map, KernelTestOp op, const std::vector<Uint8>& hole, int size, bool doubled, int iterations)
+{
+	const Uint32 pink = (map.bpp == 2) ? 0xF81F : 0xFFFF00FF;
+	const Uint32 black = (map.bpp == 2) ? 0 : 0xFF000000;
+	const Uint32 green = (map.bpp == 2) ? 0x07E0 : 0xFF00FF00;
+	const Uint32 greens[4] = { 0x1111, 0x2222, 0x3333, 0x4444 };
+	MapKernelTransparency transp;
+	transp.keyOrMask = (map.bpp == 2) ? 0 : 0xFF000000;
+	transp.key = black | transp.keyOrMask;
+	transp.hasKey = true;
+
+	srand(42);
+	int count = 0;
+	Uint32 pos = 1;
+	for (int n = 0; n < iterations; n++)  {
+		pos = pos * 1103515245 + 12345;
+		const int x = (pos >> 8) % (KernelTestMap::W - size);
+		const int y = (pos >> 20) % (KernelTestMap::H - size);
+		for (int hy = 0; hy < size; hy++)  {
+			MapKernelRow row = map.row(x, y + hy, size, &hole[hy * size * map.bpp], doubled);
+			switch (op)  {
+			case KT_CARVE: count += CarveHoleRow(row, pink, black); break;
+			case KT_DIRT: count += PlaceDirtRow(row, transp, pink,
+					&map.tile[((y + hy) % KernelTestMap::TILE) * KernelTestMap::TILE * map.bpp], KernelTestMap::TILE, x % KernelTestMap::TILE); break;
+			case KT_GREEN: count += PlaceGreenDirtRow(row, green, pink, greens); break;
+			}
+		}
+	}
+	return count;
+}
+
+// Compares the vectorized kernels with the plain loops, for the hole sizes of the themes and 16/32 bit
+void TestMapKernels()
+{
+#ifndef MAPKERNELS_SSE2
+	notes << "TestMapKernels: SSE2 kernels not compiled in, only the plain loops are tested" << endl;
+#endif
+	static const int holeSizes[5] = { 5, 7, 9, 11, 15 };
+	static const char* opNames[3] = { "CarveHole", "PlaceDirt", "PlaceGreenDirt" };
+	const int iterations = 100000;
+
+	for (int bpp = 2; bpp <= 4; bpp += 2)
+	for (int doubled = 0; doubled < 2; doubled++)
+	for (int op = KT_CARVE; op <= KT_GREEN; op++)
+	for (int s = 0; s < 5; s++)  {
+		const int size = holeSizes[s];
+		const Uint32 brown = (bpp == 2) ? 0x8A22 : 0xFF8A4522;
+		const Uint32 green = (bpp == 2) ? 0x07E0 : 0xFF00FF00;
+		std::vector<Uint8> hole = KernelTestHole(size, bpp, (bpp == 2) ? 0xF81F : 0xFFFF00FF,
+												 (bpp == 2) ? 0 : 0xFF000000, (op == KT_GREEN) ? green : brown);
+
+		float secs[2];
+		int counts[2];
+		bool same = true;
+		KernelTestMap* maps[2] = { NULL, NULL };
+		for (int vec = 0; vec < 2; vec++)  {
+			bMapKernelsSse2 = vec != 0;
+			maps[vec] = new KernelTestMap(bpp);
+			Uint32 start = SDL_GetTicks();
+			counts[vec] = KernelTestRun(*maps[vec], (KernelTestOp)op, hole, size, doubled != 0, iterations);
+			secs[vec] = (SDL_GetTicks() - start) / 1000.0f;
+		}
+		same = counts[0] == counts[1] && maps[0]->flags == maps[1]->flags && maps[0]->image == maps[1]->image;
+		delete maps[0];
+		delete maps[1];
+
+		const float pixels = (float)size * size * iterations;
+		notes << "TestMapKernels: " << opNames[op] << " size " << s << " (" << size << "x" << size << "), "
+			<< bpp * 8 << " bit" << (doubled ? " hi-res" : "") << ": plain "
+			<< (secs[0] > 0 ? pixels / secs[0] / 1000000.0f : 0.0f) << " Mpx/sec, vectorized "
+			<< (secs[1] > 0 ? pixels / secs[1] / 1000000.0f : 0.0f) << " Mpx/sec" << endl;
+		if (!same)
+			errors << "TestMapKernels: " << opNames[op] << " results differ (" << counts[0] << " vs " << counts[1] << ")" << endl;
+	}
+
+	bMapKernelsSse2 = true;
+}
+
+#endif // DEBUG
@@ -46,6 +46,7 @@
 #endif
 
 #include <map>
+#include <vector>
 
 #include <nl.h>
 #include <nlinternal.h>
@@ -113,6 +114,10 @@ inline void nl_readDouble(char* x, int& y, NLdouble z)		{ readDouble(x, y, z); }
 #include <arpa/inet.h>
 #include <netdb.h>
 #include <sys/ioctl.h>
+#ifdef __linux__
+#include <sys/epoll.h>
+#define HAVE_SENDMMSG
+#endif
 #define closesocket close
 #define INVALID_SOCKET -1
 #define SOCKET_ERROR -1
@@ -556,11 +561,36 @@ struct NetworkSocket::EventHandler {
 	}
 };
 
+// Queue for batched UDP reading and writing, see NetworkSocket::setBatching
+struct NetworkSocket::DatagramBatch {
+	// HINT: each slot takes the largest datagram nlWrite can send, recvmmsg truncates bigger ones
+	enum { MAX_DATAGRAMS = 16, MAX_DATAGRAM_SIZE = NL_MAX_PACKET_LENGTH };
+
+	// Received datagrams, served by NetworkSocket::Read
+	int readCount, readIndex;
+	// Queued datagrams are sent by flushWriteBatch
+	bool writing;
+
+#ifdef HAVE_SENDMMSG
+	std::vector<char> readBuffer;
+	struct sockaddr_in6 readAddr[MAX_DATAGRAMS];
+	size_t readLen[MAX_DATAGRAMS];
+
+	std::string writeData;
+	struct QueuedDatagram { size_t offset; size_t size; struct sockaddr_in6 addr; };
+	std::vector<QueuedDatagram> writeQueue;
+#endif
+
+	DatagramBatch() : readCount(0), readIndex(0), writing(false) {}
+};
+
 struct NetworkSocket::InternSocket {
 	NLsocket sock;
 	SmartPointer<EventHandler> eventHandler;
+	SmartPointer<DatagramBatch> batch;
+	Uint64 sendCalls, recvCalls;
 	
-	InternSocket() : sock(NL_INVALID) {}
+	InternSocket() : sock(NL_INVALID), sendCalls(0), recvCalls(0) {}
 	~InternSocket() {
 		// just a double check - there really shouldn't be a case where this could be true
 		if(eventHandler.get()) {
@@ -837,6 +867,8 @@ void NetworkSocket::Close() {
 	taskManager->start(worker);
 	
 	m_socket->sock = NL_INVALID;
+	m_socket->batch = NULL;
+	m_socket->sendCalls = m_socket->recvCalls = 0;
 	m_type = NST_INVALID;
 	m_state = NSS_NONE;
 	
@@ -849,7 +881,24 @@ int NetworkSocket::Write(const void* buffer, int nbytes) {
 		return NL_INVALID;
 	}
 	
+#ifdef HAVE_SENDMMSG
+	if(m_socket->batch.get() && m_socket->batch->writing) {
+		DatagramBatch* batch = m_socket->batch.get();
+		if(nbytes < 0 || nbytes > NL_MAX_PACKET_LENGTH || nlIsValidSocket(m_socket->sock) != NL_TRUE)
+			return NL_INVALID;
+
+		DatagramBatch::QueuedDatagram d;
+		d.offset = batch->writeData.size();
+		d.size = nbytes;
+		memcpy(&d.addr, &nlSockets[m_socket->sock]->addressout, sizeof(d.addr));
+		batch->writeData.append((const char*)buffer, nbytes);
+		batch->writeQueue.push_back(d);
+		return nbytes;
+	}
+#endif
+
 	ResetSocketError();
+	m_socket->sendCalls++;
 	NLint ret = nlWrite(m_socket->sock, buffer, nbytes);
 
 	// Error checking
@@ -875,7 +924,76 @@ int NetworkSocket::Read(void* buffer, int nbytes) {
 		return NL_INVALID;
 	}
 
+#ifdef HAVE_SENDMMSG
+	if(m_socket->batch.get()) {
+		DatagramBatch* batch = m_socket->batch.get();
+		// HINT: empty datagrams are skipped because the caller stops reading at them and
+		// we would keep the rest of the queue hidden from any readiness checks
+		while(batch->readIndex < batch->readCount && batch->readLen[batch->readIndex] == 0)
+			batch->readIndex++;
+		if(batch->readIndex >= batch->readCount) {
+			// Fetch as many datagrams as there are with one call
+			batch->readIndex = batch->readCount = 0;
+			if(batch->readBuffer.empty())
+				batch->readBuffer.resize(DatagramBatch::MAX_DATAGRAMS * DatagramBatch::MAX_DATAGRAM_SIZE);
+
+			struct mmsghdr msgs[DatagramBatch::MAX_DATAGRAMS];
+			struct iovec iovecs[DatagramBatch::MAX_DATAGRAMS];
+			memset(msgs, 0, sizeof(msgs));
+			for(int i = 0; i < DatagramBatch::MAX_DATAGRAMS; i++) {
+				iovecs[i].iov_base = &batch->readBuffer[i * DatagramBatch::MAX_DATAGRAM_SIZE];
+				iovecs[i].iov_len = DatagramBatch::MAX_DATAGRAM_SIZE;
+				msgs[i].msg_hdr.msg_iov = &iovecs[i];
+				msgs[i].msg_hdr.msg_iovlen = 1;
+				msgs[i].msg_hdr.msg_name = &batch->readAddr[i];
+				msgs[i].msg_hdr.msg_namelen = sizeof(batch->readAddr[i]);
+			}
+
+			if(nlIsValidSocket(m_socket->sock) != NL_TRUE)
+				return NL_INVALID;
+			m_socket->recvCalls++;
+			int ret = recvmmsg(nlSockets[m_socket->sock]->realsocket, msgs, DatagramBatch::MAX_DATAGRAMS, MSG_DONTWAIT, NULL);
+			if(ret <= 0) {
+				// no data available is not an error
+				if(ret < 0 && errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
+#ifdef DEBUG
+					errors << "ReadSocket " << debugString() << ": recvmmsg: " << strerror(errno) << endl;
+#endif
+				}
+				return NL_INVALID;
+			}
+
+			for(int i = 0; i < ret; i++) {
+				batch->readLen[i] = msgs[i].msg_len;
+				// nlWrite never sends more than NL_MAX_PACKET_LENGTH bytes, drop bigger ones instead of serving them cut
+				if(msgs[i].msg_hdr.msg_flags & MSG_TRUNC) {
+#ifdef DEBUG
+					warnings << "ReadSocket " << debugString() << ": dropped truncated datagram" << endl;
+#endif
+					batch->readLen[i] = 0;
+				}
+			}
+			batch->readCount = ret;
+			while(batch->readIndex < batch->readCount && batch->readLen[batch->readIndex] == 0)
+				batch->readIndex++;
+			if(batch->readIndex >= batch->readCount)
+				return 0;
+		}
+
+		// Serve the next datagram and set its sender as the remote address, like nlRead does
+		const int i = batch->readIndex++;
+		const int len = (int)MIN(batch->readLen[i], (size_t)MAX(nbytes, 0));
+		memcpy(buffer, &batch->readBuffer[i * DatagramBatch::MAX_DATAGRAM_SIZE], len);
+		if(nlLockSocket(m_socket->sock, NL_READ) != NL_FALSE) {
+			memcpy(&nlSockets[m_socket->sock]->addressin, &batch->readAddr[i], sizeof(batch->readAddr[i]));
+			nlUnlockSocket(m_socket->sock, NL_READ);
+		}
+		return len;
+	}
+#endif
+
 	ResetSocketError();
+	m_socket->recvCalls++;
 	NLint ret = nlRead(m_socket->sock, buffer, nbytes);
 	
 	// Error checking
@@ -979,6 +1097,184 @@ void NetworkSocket::WaitForSocketReadOrWrite(int timeout)
 	nlGroupDestroy(group);
 }
 
+
+void NetworkSocket::setBatching(bool v) {
+	if(v == batching()) return;
+	if(v) {
+		if(m_type != NST_UDP || nlIsValidSocket(m_socket->sock) != NL_TRUE || nlSockets[m_socket->sock]->connected == NL_TRUE) {
+			warnings << "NetworkSocket::setBatching " << debugString() << ": only supported for unconnected UDP" << endl;
+			return;
+		}
+		m_socket->batch = new DatagramBatch();
+	}
+	else {
+		flushWriteBatch();
+		m_socket->batch = NULL;
+	}
+}
+
+bool NetworkSocket::batching() const {
+	return m_socket->batch.get() != NULL;
+}
+
+void NetworkSocket::beginWriteBatch() {
+	if(m_socket->batch.get())
+		m_socket->batch->writing = true;
+}
+
+int NetworkSocket::flushWriteBatch() {
+	DatagramBatch* batch = m_socket->batch.get();
+	if(!batch || !batch->writing) return 0;
+	batch->writing = false;
+
+	int sent = 0;
+#ifdef HAVE_SENDMMSG
+	if(isOpen() && nlIsValidSocket(m_socket->sock) == NL_TRUE) {
+		const int fd = nlSockets[m_socket->sock]->realsocket;
+		struct mmsghdr msgs[DatagramBatch::MAX_DATAGRAMS];
+		struct iovec iovecs[DatagramBatch::MAX_DATAGRAMS];
+
+		size_t next = 0;
+		while(next < batch->writeQueue.size()) {
+			const size_t count = MIN(batch->writeQueue.size() - next, (size_t)DatagramBatch::MAX_DATAGRAMS);
+			memset(msgs, 0, sizeof(msgs));
+			for(size_t i = 0; i < count; i++) {
+				DatagramBatch::QueuedDatagram& d = batch->writeQueue[next + i];
+				iovecs[i].iov_base = &batch->writeData[d.offset];
+				iovecs[i].iov_len = d.size;
+				msgs[i].msg_hdr.msg_iov = &iovecs[i];
+				msgs[i].msg_hdr.msg_iovlen = 1;
+				msgs[i].msg_hdr.msg_name = &d.addr;
+				msgs[i].msg_hdr.msg_namelen = sizeof(d.addr);
+			}
+
+			m_socket->sendCalls++;
+			int ret = sendmmsg(fd, msgs, count, MSG_DONTWAIT);
+			if(ret < 0) {
+				if(errno == EINTR) continue;
+#ifdef DEBUG
+				warnings << "WriteSocket " << debugString() << ": sendmmsg: " << strerror(errno) << endl;
+#endif
+				// skip the first datagram (like a failed nlWrite would have) and go on with the rest
+				ret = 1;
+			}
+			else
+				sent += ret;
+			next += ret;
+		}
+	}
+
+	batch->writeData.clear();
+	batch->writeQueue.clear();
+#endif
+
+	return sent;
+}
+
+void NetworkSocket::getSyscallStats(Uint64& sendCalls, Uint64& recvCalls) const {
+	sendCalls = m_socket->sendCalls;
+	recvCalls = m_socket->recvCalls;
+}
+
+
+struct NetworkSocketWaiter::Intern {
+	// HawkNL socket and the system socket behind it
+	typedef std::vector< std::pair<NLsocket, int> > SocketList;
+	SocketList registered;
+	SocketList pending;
+#ifdef __linux__
+	int epollFd;
+	Intern() : epollFd(-1) {}
+#else
+	NLint nlGroup;
+	Intern() : nlGroup(NL_INVALID) {}
+#endif
+
+	void unregisterAll() {
+#ifdef __linux__
+		if(epollFd >= 0) close(epollFd);
+		epollFd = -1;
+#else
+		if(nlGroup != NL_INVALID) nlGroupDestroy(nlGroup);
+		nlGroup = NL_INVALID;
+#endif
+		registered.clear();
+	}
+
+	void registerPending() {
+		unregisterAll();
+		if(pending.empty()) return;
+
+#ifdef __linux__
+		epollFd = epoll_create((int)pending.size());
+		if(epollFd < 0) {
+			errors << "NetworkSocketWaiter: epoll_create failed: " << strerror(errno) << endl;
+			return;
+		}
+		for(SocketList::iterator i = pending.begin(); i != pending.end(); ++i) {
+			struct epoll_event ev;
+			memset(&ev, 0, sizeof(ev));
+			ev.events = EPOLLIN;
+			ev.data.fd = i->second;
+			if(epoll_ctl(epollFd, EPOLL_CTL_ADD, i->second, &ev) < 0)
+				errors << "NetworkSocketWaiter: epoll_ctl failed: " << strerror(errno) << endl;
+		}
+#else
+		nlGroup = nlGroupCreate();
+		for(SocketList::iterator i = pending.begin(); i != pending.end(); ++i)
+			nlGroupAddSocket(nlGroup, i->first);
+#endif
+		registered = pending;
+	}
+};
+
+NetworkSocketWaiter::NetworkSocketWaiter() : m_intern(NULL) {
+	m_intern = new Intern();
+}
+
+NetworkSocketWaiter::~NetworkSocketWaiter() {
+	m_intern->unregisterAll();
+	delete m_intern;
+	m_intern = NULL;
+}
+
+void NetworkSocketWaiter::clear() {
+	m_intern->pending.clear();
+}
+
+void NetworkSocketWaiter::addSocket(const NetworkSocket& sock) {
+	if(!sock.isOpen()) return;
+	NLsocket s = sock.m_socket->sock;
+	if(nlIsValidSocket(s) != NL_TRUE) return;
+	m_intern->pending.push_back( std::make_pair(s, (int)nlSockets[s]->realsocket) );
+}
+
+bool NetworkSocketWaiter::wait(int timeoutMs) {
+	if(m_intern->pending != m_intern->registered)
+		m_intern->registerPending();
+
+	if(m_intern->registered.empty()) {
+		if(timeoutMs > 0) SDL_Delay(timeoutMs);
+		return false;
+	}
+
+#ifdef __linux__
+	if(m_intern->epollFd < 0) {
+		if(timeoutMs > 0) SDL_Delay(timeoutMs);
+		return false;
+	}
+	struct epoll_event events[8];
+	int ret = epoll_wait(m_intern->epollFd, events, sizeof(events) / sizeof(events[0]), MAX(timeoutMs, 0));
+	if(ret < 0 && errno != EINTR)
+		errors << "NetworkSocketWaiter: epoll_wait failed: " << strerror(errno) << endl;
+	return ret > 0;
+#else
+	NLsocket s;
+	return nlPollGroup(m_intern->nlGroup, NL_READ_STATUS, &s, /* amount of sockets */ 1, (NLint)MAX(timeoutMs, 0)) > 0;
+#endif
+}
+
+
 NetworkAddr NetworkSocket::localAddress() const {
 	NetworkAddr addr;
 	
@@ -1173,6 +1469,22 @@ bool SetNetAddrPort(NetworkAddr& addr, unsigned short port, std::string* errorSt
 	}
 }
 
+Uint64 GetNetAddrHash(const NetworkAddr& addr) {
+	const NLaddress* nladdr = getNLaddr(addr);
+	if(nladdr == NULL || nladdr->valid == NL_FALSE)
+		return 0;
+
+	// The same fields as sock_AddrCompare (HawkNL keeps all addresses as sockaddr_in6), FNV-1a over them
+	const struct sockaddr_in6* sa = (const struct sockaddr_in6*)nladdr;
+	Uint64 hash = 14695981039346656037ULL;
+	const unsigned char* bytes = (const unsigned char*)&sa->sin6_addr;
+	for(size_t i = 0; i < sizeof(sa->sin6_addr); i++)
+		hash = (hash ^ bytes[i]) * 1099511628211ULL;
+	hash = (hash ^ (Uint64)sa->sin6_port) * 1099511628211ULL;
+	hash = (hash ^ (Uint64)sa->sin6_family) * 1099511628211ULL;
+	return hash;
+}
+
 bool AreNetAddrEqual(const NetworkAddr& addr1, const NetworkAddr& addr2) {
 	if(getNLaddr(addr1) == getNLaddr(addr2))
 		return true;
@@ -1322,6 +1634,8 @@ bool GetNetAddrFromNameAsync(const std::string& name)
 
 
 bool NetworkSocket::isDataAvailable() {
+	if(m_socket->batch.get() && m_socket->batch->readIndex < m_socket->batch->readCount)
+		return true;
 	NLint group = nlGroupCreate();
 	nlGroupAddSocket( group, m_socket->sock );
 	NLsocket sock_out[2];
@@ -1347,3 +1661,73 @@ void NetworkSocket::reapplyRemoteAddress() {
 		errors << "NetworkSocket::reapplyRemoteAddress cannot be done as " << TypeStr(m_type) << endl;
 }
 
+
+
+#ifdef DEBUG
+/////////////////////
+// Benchmark for batched UDP I/O: a swarm of local clients sends packets to a server socket
+// which answers each of them, like GameServer does each frame
+
+static void benchNetworkBatching(bool batching, int clientNum, int rounds) {
+	SmartPointer<NetworkSocket> server = new NetworkSocket();
+	server->OpenUnreliable(0);
+	server->setBatching(batching);
+	const NetworkAddr serverAddr = server->localAddress();
+
+	std::vector< SmartPointer<NetworkSocket> > clients;
+	for(int i = 0; i < clientNum; ++i) {
+		SmartPointer<NetworkSocket> sock = new NetworkSocket();
+		sock->OpenUnreliable(0);
+		sock->setRemoteAddress(serverAddr);
+		clients.push_back(sock);
+	}
+
+	char buf[4096];
+	memset(buf, 0x55, sizeof(buf));
+	const int packetSize = 100;
+	size_t received = 0, sent = 0;
+
+	// HINT: the clients run in the same process, serverTime is what the server frames took
+	Uint32 start = SDL_GetTicks(), serverTime = 0;
+	for(int r = 0; r < rounds; ++r) {
+		for(int i = 0; i < clientNum; ++i)
+			clients[i]->Write(buf, packetSize);
+
+		// Server frame: read everything and answer each packet
+		Uint32 frameStart = SDL_GetTicks();
+		server->beginWriteBatch();
+		int got = 0;
+		Uint32 waitStart = SDL_GetTicks();
+		while(got < clientNum && SDL_GetTicks() - waitStart < 1000) {
+			if(server->Read(buf, sizeof(buf)) <= 0) continue;
+			++got;
+			server->reapplyRemoteAddress();
+			server->Write(buf, packetSize);
+		}
+		server->flushWriteBatch();
+		serverTime += SDL_GetTicks() - frameStart;
+		received += got;
+		sent += got;
+
+		for(int i = 0; i < clientNum; ++i)
+			while(clients[i]->Read(buf, sizeof(buf)) > 0) {}
+	}
+	Uint32 time = SDL_GetTicks() - start;
+
+	Uint64 sendCalls = 0, recvCalls = 0;
+	server->getSyscallStats(sendCalls, recvCalls);
+	notes << (batching ? "batched" : "single") << ": " << clientNum << " clients, " << rounds << " rounds: ";
+	notes << received << " packets in, " << sent << " packets out in " << time << "ms";
+	if(time > 0) notes << " (" << (Uint64)((received + sent) * 1000 / time) << " packets/sec)";
+	notes << ", server frames: " << serverTime << "ms";
+	if(serverTime > 0) notes << " (" << (Uint64)((received + sent) * 1000 / serverTime) << " packets/sec)";
+	notes << ", server syscalls: " << sendCalls << " send, " << recvCalls << " recv" << endl;
+}
+
+void TestNetworkBatching()
+{
+	notes << "Testing batched UDP I/O" << endl;
+	benchNetworkBatching(false, 32, 2000);
+	benchNetworkBatching(true, 32, 2000);
+}
+#endif
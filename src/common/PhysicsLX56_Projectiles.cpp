@@ -21,6 +21,8 @@
 
 #include <cmath>
 #include <typeinfo>
+#include <vector>
+#include <thread>
 
 #include "ProjAction.h"
 #include "CGameScript.h"
@@ -35,6 +37,7 @@
 #include "Geometry.h"
 #include "ThreadPool.h" // for struct Action
 #include "Timer.h"
+#include "Options.h"
 
 
 
@@ -495,6 +498,267 @@ inline ProjCollisionType LX56Projectile_checkCollAndMove(CProjectile* const prj,
 }
 
 
+/*
+ Speculative parallel movement
+
+ The collision check and movement of a projectile (LX56Projectile_checkCollAndMove) is the most
+ expensive part of a projectile frame and it only depends on the projectile itself, the map pixel
+ flags and the worms. So, at the beginning of each physics frame, we precalculate it for all
+ projectiles in parallel (against the state of that moment) and reset the projectiles afterwards.
+
+ The serial loop then takes the precalculated result if nothing it depends on has changed
+ in the meantime, i.e. no earlier projectile in this frame has touched the map or the worms
+ near the path of the projectile (see LX56_invalidateSpeculativeMoves) and the projectile itself
+ was not changed (e.g. by its timer or by a target action of another projectile). Otherwise it
+ is just calculated again. So an explosion only costs the precalculations of the projectiles
+ around it, not the ones of the whole rest of the frame.
+ All other effects (spawns, explosions, dirt, projPosMap updates, ...) are still done
+ in the serial loop in the original order, so the result is exactly the same as without threads.
+ */
+
+struct LX56ProjectileMoveState {
+	AbsTime lastSimulationTime;
+	CVec pos, oldPos, vel;
+	VectorD2<int> radius;
+	int collisionSide;
+	int checkSpeedLen;
+	int random; // CalculateCheckSteps uses the random list
+	int minCheckStep, maxCheckStep, minCheckStep2, maxCheckStep2, avgCheckStep;
+	
+	void save(const CProjectile* prj) {
+		lastSimulationTime = prj->fLastSimulationTime;
+		pos = prj->vPos; oldPos = prj->vOldPos; vel = prj->vVelocity;
+		radius = prj->radius;
+		collisionSide = prj->CollisionSide;
+		checkSpeedLen = prj->iCheckSpeedLen;
+		random = prj->iRandom;
+		minCheckStep = prj->MIN_CHECKSTEP; maxCheckStep = prj->MAX_CHECKSTEP;
+		minCheckStep2 = prj->MIN_CHECKSTEP2; maxCheckStep2 = prj->MAX_CHECKSTEP2;
+		avgCheckStep = prj->AVG_CHECKSTEP;
+	}
+	
+	void restore(CProjectile* prj) const {
+		prj->fLastSimulationTime = lastSimulationTime;
+		prj->vPos = pos; prj->vOldPos = oldPos; prj->vVelocity = vel;
+		prj->radius = radius;
+		prj->CollisionSide = collisionSide;
+		prj->iCheckSpeedLen = checkSpeedLen;
+		prj->iRandom = random;
+		prj->MIN_CHECKSTEP = minCheckStep; prj->MAX_CHECKSTEP = maxCheckStep;
+		prj->MIN_CHECKSTEP2 = minCheckStep2; prj->MAX_CHECKSTEP2 = maxCheckStep2;
+		prj->AVG_CHECKSTEP = avgCheckStep;
+	}
+	
+	// HINT: floats are compared exactly here, we want a bit-exact match
+	bool operator==(const LX56ProjectileMoveState& s) const {
+		return
+			lastSimulationTime == s.lastSimulationTime &&
+			pos == s.pos && oldPos == s.oldPos && vel == s.vel &&
+			radius == s.radius &&
+			collisionSide == s.collisionSide &&
+			checkSpeedLen == s.checkSpeedLen &&
+			random == s.random &&
+			minCheckStep == s.minCheckStep && maxCheckStep == s.maxCheckStep &&
+			minCheckStep2 == s.minCheckStep2 && maxCheckStep2 == s.maxCheckStep2 &&
+			avgCheckStep == s.avgCheckStep;
+	}
+};
+
+struct LX56SpeculativeMove {
+	CProjectile* prj;
+	LX56ProjectileMoveState before; // state right before the move (i.e. after fLastSimulationTime += dt)
+	LX56ProjectileMoveState after;
+	ProjCollisionType result;
+	// everything the move has looked at (map pixels, grid cells and worms) is in this box
+	float left, top, right, bottom;
+};
+
+// sorted by projectile address, i.e. in the same order as the FastVector iteration
+static std::vector<LX56SpeculativeMove> speculativeMoves;
+static size_t speculativeMovesCursor = 0;
+
+// Areas of the map and worms which were changed after the precalculation in this frame
+struct LX56ChangedArea {
+	float left, top, right, bottom;
+};
+static std::vector<LX56ChangedArea> speculativeChangedAreas;
+// How far a change reaches from the position given to LX56_invalidateSpeculativeMoves
+static VectorD2<float> speculativeChangeRadius;
+// More areas are not worth checking for each move
+static const size_t LX56_MAX_CHANGED_AREAS = 32;
+
+// Must be called whenever something is changed which LX56Projectile_checkCollAndMove
+// depends on (besides the projectile itself), i.e. the map or the worms.
+static void LX56_invalidateSpeculativeMoves() {
+	speculativeMoves.clear();
+	speculativeMovesCursor = 0;
+	speculativeChangedAreas.clear();
+}
+
+// Same as above if the change is only around pos (explosion, carving, dirt or an injured worm there).
+static void LX56_invalidateSpeculativeMoves(const CVec& pos) {
+	if(speculativeMovesCursor >= speculativeMoves.size())
+		return;
+	
+	// The areas would have to wrap around, not worth it
+	if(cClient->getGameLobby()->features[FT_InfiniteMap] || speculativeChangedAreas.size() >= LX56_MAX_CHANGED_AREAS) {
+		LX56_invalidateSpeculativeMoves();
+		return;
+	}
+	
+	LX56ChangedArea a;
+	a.left = pos.x - speculativeChangeRadius.x;
+	a.top = pos.y - speculativeChangeRadius.y;
+	a.right = pos.x + speculativeChangeRadius.x;
+	a.bottom = pos.y + speculativeChangeRadius.y;
+	speculativeChangedAreas.push_back(a);
+}
+
+static bool LX56_speculativeMoveIsChanged(const LX56SpeculativeMove& m) {
+	for(std::vector<LX56ChangedArea>::const_iterator a = speculativeChangedAreas.begin(); a != speculativeChangedAreas.end(); ++a) {
+		if(m.left <= a->right && a->left <= m.right && m.top <= a->bottom && a->top <= m.bottom)
+			return true;
+	}
+	return false;
+}
+
+// The box around all positions the move can have checked. A collided step doesn't save the position
+// it has checked, but no position of the move is further away from the start than speed * dt.
+static void LX56_calcSpeculativeMoveBox(LX56SpeculativeMove& m, const CProjectile* prj, TimeDiff dt) {
+	const proj_t* pi = prj->getProjInfo();
+	const float gravity = pi->UseCustomGravity ? (float)pi->Gravity : 100.0f;
+	// the dampening is the only thing which can make it faster (besides the gravity)
+	const float dampening = (pi->Dampening > 1.0f) ? powf(pi->Dampening, fabs(dt.seconds()) / LX56PhysicsDT.seconds()) : 1.0f;
+	const float speed = MAX(m.before.vel.GetLength() * dampening, m.after.vel.GetLength()) + fabs(gravity) * fabs(dt.seconds());
+	const float margin = (float)MAX(m.before.radius.x, m.before.radius.y) + speed * fabs(dt.seconds()) + 2.0f;
+	
+	m.left = MIN(MIN(m.before.pos.x, m.before.oldPos.x), MIN(m.after.pos.x, m.after.oldPos.x)) - margin;
+	m.top = MIN(MIN(m.before.pos.y, m.before.oldPos.y), MIN(m.after.pos.y, m.after.oldPos.y)) - margin;
+	m.right = MAX(MAX(m.before.pos.x, m.before.oldPos.x), MAX(m.after.pos.x, m.after.oldPos.x)) + margin;
+	m.bottom = MAX(MAX(m.before.pos.y, m.before.oldPos.y), MAX(m.after.pos.y, m.after.oldPos.y)) + margin;
+}
+
+// How far the map and worm changes at some position reach, see LX56_invalidateSpeculativeMoves(pos)
+static VectorD2<float> LX56_calcSpeculativeChangeRadius(CMap* map) {
+	// The holes are used for carving (explosions) and for the dirt
+	int holeW = 0, holeH = 0;
+	for(int i = 0; i <= 4; i++) {
+		const SmartPointer<SDL_Surface>& hole = map->GetTheme()->bmpHoles[i];
+		if(hole.get()) {
+			holeW = MAX(holeW, hole->w);
+			holeH = MAX(holeH, hole->h);
+		}
+	}
+	
+	// Explosions injure the worms up to 5 pixels away, and worms are hit up to 4 pixels around them.
+	// PJ_DIRT places its dirt 6 pixels away. The grid cells around the change might be updated, too.
+	const float wormRange = 5.0f + 4.0f;
+	VectorD2<float> r;
+	r.x = MAX(holeW / 2 + 6.0f, wormRange) + map->getGridWidth() + 2.0f;
+	r.y = MAX(holeH / 2 + 6.0f, wormRange) + map->getGridHeight() + 2.0f;
+	return r;
+}
+
+struct LX56SpeculativeMoveAction : Action {
+	LX56SpeculativeMove* begin;
+	LX56SpeculativeMove* end;
+	TimeDiff dt;
+	
+	int handle() {
+		CMap* map = cClient->getMap();
+		CWorm* worms = cClient->getRemoteWorms();
+		for(LX56SpeculativeMove* m = begin; m != end; ++m) {
+			LX56ProjectileMoveState orig;
+			orig.save(m->prj);
+			m->before.restore(m->prj);
+			m->result = LX56Projectile_checkCollAndMove(m->prj, dt, map, worms);
+			m->after.save(m->prj);
+			orig.restore(m->prj);
+			LX56_calcSpeculativeMoveBox(*m, m->prj, dt);
+		}
+		return 0;
+	}
+};
+
+// Don't bother the threads if there is not much to do.
+static const size_t LX56_MIN_PROJECTILES_PER_THREAD = 32;
+
+static void LX56_calcSpeculativeMoves(Iterator<CProjectile*>::Ref projs, const AbsTime currentTime, const TimeDiff warpTime) {
+	LX56_invalidateSpeculativeMoves();
+	
+	int threadNum = tLXOptions->iPhysicsThreads;
+	if(threadNum <= 0) // automatic: all cores
+		threadNum = (int)std::thread::hardware_concurrency();
+	threadNum = MIN(threadNum, 64);
+	if(threadNum <= 1 || threadPool == NULL) return;
+	
+	static const TimeDiff orig_dt = LX56PhysicsDT;
+	const TimeDiff dt = orig_dt * (float)cClient->getGameLobby()->features[FT_GameSpeed];
+	
+	for(Iterator<CProjectile*>::Ref i = projs; i->isValid(); i->next()) {
+		CProjectile* p = i->get();
+		
+		// exactly the same calculation as in LX56_simulateProjectiles/LX56_simulateProjectile
+		AbsTime simTime = p->fLastSimulationTime;
+		simTime += warpTime;
+		if(simTime + orig_dt > currentTime) continue;
+		simTime += orig_dt;
+		
+		speculativeMoves.push_back(LX56SpeculativeMove());
+		LX56SpeculativeMove& m = speculativeMoves.back();
+		m.prj = p;
+		m.before.save(p);
+		m.before.lastSimulationTime = simTime;
+	}
+	
+	const size_t chunkNum = MIN((size_t)threadNum, speculativeMoves.size() / LX56_MIN_PROJECTILES_PER_THREAD);
+	if(chunkNum <= 1) {
+		LX56_invalidateSpeculativeMoves();
+		return;
+	}
+	
+	speculativeChangeRadius = LX56_calcSpeculativeChangeRadius(cClient->getMap());
+	
+	const size_t chunkSize = (speculativeMoves.size() + chunkNum - 1) / chunkNum;
+	std::vector<LX56SpeculativeMoveAction> actions(chunkNum);
+	for(size_t c = 0; c < chunkNum; ++c) {
+		actions[c].begin = &speculativeMoves[0] + MIN(c * chunkSize, speculativeMoves.size());
+		actions[c].end = &speculativeMoves[0] + MIN((c + 1) * chunkSize, speculativeMoves.size());
+		actions[c].dt = dt;
+	}
+	
+	// The first chunk is done by ourself, the others by the thread pool.
+	// ThreadPool deletes the given action, so we give it a copy.
+	std::vector<ThreadPoolItem*> threads(chunkNum, (ThreadPoolItem*)NULL);
+	for(size_t c = 1; c < chunkNum; ++c)
+		threads[c] = threadPool->start(new LX56SpeculativeMoveAction(actions[c]), "LX56 projectile simulation");
+	actions[0].handle();
+	for(size_t c = 1; c < chunkNum; ++c)
+		threadPool->wait(threads[c], NULL);
+}
+
+// Same as LX56Projectile_checkCollAndMove but uses the precalculated result if it is still valid.
+static ProjCollisionType LX56Projectile_checkCollAndMove_Speculative(CProjectile* const prj, TimeDiff dt, CMap *map, CWorm* worms) {
+	while(speculativeMovesCursor < speculativeMoves.size() && speculativeMoves[speculativeMovesCursor].prj < prj)
+		++speculativeMovesCursor;
+	
+	if(speculativeMovesCursor < speculativeMoves.size() && speculativeMoves[speculativeMovesCursor].prj == prj) {
+		// We only have a precalculation for the first frame of this projectile.
+		const LX56SpeculativeMove& m = speculativeMoves[speculativeMovesCursor];
+		++speculativeMovesCursor;
+		
+		LX56ProjectileMoveState cur;
+		cur.save(prj);
+		if(cur == m.before && !LX56_speculativeMoveIsChanged(m)) {
+			m.after.restore(prj);
+			return m.result;
+		}
+	}
+	
+	return LX56Projectile_checkCollAndMove(prj, dt, map, worms);
+}
+
+
 
 int Proj_SpawnParent::ownerWorm() const {
 	switch(type) {
@@ -770,13 +1034,16 @@ void Proj_Action::applyTo(const Proj_EventOccurInfo& eventInfo, CProjectile* prj
 			prj->Bounce(BounceCoeff);
 			
 				// Do we do a bounce-explosion (bouncy larpa uses this)
-			if(BounceExplode > 0)
+			if(BounceExplode > 0) {
+				LX56_invalidateSpeculativeMoves(prj->getPos());
 				cClient->Explosion(prj->getPos(), (float)BounceExplode, false, prj->GetOwner());
+			}
 			break;
 			
 		// Carve
 		case PJ_CARVE:
 			if(eventInfo.timerHit || (eventInfo.colType && !eventInfo.colType->withWorm)) {
+				LX56_invalidateSpeculativeMoves(prj->getPos());
 				int d = cClient->getMap()->CarveHole(Damage, prj->getPos(), cClient->getGameLobby()->features[FT_InfiniteMap]);
 				info->deleteAfter = true;
 				
@@ -806,6 +1073,7 @@ void Proj_Action::applyTo(const Proj_EventOccurInfo& eventInfo, CProjectile* prj
 		
 		case PJ_INJUREWORM:
 			if(eventInfo.colType && eventInfo.colType->withWorm) {
+				LX56_invalidateSpeculativeMoves(cClient->getRemoteWorms()[eventInfo.colType->wormId].getPos());
 				cClient->InjureWorm(&cClient->getRemoteWorms()[eventInfo.colType->wormId], (float)Damage, prj->GetOwner());
 			}			
 			break;
@@ -813,6 +1081,7 @@ void Proj_Action::applyTo(const Proj_EventOccurInfo& eventInfo, CProjectile* prj
 		case PJ_INJURE:
 			if(eventInfo.colType && eventInfo.colType->withWorm) {
 				info->deleteAfter = true;
+				LX56_invalidateSpeculativeMoves(cClient->getRemoteWorms()[eventInfo.colType->wormId].getPos());
 				cClient->InjureWorm(&cClient->getRemoteWorms()[eventInfo.colType->wormId], (float)Damage, prj->GetOwner());
 				break;
 			}
@@ -1101,8 +1370,10 @@ bool Proj_FallbackEvent::checkEvent(Proj_EventOccurInfo& eventInfo, CProjectile*
 
 static void projectile_doExplode(CProjectile* const prj, int damage, int shake) {
 	// Explosion
-	if(damage != -1) // TODO: why only with -1?
+	if(damage != -1) { // TODO: why only with -1?
+		LX56_invalidateSpeculativeMoves(prj->getPos());
 		cClient->Explosion(prj->getPos(), (float)damage, shake, prj->GetOwner());
+	}
 }
 
 static void projectile_doTimerExplode(CProjectile* const prj, int shake) {
@@ -1112,11 +1383,14 @@ static void projectile_doTimerExplode(CProjectile* const prj, int shake) {
 	if(pi->PlyHit.Type == PJ_EXPLODE)
 		damage = pi->PlyHit.Damage;
 	
-	if(damage != -1) // TODO: why only with -1?
+	if(damage != -1) { // TODO: why only with -1?
+		LX56_invalidateSpeculativeMoves(prj->getPos());
 		cClient->Explosion(prj->getPos(), (float)damage, shake, prj->GetOwner());
+	}
 }
 
 static void projectile_doMakeDirt(CProjectile* const prj) {
+	LX56_invalidateSpeculativeMoves(prj->getPos());
 	const int damage = 5;
 	int d = 0;
 	d += cClient->getMap()->PlaceDirt(damage,prj->getPos()-CVec(6,6));
@@ -1129,6 +1403,8 @@ static void projectile_doMakeDirt(CProjectile* const prj) {
 }
 
 static void projectile_doMakeGreenDirt(CProjectile* const prj) {
+	// The green mask is not one of the holes, so we don't know how far it reaches
+	LX56_invalidateSpeculativeMoves();
 	int d = cClient->getMap()->PlaceGreenDirt(prj->getPos());
 	
 	// Remove the dirt count on the worm
@@ -1217,7 +1493,7 @@ static inline ProjCollisionType LX56_simulateProjectile_LowLevel(AbsTime current
 	//proj->setRemote( false );
 
 	// Check for collisions and move
-	ProjCollisionType res = LX56Projectile_checkCollAndMove(proj, dt, cClient->getMap(), worms);
+	ProjCollisionType res = LX56Projectile_checkCollAndMove_Speculative(proj, dt, cClient->getMap(), worms);
 	
 	proj->life() += dt.seconds();
 	proj->extra() += dt.seconds();
@@ -1385,16 +1661,18 @@ void LX56_simulateProjectiles(Iterator<CProjectile*>::Ref projs) {
 	AbsTime realSimulationTime = GetTime();
 	
 simulateProjectilesStart:
-	if(cClient->fLastSimulationTime + orig_dt > currentTime) return;
+	if(cClient->fLastSimulationTime + orig_dt > currentTime) goto simulateProjectilesEnd;
 
 	// HINT: if the computer is too slow and doesn't manage to simulate everything, just skip few frames
 	// Better an incorrect simulation than a game that is not controllable
 	if (GetTime() - realSimulationTime > orig_dt)  {
 		cClient->fLastSimulationTime = currentTime;
-		return;
+		goto simulateProjectilesEnd;
 	}
 	realSimulationTime = GetTime();
 	
+	LX56_calcSpeculativeMoves(projs, cClient->fLastSimulationTime, warpTime);
+	
 	for(Iterator<CProjectile*>::Ref i = projs; i->isValid(); i->next()) {
 		CProjectile* p = i->get();
 		p->fLastSimulationTime += warpTime;
@@ -1404,5 +1682,8 @@ simulateProjectilesStart:
 	warpTime = TimeDiff(0);
 	cClient->fLastSimulationTime += orig_dt;
 	goto simulateProjectilesStart;
+	
+simulateProjectilesEnd:
+	LX56_invalidateSpeculativeMoves();
 }
 
@@ -0,0 +1,640 @@
+/*
+	OpenLieroX
+
+	delta compressed worm updates (S2C_UPDATEWORMSDELTA)
+
+	code under LGPL
+*/
+
+#include "WormDelta.h"
+#include "CBytestream.h"
+#include "Protocol.h"
+#include "Frame.h"
+#include "Debug.h"
+#include "MathLib.h"
+
+
+////////////////////
+// Bit packing, LSB first
+
+class BitWriter {
+public:
+	BitWriter(CBytestream *bs_) : bs(bs_), acc(0), num(0) {}
+
+	void write(Uint32 value, int bits) {
+		for (int i = 0; i < bits; i++)  {
+			if (value & (1u << i))
+				acc |= 1 << num;
+			if (++num == 8)
+				flush();
+		}
+	}
+	void writeSigned(int value, int bits) { write((Uint32)value & ((1u << bits) - 1), bits); }
+	void flush() {
+		if (num)
+			bs->writeByte(acc);
+		acc = 0; num = 0;
+	}
+
+private:
+	CBytestream *bs;
+	uchar acc;
+	int num;
+};
+
+class BitReader {
+public:
+	BitReader(const std::string& data_) : data(data_), pos(0), overflow(false) {}
+
+	Uint32 read(int bits) {
+		Uint32 value = 0;
+		for (int i = 0; i < bits; i++, pos++)  {
+			if (pos / 8 >= data.size())  {
+				overflow = true;
+				return 0;
+			}
+			if ((uchar)data[pos / 8] & (1 << (pos % 8)))
+				value |= 1u << i;
+		}
+		return value;
+	}
+	int readSigned(int bits) {
+		Uint32 v = read(bits);
+		if (v & (1u << (bits - 1)))
+			v |= ~((1u << bits) - 1);
+		return (int)v;
+	}
+	bool failed() const { return overflow; }
+
+private:
+	const std::string& data;
+	size_t pos;
+	bool overflow;
+};
+
+
+////////////////////
+// Worm state
+
+bool WormNetState::ropeHasExtra() const
+{
+	return ropeType == ROP_SHOOTING || ropeType == ROP_PLYHOOKED;
+}
+
+bool WormNetState::ropeEquals(const WormNetState& s) const
+{
+	return ropeType == s.ropeType && ropeX == s.ropeX && ropeY == s.ropeY && (!ropeHasExtra() || ropeExtra == s.ropeExtra);
+}
+
+// See CWorm::writePacket and CNinjaRope::write
+bool WormNetState::readPacket(CBytestream *bs)
+{
+	bs->read2Int12(x, y);
+	angle = bs->readByte();
+	bits = bs->readByte();
+	weapon = bs->readByte();
+	if (hasRope())  {
+		ropeType = bs->readByte();
+		bs->read2Int12(ropeX, ropeY);
+		ropeExtra = ropeHasExtra() ? bs->readByte() : 0;
+	}
+	vx = bs->readInt16();
+	vy = bs->readInt16();
+	return bs->GetPos() <= bs->GetLength();
+}
+
+void WormNetState::writePacket(CBytestream *bs) const
+{
+	bs->write2Int12(x, y);
+	bs->writeByte(angle);
+	bs->writeByte(bits);
+	bs->writeByte(weapon);
+	if (hasRope())  {
+		bs->writeByte(ropeType);
+		bs->write2Int12(ropeX, ropeY);
+		if (ropeHasExtra())
+			bs->writeByte(ropeExtra);
+	}
+	bs->writeInt16(vx);
+	bs->writeInt16(vy);
+}
+
+// Changed fields
+enum {
+	WD_POS		= 0x01,
+	WD_ANGLE	= 0x02,
+	WD_BITS		= 0x04,
+	WD_WEAPON	= 0x08,
+	WD_ROPE		= 0x10,
+	WD_VEL		= 0x20,
+	WD_ALL		= 0x3F
+};
+
+// Positions are 12 bit, small moves are sent as 6 bit differences
+static void WritePos(BitWriter& w, short x, short y, const short* baseX, const short* baseY)
+{
+	if (baseX)  {
+		const int dx = x - *baseX, dy = y - *baseY;
+		const bool small = dx >= -32 && dx < 32 && dy >= -32 && dy < 32;
+		w.write(small, 1);
+		if (small)  {
+			w.writeSigned(dx, 6);
+			w.writeSigned(dy, 6);
+			return;
+		}
+	}
+	w.write(x & 0xFFF, 12);
+	w.write(y & 0xFFF, 12);
+}
+
+static void ReadPos(BitReader& r, short& x, short& y, const short* baseX, const short* baseY)
+{
+	if (baseX && r.read(1))  {
+		x = (short)(*baseX + r.readSigned(6));
+		y = (short)(*baseY + r.readSigned(6));
+		return;
+	}
+	x = (short)r.read(12);
+	y = (short)r.read(12);
+}
+
+static void WriteVelocity(BitWriter& w, Sint16 v, const Sint16* base)
+{
+	if (base)  {
+		const int d = v - *base;
+		const bool small = d >= -64 && d < 64;
+		w.write(small, 1);
+		if (small)  {
+			w.writeSigned(d, 7);
+			return;
+		}
+	}
+	w.write((Uint16)v, 16);
+}
+
+static Sint16 ReadVelocity(BitReader& r, const Sint16* base)
+{
+	if (base && r.read(1))
+		return (Sint16)(*base + r.readSigned(7));
+	return (Sint16)r.read(16);
+}
+
+void WormNetState::writeDelta(BitWriter& w, const WormNetState* base) const
+{
+	int changed = WD_ALL;
+	if (base)  {
+		changed = 0;
+		if (x != base->x || y != base->y) changed |= WD_POS;
+		if (angle != base->angle) changed |= WD_ANGLE;
+		if (bits != base->bits) changed |= WD_BITS;
+		if (weapon != base->weapon) changed |= WD_WEAPON;
+		if (hasRope() && (!base->hasRope() || !ropeEquals(*base))) changed |= WD_ROPE;
+		if (vx != base->vx || vy != base->vy) changed |= WD_VEL;
+		w.write(changed, 6);
+	}
+
+	if (changed & WD_POS)
+		WritePos(w, x, y, base ? &base->x : NULL, base ? &base->y : NULL);
+
+	if (changed & WD_ANGLE)  {
+		const int d = angle - (base ? base->angle : 0);
+		const bool small = base && d >= -8 && d < 8;
+		if (base) w.write(small, 1);
+		if (small)
+			w.writeSigned(d, 4);
+		else
+			w.write(angle, 8);
+	}
+
+	if (changed & WD_BITS)
+		w.write(bits & 0x3F, 6);
+	if (changed & WD_WEAPON)
+		w.write(weapon, 3);
+
+	if ((changed & WD_ROPE) && hasRope())  {
+		const bool baseRope = base && base->hasRope();
+		w.write(ropeType, 4);
+		WritePos(w, ropeX, ropeY, baseRope ? &base->ropeX : NULL, baseRope ? &base->ropeY : NULL);
+		if (ropeHasExtra())
+			w.write(ropeExtra, 8);
+	}
+
+	if (changed & WD_VEL)  {
+		WriteVelocity(w, vx, base ? &base->vx : NULL);
+		WriteVelocity(w, vy, base ? &base->vy : NULL);
+	}
+}
+
+bool WormNetState::readDelta(BitReader& r, const WormNetState* base)
+{
+	int changed = WD_ALL;
+	if (base)  {
+		*this = *base;
+		changed = r.read(6);
+	}
+
+	if (changed & WD_POS)
+		ReadPos(r, x, y, base ? &base->x : NULL, base ? &base->y : NULL);
+
+	if (changed & WD_ANGLE)  {
+		if (base && r.read(1))
+			angle = (uchar)(base->angle + r.readSigned(4));
+		else
+			angle = (uchar)r.read(8);
+	}
+
+	if (changed & WD_BITS)
+		bits = (uchar)r.read(6);
+	if (changed & WD_WEAPON)
+		weapon = (uchar)r.read(3);
+
+	if ((changed & WD_ROPE) && hasRope())  {
+		const bool baseRope = base && base->hasRope();
+		ropeType = (uchar)r.read(4);
+		ReadPos(r, ropeX, ropeY, baseRope ? &base->ropeX : NULL, baseRope ? &base->ropeY : NULL);
+		ropeExtra = ropeHasExtra() ? (uchar)r.read(8) : 0;
+	}
+
+	if (changed & WD_VEL)  {
+		vx = ReadVelocity(r, base ? &base->vx : NULL);
+		vy = ReadVelocity(r, base ? &base->vy : NULL);
+	}
+
+	return !r.failed();
+}
+
+
+////////////////////
+// Server side
+
+void WormDeltaSender::reset()
+{
+	iSeq = 0;
+	for (int i = 0; i < WORMDELTA_HISTORY; i++)
+		tSent[i].used = false;
+	for (int i = 0; i < MAX_WORMS; i++)
+		bAcked[i] = false;
+}
+
+///////////////////
+// Write a snapshot
+// Layout: seq, payload length (2 bytes), bit packed payload: worm count, per worm: ID, base flag, base seq, state
+void WormDeltaSender::write(CBytestream *bs, const WormNetStates& worms)
+{
+	const uchar seq = iSeq++;
+	Snapshot& snap = tSent[seq % WORMDELTA_HISTORY];
+	snap.used = true;
+	snap.seq = seq;
+	snap.worms = 0;
+
+	bs->writeByte(S2C_UPDATEWORMSDELTA);
+	bs->writeByte(seq);
+	const size_t lenPos = bs->GetLength();
+	bs->writeInt(0, 2);
+
+	BitWriter w(bs);
+	w.write((Uint32)worms.size(), 6);
+	for (WormNetStates::const_iterator it = worms.begin(); it != worms.end(); ++it)  {
+		const int id = it->first;
+		w.write(id, 5);
+
+		// Use the acknowledged state as base, if the client still remembers it
+		const bool base = bAcked[id] && (uchar)(seq - iAckedSeq[id]) < WORMDELTA_HISTORY;
+		w.write(base, 1);
+		if (base)
+			w.write(iAckedSeq[id], 8);
+		it->second.writeDelta(w, base ? &tAcked[id] : NULL);
+
+		snap.worms |= 1u << id;
+		snap.states[id] = it->second;
+	}
+	w.flush();
+
+	const size_t len = bs->GetLength() - lenPos - 2;
+	bs->writeByteAt(lenPos, (uchar)(len & 0xFF));
+	bs->writeByteAt(lenPos + 1, (uchar)(len >> 8));
+}
+
+///////////////////
+// The client tells us which snapshots it got
+// Layout: flags (1 = reset), latest seq, 32 bit mask of the snapshots before
+void WormDeltaSender::parseAck(CBytestream *bs)
+{
+	const uchar flags = bs->readByte();
+	const uchar latest = bs->readByte();
+	const Uint32 mask = (Uint32)bs->readInt(4);
+
+	if (flags & 1)  {
+		for (int i = 0; i < MAX_WORMS; i++)
+			bAcked[i] = false;
+		return;
+	}
+
+	// Oldest first, so the newest state wins
+	for (int n = WORMDELTA_HISTORY; n >= 0; n--)  {
+		if (n > 0 && !(mask & (1u << (n - 1))))
+			continue;
+
+		const uchar seq = (uchar)(latest - n);
+		// Not sent yet (broken ack) or too old
+		if ((uchar)(iSeq - 1 - seq) >= WORMDELTA_HISTORY)
+			continue;
+		const Snapshot& snap = tSent[seq % WORMDELTA_HISTORY];
+		if (!snap.used || snap.seq != seq)
+			continue;
+
+		for (int id = 0; id < MAX_WORMS; id++)  {
+			if (!(snap.worms & (1u << id)))
+				continue;
+			// Don't go back to an older state
+			if (bAcked[id] && (uchar)(seq - iAckedSeq[id]) >= 128)
+				continue;
+			bAcked[id] = true;
+			iAckedSeq[id] = seq;
+			tAcked[id] = snap.states[id];
+		}
+	}
+}
+
+
+////////////////////
+// Client side
+
+void WormDeltaReceiver::reset()
+{
+	for (int i = 0; i < MAX_WORMS; i++)
+		for (int j = 0; j < WORMDELTA_HISTORY; j++)
+			tStates[i][j].valid = false;
+	bGotSnapshot = false;
+	iLatest = 0;
+	iReceived = 0;
+	bNeedAck = false;
+	bNeedReset = false;
+}
+
+void WormDeltaReceiver::skip(CBytestream *bs)
+{
+	bs->Skip(1); // seq
+	const int len = bs->readInt(2);
+	bs->Skip(len);
+}
+
+void WormDeltaReceiver::skipAck(CBytestream *bs)
+{
+	bs->Skip(6);
+}
+
+bool WormDeltaReceiver::read(CBytestream *bs, WormNetStates& worms)
+{
+	const uchar seq = bs->readByte();
+	const int len = bs->readInt(2);
+	if ((size_t)len > bs->GetRestLen())  {
+		warnings << "WormDeltaReceiver::read: bad snapshot length " << len << endl;
+		bs->SkipAll();
+		return false;
+	}
+	const std::string payload = bs->readData(len);
+
+	worms.clear();
+	BitReader r(payload);
+	const int count = r.read(6);
+	for (int i = 0; i < count; i++)  {
+		const int id = r.read(5);
+
+		const WormNetState* base = NULL;
+		if (r.read(1))  {
+			const uchar baseSeq = (uchar)r.read(8);
+			const Entry& e = tStates[id][baseSeq % WORMDELTA_HISTORY];
+			if (!e.valid || e.seq != baseSeq)  {
+				// We don't have that state (anymore), let the server send full states again
+				notes << "WormDeltaReceiver: missing base state " << (int)baseSeq << " for worm " << id << endl;
+				bNeedReset = bNeedAck = true;
+				return false;
+			}
+			base = &e.state;
+		}
+
+		WormNetState state;
+		if (!state.readDelta(r, base) || r.failed())  {
+			warnings << "WormDeltaReceiver::read: snapshot " << (int)seq << " is broken" << endl;
+			bNeedReset = bNeedAck = true;
+			return false;
+		}
+		worms.push_back(std::make_pair(id, state));
+	}
+
+	// Everything decoded, remember the states as base for the following snapshots
+	for (WormNetStates::const_iterator it = worms.begin(); it != worms.end(); ++it)  {
+		Entry& e = tStates[it->first][seq % WORMDELTA_HISTORY];
+		e.valid = true;
+		e.seq = seq;
+		e.state = it->second;
+	}
+
+	if (!bGotSnapshot)  {
+		bGotSnapshot = true;
+		iLatest = seq;
+		iReceived = 0;
+	} else  {
+		const uchar d = (uchar)(seq - iLatest);
+		if (d > 0 && d < 128)  { // newer
+			// The old latest one moves to bit d - 1
+			if (d < WORMDELTA_HISTORY)
+				iReceived = (iReceived << d) | (1u << (d - 1));
+			else
+				iReceived = (d == WORMDELTA_HISTORY) ? (1u << (d - 1)) : 0;
+			iLatest = seq;
+		} else if (d >= 128)  { // older, arrived late
+			const uchar back = (uchar)(iLatest - seq);
+			if (back <= WORMDELTA_HISTORY)
+				iReceived |= 1u << (back - 1);
+		}
+	}
+	bNeedAck = true;
+	return true;
+}
+
+void WormDeltaReceiver::writeAck(CBytestream *bs)
+{
+	if (!bNeedAck)
+		return;
+
+	bs->writeByte(C2S_UPDATEWORMSACK);
+	bs->writeByte(bNeedReset ? 1 : 0);
+	bs->writeByte(iLatest);
+	bs->writeInt(bGotSnapshot ? iReceived : 0, 4);
+
+	bNeedAck = false;
+	bNeedReset = false;
+}
+
+
+#ifdef DEBUG
+////////////////////
+// Test
+
+// The fields which are not sent don't matter, so compare the CWorm::writePacket format
+static std::string WormDeltaTestPacket(const WormNetState& s)
+{
+	CBytestream bs;
+	s.writePacket(&bs);
+	return bs.readData();
+}
+
+// Mostly small moves, sometimes jumps, rope changes and so on
+static void WormDeltaTestMove(WormNetState& s)
+{
+	const bool jump = GetRandomInt(20) == 0;
+	s.x = jump ? GetRandomInt(0xFFF) : ((s.x + GetRandomInt(8) - 4) & 0xFFF);
+	s.y = jump ? GetRandomInt(0xFFF) : ((s.y + GetRandomInt(8) - 4) & 0xFFF);
+	s.angle = (GetRandomInt(10) == 0) ? GetRandomInt(255) : (uchar)(s.angle + GetRandomInt(4) - 2);
+	if (GetRandomInt(10) == 0)
+		s.bits = GetRandomInt(0x3F);
+	if (GetRandomInt(10) == 0)
+		s.weapon = GetRandomInt(7);
+	if (s.hasRope())  {
+		static const uchar ropeTypes[] = { ROP_SHOOTING, ROP_HOOKED, ROP_FALLING, ROP_PLYHOOKED };
+		if (GetRandomInt(10) == 0)
+			s.ropeType = ropeTypes[GetRandomInt(3)];
+		s.ropeX = jump ? GetRandomInt(0xFFF) : ((s.ropeX + GetRandomInt(4) - 2) & 0xFFF);
+		s.ropeY = (s.ropeY + GetRandomInt(4) - 2) & 0xFFF;
+		if (GetRandomInt(5) == 0)
+			s.ropeExtra = GetRandomInt(255);
+	}
+	s.vx = (GetRandomInt(10) == 0) ? (Sint16)(GetRandomInt(2000) - 1000) : (Sint16)(s.vx + GetRandomInt(20) - 10);
+	s.vy = (Sint16)(s.vy + GetRandomInt(200) - 100);
+}
+
+// Decodes a snapshot and compares it to what was sent, returns the number of errors
+// mustFail: the base states are gone, the snapshot must not be decoded
+static int WormDeltaTestReceive(WormDeltaReceiver& receiver, CBytestream& bs, const WormNetStates& sent, bool mustFail)
+{
+	bs.ResetPosToBegin();
+	if (bs.readByte() != S2C_UPDATEWORMSDELTA)  {
+		errors << "TestWormDelta: wrong message" << endl;
+		return 1;
+	}
+	WormNetStates got;
+	if (!receiver.read(&bs, got))  {
+		if (!mustFail)
+			errors << "TestWormDelta: snapshot could not be decoded" << endl;
+		return mustFail ? 0 : 1;
+	}
+	if (mustFail)  {
+		errors << "TestWormDelta: snapshot was decoded without its base state" << endl;
+		return 1;
+	}
+	if (!bs.isPosAtEnd())  {
+		errors << "TestWormDelta: " << bs.GetRestLen() << " bytes left behind the snapshot" << endl;
+		return 1;
+	}
+	if (got.size() != sent.size())  {
+		errors << "TestWormDelta: got " << got.size() << " worms, sent " << sent.size() << endl;
+		return 1;
+	}
+	for (size_t i = 0; i < sent.size(); i++)  {
+		if (got[i].first != sent[i].first || WormDeltaTestPacket(got[i].second) != WormDeltaTestPacket(sent[i].second))  {
+			errors << "TestWormDelta: worm " << sent[i].first << " differs" << endl;
+			return 1;
+		}
+	}
+	return 0;
+}
+
+// Delivers the acknowledgement of the receiver, if any
+static void WormDeltaTestAck(WormDeltaReceiver& receiver, WormDeltaSender& sender, bool lost)
+{
+	CBytestream ack;
+	receiver.writeAck(&ack);
+	if (lost || ack.GetLength() == 0)
+		return;
+	if (ack.readByte() == C2S_UPDATEWORMSACK)
+		sender.parseAck(&ack);
+}
+
+// Moves the worms and writes a snapshot of them (or of some of them)
+static void WormDeltaTestSend(WormDeltaSender& sender, WormNetState* states, CBytestream& bs, WormNetStates& sent, bool all)
+{
+	sent.clear();
+	for (int id = 0; id < MAX_WORMS; id += 3)  {
+		WormDeltaTestMove(states[id]);
+		if (all || GetRandomInt(2) > 0)
+			sent.push_back(std::make_pair(id, states[id]));
+	}
+	bs.Clear();
+	sender.write(&bs, sent);
+}
+
+// Size of the snapshot without any acknowledged states
+static size_t WormDeltaTestFullSize(const WormNetStates& sent)
+{
+	WormDeltaSender sender;
+	CBytestream bs;
+	sender.write(&bs, sent);
+	return bs.GetLength();
+}
+
+void TestWormDelta()
+{
+	notes << "\n\n\n\nTesting the worm delta updates" << endl;
+
+	WormDeltaSender sender;
+	WormDeltaReceiver receiver;
+	WormNetState states[MAX_WORMS];
+	CBytestream bs;
+	WormNetStates sent;
+	int failed = 0;
+
+	// Lossy link: snapshots and acks get lost, some snapshots arrive after the following one
+	size_t deltaSize = 0, fullSize = 0;
+	CBytestream late;
+	WormNetStates lateSent;
+	for (int i = 0; i < 1000; i++)  {
+		WormDeltaTestSend(sender, states, bs, sent, true);
+		if (i > 0 && GetRandomInt(5) == 0)
+			continue; // lost
+		if (i > 0 && late.GetLength() == 0 && GetRandomInt(20) == 0)  {
+			late = bs;
+			lateSent = sent;
+			continue;
+		}
+		failed += WormDeltaTestReceive(receiver, bs, sent, false);
+		deltaSize += bs.GetLength();
+		fullSize += WormDeltaTestFullSize(sent);
+		if (late.GetLength() > 0)  {
+			failed += WormDeltaTestReceive(receiver, late, lateSent, false);
+			late.Clear();
+		}
+		WormDeltaTestAck(receiver, sender, GetRandomInt(3) == 0);
+	}
+	notes << "lossy link: " << deltaSize << " bytes received, " << fullSize << " bytes as full states" << endl;
+	if (deltaSize >= fullSize)
+		failed++, errors << "TestWormDelta: the deltas are not smaller than the full states" << endl;
+
+	// All acks lost for longer than the history, the sender has to go back to full states
+	for (int i = 0; i < WORMDELTA_HISTORY; i++)  {
+		WormDeltaTestSend(sender, states, bs, sent, true);
+		failed += WormDeltaTestReceive(receiver, bs, sent, false);
+		WormDeltaTestAck(receiver, sender, true);
+	}
+	WormDeltaTestSend(sender, states, bs, sent, true);
+	failed += WormDeltaTestReceive(receiver, bs, sent, false);
+	WormDeltaTestAck(receiver, sender, false);
+	if (bs.GetLength() != WormDeltaTestFullSize(sent))
+		failed++, errors << "TestWormDelta: no full states after the acks were lost" << endl;
+
+	// The receiver forgets its states (e.g. after a reconnect), it can't decode
+	// the next snapshot and asks for full states again
+	receiver.reset();
+	WormDeltaTestSend(sender, states, bs, sent, true);
+	failed += WormDeltaTestReceive(receiver, bs, sent, true);
+	WormDeltaTestAck(receiver, sender, false);
+	for (int i = 0; i < 10; i++)  {
+		WormDeltaTestSend(sender, states, bs, sent, false);
+		failed += WormDeltaTestReceive(receiver, bs, sent, false);
+		WormDeltaTestAck(receiver, sender, false);
+	}
+
+	notes << "Worm delta updates: " << failed << " errors" << endl;
+}
+#endif
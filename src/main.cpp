@@ -47,6 +47,16 @@
 #include "ConversationLogger.h"
 #include "Command.h"
 
+#ifdef DEBUG
+#include "CProjectile.h"
+#include "Networking.h"
+#include "GeoIPDatabase.h"
+#include "CFont.h"
+#include "MapKernels.h"
+#include "FileDownload.h"
+#include "WormDelta.h"
+#endif
+
 #include "DeprecatedGUI/CBar.h"
 #include "DeprecatedGUI/Graphics.h"
 #include "DeprecatedGUI/Menu.h"
@@ -624,6 +634,7 @@ int main(int argc, char *argv[])
 	if(!InitNetworkSystem())
 		errors << "Failed to initialize the network library" << endl;
 	InitThreadPool();
+	InitLogWriter();
 	
 	setBinaryDirAndName(argv[0]);
 
@@ -812,6 +823,7 @@ quit:
 		goto startpoint;
 	}
 
+	UnInitLogWriter();
 	UnInitThreadPool();
 
 	// Network
@@ -1002,6 +1014,32 @@ static int MainLoopThread(void*) {
 
 
 
+#ifdef DEBUG
+static void TestNetworking()
+{
+	TestCChannelRobustness();
+	TestFileDownloadStreaming();
+}
+
+// The tests and benchmarks which can be started from the command line, they quit the game afterwards
+struct DebugTest {
+	const char* arg;
+	void (*run)();
+	const char* help;
+};
+
+static const DebugTest debugTests[] = {
+	{ "-nettest",		TestNetworking,				"Test CChannel reliability and file stream resuming" },
+	{ "-projbench",		TestProjectileIteration,	"Benchmark projectile iteration" },
+	{ "-udpbench",		TestNetworkBatching,		"Benchmark batched UDP sending/receiving" },
+	{ "-geoipbench",	TestGeoIPLookup,			"Benchmark GeoIP lookups" },
+	{ "-fontbench",		TestFontDrawing,			"Benchmark coloured font drawing" },
+	{ "-mapbench",		TestMapKernels,				"Benchmark the CarveHole/PlaceDirt row kernels" },
+	{ "-deltatest",		TestWormDelta,				"Test the delta compressed worm updates" },
+};
+#endif
+
+
 ///////////////////
 // Parse the arguments
 void ParseArguments(int argc, char *argv[])
@@ -1127,7 +1165,8 @@ void ParseArguments(int argc, char *argv[])
 			printf("   -console      Attach a console window to the main OpenLieroX window\n");
 			#endif
 			#ifdef DEBUG
-     		printf("   -nettest      Test CChannel reliability\n");
+			for( size_t t = 0; t < sizeof(debugTests) / sizeof(debugTests[0]); t++ )
+				printf("   %-13s %s\n", debugTests[t].arg, debugTests[t].help);
 			#endif
      		printf("   -skin         Turns on new skinned GUI - it's unfinished yet\n");
      		printf("   -noskin       Turns off new skinned GUI\n");
@@ -1140,12 +1179,15 @@ void ParseArguments(int argc, char *argv[])
      		exit(0);
         }
 		#ifdef DEBUG
-		if( !stricmp(a, "-nettest") )
+		for( size_t t = 0; t < sizeof(debugTests) / sizeof(debugTests[0]); t++ )
 		{
-			InitializeLieroX();
-			TestCChannelRobustness();
-			ShutdownLieroX();
-     		exit(0);
+			if( !stricmp(a, debugTests[t].arg) )
+			{
+				InitializeLieroX();
+				debugTests[t].run();
+				ShutdownLieroX();
+				exit(0);
+			}
 		}
 		#endif
     }
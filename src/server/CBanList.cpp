@@ -11,6 +11,7 @@
 /////////////////////////////////////////
 
 
+#include <algorithm>
 #include "LieroX.h"
 
 #include "FindFile.h"
@@ -25,31 +26,167 @@ CBanList::CBanList()
     m_psBanList = NULL;
     m_psSortedList = NULL;
     m_nCount = 0;
+	m_bSorted = false;
 	m_szPath = "cfg/ban.lst";
 	m_bLoading = false;
 }
 
 ///////////////////
-// Find a banned worm in the list
-banlist_t *CBanList::findBanned(const std::string& szAddress)
+// Removes the port and spaces from the address
+static std::string banAddress(const std::string& szAddress)
 {
-	if (m_nCount <= 0)
-		return NULL;
-
-	// Remove the port from the address
 	std::string addr = szAddress;
 	size_t pos = addr.rfind(':');
 	if(pos != std::string::npos) {
 		addr.erase(pos);
 	}
 	TrimSpaces( addr );
+	return addr;
+}
 
-    banlist_t *psWorm = m_psBanList;
+///////////////////
+// Parses an IPv4 address, returns false if it is none
+static bool parseIPv4(const std::string& addr, Uint32& ip)
+{
+	ip = 0;
+	int octets = 0;
+	size_t i = 0;
+	while(octets < 4) {
+		if(i >= addr.size() || addr[i] < '0' || addr[i] > '9')
+			return false;
+		Uint32 octet = 0;
+		for(; i < addr.size() && addr[i] >= '0' && addr[i] <= '9'; i++) {
+			octet = octet * 10 + (addr[i] - '0');
+			if(octet > 255)
+				return false;
+		}
+		ip = (ip << 8) | octet;
+		octets++;
+		if(octets < 4) {
+			if(i >= addr.size() || addr[i] != '.')
+				return false;
+			i++;
+		}
+	}
+	return i == addr.size();
+}
+
+static Uint32 prefixMask(int prefixLen)
+{
+	return (prefixLen <= 0) ? 0 : (0xffffffff << (32 - prefixLen));
+}
+
+///////////////////
+// Parses an address range, either with wildcards ("1.2.*") or in CIDR notation ("1.2.0.0/16")
+// Returns false if it is no range
+static bool parseBanRange(const std::string& addr, Uint32& ip, int& prefixLen)
+{
+	size_t slash = addr.find('/');
+	if(slash != std::string::npos) {
+		bool fail = false;
+		prefixLen = from_string<int>(addr.substr(slash + 1), fail);
+		if(fail || prefixLen < 0 || prefixLen > 32)
+			return false;
+		if(!parseIPv4(addr.substr(0, slash), ip))
+			return false;
+		ip &= prefixMask(prefixLen);
+		return true;
+	}
+
+	size_t star = addr.find('*');
+	if(star == std::string::npos)
+		return false;
+
+	// All octets after the first wildcard have to be wildcards too
+	std::vector<std::string> octets = explode(addr, ".");
+	if(octets.size() > 4)
+		return false;
+	ip = 0;
+	prefixLen = 0;
+	bool wildcard = false;
+	for(size_t i = 0; i < 4; i++) {
+		if(i >= octets.size() || octets[i] == "*") {
+			wildcard = true;
+			ip <<= 8;
+			continue;
+		}
+		if(wildcard)
+			return false;
+		Uint32 octet;
+		if(!parseIPv4(octets[i] + ".0.0.0", octet))
+			return false;
+		ip = (ip << 8) | (octet >> 24);
+		prefixLen += 8;
+	}
+	return wildcard;
+}
 
-    for(; psWorm; psWorm=psWorm->psNext) {
-        if( stringcasecmp(psWorm->szAddress, addr) == 0 )
-            return psWorm;
-    }
+///////////////////
+// Adds an item to the index
+// HINT: newer entries replace older ones with the same address, like in the list which has the newest first
+void CBanList::indexItem(banlist_t *item)
+{
+	Uint32 ip = 0;
+	int prefixLen = 0;
+	if(parseBanRange(item->szAddress, ip, prefixLen))
+		m_cRangeIndex[prefixLen][ip] = item;
+	else
+		m_cExactIndex[stringtolower(item->szAddress)] = item;
+}
+
+///////////////////
+// Rebuild the index from the items
+void CBanList::rebuildIndex()
+{
+	m_cExactIndex.clear();
+	m_cRangeIndex.clear();
+	for(std::vector<banlist_t *>::iterator it = m_cItems.begin(); it != m_cItems.end(); it++)
+		indexItem(*it);
+}
+
+///////////////////
+// Find an item with exactly this address (can also be a range)
+banlist_t *CBanList::findExact(const std::string& szAddress)
+{
+	std::string addr = banAddress(szAddress);
+
+	Uint32 ip = 0;
+	int prefixLen = 0;
+	if(parseBanRange(addr, ip, prefixLen)) {
+		std::map< int, std::unordered_map<Uint32, banlist_t *> >::iterator range = m_cRangeIndex.find(prefixLen);
+		if(range == m_cRangeIndex.end())
+			return NULL;
+		std::unordered_map<Uint32, banlist_t *>::iterator it = range->second.find(ip);
+		return (it != range->second.end()) ? it->second : NULL;
+	}
+
+	std::unordered_map<std::string, banlist_t *>::iterator it = m_cExactIndex.find(stringtolower(addr));
+	return (it != m_cExactIndex.end()) ? it->second : NULL;
+}
+
+///////////////////
+// Find a banned worm in the list
+// The address can also be covered by a banned range
+banlist_t *CBanList::findBanned(const std::string& szAddress)
+{
+	if (m_nCount <= 0)
+		return NULL;
+
+	banlist_t *psWorm = findExact(szAddress);
+	if(psWorm)
+		return psWorm;
+
+	// Check the ranges, the most specific first
+	Uint32 ip = 0;
+	if(m_cRangeIndex.empty() || !parseIPv4(banAddress(szAddress), ip))
+		return NULL;
+
+	std::map< int, std::unordered_map<Uint32, banlist_t *> >::reverse_iterator range = m_cRangeIndex.rbegin();
+	for(; range != m_cRangeIndex.rend(); range++) {
+		std::unordered_map<Uint32, banlist_t *>::iterator it = range->second.find(ip & prefixMask(range->first));
+		if(it != range->second.end())
+			return it->second;
+	}
 
     // No match
     return NULL;
@@ -62,20 +199,14 @@ int CBanList::getIdByAddr(const std::string& szAddress)
 	if (m_nCount <= 0)
 		return -1;
 
-	// Remove the port from the address
-	std::string addr = szAddress;
-	size_t pos = addr.rfind(':');
-	if(pos != std::string::npos) {
-		addr.erase(pos);
-	}
-	TrimSpaces( addr );
-    
-    banlist_t *psWorm = m_psBanList;
+	banlist_t *psWorm = findExact(szAddress);
+	if (!psWorm)
+		return -1;
 
-    for(int i=0; psWorm; psWorm=psWorm->psNext,i++) {
-        if( stringcasecmp(psWorm->szAddress, addr) == 0 )
-            return i;
-    }
+	for(int i = 0; i < m_nCount; i++) {
+		if(getItemById(i) == psWorm)
+			return i;
+	}
 
     // No match
     return -1;
@@ -104,9 +235,12 @@ void CBanList::addBanned(const std::string& szAddress, const std::string& szNick
     // Link it in
     psWorm->psNext = m_psBanList;
     m_psBanList = psWorm;
+	m_cItems.push_back(psWorm);
+	m_nCount++;
+	indexItem(psWorm);
 
-    // Sort the list
-    sortList();
+	// The sorted list is created when it is needed
+	m_bSorted = false;
 
 	if (!m_bLoading)
 		saveList(m_szPath);
@@ -116,14 +250,7 @@ void CBanList::addBanned(const std::string& szAddress, const std::string& szNick
 // Unban a worm
 void CBanList::removeBanned(const std::string& szAddress)
 {
-	// Remove the port from the address
-	std::string addr = szAddress;
-	size_t pos = addr.rfind(':');
-	if(pos != std::string::npos) {
-		addr.erase(pos);
-	}
-
-    banlist_t *psWorm = findBanned(szAddress);
+    banlist_t *psWorm = findExact(szAddress);
 	if (!psWorm)
 		return;
 	int ID = getIdByAddr(szAddress);
@@ -133,30 +260,22 @@ void CBanList::removeBanned(const std::string& szAddress)
 	// Previous worm in ban list
 	banlist_t *psPrevWorm = getItemById(ID-1);
 	if (!psPrevWorm)  { // our worm is the first in the list
-		if (psWorm->psNext) 
-		  m_psBanList = psWorm->psNext;  // update the pointer to the first item
-		else
-		  m_psBanList = NULL;  // the worm is (was) the only one in the list
-		
-		// Unban the worm
-		delete psWorm;
-		psWorm = NULL;
+		m_psBanList = psWorm->psNext;  // update the pointer to the first item
 	}
 	else  {  // our worm isn't the first in the list
-		if (psWorm->psNext)
-			psPrevWorm->psNext = psWorm->psNext;  // our worm is somewhere in the middle of the list
-		else
-			psPrevWorm->psNext = NULL;  // our worm is the last in the list
-		
-		// Unban the worm
-		delete psWorm;
-		psWorm = NULL;
+		psPrevWorm->psNext = psWorm->psNext;
 	}
 
+	m_cItems.erase(m_cItems.begin() + (m_nCount - 1 - ID));
 	m_nCount--;  // update the number of items
 
-    // Sort the list
-    sortList();
+	// Unban the worm
+	delete psWorm;
+	psWorm = NULL;
+
+	// An older entry with the same address may be indexed now
+	rebuildIndex();
+	m_bSorted = false;
 
 	// Save the list
 	saveList(m_szPath);
@@ -172,15 +291,12 @@ void CBanList::saveList(const std::string& szFilename)
     if( !fp )
         return;
 
-    banlist_t *psWorm = m_psBanList;
-	if (!psWorm)
-		fputs("",fp);
-	else {
-		for(; psWorm; psWorm=psWorm->psNext) {
-
-			fprintf(fp, "%s,%s\n", psWorm->szAddress.c_str(), psWorm->szNick.c_str());
-		}
-	}  // else
+	// Write it in one go
+	std::string data;
+	for(banlist_t *psWorm = m_psBanList; psWorm; psWorm=psWorm->psNext)
+		data += psWorm->szAddress + "," + psWorm->szNick + "\n";
+	if (!data.empty())
+		fwrite(data.data(), 1, data.size(), fp);
 
     fclose(fp);
 }
@@ -194,23 +310,23 @@ void CBanList::loadList(const std::string& szFilename)
     // Shutdown the list first
     Shutdown();
 
-    FILE *fp = OpenGameFile(szFilename, "rt");
-    if( !fp )
-        return;
-
-	std::string line;
-	
-    while( !feof(fp) ) {
-        line = ReadUntil(fp, '\n');
+	// Read it in one go
+	std::string data = GetFileContents(szFilename);
+
+	size_t start = 0;
+	while(start < data.size()) {
+		size_t end = data.find('\n', start);
+		if(end == std::string::npos)
+			end = data.size();
+		std::string line = data.substr(start, end - start);
+		// Lists written on Windows or edited there end their lines with \r\n
+		if(!line.empty() && line[line.size() - 1] == '\r')
+			line.erase(line.size() - 1);
 		std::vector<std::string> exploded = explode(line,",");
 		if (exploded.size() >= 2)
 			addBanned(exploded[0],exploded[1]);
-    }
-
-    fclose(fp);
-
-    // Sort the list
-    sortList();
+		start = end + 1;
+	}
 
 	m_bLoading = false;
 }
@@ -260,46 +376,29 @@ int CBanList::getNumItems()
 ///////////////////
 // Create a sorted list
 void CBanList::sortList() {
-    int i, j;
+	if( m_bSorted && m_psSortedList )
+		return;
 
     // Free any previous list
     if( m_psSortedList )
         delete[] m_psSortedList;
 
-    // Count the number of banned worms
-    m_nCount = 0;
-    banlist_t *psWorm = m_psBanList;
-    for(; psWorm; psWorm=psWorm->psNext)  {
-        m_nCount++;
-	}
-
     // Allocate the sorted list
     m_psSortedList = new banlist_t[m_nCount];
     if( !m_psSortedList )
         return;
 
     // Fill in the links
-    psWorm = m_psBanList;
-    for( i=0; i<m_nCount; i++, psWorm=psWorm->psNext)
+    banlist_t *psWorm = m_psBanList;
+    for( int i=0; i<m_nCount; i++, psWorm=psWorm->psNext)
         m_psSortedList[i].psLink = psWorm;
-    
-    if( m_nCount < 2 )
-        return;
 
-    // Sort the list using a simple bubble sort
-    banlist_t temp;
-   	for(i=0; i<m_nCount; i++) {
-		for(j=0; j<m_nCount-1-i; j++) {
-
-            if( m_psSortedList[j].psLink->szNick.compare( m_psSortedList[j+1].psLink->szNick) > 0 ) {
-
-                // Swap the 2 items
-                temp = m_psSortedList[j];
-                m_psSortedList[j] = m_psSortedList[j+1];
-                m_psSortedList[j+1] = temp;
-            }
-        }
-    }
+	// Sort by nick, keep the order of equal nicks
+	struct NickLess {
+		bool operator()(const banlist_t& a, const banlist_t& b) const { return a.psLink->szNick.compare(b.psLink->szNick) < 0; }
+	};
+	std::stable_sort(m_psSortedList, m_psSortedList + m_nCount, NickLess());
+	m_bSorted = true;
 }
 
 ///////////////////
@@ -311,19 +410,11 @@ std::string CBanList::getPath() {
 ///////////////////
 // Get the specified item
 banlist_t *CBanList::getItemById(int ID) {
-    if (ID > m_nCount || ID < 0)
-		return NULL;
-	banlist_t *psWorm = m_psBanList;
-
-	if(!psWorm)
+    if (ID >= m_nCount || ID < 0)
 		return NULL;
 
-    for(int i=0; psWorm; psWorm=psWorm->psNext,i++)  {
-		if (ID == i) 
-		  return psWorm;
-	}
-
-	return NULL;
+	// The list has the newest item first
+	return m_cItems[m_nCount - 1 - ID];
 }
 
 ///////////////////
@@ -340,9 +431,14 @@ void CBanList::Shutdown()
      }
 
      m_psBanList = NULL;
+	m_nCount = 0;
+	m_cItems.clear();
+	m_cExactIndex.clear();
+	m_cRangeIndex.clear();
 
     // Free any sorted list
     if( m_psSortedList )
         delete[] m_psSortedList;
     m_psSortedList = NULL;
+	m_bSorted = false;
 }
@@ -12,6 +12,16 @@
 #include "Options.h"
 #include "CWorm.h"
 #include "Protocol.h"
+#include "CServerConnection.h"
+#include "CMap.h"
+#include "FeatureList.h"
+
+CGameMode::CGameMode()
+{
+	for(int c = 0; c < MAX_CLIENTS; c++)
+		for(int i = 0; i < MAX_WORMS; i++)
+			bWormUpdateDelayed[c][i] = false;
+}
 
 int CGameMode::GeneralGameType() {
 	if(GameTeams() == 1)
@@ -44,6 +54,81 @@ void CGameMode::PrepareGame()
 	}
 }
 
+// How far a client can look around its worms (one screen, the view is clamped at the map border),
+// plus a bit for the movement until the next update arrives
+static const float AREA_OF_INTEREST_X = 320.0f + 40.0f;
+static const float AREA_OF_INTEREST_Y = 240.0f + 40.0f;
+
+bool CGameMode::IsInAreaOfInterest(CServerConnection* cl, CWorm* worm)
+{
+	const bool wrapAround = tLXOptions->tGameInfo.features[FT_InfiniteMap];
+	CMap* map = cServer->getMap();
+
+	bool following = false;
+	for(int i = 0; i < cl->getNumWorms(); i++) {
+		CWorm* own = cl->getWorm(i);
+		if(!own || !own->getAlive())
+			continue;
+		following = true;
+
+		float dx = fabs(worm->getPos().x - own->getPos().x);
+		float dy = fabs(worm->getPos().y - own->getPos().y);
+		if(wrapAround && map) {
+			dx = MIN(dx, (float)map->GetWidth() - dx);
+			dy = MIN(dy, (float)map->GetHeight() - dy);
+		}
+		if(dx < AREA_OF_INTEREST_X && dy < AREA_OF_INTEREST_Y)
+			return true;
+	}
+
+	// Without an own living worm the client can spectate anybody
+	return !following;
+}
+
+bool CGameMode::NeedUpdate(CServerConnection* cl, CWorm* worm)
+{
+	const float delay = tLXOptions->fFarWormUpdateDelay;
+	if(delay <= 0.0f || cl->isLocalClient())
+		return true;
+
+	const int c = cl->getConnectionArrayIndex();
+	const int w = worm->getID();
+	if(c < 0 || w < 0 || w >= MAX_WORMS)
+		return true;
+
+	if(!IsInAreaOfInterest(cl, worm) && (tLX->currentTime - fLastWormUpdate[c][w]).seconds() < delay) {
+		// The worm might stop moving meanwhile, so remember to send the latest state later
+		bWormUpdateDelayed[c][w] = true;
+		return false;
+	}
+
+	fLastWormUpdate[c][w] = tLX->currentTime;
+	bWormUpdateDelayed[c][w] = false;
+	return true;
+}
+
+bool CGameMode::NeedDelayedUpdate(CServerConnection* cl, CWorm* worm)
+{
+	const int c = cl->getConnectionArrayIndex();
+	const int w = worm->getID();
+	if(c < 0 || w < 0 || w >= MAX_WORMS || !bWormUpdateDelayed[c][w])
+		return false;
+
+	return NeedUpdate(cl, worm);
+}
+
+void CGameMode::ClientConnected(CServerConnection* cl)
+{
+	const int c = cl->getConnectionArrayIndex();
+	if(c < 0 || c >= MAX_CLIENTS)
+		return;
+
+	for(int w = 0; w < MAX_WORMS; w++) {
+		fLastWormUpdate[c][w] = AbsTime();
+		bWormUpdateDelayed[c][w] = false;
+	}
+}
+
 bool CGameMode::Spawn(CWorm* worm, CVec pos) {
 	worm->Spawn(pos);
 	return true;
@@ -233,7 +233,7 @@ bool CHideAndSeek::NeedUpdate(CServerConnection* cl, CWorm* worm)
 	if(cl->getWorm(0)->getTeam() != worm->getTeam() && !bVisible[worm->getID()] && !worm->getWormState()->bCarve)
 		return false;
 
-	return true;
+	return CGameMode::NeedUpdate(cl, worm);
 }
 
 void CHideAndSeek::Show(CWorm* worm, bool message)
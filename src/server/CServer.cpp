@@ -117,6 +117,7 @@ void GameServer::ResetSockets() {
 	for( int i=0; i < MAX_SERVER_SOCKETS; i++ )
 		tSockets[i] = new NetworkSocket();
 	tNatClients.clear();	
+	tClientAddrMap.clear();
 }
 
 
@@ -185,12 +186,16 @@ int GameServer::StartServer()
 		}
 	}
 
+	for( int i = 0; i < MAX_SERVER_SOCKETS; i++ )
+		tSockets[i]->setBatching(tLXOptions->bNetworkBatching);
+
 	NetworkAddr addr = tSockets[0]->localAddress();
 	// TODO: Why is that stored in debug_string ???
 	NetAddrToString(addr, tLX->debug_string);
 	hints << "server started on " <<  tLX->debug_string << endl;
 
 	// Initialize the clients
+	tClientAddrMap.clear();
 	cClients = new CServerConnection[MAX_CLIENTS];
 	if(cClients==NULL) {
 		SetError("Error: Out of memory!\nsv::Startserver() " + itoa(__LINE__));
@@ -974,21 +979,8 @@ bool GameServer::ReadPacketsFromSocket(const SmartPointer<NetworkSocket>& sock)
 		iSuicidesInPacket = 0;
 
 		// Read packets
-		CServerConnection *cl = cClients;
-		for (int c = 0; c < MAX_CLIENTS; c++, cl++) {
-
-			// Player not connected
-			if(cl->getStatus() == NET_DISCONNECTED)
-				continue;
-
-			// Check if the packet is from this player
-			if(!AreNetAddrEqual(addrFrom, cl->getChannel()->getAddress()))
-				continue;
-
-			// Check the port
-			if (GetNetAddrPort(addrFrom) != GetNetAddrPort(cl->getChannel()->getAddress()))
-				continue;
-
+		CServerConnection *cl = findClientByAddr(addrFrom);
+		if(cl) {
 			// Parse the packet - process continuously in case we've received multiple logical packets on new CChannel
 			uint n = 0;
 			while (cl->getChannel()->Process(&bs))  {
@@ -1013,6 +1005,70 @@ bool GameServer::ReadPacketsFromSocket(const SmartPointer<NetworkSocket>& sock)
 	return anythingNew;
 }
 
+////////////////////
+// Finds the client which sends from the given address, NULL if none
+// HINT: the map is only a cache, each hit is verified and misses fall back to scanning all clients
+CServerConnection* GameServer::findClientByAddr(const NetworkAddr& addr)
+{
+	struct Matches {
+		static bool check(CServerConnection* cl, const NetworkAddr& addr) {
+			// Player not connected
+			if(cl->getStatus() == NET_DISCONNECTED)
+				return false;
+
+			// Check if the packet is from this player
+			if(!AreNetAddrEqual(addr, cl->getChannel()->getAddress()))
+				return false;
+
+			// Check the port
+			return GetNetAddrPort(addr) == GetNetAddrPort(cl->getChannel()->getAddress());
+		}
+	};
+
+	const Uint64 key = GetNetAddrHash(addr);
+
+	ClientAddrMap::iterator it = tClientAddrMap.find(key);
+	if(it != tClientAddrMap.end()) {
+		CServerConnection* cl = &cClients[it->second];
+		if(Matches::check(cl, addr))
+			return cl;
+		tClientAddrMap.erase(it);
+	}
+
+	CServerConnection *cl = cClients;
+	for (int c = 0; c < MAX_CLIENTS; c++, cl++) {
+		if(!Matches::check(cl, addr))
+			continue;
+
+		// Entries of gone clients are only removed on lookup, don't let them pile up
+		if(tClientAddrMap.size() >= 4 * MAX_CLIENTS)
+			tClientAddrMap.clear();
+		tClientAddrMap[key] = c;
+		return cl;
+	}
+
+	return NULL;
+}
+
+
+///////////////////
+// Sleep until a packet arrives on any server socket or the timeout is over
+// Returns true if there is something to read
+bool GameServer::WaitForPackets(int timeoutMs)
+{
+	tSocketWaiter.clear();
+	for( int i = 0; i < MAX_SERVER_SOCKETS; i++ )
+		if(tSockets[i].get())
+			tSocketWaiter.addSocket(*tSockets[i].get());
+
+	for (NatConnList::iterator it = tNatClients.begin(); it != tNatClients.end(); ++it)  {
+		tSocketWaiter.addSocket(*(*it)->tTraverseSocket.get());
+		tSocketWaiter.addSocket(*(*it)->tConnectHereSocket.get());
+	}
+
+	return tSocketWaiter.wait(timeoutMs);
+}
+
 
 ///////////////////
 // Read packets
@@ -1066,6 +1122,10 @@ void GameServer::SendPackets(bool sendPendingOnly)
 		return;
 	}
 	
+	// Queue all outgoing packets of this frame, they are sent together below
+	for( int i = 0; i < MAX_SERVER_SOCKETS; i++ )
+		tSockets[i]->beginWriteBatch();
+
 	if(!sendPendingOnly) {
 		// If we are playing, send update to the clients
 		if (iState == SVS_PLAYING)
@@ -1099,6 +1159,9 @@ void GameServer::SendPackets(bool sendPendingOnly)
 		// Clear the unreliable bytestream
 		cl->getUnreliable()->Clear();
 	}
+
+	for( int i = 0; i < MAX_SERVER_SOCKETS; i++ )
+		tSockets[i]->flushWriteBatch();
 }
 
 
@@ -225,7 +225,9 @@ void CServerConnection::setNetEngineFromClientVersion()
 {
 	resetNetEngine();
 	
-	if( getClientVersion() >= OLXBetaVersion(0,58,1) )
+	if( getClientVersion() >= OLXRcVersion(0,58,6) && getClientVersion() < OLXBetaVersion(0,59,0) ) // 0.59 doesn't know the worm deltas
+		cNetEngine = new CServerNetEngineRc6( server, this );
+	else if( getClientVersion() >= OLXBetaVersion(0,58,1) )
 		cNetEngine = new CServerNetEngineBeta9( server, this );
 	else if( getClientVersion() >= OLXBetaVersion(8) )
 		cNetEngine = new CServerNetEngineBeta8( server, this );
@@ -237,6 +239,7 @@ void CServerConnection::setNetEngineFromClientVersion()
 		cNetEngine = new CServerNetEngineBeta3( server, this );
 	else
 		cNetEngine = new CServerNetEngine( server, this );
+	cUdpFileDownloader.allowFileStream( getClientVersion() >= OLXRcVersion(0,58,6) && getClientVersion() < OLXBetaVersion(0,59,0) );
 }
 
 CChannel * CServerConnection::createChannel(const Version& v)
@@ -30,17 +30,33 @@
 #include "WeaponDesc.h"
 
 
+// Returns the center of a random spawn cell of the map
+// WARNING: cMap->lockFlags() before and check that the spawn index is not empty
+static CVec RandomSpawnCell(CMap* map) {
+	const std::vector<int>& cells = map->getSpawnCells();
+	const int cell = cells[GetRandomInt((int)cells.size() - 1)];
+	const int gw = map->getGridWidth();
+	const int gh = map->getGridHeight();
+	const int x = cell % map->getGridCols();
+	const int y = cell / map->getGridCols();
+	return CVec((float)x * gw + gw / 2, (float)y * gh + gh / 2);
+}
+
 CVec GameServer::FindSpotCloseToPos(const std::list<CVec>& goodPos, const std::list<CVec>& badPos, bool keepDistanceToBad) {
-	// TODO: optimise this!
+	// With the spawn index, we lock only once and each random spot is O(1).
+	// The old way over FindSpot is only needed if there isn't any valid spawn cell.
+	cMap->lockFlags(false);
+	const bool useIndex = cMap->hasSpawnCellIndex() && !cMap->getSpawnCells().empty();
+	if(!useIndex) cMap->unlockFlags(false);
 	
 	float team_dist = -9999999.0f;
-	CVec pos = FindSpot();
+	CVec pos = useIndex ? RandomSpawnCell(cMap) : FindSpot();
 	CVec pos1;
 	
 	for( int k=0; k<100; k++ )
 	{
 		float team_dist1 = 0;
-		pos1 = FindSpot();
+		pos1 = useIndex ? RandomSpawnCell(cMap) : FindSpot();
 		for(std::list<CVec>::const_iterator i = goodPos.begin(); i != goodPos.end(); ++i)
 			team_dist1 -= ( pos1 - *i ).GetLength() / (goodPos.size() * 10.0f);
 		for(std::list<CVec>::const_iterator i = badPos.begin(); i != badPos.end(); ++i) {
@@ -59,6 +75,7 @@ CVec GameServer::FindSpotCloseToPos(const std::list<CVec>& goodPos, const std::l
 		}
 	}
 	
+	if(useIndex) cMap->unlockFlags(false);
 	return pos;	
 }
 
@@ -169,6 +186,15 @@ CVec GameServer::FindSpot()
 	int	 gw = cMap->getGridWidth();
 	int	 gh = cMap->getGridHeight();
 
+	// All valid cells are in the spawn index of the map, so just take a random one
+	cMap->lockFlags(false);
+	if(cMap->hasSpawnCellIndex() && !cMap->getSpawnCells().empty()) {
+		CVec ret = RandomSpawnCell(cMap);
+		cMap->unlockFlags(false);
+		return ret;
+	}
+	cMap->unlockFlags(false);
+
 	uchar pf, pf1, pf2, pf3, pf4;
 	cMap->lockFlags();
 	
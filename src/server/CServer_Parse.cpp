@@ -163,6 +163,10 @@ void CServerNetEngine::ParsePacket(CBytestream *bs) {
 			ParseReportDamage(bs);
 			break;
 
+		case C2S_UPDATEWORMSACK:
+			ParseUpdateWormsAck(bs);
+			break;
+
 		default:
 			// HACK, HACK: old olx/lxp clients send the ping twice, once normally once per channel
 			// which leads to warnings here - we simply parse it here and avoid warnings
@@ -884,7 +888,8 @@ void CServerNetEngine::ParseSendFile(CBytestream *bs)
 	if( cl->getUdpFileDownloader()->receive(bs) )
 	{
 		if( cl->getUdpFileDownloader()->isFinished() &&
-			( cl->getUdpFileDownloader()->getFilename() == "GET:" || cl->getUdpFileDownloader()->getFilename() == "STAT:" ) )
+			( cl->getUdpFileDownloader()->getFilename() == "GET:" || cl->getUdpFileDownloader()->getFilename() == "GET_STREAM:" ||
+			cl->getUdpFileDownloader()->getFilename() == "STAT:" ) )
 		{
 			cl->getUdpFileDownloader()->abortDownload();	// We can't provide that file or statistics on it
 		}
@@ -1407,6 +1412,10 @@ void GameServer::ParseConnect(const SmartPointer<NetworkSocket>& net_socket, CBy
 
 	newcl->setStatus(NET_CONNECTED);
 
+	// The game modes might still have the update times of a previous client in this slot
+	for(Iterator<CGameMode* const&>::Ref i = GameModeIterator(); i->isValid(); i->next())
+		i->get()->ClientConnected(newcl);
+
 	if(newcl->getNetEngine()) {
 		// Note: do it also for reconnecting clients as reconnecting detection could be wrong
 		// TODO: It seems that this happens very often. Why?
@@ -360,6 +360,91 @@ void GameServer::SendWormsOut(const std::list<byte>& ids)
 	}
 }
 
+///////////////////
+// Per-frame cache of the worm update packets
+// The packet written by CWorm::writePacket only depends on the receiver's net-engine
+// version (if the velocity is always sent), so every worm is serialized at most once
+// per variant each frame and the result is shared by all clients.
+struct WormUpdateCache {
+	enum { VAR_OLD = 0, VAR_VELOCITY = 1, VAR_NUM = 2 };
+	CBytestream packets[VAR_NUM][MAX_WORMS];
+	bool written[VAR_NUM][MAX_WORMS];
+	WormNetState states[MAX_WORMS];
+	bool parsed[MAX_WORMS];
+
+	void reset() {
+		for(int v = 0; v < VAR_NUM; v++)
+			for(int i = 0; i < MAX_WORMS; i++)
+				written[v][i] = false;
+		for(int i = 0; i < MAX_WORMS; i++)
+			parsed[i] = false;
+	}
+
+	static int variant(CServerConnection* cl) {
+		// HINT: every Version temporary allocates its game name and this is called per worm and client
+		static const Version velocityVersion = OLXBetaVersion(5);
+		return (cl->getClientVersion() >= velocityVersion) ? VAR_VELOCITY : VAR_OLD;
+	}
+
+	CBytestream* get(CWorm* w, CServerConnection* cl) {
+		const int v = variant(cl);
+		const int id = w->getID();
+		CBytestream* bs = &packets[v][id];
+		if(!written[v][id]) {
+			bs->Clear();
+			bs->writeByte(id);
+			w->writePacket(bs, true, cl);
+			written[v][id] = true;
+		}
+		return bs;
+	}
+
+	// The velocity variant as WormNetState, for the delta compressed updates
+	const WormNetState& getState(CWorm* w, CServerConnection* cl) {
+		const int id = w->getID();
+		CBytestream* bs = get(w, cl);
+		if(!parsed[id]) {
+			bs->ResetPosToBegin();
+			bs->Skip(1); // ID
+			states[id].readPacket(bs);
+			parsed[id] = true;
+		}
+		return states[id];
+	}
+};
+
+static WormUpdateCache wormUpdateCache;
+
+///////////////////
+// Write the worm update for the worms (S2C_UPDATEWORMS)
+void CServerNetEngine::WriteUpdateWorms(CBytestream *bs, const std::vector<CWorm*>& worms)
+{
+	bs->writeByte(S2C_UPDATEWORMS);
+	bs->writeByte((byte)worms.size());
+	for(std::vector<CWorm*>::const_iterator it = worms.begin(); it != worms.end(); ++it)
+		bs->Append(wormUpdateCache.get(*it, cl));
+}
+
+///////////////////
+// Write the worm update as delta to the states the client has acknowledged (S2C_UPDATEWORMSDELTA)
+void CServerNetEngineRc6::WriteUpdateWorms(CBytestream *bs, const std::vector<CWorm*>& worms)
+{
+	// Bandwidth doesn't matter for the local client, and it would never acknowledge anything
+	if(cl->isLocalClient()) {
+		CServerNetEngineBeta9::WriteUpdateWorms(bs, worms);
+		return;
+	}
+
+	if(worms.empty())
+		return;
+
+	tStates.clear();
+	for(std::vector<CWorm*>::const_iterator it = worms.begin(); it != worms.end(); ++it)
+		tStates.push_back(std::make_pair((*it)->getID(), wormUpdateCache.getState(*it, cl)));
+
+	cWormDelta.write(bs, tStates);
+}
+
 ///////////////////
 // Update all the client about the playing worms
 // Returns true if we sent an update
@@ -371,7 +456,12 @@ bool GameServer::SendUpdate()
 	//
 	// Get the update packets for each worm that needs it and save them
 	//
-	std::list<CWorm *> worms_to_update;
+	std::vector<CWorm *> worms_to_update;
+	std::vector<CWorm *> worms_unchanged; // a client might still wait for an update which the game mode delayed
+	std::vector<CWorm *> worms; // the ones sent to the current client
+	worms_to_update.reserve(MAX_WORMS);
+	worms_unchanged.reserve(MAX_WORMS);
+	worms.reserve(MAX_WORMS);
 	CWorm *w = cWorms;
 	{
 		int i, j;
@@ -391,10 +481,13 @@ bool GameServer::SendUpdate()
 			if (w->checkPacketNeeded())  {
 				worms_to_update.push_back(w);
 			}
+			else if (w->getAlive())
+				worms_unchanged.push_back(w);
 		}
 	}
 
 	size_t uploadAmount = 0;
+	wormUpdateCache.reset();
 
 	{
 		int last = lastClientSendData;
@@ -406,7 +499,8 @@ bool GameServer::SendUpdate()
 
 			// HINT: happens when clients join during game and haven't selected their weapons yet
 			// HINT 2: this should be valid for beta 9+ though so the user can see others playing while selecting weapons
-			if (cl->getClientVersion() < OLXBetaVersion(0,58,1))
+			static const Version beta9 = OLXBetaVersion(0,58,1);
+			if (cl->getClientVersion() < beta9)
 				if (!cl->getGameReady())
 					continue;
 
@@ -440,13 +534,13 @@ bool GameServer::SendUpdate()
 				}
 			}
 
-			CBytestream update_packets;  // Contains all the update packets except the one from this client
-
-			byte num_worms = 0;
+			CBytestream *bs = cl->getUnreliable();
+			size_t oldBsPos = bs->GetPos();
 
 			// Send all the _other_ worms details
 			{
-				std::list<CWorm*>::const_iterator w_it = worms_to_update.begin();
+				worms.clear();
+				std::vector<CWorm*>::const_iterator w_it = worms_to_update.begin();
 				for(; w_it != worms_to_update.end(); w_it++) {
 					CWorm* w = *w_it;
 
@@ -458,24 +552,18 @@ bool GameServer::SendUpdate()
 					if(!getGameMode()->NeedUpdate(cl, w))
 						continue;
 
-					++num_worms;
-
-					CBytestream bytes;
-					bytes.writeByte(w->getID());
-					w->writePacket(&bytes, true, cl);
-
-					// Send out the update
-					update_packets.Append(&bytes);
+					worms.push_back(w);
 				}
-			}
 
-			CBytestream *bs = cl->getUnreliable();
-			size_t oldBsPos = bs->GetPos();
+				for(w_it = worms_unchanged.begin(); w_it != worms_unchanged.end(); w_it++) {
+					CWorm* w = *w_it;
+					if(!cl->OwnsWorm(w->getID()) && getGameMode()->NeedDelayedUpdate(cl, w))
+						worms.push_back(w);
+				}
 
-			// Write the packets to the unreliable bytestream
-			bs->writeByte(S2C_UPDATEWORMS);
-			bs->writeByte(num_worms);
-			bs->Append(&update_packets);
+				// The packets are written directly to the unreliable bytestream
+				cl->getNetEngine()->WriteUpdateWorms(bs, worms);
+			}
 			
 			// Write out a stat packet
 			{
@@ -712,6 +800,11 @@ void GameServer::UpdateGameLobby()
 	tLXOptions->tGameInfo.sMapName = CMap::GetLevelName(tLXOptions->tGameInfo.sMapFile);
 	CGameScript::CheckFile(tLXOptions->tGameInfo.sModDir, tLXOptions->tGameInfo.sModName);
 	
+	// Dedicated servers often start the game right after the map was chosen, so already
+	// load the map now in the background; GameServer::StartGame will take it from the cache
+	if(bDedicated && iState == SVS_LOBBY && tLXOptions->tGameInfo.sMapFile != "")
+		CMap::PreloadInBackground("levels/" + tLXOptions->tGameInfo.sMapFile);
+	
 	m_clientsNeedLobbyUpdate = true;
 	m_clientsNeedLobbyUpdateTime = tLX->currentTime;
 }
@@ -913,6 +1006,33 @@ int CServerNetEngineBeta5::SendFiles()
 	return ping;
 }
 
+// Queue this many stream chunks at once, CChannel moves them into its window as the acknowledges come
+static const size_t fileStreamQueue = 16;
+
+int CServerNetEngineRc6::SendFiles()
+{
+	if( ! cl->getUdpFileDownloader()->isSendingStream() )
+		return CServerNetEngineBeta9::SendFiles();
+	if(cl->getStatus() == NET_DISCONNECTED || cl->getStatus() == NET_ZOMBIE)
+		return 0;
+
+	// Don't wait for pings from the client, keep the reliable window full
+	CChannel * chan = cl->getChannel();
+	while( cl->getUdpFileDownloader()->isSendingStream() &&
+			! chan->getBufferFull() && chan->getMessagesQueued() < fileStreamQueue )
+	{
+		CBytestream bs;
+		bs.writeByte(S2C_SENDFILESTREAM);
+		cl->getUdpFileDownloader()->sendStream(&bs);
+		SendPacket( &bs );
+	}
+	cl->setLastFileRequestPacketReceived( tLX->currentTime );
+
+	if( chan->getPing() != 0 )
+		return chan->getPing();
+	return minPingDefault;
+}
+
 void GameServer::SendFiles()
 {
 	// To keep sending packets if no acknowledge received from client -
@@ -25,6 +25,7 @@
 #include "ConfigHandler.h"
 #include "SmartPointer.h"
 #include "CrashHandler.h"
+#include "ThreadPool.h"
 
 
 
@@ -152,6 +153,50 @@ SmartPointer<SDL_Surface> LoadGameImage(const std::string& _filename, bool witha
 
 void SetColorKey(SDL_Surface * dst) {} // stub
 
+SmartPointer<SDL_Surface> DecodeGameImage(const std::string& _filename, bool& cached) {
+	// stub
+	cached = false;
+	return NULL;
+}
+
+SmartPointer<SDL_Surface> ConvertGameImage(const std::string& _filename, const SmartPointer<SDL_Surface>& img, bool withalpha) {
+	// stub
+	return NULL;
+}
+
+SmartPointer<SDL_Surface> GenerateShadowSurface(SDL_Surface *object, unsigned char opacity) {
+	// stub
+	return NULL;
+}
+
+std::string GetWriteFullFileName(const std::string& path, bool create_nes_dirs) {
+	// stub
+	return path;
+}
+
+FILE* OpenAbsFile(const std::string& path, const char *mode) {
+	// stub
+	return fopen(path.c_str(), mode);
+}
+
+std::string GetFileContents(const std::string& path, bool absolute) {
+	// stub
+	std::string data;
+	FILE* f = fopen(path.c_str(), "rb");
+	if(!f) return data;
+	char buf[4096];
+	size_t r;
+	while((r = fread(buf, 1, sizeof(buf), f)) > 0)
+		data.append(buf, r);
+	fclose(f);
+	return data;
+}
+
+// no thread pool, CGameScript loads everything itself then
+ThreadPool* threadPool = NULL;
+ThreadPoolItem* ThreadPool::start(Action* act, const std::string& name, bool headless) { return NULL; } // stub
+bool ThreadPool::wait(ThreadPoolItem* thread, int* status) { return false; } // stub
+
 bool bDedicated = true;
 
 void SetError(const std::string& text) { errors << "SetError: " << text << endl; }